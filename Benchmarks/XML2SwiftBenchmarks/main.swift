@@ -0,0 +1,187 @@
+//
+//  main.swift
+//  XML2Swift
+//
+//  Created by igork on 10/19/26.
+//
+//  End-to-end benchmarks of the public API on a synthetic KeePass database.
+//  Usage: XML2SwiftBenchmarks [--size 64MB] [--iterations 5]
+//
+
+import Foundation
+import XML2Swift
+#if canImport(Darwin)
+import Darwin
+#else
+import Glibc
+#endif
+
+// Foundation on macOS has its own XMLDocument and XMLElement.
+typealias XMLDocument = XML2Swift.XMLDocument
+typealias XMLElement = XML2Swift.XMLElement
+
+struct Options {
+    var size = 16 * 1024 * 1024
+    var iterations = 5
+
+    init(arguments: [String]) {
+        var index = 1
+        while index + 1 < arguments.count {
+            switch arguments[index] {
+            case "--size":
+                size = Options.parseSize(arguments[index + 1]) ?? size
+            case "--iterations":
+                iterations = Int(arguments[index + 1]) ?? iterations
+            default:
+                break
+            }
+            index += 2
+        }
+    }
+
+    static func parseSize(_ text: String) -> Int? {
+        let units: [(String, Int)] = [("GB", 1 << 30), ("MB", 1 << 20), ("KB", 1 << 10)]
+        for (suffix, multiplier) in units where text.hasSuffix(suffix) {
+            return Double(text.dropLast(suffix.count)).map { Int($0 * Double(multiplier)) }
+        }
+        return Int(text)
+    }
+}
+
+/// Generates groups of entries with the element layout KeePass 2.x writes until the document reaches `size` bytes.
+func keePassDocument(size: Int) -> Data {
+    var data = Data(capacity: size + 4096)
+    func append(_ string: String) {
+        data.append(contentsOf: Array(string.utf8))
+    }
+
+    append("<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<KeePassFile><Meta><Generator>XML2Swift</Generator>")
+    append("<HeaderHash>kQEWtadyseNE1NTDN/6FjXYs8qxqwy9lwmrHMmzrSvM=</HeaderHash><HistoryMaxSize>6291456</HistoryMaxSize>")
+    append("<RecycleBinEnabled>True</RecycleBinEnabled></Meta><Root>")
+
+    var group = 0
+    while data.count < size {
+        append("<Group><UUID>TvV+7TUeSCubDEEOidwvag==</UUID><Name>Group \(group)</Name><IconID>\(group % 64)</IconID>")
+        append("<Times><LastModificationTime>2017-11-23T18:55:45Z</LastModificationTime><Expires>False</Expires><UsageCount>\(group)</UsageCount></Times>")
+        for entry in 0..<16 {
+            append("<Entry><UUID>gtVlzbVpRm2cP6yFsd+njg==</UUID><IconID>0</IconID>")
+            append("<Times><LastModificationTime>2017-11-23T18:55:45Z</LastModificationTime><Expires>False</Expires><UsageCount>\(entry)</UsageCount></Times>")
+            append("<String><Key>Title</Key><Value>Entry \(group).\(entry)</Value></String>")
+            append("<String><Key>UserName</Key><Value>user\(entry)@example.com</Value></String>")
+            append("<String><Key>Password</Key><Value ProtectInMemory=\"True\">c2VjcmV0IHBhc3N3b3Jk</Value></String>")
+            append("<String><Key>URL</Key><Value>https://example.com/\(group)</Value></String>")
+            append("<String><Key>Notes</Key><Value>Notes &amp; remarks for entry \(entry)</Value></String></Entry>")
+        }
+        append("</Group>")
+        group += 1
+    }
+
+    append("</Root></KeePassFile>\n")
+    return data
+}
+
+/// Heap bytes currently allocated by the process.
+func heapBytesInUse() -> Int {
+    #if canImport(Darwin)
+    var statistics = malloc_statistics_t()
+    malloc_zone_statistics(nil, &statistics)
+    return Int(statistics.size_in_use)
+    #else
+    let info = mallinfo2()
+    return Int(info.uordblks + info.hblkhd)
+    #endif
+}
+
+func peakResidentBytes() -> Int {
+    var usage = rusage()
+    getrusage(RUSAGE_SELF, &usage)
+    #if canImport(Darwin)
+    return Int(usage.ru_maxrss)
+    #else
+    return Int(usage.ru_maxrss) * 1024
+    #endif
+}
+
+struct Measurement {
+    var nanoseconds: UInt64 = 0
+    var allocatedBytes = 0
+    var wrappers: Int64 = 0
+
+    mutating func measure<R>(_ work: () throws -> R) rethrows -> R {
+        let wrappersBefore = XMLInstrumentation.value(of: .wrappersMaterialized)
+        let bytesBefore = heapBytesInUse()
+        let start = DispatchTime.now().uptimeNanoseconds
+        let result = try work()
+        nanoseconds += DispatchTime.now().uptimeNanoseconds - start
+        allocatedBytes += heapBytesInUse() - bytesBefore
+        wrappers += XMLInstrumentation.value(of: .wrappersMaterialized) - wrappersBefore
+        return result
+    }
+}
+
+func report(_ name: String, _ measurement: Measurement, iterations: Int, bytes: Int = 0, operations: Int = 0) {
+    let seconds = Double(measurement.nanoseconds) / 1e9
+    var line = name.padding(toLength: 28, withPad: " ", startingAt: 0)
+    line += String(format: " %10.3f ms/iter", seconds * 1e3 / Double(iterations))
+    if bytes > 0 {
+        line += String(format: " %10.1f MB/s", Double(bytes * iterations) / seconds / 1048576.0)
+    }
+    if operations > 0 {
+        line += String(format: " %10.1f ns/op", Double(measurement.nanoseconds) / Double(operations * iterations))
+    }
+    line += String(format: " %10.1f MB heap/iter", Double(measurement.allocatedBytes) / Double(iterations) / 1048576.0)
+    if XMLInstrumentation.isEnabled {
+        line += " \(measurement.wrappers / Int64(iterations)) wrappers/iter"
+    }
+    print(line)
+}
+
+let options = Options(arguments: CommandLine.arguments)
+let input = keePassDocument(size: options.size)
+print("document: \(input.count) bytes, \(options.iterations) iterations")
+
+var parse = Measurement(), xpath = Measurement(), elements = Measurement(), strings = Measurement()
+var serialize = Measurement()
+var entryCount = 0, textCount = 0, serializedCount = 0
+
+// Wrappers keep themselves and their tree alive, so dropping the document here frees nothing and
+// the heap grows by one tree per iteration. Teardown is timed by the "free document" row of
+// XML2SwiftMicrobenchmarks, which releases the tree through _XMLFreeDocument.
+for _ in 0..<options.iterations {
+    let document = try parse.measure { try XMLDocument(data: input) }
+    let root = document.rootElement()!.element(forName: "Root")!
+
+    let entries = try xpath.measure { try root.nodes(forXPath: "Group/Entry") }
+    entryCount = entries.count
+
+    let groups = elements.measure { () -> [XMLElement] in
+        let groups = root.elements(forName: "Group")
+        for group in groups {
+            _ = group.elements(forName: "Entry")
+        }
+        return groups
+    }
+
+    textCount = strings.measure { () -> Int in
+        var count = 0
+        for group in groups {
+            for entry in group.elements(forName: "Entry") {
+                for field in entry.elements(forName: "String") {
+                    count += field.element(forName: "Value")?.stringValue?.utf8.count ?? 0
+                }
+            }
+        }
+        return count
+    }
+
+    serializedCount = serialize.measure { document.xmlData(options: []).count }
+}
+
+let iterations = options.iterations
+report("XMLDocument(data:)", parse, iterations: iterations, bytes: input.count)
+report("nodes(forXPath:)", xpath, iterations: iterations, operations: entryCount)
+report("elements(forName:)", elements, iterations: iterations, operations: entryCount)
+report("stringValue", strings, iterations: iterations, operations: entryCount * 5)
+report("xmlData(options:)", serialize, iterations: iterations, bytes: serializedCount)
+print("text read per iteration: \(textCount) bytes")
+print(String(format: "peak resident memory: %.1f MB", Double(peakResidentBytes()) / 1048576.0))
@@ -0,0 +1,245 @@
+//
+//  main.c
+//  XML2Swift
+//
+//  Created by igork on 10/19/26.
+//
+//  Microbenchmarks for the C layer in xml_interface.c, run on a synthetic KeePass database.
+//  Usage: XML2SwiftMicrobenchmarks [size[KB|MB|GB]] [iterations]
+//
+
+#include "xml_interface.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+#ifdef __APPLE__
+#include <malloc/malloc.h>
+#else
+#include <malloc.h>
+#endif
+
+typedef struct {
+    char* bytes;
+    size_t length;
+    size_t capacity;
+} _Buffer;
+
+static void _append(_Buffer* buffer, const char* format, ...) __attribute__((format(printf, 2, 3)));
+
+static void _append(_Buffer* buffer, const char* format, ...) {
+    for (;;) {
+        va_list arguments;
+        va_start(arguments, format);
+        int written = vsnprintf(buffer->bytes + buffer->length, buffer->capacity - buffer->length, format, arguments);
+        va_end(arguments);
+        if (written >= 0 && (size_t)written < buffer->capacity - buffer->length) {
+            buffer->length += (size_t)written;
+            return;
+        }
+        buffer->capacity = buffer->capacity * 2 + 4096;
+        buffer->bytes = realloc(buffer->bytes, buffer->capacity);
+        if (buffer->bytes == NULL) {
+            abort();
+        }
+    }
+}
+
+// Generates groups of entries with the element layout KeePass 2.x writes until the
+// document reaches the requested size.
+static _Buffer _keePassDocument(size_t targetSize) {
+    _Buffer buffer = {NULL, 0, 0};
+    _append(&buffer, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<KeePassFile><Meta><Generator>XML2Swift</Generator>"
+                     "<HeaderHash>kQEWtadyseNE1NTDN/6FjXYs8qxqwy9lwmrHMmzrSvM=</HeaderHash><HistoryMaxSize>6291456</HistoryMaxSize>"
+                     "<RecycleBinEnabled>True</RecycleBinEnabled></Meta><Root>");
+
+    for (unsigned long group = 0; buffer.length < targetSize; group++) {
+        _append(&buffer, "<Group><UUID>TvV+7TUeSCubDEEOidwvag==</UUID><Name>Group %lu</Name><IconID>%lu</IconID>"
+                         "<Times><LastModificationTime>2017-11-23T18:55:45Z</LastModificationTime><Expires>False</Expires>"
+                         "<UsageCount>%lu</UsageCount></Times>", group, group % 64, group);
+        for (unsigned long entry = 0; entry < 16; entry++) {
+            _append(&buffer, "<Entry><UUID>gtVlzbVpRm2cP6yFsd+njg==</UUID><IconID>0</IconID>"
+                             "<Times><LastModificationTime>2017-11-23T18:55:45Z</LastModificationTime><Expires>False</Expires>"
+                             "<UsageCount>%lu</UsageCount></Times>"
+                             "<String><Key>Title</Key><Value>Entry %lu.%lu</Value></String>"
+                             "<String><Key>UserName</Key><Value>user%lu@example.com</Value></String>"
+                             "<String><Key>Password</Key><Value ProtectInMemory=\"True\">c2VjcmV0IHBhc3N3b3Jk</Value></String>"
+                             "<String><Key>URL</Key><Value>https://example.com/%lu</Value></String>"
+                             "<String><Key>Notes</Key><Value>Notes &amp; remarks for entry %lu</Value></String></Entry>",
+                    entry, group, entry, entry, group, entry);
+        }
+        _append(&buffer, "</Group>");
+    }
+
+    _append(&buffer, "</Root></KeePassFile>\n");
+    return buffer;
+}
+
+static uint64_t _now(void) {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (uint64_t)time.tv_sec * 1000000000ull + (uint64_t)time.tv_nsec;
+}
+
+static size_t _peakResidentBytes(void) {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+    return (size_t)usage.ru_maxrss;
+#else
+    return (size_t)usage.ru_maxrss * 1024;
+#endif
+}
+
+// Heap bytes currently allocated by the process, to report how much a parsed document keeps alive.
+static size_t _allocatedBytes(void) {
+#ifdef __APPLE__
+    malloc_statistics_t statistics;
+    malloc_zone_statistics(NULL, &statistics);
+    return statistics.size_in_use;
+#else
+    struct mallinfo2 info = mallinfo2();
+    return info.uordblks + info.hblkhd;
+#endif
+}
+
+static void _report(const char* name, uint64_t nanoseconds, size_t iterations, size_t bytes, size_t operations) {
+    double seconds = (double)nanoseconds / 1e9;
+    printf("%-28s %10.3f ms/iter", name, seconds * 1e3 / (double)iterations);
+    if (bytes > 0) {
+        printf(" %10.1f MB/s", (double)bytes * (double)iterations / seconds / (1024.0 * 1024.0));
+    }
+    if (operations > 0) {
+        printf(" %10.1f ns/op", (double)nanoseconds / (double)(operations * iterations));
+    }
+    printf("\n");
+}
+
+static int _discardWrite(void* context, const char* buffer, int length) {
+    *(size_t*)context += (size_t)length;
+    return length;
+}
+
+static int _closeOutput(void* context) {
+    return 0;
+}
+
+static size_t _parseSize(const char* text) {
+    char* end = NULL;
+    double value = strtod(text, &end);
+    if (strcmp(end, "KB") == 0) {
+        value *= 1024;
+    } else if (strcmp(end, "MB") == 0) {
+        value *= 1024 * 1024;
+    } else if (strcmp(end, "GB") == 0) {
+        value *= 1024.0 * 1024 * 1024;
+    }
+    return (size_t)value;
+}
+
+int main(int argc, const char* argv[]) {
+    size_t targetSize = argc > 1 ? _parseSize(argv[1]) : 16 * 1024 * 1024;
+    size_t iterations = argc > 2 ? (size_t)strtoul(argv[2], NULL, 10) : 5;
+
+    _XMLMemoryInstall();
+    xmlInitParser();
+
+    _Buffer input = _keePassDocument(targetSize);
+    printf("document: %zu bytes, %zu iterations\n", input.length, iterations);
+
+    uint64_t parse = 0, find = 0, content = 0, numbers = 0, dates = 0, hash = 0, serialize = 0, release = 0;
+    size_t elements = 0, texts = 0, serialized = 0, retainedBytes = 0;
+
+    for (size_t iteration = 0; iteration < iterations; iteration++) {
+        size_t bytesBefore = _allocatedBytes();
+        uint64_t start = _now();
+        _XMLError error;
+        _XMLDocPtr doc = _XMLDocPtrFromBytesWithOptions((const uint8_t*)input.bytes, input.length, 0, &error);
+        parse += _now() - start;
+        if (doc == NULL) {
+            fprintf(stderr, "parse failed: %s\n", error.message);
+            return 1;
+        }
+        retainedBytes = _allocatedBytes() - bytesBefore;
+
+        _XMLNodePtr root = _XMLNodeFindElement(_XMLNodeGetFirstChild(_XMLDocRootElement(doc)), "Root");
+
+        // Sibling lookup by name, as elements(forName:) and element(forName:) do.
+        elements = 0;
+        start = _now();
+        for (_XMLNodePtr group = _XMLNodeFindElement(_XMLNodeGetFirstChild(root), "Group"); group != NULL; group = _XMLNodeFindElement(_XMLNodeGetNextSibling(group), "Group")) {
+            for (_XMLNodePtr entry = _XMLNodeFindElement(_XMLNodeGetFirstChild(group), "Entry"); entry != NULL; entry = _XMLNodeFindElement(_XMLNodeGetNextSibling(entry), "Entry")) {
+                elements++;
+            }
+        }
+        find += _now() - start;
+
+        // Text access and typed decoding of every Times block. The operands are collected first so
+        // each batch runs under a single pair of clock reads rather than one per call.
+        _XMLNodePtr* modified = malloc(elements * sizeof(_XMLNodePtr));
+        _XMLNodePtr* usage = malloc(elements * sizeof(_XMLNodePtr));
+        if (modified == NULL || usage == NULL) {
+            abort();
+        }
+        texts = 0;
+        for (_XMLNodePtr group = _XMLNodeFindElement(_XMLNodeGetFirstChild(root), "Group"); group != NULL; group = _XMLNodeFindElement(_XMLNodeGetNextSibling(group), "Group")) {
+            for (_XMLNodePtr entry = _XMLNodeFindElement(_XMLNodeGetFirstChild(group), "Entry"); entry != NULL; entry = _XMLNodeFindElement(_XMLNodeGetNextSibling(entry), "Entry")) {
+                _XMLNodePtr times = _XMLNodeFindElement(_XMLNodeGetFirstChild(entry), "Times");
+                modified[texts] = _XMLNodeFindElement(_XMLNodeGetFirstChild(times), "LastModificationTime");
+                usage[texts] = _XMLNodeFindElement(_XMLNodeGetFirstChild(times), "UsageCount");
+                texts++;
+            }
+        }
+
+        start = _now();
+        for (size_t index = 0; index < texts; index++) {
+            _XMLSpanRelease(_XMLNodeCopyContentSpan(modified[index]));
+            _XMLSpanRelease(_XMLNodeCopyContentSpan(usage[index]));
+        }
+        content += _now() - start;
+
+        double value = 0;
+        start = _now();
+        for (size_t index = 0; index < texts; index++) {
+            _XMLTextGetDouble(_XMLNodeGetContentNoCopy(usage[index]), &value);
+        }
+        numbers += _now() - start;
+
+        start = _now();
+        for (size_t index = 0; index < texts; index++) {
+            _XMLTextGetISO8601Date(_XMLNodeGetContentNoCopy(modified[index]), &value);
+        }
+        dates += _now() - start;
+        free(modified);
+        free(usage);
+
+        start = _now();
+        _XMLNodeGetStructuralHash(_XMLDocRootElement(doc));
+        hash += _now() - start;
+
+        serialized = 0;
+        start = _now();
+        _XMLNodeSaveToIO(doc, 0, _discardWrite, _closeOutput, &serialized);
+        serialize += _now() - start;
+
+        start = _now();
+        _XMLFreeDocument(doc);
+        release += _now() - start;
+    }
+
+    _report("parse", parse, iterations, input.length, 0);
+    _report("find element", find, iterations, 0, elements);
+    _report("content span", content, iterations, 0, texts * 2);
+    _report("decode double", numbers, iterations, 0, texts);
+    _report("decode ISO 8601 date", dates, iterations, 0, texts);
+    _report("structural hash", hash, iterations, 0, 0);
+    _report("serialize", serialize, iterations, serialized, 0);
+    _report("free document", release, iterations, 0, 0);
+    printf("heap retained by a parsed document: %.1f MB\n", (double)retainedBytes / (1024.0 * 1024.0));
+    printf("peak resident memory: %.1f MB\n", (double)_peakResidentBytes() / (1024.0 * 1024.0));
+
+    free(input.bytes);
+    return 0;
+}
@@ -0,0 +1 @@
+#include <libxml/parser.h>
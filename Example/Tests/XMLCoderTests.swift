@@ -0,0 +1,250 @@
+//
+//  XMLCoderTests.swift
+//  XML2Swift_Tests
+//
+//  Created by igork on 10/19/26.
+//  Copyright © 2026 CocoaPods. All rights reserved.
+//
+
+import XCTest
+import CleanTests
+import XML2Swift
+
+class XMLCoderTests: XCTestCase {
+    struct Times: Codable, Equatable {
+        let lastModificationTime: Date
+        let expires: Bool
+        let usageCount: Int
+
+        enum CodingKeys: String, CodingKey {
+            case lastModificationTime = "LastModificationTime"
+            case expires = "Expires"
+            case usageCount = "UsageCount"
+        }
+    }
+
+    struct Group: Codable, Equatable {
+        let uuid: Data
+        let name: String
+        let notes: String?
+        let iconID: Int
+        let times: Times
+        let groups: [Group]
+
+        enum CodingKeys: String, CodingKey {
+            case uuid = "UUID"
+            case name = "Name"
+            case notes = "Notes"
+            case iconID = "IconID"
+            case times = "Times"
+            case groups = "Group"
+        }
+    }
+
+    struct Meta: Codable, Equatable {
+        let generator: String
+        let headerHash: Data
+        let maintenanceHistoryDays: Int
+        let masterKeyChangeRec: Int64
+        let historyMaxSize: UInt64
+        let recycleBinEnabled: Bool
+
+        enum CodingKeys: String, CodingKey {
+            case generator = "Generator"
+            case headerHash = "HeaderHash"
+            case maintenanceHistoryDays = "MaintenanceHistoryDays"
+            case masterKeyChangeRec = "MasterKeyChangeRec"
+            case historyMaxSize = "HistoryMaxSize"
+            case recycleBinEnabled = "RecycleBinEnabled"
+        }
+    }
+
+    struct Root: Codable, Equatable {
+        let groups: [Group]
+
+        enum CodingKeys: String, CodingKey {
+            case groups = "Group"
+        }
+    }
+
+    struct KeePassFile: Codable, Equatable {
+        let meta: Meta
+        let root: Root
+
+        enum CodingKeys: String, CodingKey {
+            case meta = "Meta"
+            case root = "Root"
+        }
+    }
+
+    func testThatDecodesKdbV4Payload() throws {
+        let data = try Data(contentsOf: URL(fileURLWithPath: TestConstants.kdbV4FilePath))
+        let file = try XMLDecoder().decode(KeePassFile.self, from: data)
+
+        assertPairsEqual(expected: "MiniKeePass", actual: file.meta.generator)
+        assertPairsEqual(expected: 32, actual: file.meta.headerHash.count)
+        assertPairsEqual(expected: 365, actual: file.meta.maintenanceHistoryDays)
+        assertPairsEqual(expected: -1, actual: file.meta.masterKeyChangeRec)
+        assertPairsEqual(expected: 6291456, actual: file.meta.historyMaxSize)
+        assertPairsEqual(expected: true, actual: file.meta.recycleBinEnabled)
+
+        let general = file.root.groups.first
+        assertPairsEqual(expected: 1, actual: file.root.groups.count)
+        assertPairsEqual(expected: "General", actual: general?.name)
+        assertPairsEqual(expected: 16, actual: general?.uuid.count)
+        assertPairsEqual(expected: 48, actual: general?.iconID)
+        XCTAssertNil(general?.notes)
+        assertPairsEqual(expected: 1511463345, actual: general?.times.lastModificationTime.timeIntervalSince1970)
+        assertPairsEqual(expected: false, actual: general?.times.expires)
+        assertPairsEqual(expected: "Windows", actual: general?.groups.first?.name)
+    }
+
+    func testThatDecodesAttributesAndStrategies() throws {
+        struct Item: Decodable {
+            let id: Int
+            let checksum: Data
+            let created: Date
+            let tags: [String]
+        }
+
+        let xml = """
+        <item id="42">
+            <checksum>cafe01</checksum>
+            <created>1500000000</created>
+            <tags>a</tags>
+            <tags>b</tags>
+        </item>
+        """
+        let decoder = XMLDecoder()
+        decoder.dataDecodingStrategy = .hex
+        decoder.dateDecodingStrategy = .secondsSince1970
+
+        let item = try decoder.decode(Item.self, from: xml.data(using: .utf8)!)
+        assertPairsEqual(expected: 42, actual: item.id)
+        assertPairsEqual(expected: Data([0xca, 0xfe, 0x01]), actual: item.checksum)
+        assertPairsEqual(expected: 1500000000, actual: item.created.timeIntervalSince1970)
+        assertPairsEqual(expected: ["a", "b"], actual: item.tags)
+
+        XCTAssertThrowsError(try decoder.decode(Item.self, from: "<item id=\"x\"/>".data(using: .utf8)!))
+    }
+
+    func testThatRejectsImpossibleDates() throws {
+        struct Stamp: Decodable {
+            let at: Date
+        }
+
+        let decoder = XMLDecoder()
+        let leapDay = try decoder.decode(Stamp.self, from: "<s><at>2024-02-29T23:59:59Z</at></s>".data(using: .utf8)!)
+        assertPairsEqual(expected: 1709251199, actual: leapDay.at.timeIntervalSince1970)
+
+        for text in ["2023-02-29T00:00:00Z", "2024-04-31T00:00:00Z", "2024-01-01T24:00:00Z"] {
+            XCTAssertThrowsError(try decoder.decode(Stamp.self, from: "<s><at>\(text)</at></s>".data(using: .utf8)!))
+        }
+    }
+
+    func testThatEncodedModelsDecodeBack() throws {
+        let data = try Data(contentsOf: URL(fileURLWithPath: TestConstants.kdbV4FilePath))
+        let file = try XMLDecoder().decode(KeePassFile.self, from: data)
+
+        let encoded = try XMLEncoder().encode(file, withRootKey: "KeePassFile")
+        let decoded = try XMLDecoder().decode(KeePassFile.self, from: encoded)
+        assertPairsEqual(expected: file, actual: decoded)
+
+        let document = try XMLDocument(data: encoded)
+        assertPairsEqual(expected: "KeePassFile", actual: document.rootElement()?.name)
+        assertPairsEqual(expected: 2, actual: document.rootElement()?.childCount)
+    }
+
+    func testThatEncodesAttributesAndEscapesText() throws {
+        struct Entry: Encodable {
+            let id: Int
+            let title: String
+            let tags: [String]
+        }
+
+        let encoder = XMLEncoder()
+        encoder.attributeEncodingStrategy = .keys(["id"])
+        let data = try encoder.encode(Entry(id: 7, title: "Tom & Jerry <3", tags: ["a", "b"]), withRootKey: "entry")
+        let string = String(data: data, encoding: .utf8)!
+
+        XCTAssertTrue(string.contains("<entry id=\"7\"><title>Tom &amp; Jerry &lt;3</title><tags>a</tags><tags>b</tags></entry>"))
+
+        struct LateAttribute: Encodable {
+            let title: String
+            let id: Int
+
+            enum CodingKeys: String, CodingKey {
+                case title, id
+            }
+        }
+        XCTAssertThrowsError(try encoder.encode(LateAttribute(title: "x", id: 1), withRootKey: "entry"))
+    }
+
+    func testThatEncodesHexDataInLowercaseEverywhere() throws {
+        struct Blob: Encodable {
+            let id: Data
+            let payload: Data
+        }
+
+        let encoder = XMLEncoder()
+        encoder.dataEncodingStrategy = .hex
+        encoder.attributeEncodingStrategy = .keys(["id"])
+        let data = try encoder.encode(Blob(id: Data([0xab, 0x01]), payload: Data([0xca, 0xfe, 0x0f])), withRootKey: "blob")
+        let string = String(data: data, encoding: .utf8)!
+
+        XCTAssertTrue(string.contains("<blob id=\"ab01\"><payload>cafe0f</payload></blob>"))
+    }
+
+    func testDecoderPerformance() throws {
+        let data = XMLCoderTests.largeKeePassPayload()
+        let decoder = XMLDecoder()
+
+        measure {
+            let file = try? decoder.decode(KeePassFile.self, from: data)
+            XCTAssertEqual(XMLCoderTests.largeGroupCount, file?.root.groups.count)
+        }
+    }
+
+    func testManualWalkPerformance() throws {
+        let data = XMLCoderTests.largeKeePassPayload()
+        let formatter = DateFormatter()
+        formatter.locale = Locale(identifier: "en_US_POSIX")
+        formatter.dateFormat = "yyyy-MM-dd'T'HH:mm:ssZZZZZ"
+
+        func group(from element: XMLElement) -> Group {
+            let times = element.element(forName: "Times")!
+            return Group(uuid: Data(base64Encoded: element.element(forName: "UUID")!.stringValue!)!,
+                         name: element.element(forName: "Name")!.stringValue!,
+                         notes: element.element(forName: "Notes")?.stringValue,
+                         iconID: Int(element.element(forName: "IconID")!.stringValue!)!,
+                         times: Times(lastModificationTime: formatter.date(from: times.element(forName: "LastModificationTime")!.stringValue!)!,
+                                      expires: times.element(forName: "Expires")!.stringValue! == "True",
+                                      usageCount: Int(times.element(forName: "UsageCount")!.stringValue!)!),
+                         groups: element.elements(forName: "Group").map(group(from:)))
+        }
+
+        measure {
+            let document = try? XMLDocument(data: data)
+            let root = document?.rootElement()?.element(forName: "Root")
+            let groups = root?.elements(forName: "Group").map(group(from:))
+            XCTAssertEqual(XMLCoderTests.largeGroupCount, groups?.count)
+        }
+    }
+
+    static let largeGroupCount = 2000
+
+    static func largeKeePassPayload() -> Data {
+        var xml = "<KeePassFile><Meta><Generator>XML2Swift</Generator><HeaderHash>kQEWtadyseNE1NTDN/6FjXYs8qxqwy9lwmrHMmzrSvM=</HeaderHash>"
+        xml += "<MaintenanceHistoryDays>365</MaintenanceHistoryDays><MasterKeyChangeRec>-1</MasterKeyChangeRec>"
+        xml += "<HistoryMaxSize>6291456</HistoryMaxSize><RecycleBinEnabled>True</RecycleBinEnabled></Meta><Root>"
+        for i in 0..<largeGroupCount {
+            xml += "<Group><UUID>TvV+7TUeSCubDEEOidwvag==</UUID><Name>Group \(i)</Name><Notes>Notes \(i)</Notes><IconID>\(i % 64)</IconID>"
+            xml += "<Times><LastModificationTime>2017-11-23T18:55:45Z</LastModificationTime><Expires>False</Expires><UsageCount>\(i)</UsageCount></Times>"
+            xml += "<Group><UUID>gtVlzbVpRm2cP6yFsd+njg==</UUID><Name>Child \(i)</Name><IconID>38</IconID>"
+            xml += "<Times><LastModificationTime>2017-11-23T18:55:45Z</LastModificationTime><Expires>False</Expires><UsageCount>0</UsageCount></Times></Group>"
+            xml += "</Group>"
+        }
+        xml += "</Root></KeePassFile>"
+        return xml.data(using: .utf8)!
+    }
+}
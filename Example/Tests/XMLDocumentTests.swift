@@ -9,6 +9,7 @@
 import XCTest
 import CleanTests
 import XML2Swift
+import CommonCrypto
 
 class XMLDocumentTests: XCTestCase {
     var xmlDocument: XMLDocument!
@@ -103,6 +104,663 @@ class XMLDocumentTests: XCTestCase {
         
     }
 
+    func testThatValidatesAgainstXMLSchema() throws {
+        let schemaData = """
+        <xs:schema xmlns:xs="http://www.w3.org/2001/XMLSchema">
+            <xs:element name="note">
+                <xs:complexType>
+                    <xs:sequence>
+                        <xs:element name="to" type="xs:string"/>
+                        <xs:element name="from" type="xs:string"/>
+                        <xs:element name="heading" type="xs:string"/>
+                        <xs:element name="body" type="xs:string"/>
+                    </xs:sequence>
+                </xs:complexType>
+            </xs:element>
+        </xs:schema>
+        """.data(using: .utf8)!
+        let schema = try XMLSchema(data: schemaData)
+
+        let document = try XMLDocument(contentsOf: URL(fileURLWithPath: TestConstants.xmlFilePath))
+        XCTAssertNoThrow(try document.validate(against: schema))
+
+        let streamData = try Data(contentsOf: URL(fileURLWithPath: TestConstants.xmlFilePath))
+        XCTAssertNoThrow(try schema.validate(data: streamData))
+
+        let invalidDocument = try XMLDocument(xmlString: "<note><to>Tove</to></note>")
+        XCTAssertThrowsError(try invalidDocument.validate(against: schema))
+    }
+
+    func testThatProjectionKeepsOnlyMatchingSubtrees() throws {
+        let data = try Data(contentsOf: URL(fileURLWithPath: TestConstants.kdbV4FilePath))
+        let document = try XMLDocument(data: data, projection: ["/KeePassFile/Root/Group/Name"])
+
+        let root = document.rootElement()
+        assertPairsEqual(expected: "KeePassFile", actual: root?.name)
+        assertPairsEqual(expected: 1, actual: root?.childCount)
+        assertPairsEqual(expected: "Root", actual: root?.child(at: 0)?.name)
+
+        let group = root?.elements(forName: "Root").first?.elements(forName: "Group").first
+        assertPairsEqual(expected: 1, actual: group?.childCount)
+        assertPairsEqual(expected: "General", actual: group?.child(at: 0)?.stringValue)
+
+        XCTAssertThrowsError(try XMLDocument(data: "<a><b></a>".data(using: .utf8)!, projection: ["//b"]))
+    }
+
+    func testThatInstrumentationCountsParsingAndWrapping() throws {
+        XMLInstrumentation.reset()
+        let data = try Data(contentsOf: URL(fileURLWithPath: TestConstants.xmlFilePath))
+        let document = try XMLDocument(data: data)
+        _ = document.rootElement()?.children
+        _ = try document.nodes(forXPath: "//to")
+
+        let snapshot = XMLInstrumentation.snapshot()
+        if XMLInstrumentation.isEnabled {
+            assertPairsEqual(expected: Int64(data.count), actual: snapshot.counters[.bytesParsed])
+            XCTAssertGreaterThan(snapshot.counters[.nodesCreated] ?? 0, 0)
+            XCTAssertGreaterThan(snapshot.counters[.wrappersMaterialized] ?? 0, 1)
+            assertPairsEqual(expected: 1, actual: snapshot.counters[.xpathEvaluations])
+            assertPairsEqual(expected: 1, actual: snapshot.timings[.parse]?.count)
+        } else {
+            XCTAssertTrue(snapshot.counters.values.allSatisfy { $0 == 0 })
+        }
+    }
+
+    func testThatParseLimitsAbortOversizedDocuments() throws {
+        let data = try Data(contentsOf: URL(fileURLWithPath: TestConstants.kdbV4FilePath))
+
+        let document = try XMLDocument(data: data, limits: XMLDocument.ParseLimits(maxBytes: 16 << 20, maxNodes: 10_000, maxDepth: 16))
+        assertPairsEqual(expected: "KeePassFile", actual: document.rootElement()?.name)
+        XCTAssertGreaterThan(document.memoryFootprint, data.count)
+
+        XCTAssertThrowsError(try XMLDocument(data: data, limits: XMLDocument.ParseLimits(maxNodes: 10)))
+        XCTAssertThrowsError(try XMLDocument(data: data, limits: XMLDocument.ParseLimits(maxDepth: 3)))
+        XCTAssertThrowsError(try XMLDocument(data: data, limits: XMLDocument.ParseLimits(maxBytes: 1024)))
+
+        // Kept whitespace becomes text nodes and counts against the budget.
+        let spaced = "<r>\n <a/>\n <a/>\n <a/>\n <a/>\n</r>".data(using: .utf8)!
+        XCTAssertNoThrow(try XMLDocument(data: spaced, limits: XMLDocument.ParseLimits(maxNodes: 6)))
+        XCTAssertThrowsError(try XMLDocument(data: spaced, options: .nodePreserveWhitespace, limits: XMLDocument.ParseLimits(maxNodes: 6)))
+    }
+
+    func testThatFrozenDocumentServesConcurrentQueries() throws {
+        let data = try Data(contentsOf: URL(fileURLWithPath: TestConstants.kdbV4FilePath))
+        let document = try XMLDocument(data: data)
+        let frozen = document.freeze()
+
+        XCTAssertFalse(document.isFrozen)
+        XCTAssertTrue(frozen.isFrozen)
+        XCTAssertTrue(frozen.freeze() === frozen)
+
+        let expected = try document.nodes(forXPath: "//Group/Name").compactMap { $0.stringValue }
+        var results = [[String]](repeating: [], count: 8)
+        var roots = [XMLElement?](repeating: nil, count: 8)
+        let lock = NSLock()
+        DispatchQueue.concurrentPerform(iterations: 8) { i in
+            let names = (try? frozen.nodes(forXPath: "//Group/Name"))?.compactMap { $0.stringValue } ?? []
+            let root = frozen.rootElement()
+            XCTAssertTrue(root?.isFrozen ?? false)
+            lock.lock()
+            results[i] = names
+            roots[i] = root
+            lock.unlock()
+        }
+
+        XCTAssertFalse(expected.isEmpty)
+        for (names, root) in zip(results, roots) {
+            assertPairsEqual(expected: expected, actual: names)
+            XCTAssertTrue(root === frozen.rootElement())
+        }
+    }
+
+    func testThatNodeRefsWalkWithoutWrappers() throws {
+        let data = try Data(contentsOf: URL(fileURLWithPath: TestConstants.kdbV4FilePath))
+        let document = try XMLDocument(data: data)
+        let root = document.nodeRef
+
+        // The test target builds the library with XML2SWIFT_INSTRUMENTATION=1, see the Podfile.
+        XCTAssertTrue(XMLInstrumentation.isEnabled)
+        XMLInstrumentation.reset()
+        var elementCount = 0
+        for node in root.descendants where node.kind == .element {
+            elementCount += 1
+        }
+        assertPairsEqual(expected: 0, actual: XMLInstrumentation.value(of: .wrappersMaterialized))
+        assertPairsEqual(expected: try document.nodes(forXPath: "//*").count, actual: elementCount)
+
+        let meta = root.element(forName: "KeePassFile")?.element(forName: "Meta")
+        assertPairsEqual(expected: "MiniKeePass", actual: meta?.element(forName: "Generator")?.stringValue)
+        assertPairsEqual(expected: "KeePassFile", actual: meta?.parent?.name)
+
+        let names = try root.nodes(forXPath: "//Group/Name").compactMap { $0.stringValue }
+        assertPairsEqual(expected: try document.nodes(forXPath: "//Group/Name").compactMap { $0.stringValue }, actual: names)
+
+        let generator = meta?.element(forName: "Generator")
+        XCTAssertTrue(generator?.node === document.rootElement()?.element(forName: "Meta")?.element(forName: "Generator"))
+    }
+
+    func testThatNodeRefDescendantsStepOverEntityReferences() throws {
+        let xml = "<!DOCTYPE r [<!ENTITY e \"<x/>\">]><r><a>&e;</a><b/></r>"
+        let document = try XMLDocument(data: xml.data(using: .utf8)!, options: .nodeLoadExternalEntitiesNever)
+
+        let names = document.nodeRef.descendants.filter { $0.kind == .element }.compactMap { $0.name }
+        assertPairsEqual(expected: ["r", "a", "b"], actual: names)
+    }
+
+    func testThatClonesTemplateRecordsIntoAnotherDocument() throws {
+        let template = try XMLDocument(xmlString: "<Template><Entry id=\"0\"><Title>Untitled</Title><Notes/></Entry></Template>")
+        let entry = template.rootElement()!.element(forName: "Entry")!
+
+        let output = XMLDocument(rootElement: XMLElement(name: "Entries"))
+        for i in 0..<100 {
+            let clone = entry.clone(into: output) as! XMLElement
+            clone.attribute(forName: "id")?.stringValue = "\(i)"
+            output.rootElement()!.addChild(clone)
+        }
+
+        let entries = output.rootElement()!.elements(forName: "Entry")
+        assertPairsEqual(expected: 100, actual: entries.count)
+        assertPairsEqual(expected: "99", actual: entries.last?.attribute(forName: "id")?.stringValue)
+        assertPairsEqual(expected: "Untitled", actual: entries.last?.element(forName: "Title")?.stringValue)
+        assertPairsEqual(expected: "0", actual: entry.attribute(forName: "id")?.stringValue)
+
+        let copy = entry.copy() as! XMLElement
+        assertPairsEqual(expected: entry.xmlString, actual: copy.xmlString)
+        XCTAssertNil(copy.parent)
+    }
+
+    func testThatTreeBuilderCreatesSubtreesInOneCall() throws {
+        let report = try XMLElement(building: { builder in
+            builder.element("Report", attributes: ["version": "2"]) { report in
+                report.comment("generated")
+                for i in 0..<3 {
+                    report.element("Row", attributes: ["id": "\(i)"]) { row in
+                        row.element("Name", stringValue: "Row \(i) & co")
+                        row.cdata("<raw>")
+                    }
+                }
+            }
+        })
+
+        assertPairsEqual(expected: "Report", actual: report.name)
+        assertPairsEqual(expected: 4, actual: report.childCount)
+        assertPairsEqual(expected: "2", actual: report.attribute(forName: "version")?.stringValue)
+        assertPairsEqual(expected: "Row 2 & co", actual: report.elements(forName: "Row").last?.element(forName: "Name")?.stringValue)
+        XCTAssertTrue(report.xmlString.contains("<Row id=\"0\"><Name>Row 0 &amp; co</Name><![CDATA[<raw>]]></Row>"))
+
+        try report.appendChildren { builder in
+            builder.element("Total", stringValue: "3")
+        }
+        assertPairsEqual(expected: 5, actual: report.childCount)
+        assertPairsEqual(expected: "3", actual: report.element(forName: "Total")?.stringValue)
+    }
+
+    func testThatNormalizesAdjacentTextNodesInPlace() throws {
+        let document = try XMLDocument(xmlString: "<r>a<![CDATA[b]]>c<x>1<y/>2<![CDATA[3]]></x><e><![CDATA[z]]></e></r>")
+        let root = document.rootElement()!
+        let first = root.child(at: 0)!
+        root.insertChild(XMLNode.text(withStringValue: "") as! XMLNode, at: 4)
+
+        root.normalizeAdjacentTextNodesPreservingCDATA(true)
+        assertPairsEqual(expected: 5, actual: root.childCount)
+
+        root.normalizeAdjacentTextNodesPreservingCDATA(false)
+        assertPairsEqual(expected: 3, actual: root.childCount)
+        XCTAssertTrue(root.child(at: 0) === first)
+        assertPairsEqual(expected: "abc", actual: first.stringValue)
+        assertPairsEqual(expected: "<x>1<y/>23</x>", actual: root.child(at: 1)?.xmlString)
+        assertPairsEqual(expected: "<e><![CDATA[z]]></e>", actual: root.child(at: 2)?.xmlString)
+    }
+
+    func testThatDiffPatchesOldDocumentIntoNewOne() throws {
+        let old = try XMLDocument(xmlString: "<db v=\"1\"><e id=\"a\"><t>A</t></e><e id=\"b\"><t>B</t></e><e id=\"c\"><t>C</t></e><!--x--></db>")
+        let new = try XMLDocument(xmlString: "<db v=\"2\"><e id=\"a\"><t>A</t></e><e id=\"c\" n=\"1\"><t>C2</t></e><e id=\"d\"><t>D</t></e><!--y--></db>")
+
+        let diff = XMLDiff(from: old, to: new)
+        XCTAssertFalse(diff.isEmpty)
+        XCTAssertTrue(XMLDiff(from: old, to: old).isEmpty)
+
+        let decoded = try XMLDiff(serialized: diff.serialized)
+        assertPairsEqual(expected: diff, actual: decoded)
+        XCTAssertLessThan(diff.serialized.count, new.xmlString.utf8.count)
+
+        try decoded.apply(to: old)
+        assertPairsEqual(expected: new.rootElement()?.xmlString, actual: old.rootElement()?.xmlString)
+
+        XCTAssertThrowsError(try XMLDiff(serialized: Data([1, 2, 3])))
+        XCTAssertThrowsError(try XMLDiff(operations: [.delete(path: [5])]).apply(to: old))
+
+        // An empty text node serializes to an empty fragment.
+        let target = try XMLDocument(xmlString: "<r><a/></r>")
+        try XMLDiff(operations: [.insert(parent: [0], index: 0, xml: "")]).apply(to: target)
+        assertPairsEqual(expected: 2, actual: target.rootElement()?.childCount)
+        assertPairsEqual(expected: .text, actual: target.rootElement()?.child(at: 0)?.kind)
+        assertPairsEqual(expected: "", actual: target.rootElement()?.child(at: 0)?.stringValue)
+    }
+
+    func testThatStructuralHashTracksMutations() throws {
+        let first = try XMLDocument(xmlString: "<r><a x=\"1\" y=\"2\">t</a><b/></r>")
+        let second = try XMLDocument(xmlString: "<r><a y=\"2\" x=\"1\">t</a><b/></r>")
+        assertPairsEqual(expected: first.structuralHash, actual: second.structuralHash)
+
+        let root = first.rootElement()!
+        let a = root.element(forName: "a")!
+        let b = root.element(forName: "b")!
+        let bHash = b.structuralHash
+        let rootHash = root.structuralHash
+
+        a.attribute(forName: "x")?.stringValue = "3"
+        XCTAssertNotEqual(rootHash, root.structuralHash)
+        assertPairsEqual(expected: bHash, actual: b.structuralHash)
+
+        a.attribute(forName: "x")?.stringValue = "1"
+        assertPairsEqual(expected: rootHash, actual: root.structuralHash)
+
+        a.stringValue = "u"
+        XCTAssertNotEqual(rootHash, root.structuralHash)
+        a.stringValue = "t"
+        assertPairsEqual(expected: rootHash, actual: root.structuralHash)
+
+        // Text added next to text is merged into the neighbour; the added node is left detached.
+        let x = XMLNode.text(withStringValue: "x") as! XMLNode
+        a.addChild(x)
+        assertPairsEqual(expected: 1, actual: a.childCount)
+        assertPairsEqual(expected: "tx", actual: a.stringValue)
+        assertPairsEqual(expected: "x", actual: x.stringValue)
+        XCTAssertNil(x.parent)
+        XCTAssertNotEqual(rootHash, root.structuralHash)
+        a.stringValue = "t"
+        assertPairsEqual(expected: rootHash, actual: root.structuralHash)
+
+        a.insertChild(XMLNode.text(withStringValue: "y") as! XMLNode, at: 0)
+        assertPairsEqual(expected: 1, actual: a.childCount)
+        assertPairsEqual(expected: "yt", actual: a.stringValue)
+        XCTAssertNotEqual(rootHash, root.structuralHash)
+        a.stringValue = "t"
+        assertPairsEqual(expected: rootHash, actual: root.structuralHash)
+
+        b.addChild(XMLElement(name: "c"))
+        XCTAssertNotEqual(rootHash, root.structuralHash)
+        b.child(at: 0)?.detach()
+        assertPairsEqual(expected: rootHash, actual: root.structuralHash)
+        assertPairsEqual(expected: second.structuralHash, actual: first.structuralHash)
+    }
+
+    func testThatParsesThroughDecryptVerifyInflatePipeline() throws {
+        let gzipped = Data(base64Encoded: "H4sIAAAAAAACA02OsQ7CMAxEP8k/cPJWGKpWCBC7hxOKFBLkukP/HkqCYHs6P9uHkTzZshxSpmJimOLIQreorn0I+UWQJp1rjbfqdX0qZntQ9wTyQQwlfFNcwlO5K0Zuek2RCdkRN8srdbKUIY0hX1f6rvTb0j7Jf9EXnJoo+7YAAAA=")!
+        let key = Data(repeating: 0x2a, count: 32)
+        let iv = Data(repeating: 0x07, count: 16)
+        let blocks = hashedBlocks(gzipped, blockSize: 32)
+        let encrypted = readAll(try CipherInputStream(.encrypt, upstream: DataInputStream(withData: blocks), key: key, iv: iv))
+
+        let decrypted = try CipherInputStream(.decrypt, upstream: DataInputStream(withData: encrypted), key: key, iv: iv, bufferSize: 64)
+        let document = try XMLDocument(stream: InflateInputStream(upstream: HashedBlockInputStream(upstream: decrypted), bufferSize: 16))
+        assertPairsEqual(expected: "KeePassFile", actual: document.rootElement()?.name)
+        assertPairsEqual(expected: "Mail", actual: try document.nodes(forXPath: "//Entry/String/Value").first?.stringValue)
+
+        var tampered = blocks
+        tampered[tampered.count - 41] ^= 1
+        XCTAssertThrowsError(try XMLDocument(stream: InflateInputStream(upstream: HashedBlockInputStream(upstream: DataInputStream(withData: tampered))))) { error in
+            guard case IOStreamError.integrityCheckFailed = error else {
+                return XCTFail("Unexpected error \(error)")
+            }
+        }
+
+        let wrongKey = try CipherInputStream(.decrypt, upstream: DataInputStream(withData: encrypted), key: Data(count: 32), iv: iv)
+        XCTAssertThrowsError(try XMLDocument(stream: InflateInputStream(upstream: HashedBlockInputStream(upstream: wrongKey))))
+    }
+
+    func testThatWritesGzipWhileSerializing() throws {
+        let sink = DataOutputStream()
+        let gzip = try DeflateOutputStream(downstream: sink, bufferSize: 256)
+        try xmlDocument.write(to: gzip)
+        try gzip.close()
+
+        XCTAssertEqual([0x1f, 0x8b], Array(sink.data.prefix(2)))
+        XCTAssertLessThan(sink.data.count, xmlDocument.xmlData.count)
+
+        let roundTrip = try XMLDocument(stream: InflateInputStream(upstream: DataInputStream(withData: sink.data)))
+        assertPairsEqual(expected: xmlDocument.xmlString, actual: roundTrip.xmlString)
+        XCTAssertThrowsError(try gzip.write([1], maxLength: 1))
+        XCTAssertThrowsError(try DeflateOutputStream(downstream: DataOutputStream(), level: 10))
+    }
+
+    func testThatRestoresDocumentFromSnapshot() throws {
+        let namespaced = try XMLDocument(xmlString: "<r xmlns=\"urn:a\" xmlns:b=\"urn:b\" b:x=\"1\" xml:lang=\"en\"><b:c>t<![CDATA[<z>]]><!--c--></b:c><d xmlns=\"\"/></r>")
+        for document in [xmlDocument!, namespaced] {
+            let sink = DataOutputStream()
+            try document.writeSnapshot(to: sink)
+
+            let restored = try XMLDocument(snapshot: sink.data)
+            assertPairsEqual(expected: document.xmlString, actual: restored.xmlString)
+            assertPairsEqual(expected: document.structuralHash, actual: restored.structuralHash)
+        }
+
+        // The HTML flag and the document URL are part of the snapshot header.
+        let html = try XMLDocument(data: Data("<html><body><p>a<br>b</p></body></html>".utf8), options: .documentTidyHTML)
+        html.uri = "https://example.com/index.html"
+        let htmlSink = DataOutputStream()
+        try html.writeSnapshot(to: htmlSink)
+        let restoredHTML = try XMLDocument(snapshot: htmlSink.data)
+        XCTAssertEqual(.html, restoredHTML.documentContentKind)
+        assertPairsEqual(expected: "https://example.com/index.html", actual: restoredHTML.uri)
+        assertPairsEqual(expected: html.xmlString, actual: restoredHTML.xmlString)
+
+        let sink = DataOutputStream()
+        try namespaced.writeSnapshot(to: sink)
+        XCTAssertNil(try XMLDocument(snapshot: sink.data).uri)
+        XCTAssertThrowsError(try XMLDocument(snapshot: sink.data.prefix(sink.data.count - 1)))
+        XCTAssertThrowsError(try XMLDocument(snapshot: Data()))
+    }
+
+    func testThatIndexFindsElementsWithoutParsingTheFile() throws {
+        let source = URL(fileURLWithPath: TestConstants.kdbV4FilePath)
+        let indexURL = FileManager.default.temporaryDirectory.appendingPathComponent("kdbv4payload.xidx")
+        defer {
+            try? FileManager.default.removeItem(at: indexURL)
+        }
+
+        let byUUID = XMLElementIndex.Key(path: "//Group", name: "UUID")
+        let byName = XMLElementIndex.Key(path: "/KeePassFile/Root/Group/Group", name: "Name")
+        try XMLElementIndex.build(for: source, keys: [byUUID, byName], to: indexURL)
+        let index = try XMLElementIndex(contentsOf: indexURL, source: source)
+
+        let groups = try index.elements(for: byUUID, value: "gtVlzbVpRm2cP6yFsd+njg==")
+        assertPairsEqual(expected: 1, actual: groups.count)
+        assertPairsEqual(expected: "Windows", actual: groups.first?.element(forName: "Name")?.stringValue)
+
+        let network = try index.elements(for: byName, value: "Network")
+        assertPairsEqual(expected: "3ULGNaUNSt661aTCWXFCxQ==", actual: network.first?.element(forName: "UUID")?.stringValue)
+        XCTAssertTrue(index.ranges(for: byUUID, value: "missing").isEmpty)
+        XCTAssertTrue(index.ranges(for: XMLElementIndex.Key(path: "//Entry", name: "@id"), value: "1").isEmpty)
+
+        // Offsets past Int.max or past the source are rejected when the index is opened.
+        let corruptURL = FileManager.default.temporaryDirectory.appendingPathComponent("corrupt.xidx")
+        defer {
+            try? FileManager.default.removeItem(at: corruptURL)
+        }
+        let written = try Data(contentsOf: indexURL)
+        let entriesOffset = 40 + 2 * 24
+        for offset in [32, entriesOffset + 24] {
+            var corrupt = written
+            corrupt.replaceSubrange(offset..<offset + 8, with: [UInt8](repeating: 0xff, count: 8))
+            try corrupt.write(to: corruptURL)
+            XCTAssertThrowsError(try XMLElementIndex(contentsOf: corruptURL, source: source))
+        }
+    }
+
+    func testThatLooksUpElementsByIDAndKey() throws {
+        let document = try XMLDocument(xmlString: """
+            <!DOCTYPE db [<!ATTLIST Group gid ID #IMPLIED>]>
+            <db><Group gid="g1"><Entry UUID="a" xml:id="e1"/><Entry UUID="b"/></Group><Entry UUID="a"/></db>
+            """)
+        assertPairsEqual(expected: "g1", actual: document.element(forID: "g1")?.attribute(forName: "gid")?.stringValue)
+        assertPairsEqual(expected: "a", actual: document.element(forID: "e1")?.attribute(forName: "UUID")?.stringValue)
+        XCTAssertNil(document.element(forID: "missing"))
+
+        let unindexed = document.elements(withAttribute: "UUID", value: "a", ofElementsNamed: "Entry")
+        document.addKeyIndex(forAttribute: "UUID", ofElementsNamed: "Entry")
+        let indexed = document.elements(withAttribute: "UUID", value: "a", ofElementsNamed: "Entry")
+        assertPairsEqual(expected: 2, actual: indexed.count)
+        XCTAssertTrue(zip(unindexed, indexed).allSatisfy { $0 === $1 })
+
+        let b = document.elements(withAttribute: "UUID", value: "b", ofElementsNamed: "Entry").first!
+        b.attribute(forName: "UUID")?.stringValue = "c"
+        XCTAssertTrue(document.elements(withAttribute: "UUID", value: "b", ofElementsNamed: "Entry").isEmpty)
+        XCTAssertTrue(document.elements(withAttribute: "UUID", value: "c", ofElementsNamed: "Entry").first === b)
+
+        b.detach()
+        XCTAssertTrue(document.elements(withAttribute: "UUID", value: "c", ofElementsNamed: "Entry").isEmpty)
+    }
+
+    func testThatUpdatesKeyIndexesInPlace() throws {
+        let document = try XMLDocument(xmlString: """
+            <!DOCTYPE db [<!ATTLIST Entry UUID CDATA "d">]>
+            <db xmlns:p="urn:p"><Group><Entry UUID="a"/><Entry p:UUID="a"/><Entry/></Group><Entry UUID="a"/></db>
+            """)
+        document.addKeyIndex(forAttribute: "UUID", ofElementsNamed: "Entry")
+        // Neither the namespaced attribute nor the DTD default is a key.
+        assertPairsEqual(expected: 2, actual: document.elements(withAttribute: "UUID", value: "a", ofElementsNamed: "Entry").count)
+        XCTAssertTrue(document.elements(withAttribute: "UUID", value: "d", ofElementsNamed: "Entry").isEmpty)
+
+        let root = document.rootElement()!
+        let group = root.elements(forName: "Group").first!
+        let inserted = try XMLElement(xmlString: "<Group><Entry UUID=\"a\"/></Group>")
+        root.insertChild(inserted, at: 0)
+        let keyed = document.elements(withAttribute: "UUID", value: "a", ofElementsNamed: "Entry")
+        assertPairsEqual(expected: 3, actual: keyed.count)
+        XCTAssertTrue(keyed.first?.parent === inserted)
+
+        let renamed = group.elements(forName: "Entry").last!
+        renamed.addAttribute(XMLNode.attribute(withName: "UUID", stringValue: "b") as! XMLNode)
+        XCTAssertTrue(document.elements(withAttribute: "UUID", value: "b", ofElementsNamed: "Entry").first === renamed)
+        renamed.name = "Item"
+        XCTAssertTrue(document.elements(withAttribute: "UUID", value: "b", ofElementsNamed: "Entry").isEmpty)
+        renamed.name = "Entry"
+        renamed.removeAttribute(forName: "UUID")
+        XCTAssertTrue(document.elements(withAttribute: "UUID", value: "b", ofElementsNamed: "Entry").isEmpty)
+
+        group.stringValue = "empty"
+        inserted.setChildren(nil)
+        assertPairsEqual(expected: 1, actual: document.elements(withAttribute: "UUID", value: "a", ofElementsNamed: "Entry").count)
+    }
+
+    func testThatEvaluatesScalarAndNodeSetXPath() throws {
+        let document = try XMLDocument(xmlString: "<db><Entry n=\"2\">x</Entry><Entry n=\"3\">y</Entry></db>")
+        guard case .number(let count) = try document.evaluate(xpath: "count(//Entry)"),
+            case .number(let sum) = try document.evaluate(xpath: "sum(//Entry/@n)"),
+            case .string(let text) = try document.evaluate(xpath: "string(//Entry[2])"),
+            case .boolean(let found) = try document.evaluate(xpath: "boolean(//Entry[@n > 3])"),
+            case .nodes(let nodes) = try document.evaluate(xpath: "//Entry") else {
+            return XCTFail("Unexpected result types")
+        }
+        assertPairsEqual(expected: 2, actual: count)
+        assertPairsEqual(expected: 5, actual: sum)
+        assertPairsEqual(expected: "y", actual: text)
+        XCTAssertFalse(found)
+        assertPairsEqual(expected: ["x", "y"], actual: nodes.refs.map { $0.stringValue })
+        XCTAssertTrue(nodes[1] === document.rootElement()?.elements(forName: "Entry").last)
+        XCTAssertThrowsError(try document.evaluate(xpath: "//["))
+    }
+
+    func testThatBatchEvaluatesCompiledXPathAcrossDocuments() throws {
+        let batch = try XMLXPathBatch(["count(//k:Entry)", "string(//k:Entry/@n)", "//k:Entry/@n", "boolean(//k:Group)"],
+                                      namespaces: ["k": "urn:kdb"])
+        let data = (0..<50).map { "<db xmlns=\"urn:kdb\"><Entry n=\"\($0)\"/><Entry n=\"x\"/></db>".data(using: .utf8)! } + [Data("<db".utf8)]
+        let results = batch.evaluate(data)
+
+        assertPairsEqual(expected: 51, actual: results.count)
+        for i in 0..<50 {
+            assertPairsEqual(expected: [.number(2), .string("\(i)"), .strings(["\(i)", "x"]), .boolean(false)], actual: Array(results[i]!))
+        }
+        XCTAssertNil(results[50])
+        XCTAssertNotNil(results.error(at: 50))
+
+        let documents = try data.prefix(3).map { try XMLDocument(data: $0).freeze() }
+        assertPairsEqual(expected: Array(results[2]!), actual: Array(batch.evaluate(documents, concurrency: 2)[2]!))
+        XCTAssertThrowsError(try XMLXPathBatch(["//["]))
+    }
+
+    func testBatchXPathSerialPerformance() throws {
+        try measureBatchXPath(concurrency: 1)
+    }
+
+    func testBatchXPathParallelPerformance() throws {
+        try measureBatchXPath(concurrency: ProcessInfo.processInfo.activeProcessorCount)
+    }
+
+    func measureBatchXPath(concurrency: Int) throws {
+        let data = [Data](repeating: XMLCoderTests.largeKeePassPayload(), count: 16)
+        let batch = try XMLXPathBatch(["count(//Group)", "sum(//UsageCount)", "//Group[IconID = 38]/Name"])
+
+        measure {
+            let results = batch.evaluate(data, concurrency: concurrency)
+            XCTAssertEqual(.number(Double(2 * XMLCoderTests.largeGroupCount)), results[15]?.first)
+        }
+    }
+
+    func testThatStreamingXPathEmitsMatchesDuringParse() throws {
+        let xml = """
+            <db xmlns:k="urn:kdb"><Group kind="a"><Entry>1</Entry><Group kind="b"><Entry>2</Entry></Group></Group>
+            <k:Group kind="a"><k:Entry>3</k:Entry></k:Group><Entry>4</Entry></db>
+            """
+        let query = try XMLStreamingXPath("//Group[@kind='a']//Entry")
+        var matches: [String?] = []
+        weak var lastMatch: XMLElement?
+        try query.evaluate(stream: DataInputStream(withData: xml.data(using: .utf8)!)) { element, _ in
+            matches.append(element.stringValue)
+            lastMatch = element
+        }
+        assertPairsEqual(expected: ["1", "2"], actual: matches)
+        // The match documents are freed along with their wrappers once the block returns.
+        XCTAssertNil(lastMatch)
+
+        var groups: [XMLElement] = []
+        try XMLStreamingXPath("/db/*", namespaces: ["k": "urn:kdb"]).evaluate(stream: DataInputStream(withData: xml.data(using: .utf8)!)) { element, stop in
+            groups.append(element.copy() as! XMLElement)
+            stop = groups.count == 2
+        }
+        assertPairsEqual(expected: ["Group", "k:Group"], actual: groups.map { $0.name })
+        assertPairsEqual(expected: "urn:kdb", actual: groups[1].uri)
+
+        XCTAssertThrowsError(try XMLStreamingXPath("//Group[1]"))
+        XCTAssertThrowsError(try XMLStreamingXPath("//k:Group"))
+        XCTAssertThrowsError(try query.evaluate(stream: DataInputStream(withData: Data("<db><Group kind='a'><Entry>".utf8))) { _, _ in })
+    }
+
+    #if compiler(>=5.7)
+    @available(iOS 13.0, macOS 10.15, *)
+    func testThatParsesAndSerializesAsynchronously() async throws {
+        let data = XMLCoderTests.largeKeePassPayload()
+        var consumed: Int64 = 0
+        let document = try await XMLDocument.parse(data: data) { consumed = $0 }
+        assertPairsEqual(expected: Int64(data.count), actual: consumed)
+        assertPairsEqual(expected: document.xmlData(), actual: try await document.serialized())
+
+        let parse = Task { try await XMLDocument.parse(data: data) }
+        parse.cancel()
+        do {
+            _ = try await parse.value
+            XCTFail("The parse was not cancelled")
+        } catch {
+            XCTAssertTrue(error is CancellationError)
+        }
+    }
+    #endif
+
+    func testThatEntityCacheServesRepeatedDTDLoads() throws {
+        let directory = FileManager.default.temporaryDirectory.appendingPathComponent(UUID().uuidString)
+        try FileManager.default.createDirectory(at: directory, withIntermediateDirectories: true)
+        let dtdURL = directory.appendingPathComponent("partner.dtd")
+        try "<!ELEMENT r (#PCDATA)><!ENTITY greeting 'hello'><!ENTITY body SYSTEM 'body.txt'>".write(to: dtdURL, atomically: true, encoding: .utf8)
+        try " world".write(to: directory.appendingPathComponent("body.txt"), atomically: true, encoding: .utf8)
+        XMLEntityCache.capacity = 1 << 20
+        XMLEntityCache.allowsNetworkAccess = false
+        defer {
+            XMLEntityCache.capacity = 0
+            XMLEntityCache.allowsNetworkAccess = true
+            XMLEntityCache.removeAll()
+            try? FileManager.default.removeItem(at: directory)
+        }
+        XMLEntityCache.removeAll()
+
+        let xml = "<!DOCTYPE r SYSTEM \"\(dtdURL.absoluteString)\"><r>&greeting;&body;</r>"
+        let first = try XMLDocument(xmlString: xml, options: .nodeLoadExternalEntitiesAlways)
+        assertPairsEqual(expected: 2, actual: XMLEntityCache.missCount)
+        let second = try XMLDocument(xmlString: xml, options: .nodeLoadExternalEntitiesAlways)
+        assertPairsEqual(expected: 2, actual: XMLEntityCache.hitCount)
+        assertPairsEqual(expected: "hello world", actual: first.rootElement()?.stringValue)
+        assertPairsEqual(expected: first.rootElement()?.stringValue, actual: second.rootElement()?.stringValue)
+
+        _ = try XMLDTD(contentsOf: dtdURL)
+        let hits = XMLEntityCache.hitCount
+        XCTAssertNotNil(try XMLDTD(contentsOf: dtdURL).elementDeclaration(forName: "r"))
+        assertPairsEqual(expected: hits + 1, actual: XMLEntityCache.hitCount)
+
+        XMLEntityCache.map(systemID: "http://partner.example/partner.dtd", to: dtdURL)
+        let mapped = try XMLDocument(xmlString: "<!DOCTYPE r SYSTEM \"http://partner.example/partner.dtd\"><r>&greeting;</r>",
+                                     options: .nodeLoadExternalEntitiesAlways)
+        assertPairsEqual(expected: "hello", actual: mapped.rootElement()?.stringValue)
+        let blocked = try XMLDocument(xmlString: "<!DOCTYPE r SYSTEM \"http://elsewhere.example/partner.dtd\"><r>&greeting;</r>",
+                                      options: .nodeLoadExternalEntitiesAlways)
+        XCTAssertNotEqual("hello", blocked.rootElement()?.stringValue)
+    }
+
+    func testThatNamesAndContentCrossTheCBoundaryAsUTF8() throws {
+        let longName = "p:" + String(repeating: "ü", count: 100)
+        let doc = try XMLDocument(xmlString: "<r xmlns:p=\"urn:p\"><p:a p:k=\"v\">grüße</p:a><\(longName)/><b>x<c/>y</b></r>")
+        let a = doc.rootElement()?.elements(forName: "p:a").first
+        assertPairsEqual(expected: "p:a", actual: a?.name)
+        assertPairsEqual(expected: "a", actual: a?.localName)
+        assertPairsEqual(expected: "p", actual: a?.prefix)
+        assertPairsEqual(expected: "p:k", actual: a?.attributes?.first?.name)
+        assertPairsEqual(expected: "grüße", actual: a?.stringValue)
+        assertPairsEqual(expected: "<p:a p:k=\"v\">grüße</p:a>", actual: a?.xmlString)
+        assertPairsEqual(expected: longName, actual: doc.rootElement()?.children?[1].name)
+        assertPairsEqual(expected: "xy", actual: doc.rootElement()?.elements(forName: "b").first?.stringValue)
+
+        XCTAssertThrowsError(try XMLDocument(data: Data()))
+        XCTAssertThrowsError(try doc.evaluate(xpath: "count(")) { error in
+            assertPairsEqual(expected: "NSXMLParserErrorDomain", actual: (error as NSError).domain)
+        }
+    }
+
+    func testThatParsesAndSerializesHTML() throws {
+        let html = "<!DOCTYPE html><html><body><p class=lead>one<br>two<p>three &amp; four</body></html>"
+        let doc = try XMLDocument(html: Data(html.utf8))
+        XCTAssertEqual(.html, doc.documentContentKind)
+        assertPairsEqual(expected: 2, actual: try doc.nodes(forXPath: "//p").count)
+        assertPairsEqual(expected: "<p class=\"lead\">one<br>two</p>", actual: try doc.nodes(forXPath: "//p").first?.xmlString)
+        XCTAssertEqual("<!DOCTYPE html>\n<html><body><p class=\"lead\">one<br>two</p><p>three &amp; four</p></body></html>\n", doc.xmlString)
+
+        let streamed = try XMLDocument(stream: DataInputStream(withData: Data(html.utf8)), options: .documentTidyHTML)
+        XCTAssertEqual(doc.xmlString, streamed.xmlString)
+        XCTAssertEqual(.html, doc.freeze().documentContentKind)
+
+        let accented = "<p>grüße</p>"
+        let accentedDoc = try XMLDocument(html: Data(accented.utf8))
+        assertPairsEqual(expected: "grüße", actual: try accentedDoc.nodes(forXPath: "//p").first?.stringValue)
+        XCTAssertEqual("<html><body><p>grüße</p></body></html>\n", accentedDoc.xmlString)
+        XCTAssertEqual("UTF-8", accentedDoc.characterEncoding)
+        let accentedStream = try XMLDocument(stream: DataInputStream(withData: Data(accented.utf8)), options: .documentTidyHTML)
+        XCTAssertEqual(accentedDoc.xmlString, accentedStream.xmlString)
+
+        XCTAssertThrowsError(try XMLDocument(data: Data(html.utf8), options: .documentTidyHTML, projection: ["p"]))
+        XCTAssertThrowsError(try XMLDocument(data: Data(html.utf8), options: .documentTidyHTML, limits: XMLDocument.ParseLimits(maxNodes: 100)))
+    }
+
+    func hashedBlocks(_ data: Data, blockSize: Int) -> Data {
+        var result = Data()
+        var index: UInt32 = 0
+        func appendBlock(_ chunk: Data, hash: [UInt8]) {
+            withUnsafeBytes(of: index.littleEndian) { result.append(contentsOf: $0) }
+            result.append(contentsOf: hash)
+            withUnsafeBytes(of: UInt32(chunk.count).littleEndian) { result.append(contentsOf: $0) }
+            result.append(chunk)
+            index += 1
+        }
+
+        for start in stride(from: 0, to: data.count, by: blockSize) {
+            let chunk = data.subdata(in: start..<min(start + blockSize, data.count))
+            var hash = [UInt8](repeating: 0, count: Int(CC_SHA256_DIGEST_LENGTH))
+            chunk.withUnsafeBytes { _ = CC_SHA256($0.baseAddress, CC_LONG(chunk.count), &hash) }
+            appendBlock(chunk, hash: hash)
+        }
+        appendBlock(Data(), hash: [UInt8](repeating: 0, count: Int(CC_SHA256_DIGEST_LENGTH)))
+        return result
+    }
+
+    func readAll(_ stream: XML2Swift.InputStream) -> Data {
+        var result = Data()
+        var buffer = [UInt8](repeating: 0, count: 100)
+        while true {
+            let count = stream.read(&buffer, maxLength: buffer.count)
+            guard count > 0 else { break }
+            result.append(contentsOf: buffer[0..<count])
+        }
+        return result
+    }
+
     func printRecursive(node: XMLNode?) {
         print("\(node?.name ?? "") value: \(node?.stringValue ?? "")")
 
@@ -0,0 +1,52 @@
+// swift-tools-version:5.5
+//
+//  Package.swift
+//  XML2Swift
+//
+//  Created by igork on 10/19/26.
+//
+//  The CocoaPods spec remains the way the library is shipped. This manifest exists to build
+//  the benchmark executables:
+//
+//      swift run -c release XML2SwiftBenchmarks --size 64MB
+//      swift run -c release XML2SwiftMicrobenchmarks 64MB
+//
+
+import PackageDescription
+
+let package = Package(
+    name: "XML2Swift",
+    // Only raises the macOS deployment target for the concurrency APIs; Linux builds are unaffected.
+    platforms: [.macOS(.v10_15)],
+    products: [
+        .library(name: "XML2Swift", targets: ["XML2Swift"]),
+        .executable(name: "XML2SwiftBenchmarks", targets: ["XML2SwiftBenchmarks"]),
+        .executable(name: "XML2SwiftMicrobenchmarks", targets: ["XML2SwiftMicrobenchmarks"]),
+    ],
+    targets: [
+        // Supplies the libxml2 include path and link flags to the C targets.
+        .systemLibrary(name: "CLibXML2",
+                       path: "Benchmarks/libxml2",
+                       pkgConfig: "libxml-2.0",
+                       providers: [.apt(["libxml2-dev"]), .brew(["libxml2"])]),
+        .target(name: "XML2SwiftInterface",
+                dependencies: ["CLibXML2"],
+                path: "XML2Swift/Classes",
+                sources: ["xml_interface.c"],
+                publicHeadersPath: ".",
+                linkerSettings: [.linkedLibrary("z")]),
+        // The pod compiles the Swift sources and xml_interface.c into one module; SwiftPM
+        // cannot mix languages in a target, so the C interface is imported implicitly instead.
+        .target(name: "XML2Swift",
+                dependencies: ["XML2SwiftInterface", "CLibXML2"],
+                path: "XML2Swift/Classes",
+                exclude: ["xml_interface.c", "xml_interface.h"],
+                swiftSettings: [.unsafeFlags(["-Xfrontend", "-import-module", "-Xfrontend", "XML2SwiftInterface"])]),
+        .executableTarget(name: "XML2SwiftBenchmarks",
+                          dependencies: ["XML2Swift"],
+                          path: "Benchmarks/XML2SwiftBenchmarks"),
+        .executableTarget(name: "XML2SwiftMicrobenchmarks",
+                          dependencies: ["XML2SwiftInterface"],
+                          path: "Benchmarks/XML2SwiftMicrobenchmarks"),
+    ]
+)
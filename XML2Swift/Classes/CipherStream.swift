@@ -0,0 +1,148 @@
+//
+//  CipherStream.swift
+//  XML2Swift
+//
+//  Created by igork on 10/19/26.
+//
+
+import Foundation
+
+#if canImport(CommonCrypto)
+import CommonCrypto
+
+/*!
+ @class CipherInputStream
+ @abstract Encrypts or decrypts another stream with a CommonCrypto block cipher while it is being read.
+ @discussion CBC is used when an initialization vector is given and ECB otherwise. Data passes through an input and an output buffer of about bufferSize bytes each, whatever the length of the stream. With PKCS#7 padding the last block is only checked when the upstream ends, so a wrong key usually shows up as an error on the final read.
+ */
+public final class CipherInputStream: FailableInputStream {
+    public enum Operation {
+        case encrypt
+        case decrypt
+    }
+
+    public enum Algorithm {
+        case aes
+        case tripleDES
+
+        var ccAlgorithm: CCAlgorithm {
+            switch self {
+            case .aes: return CCAlgorithm(kCCAlgorithmAES)
+            case .tripleDES: return CCAlgorithm(kCCAlgorithm3DES)
+            }
+        }
+
+        var blockSize: Int {
+            switch self {
+            case .aes: return kCCBlockSizeAES128
+            case .tripleDES: return kCCBlockSize3DES
+            }
+        }
+    }
+
+    let upstream: InputStream
+    private let cryptor: CCCryptorRef
+    private let bufferSize: Int
+    private let input: UnsafeMutablePointer<UInt8>
+    private let output: UnsafeMutablePointer<UInt8>
+    private let outputCapacity: Int
+    private var outputStart = 0
+    private var outputEnd = 0
+    private var finished = false
+    public private(set) var error: Error?
+
+    /*!
+     @method initWithOperation:upstream:algorithm:key:iv:padding:bufferSize:error:
+     @abstract Throws IOStreamError.cipherFailure when the key or the initialization vector has the wrong length for the algorithm.
+     */
+    public init(_ operation: Operation, upstream: InputStream, algorithm: Algorithm = .aes, key: Data, iv: Data?, padding: Bool = true, bufferSize: Int = 32 * 1024) throws {
+        if let iv = iv, iv.count != algorithm.blockSize {
+            throw IOStreamError.cipherFailure(status: CCCryptorStatus(kCCParamError))
+        }
+
+        var options = CCOptions(0)
+        if padding {
+            options |= CCOptions(kCCOptionPKCS7Padding)
+        }
+        if iv == nil {
+            options |= CCOptions(kCCOptionECBMode)
+        }
+
+        var cryptorRef: CCCryptorRef? = nil
+        let status = key.withUnsafeBytes { (keyBytes: UnsafeRawBufferPointer) -> CCCryptorStatus in
+            return (iv ?? Data()).withUnsafeBytes { (ivBytes: UnsafeRawBufferPointer) -> CCCryptorStatus in
+                return CCCryptorCreate(operation == .encrypt ? CCOperation(kCCEncrypt) : CCOperation(kCCDecrypt),
+                                       algorithm.ccAlgorithm, options,
+                                       keyBytes.baseAddress, key.count,
+                                       iv == nil ? nil : ivBytes.baseAddress,
+                                       &cryptorRef)
+            }
+        }
+        guard status == CCCryptorStatus(kCCSuccess), let cryptor = cryptorRef else {
+            throw IOStreamError.cipherFailure(status: status)
+        }
+
+        self.upstream = upstream
+        self.cryptor = cryptor
+        self.bufferSize = bufferSize
+        // An update can release one block held back by the previous one, the final call at most one block.
+        self.outputCapacity = bufferSize + algorithm.blockSize
+        self.input = UnsafeMutablePointer<UInt8>.allocate(capacity: bufferSize)
+        self.output = UnsafeMutablePointer<UInt8>.allocate(capacity: outputCapacity)
+    }
+
+    deinit {
+        CCCryptorRelease(cryptor)
+        input.deallocate()
+        output.deallocate()
+    }
+
+    public var hasBytesAvailable: Bool {
+        return error == nil && (outputStart < outputEnd || !finished)
+    }
+
+    public func read(_ buffer: UnsafeMutablePointer<UInt8>, maxLength len: Int) -> Int {
+        guard error == nil else {
+            return -1
+        }
+
+        while outputStart == outputEnd && !finished {
+            guard _refill() else {
+                return -1
+            }
+        }
+
+        let count = min(len, outputEnd - outputStart)
+        buffer.initialize(from: output + outputStart, count: count)
+        outputStart += count
+        return count
+    }
+
+    private func _refill() -> Bool {
+        let count = upstream.read(input, maxLength: bufferSize)
+        if count < 0 {
+            error = upstream._failure
+            return false
+        }
+
+        var moved = 0
+        let status: CCCryptorStatus
+        if count == 0 {
+            status = CCCryptorFinal(cryptor, output, outputCapacity, &moved)
+            finished = true
+        } else {
+            status = CCCryptorUpdate(cryptor, input, count, output, outputCapacity, &moved)
+        }
+
+        guard status == CCCryptorStatus(kCCSuccess) else {
+            error = IOStreamError.cipherFailure(status: status)
+            return false
+        }
+
+        outputStart = 0
+        outputEnd = moved
+        return true
+    }
+}
+
+#endif
@@ -0,0 +1,215 @@
+//
+//  CompressionStream.swift
+//  XML2Swift
+//
+//  Created by igork on 10/19/26.
+//
+
+import Foundation
+
+/*!
+ @class InflateInputStream
+ @abstract Decompresses a gzip or zlib stream while it is being read. The format is detected from the header.
+ @discussion Compressed input is read in chunks of bufferSize bytes into a buffer allocated once, and output is inflated straight into the caller's buffer, so memory use does not depend on the size of the stream. Bytes following the end of the compressed stream are not read.
+ */
+public final class InflateInputStream: FailableInputStream {
+    let upstream: InputStream
+    private let zstream: _XMLZStreamPtr
+    private let bufferSize: Int
+    private let buffer: UnsafeMutablePointer<UInt8>
+    private var bufferStart = 0
+    private var bufferEnd = 0
+    private var upstreamEnded = false
+    private var finished = false
+    public private(set) var error: Error?
+
+    /*!
+     @method initWithUpstream:bufferSize:error:
+     @abstract Throws IOStreamError.zlibUnavailable if zlib can not allocate its state.
+     */
+    public init(upstream: InputStream, bufferSize: Int = 32 * 1024) throws {
+        guard let zstream = _XMLZStreamCreateInflate() else {
+            throw IOStreamError.zlibUnavailable
+        }
+        self.upstream = upstream
+        self.zstream = zstream
+        self.bufferSize = bufferSize
+        self.buffer = UnsafeMutablePointer<UInt8>.allocate(capacity: bufferSize)
+    }
+
+    deinit {
+        _XMLZStreamFree(zstream)
+        buffer.deallocate()
+    }
+
+    public var hasBytesAvailable: Bool {
+        return !finished && error == nil
+    }
+
+    public func read(_ output: UnsafeMutablePointer<UInt8>, maxLength len: Int) -> Int {
+        guard error == nil else {
+            return -1
+        }
+
+        // Loop until something was produced: returning 0 would tell the reader the stream ended.
+        while !finished {
+            if bufferStart == bufferEnd && !upstreamEnded {
+                let count = upstream.read(buffer, maxLength: bufferSize)
+                if count < 0 {
+                    error = upstream._failure
+                    return -1
+                }
+                upstreamEnded = (count == 0)
+                bufferStart = 0
+                bufferEnd = count
+            }
+
+            var consumed = 0
+            var ended = false
+            let produced = _XMLZStreamProcess(zstream, buffer + bufferStart, bufferEnd - bufferStart, &consumed, output, len, false, &ended)
+            guard produced >= 0 else {
+                error = IOStreamError.corruptData
+                return -1
+            }
+
+            bufferStart += consumed
+            finished = ended
+            if produced > 0 {
+                return produced
+            }
+            if consumed == 0 && upstreamEnded {
+                error = IOStreamError.truncated
+                return -1
+            }
+        }
+
+        return 0
+    }
+}
+
+/*!
+ @class DeflateOutputStream
+ @abstract Compresses everything written to it as gzip or zlib data and writes the result to another stream.
+ @discussion Writes are copied into one of two buffers of bufferSize bytes. A full buffer is compressed on a background queue, which also writes to the downstream, while the writer goes on filling the other one; the writer only waits when both buffers are busy. Errors from the background are thrown by the next write or by close. close must be called to write the end of the compressed stream; it also closes the downstream.
+ */
+public final class DeflateOutputStream: OutputStream {
+    public enum Format {
+        case gzip
+        case zlib
+    }
+
+    let downstream: OutputStream
+    private let zstream: _XMLZStreamPtr
+    private let bufferSize: Int
+    private var buffers: [UnsafeMutablePointer<UInt8>]
+    private var filling = 0
+    private var fillCount = 0
+    private let output: UnsafeMutablePointer<UInt8>
+    private let queue = DispatchQueue(label: "XML2Swift.DeflateOutputStream")
+    // Taken while a buffer is being compressed, so at most one buffer is in flight.
+    private let idle = DispatchSemaphore(value: 1)
+    private var backgroundError: Error?
+    private var closed = false
+
+    /*!
+     @method initWithDownstream:format:level:bufferSize:
+     @abstract level follows zlib: 0 stores, 1 is fastest, 9 smallest and -1 the default trade-off.
+     @discussion Throws IOStreamError.invalidCompressionLevel for any other level, and IOStreamError.zlibUnavailable if zlib can not allocate its state.
+     */
+    public init(downstream: OutputStream, format: Format = .gzip, level: Int = -1, bufferSize: Int = 64 * 1024) throws {
+        guard (-1...9).contains(level) else {
+            throw IOStreamError.invalidCompressionLevel(level)
+        }
+        guard let zstream = _XMLZStreamCreateDeflate(Int32(level), format == .gzip) else {
+            throw IOStreamError.zlibUnavailable
+        }
+        self.downstream = downstream
+        self.zstream = zstream
+        self.bufferSize = bufferSize
+        self.buffers = [UnsafeMutablePointer<UInt8>.allocate(capacity: bufferSize),
+                        UnsafeMutablePointer<UInt8>.allocate(capacity: bufferSize)]
+        self.output = UnsafeMutablePointer<UInt8>.allocate(capacity: bufferSize)
+    }
+
+    deinit {
+        // Pending work retains the stream, so nothing can be in flight here.
+        _XMLZStreamFree(zstream)
+        buffers.forEach { $0.deallocate() }
+        output.deallocate()
+    }
+
+    public var hasSpaceAvailable: Bool {
+        return !closed
+    }
+
+    public func write(_ buffer: UnsafePointer<UInt8>, maxLength len: Int) throws -> Int {
+        guard !closed else {
+            throw IOStreamError.writeFailed
+        }
+
+        var written = 0
+        while written < len {
+            let count = min(len - written, bufferSize - fillCount)
+            (buffers[filling] + fillCount).initialize(from: buffer + written, count: count)
+            fillCount += count
+            written += count
+
+            if fillCount == bufferSize {
+                try _submit(finish: false)
+            }
+        }
+        return len
+    }
+
+    public func close() throws {
+        guard !closed else {
+            return
+        }
+        closed = true
+
+        try _submit(finish: true)
+        idle.wait()
+        idle.signal()
+        if let error = backgroundError {
+            throw error
+        }
+        try downstream.close()
+    }
+
+    private func _submit(finish: Bool) throws {
+        idle.wait()
+        if let error = backgroundError {
+            idle.signal()
+            throw error
+        }
+
+        let input = buffers[filling]
+        let count = fillCount
+        queue.async {
+            do {
+                try self._compress(input, count: count, finish: finish)
+            } catch {
+                self.backgroundError = error
+            }
+            self.idle.signal()
+        }
+
+        filling = 1 - filling
+        fillCount = 0
+    }
+
+    private func _compress(_ input: UnsafeMutablePointer<UInt8>, count: Int, finish: Bool) throws {
+        var offset = 0
+        var ended = false
+        repeat {
+            var consumed = 0
+            let produced = _XMLZStreamProcess(zstream, input + offset, count - offset, &consumed, output, bufferSize, finish, &ended)
+            guard produced >= 0 else {
+                throw IOStreamError.compressionFailed
+            }
+
+            offset += consumed
+            try downstream._write(fully: output, count: produced)
+        } while offset < count || (finish && !ended)
+    }
+}
@@ -0,0 +1,126 @@
+//
+//  HashedBlockStream.swift
+//  XML2Swift
+//
+//  Created by igork on 10/19/26.
+//
+
+import Foundation
+
+#if canImport(CommonCrypto)
+import CommonCrypto
+
+/*!
+ @class HashedBlockInputStream
+ @abstract Verifies and unwraps a stream of SHA-256 hashed blocks, the layer KeePass KDBX 3.1 puts between the cipher and the compression.
+ @discussion Each block is a little-endian UInt32 index, the SHA-256 of the data, a little-endian UInt32 length and the data itself. A block of length 0 with an all-zero hash ends the stream. A block is only handed on once its hash matched, so tampered bytes never reach the parser. The buffer grows to the largest block seen, up to maxBlockSize.
+ */
+public final class HashedBlockInputStream: FailableInputStream {
+    private static let headerSize = 4 + Int(CC_SHA256_DIGEST_LENGTH) + 4
+
+    let upstream: InputStream
+    public let maxBlockSize: Int
+    // The block header followed by room for the digest computed over the block.
+    private let scratch: UnsafeMutablePointer<UInt8>
+    private var block: UnsafeMutablePointer<UInt8>
+    private var blockCapacity = 0
+    private var blockStart = 0
+    private var blockEnd = 0
+    private var nextIndex: UInt32 = 0
+    private var finished = false
+    public private(set) var error: Error?
+
+    public init(upstream: InputStream, maxBlockSize: Int = 16 * 1024 * 1024) {
+        self.upstream = upstream
+        self.maxBlockSize = maxBlockSize
+        self.scratch = UnsafeMutablePointer<UInt8>.allocate(capacity: HashedBlockInputStream.headerSize + Int(CC_SHA256_DIGEST_LENGTH))
+        self.block = UnsafeMutablePointer<UInt8>.allocate(capacity: 0)
+    }
+
+    deinit {
+        scratch.deallocate()
+        block.deallocate()
+    }
+
+    public var hasBytesAvailable: Bool {
+        return error == nil && (blockStart < blockEnd || !finished)
+    }
+
+    public func read(_ buffer: UnsafeMutablePointer<UInt8>, maxLength len: Int) -> Int {
+        guard error == nil else {
+            return -1
+        }
+
+        while blockStart == blockEnd && !finished {
+            guard _readBlock() else {
+                return -1
+            }
+        }
+
+        let count = min(len, blockEnd - blockStart)
+        buffer.initialize(from: block + blockStart, count: count)
+        blockStart += count
+        return count
+    }
+
+    private func _readBlock() -> Bool {
+        let headerSize = HashedBlockInputStream.headerSize
+        let digestLength = Int(CC_SHA256_DIGEST_LENGTH)
+
+        let headerCount = upstream._read(fully: scratch, count: headerSize)
+        guard headerCount == headerSize else {
+            return _fail(headerCount < 0 ? upstream._failure : IOStreamError.truncated)
+        }
+
+        let index = _littleEndianUInt32(scratch)
+        let size = Int(_littleEndianUInt32(scratch + 4 + digestLength))
+        guard index == nextIndex else {
+            return _fail(IOStreamError.corruptData)
+        }
+
+        let storedHash = scratch + 4
+        if size == 0 {
+            guard (0..<digestLength).allSatisfy({ storedHash[$0] == 0 }) else {
+                return _fail(IOStreamError.integrityCheckFailed(block: Int(index)))
+            }
+            finished = true
+            return true
+        }
+
+        guard size <= maxBlockSize else {
+            return _fail(IOStreamError.corruptData)
+        }
+        if size > blockCapacity {
+            block.deallocate()
+            block = UnsafeMutablePointer<UInt8>.allocate(capacity: size)
+            blockCapacity = size
+        }
+
+        let blockCount = upstream._read(fully: block, count: size)
+        guard blockCount == size else {
+            return _fail(blockCount < 0 ? upstream._failure : IOStreamError.truncated)
+        }
+
+        let digest = scratch + headerSize
+        CC_SHA256(block, CC_LONG(size), digest)
+        guard memcmp(digest, storedHash, digestLength) == 0 else {
+            return _fail(IOStreamError.integrityCheckFailed(block: Int(index)))
+        }
+
+        nextIndex += 1
+        blockStart = 0
+        blockEnd = size
+        return true
+    }
+
+    private func _fail(_ error: Error) -> Bool {
+        self.error = error
+        return false
+    }
+
+    private func _littleEndianUInt32(_ bytes: UnsafePointer<UInt8>) -> UInt32 {
+        return UInt32(bytes[0]) | UInt32(bytes[1]) << 8 | UInt32(bytes[2]) << 16 | UInt32(bytes[3]) << 24
+    }
+}
+
+#endif
@@ -0,0 +1,90 @@
+//
+//  IOStream+XMLInterface.swift
+//  XML2Swift
+//
+//  Created by igork on 10/19/26.
+//
+
+import Foundation
+#if canImport(libxml2)
+import libxml2
+#else
+import CLibXML2
+#endif
+
+/// Boxes an `InputStream` so that it can be handed to libxml2 as the `void*` context of its I/O callbacks.
+internal final class _XMLInputStreamContext {
+    let stream: InputStream
+
+    init(stream: InputStream) {
+        self.stream = stream
+    }
+
+    func withOpaquePointer<R>(_ work: (UnsafeMutableRawPointer) throws -> R) rethrows -> R {
+        return try withExtendedLifetime(self) {
+            return try work(Unmanaged.passUnretained(self).toOpaque())
+        }
+    }
+}
+
+internal let _XMLInputStreamRead: xmlInputReadCallback = { context, buffer, length in
+    guard let context = context, let buffer = buffer else {
+        return -1
+    }
+
+    let box = Unmanaged<_XMLInputStreamContext>.fromOpaque(context).takeUnretainedValue()
+    return buffer.withMemoryRebound(to: UInt8.self, capacity: Int(length)) {
+        return Int32(box.stream.read($0, maxLength: Int(length)))
+    }
+}
+
+internal let _XMLInputStreamClose: xmlInputCloseCallback = { _ in
+    return 0
+}
+
+/// Boxes an `OutputStream` for libxml2's output callbacks. libxml2 only sees a failed write,
+/// so the error thrown by the stream is kept here for the caller to rethrow.
+internal final class _XMLOutputStreamContext {
+    let stream: OutputStream
+    var error: Error?
+
+    init(stream: OutputStream) {
+        self.stream = stream
+    }
+
+    func withOpaquePointer<R>(_ work: (UnsafeMutableRawPointer) throws -> R) rethrows -> R {
+        return try withExtendedLifetime(self) {
+            return try work(Unmanaged.passUnretained(self).toOpaque())
+        }
+    }
+}
+
+internal let _XMLOutputStreamWrite: xmlOutputWriteCallback = { context, buffer, length in
+    guard let context = context, let buffer = buffer else {
+        return -1
+    }
+
+    let box = Unmanaged<_XMLOutputStreamContext>.fromOpaque(context).takeUnretainedValue()
+    return buffer.withMemoryRebound(to: UInt8.self, capacity: Int(length)) { bytes in
+        var written = 0
+        do {
+            while written < Int(length) {
+                let count = try box.stream.write(bytes + written, maxLength: Int(length) - written)
+                guard count > 0 else {
+                    return -1
+                }
+                written += count
+            }
+        } catch {
+            box.error = error
+            return -1
+        }
+        _XMLInstrumentationAdd(_kXMLCounterSerializedBytes, Int64(written))
+        return Int32(written)
+    }
+}
+
+/// The stream belongs to the caller, who decides when to close it.
+internal let _XMLOutputStreamClose: xmlOutputCloseCallback = { _ in
+    return 0
+}
@@ -15,3 +15,72 @@ public protocol OutputStream {
     func write(_ buffer: UnsafePointer<UInt8>, maxLength len: Int) throws -> Int
     func close() throws
 }
+
+/*!
+ @protocol FailableInputStream
+ @abstract A stream that can fail part way through, for instance on corrupt or tampered input. Once it has failed read returns -1 and error tells why.
+ */
+public protocol FailableInputStream: InputStream {
+    var error: Error? { get }
+}
+
+/*!
+ @enum IOStreamError
+ @constant readFailed The upstream returned -1 without saying why.
+ @constant truncated The upstream ended in the middle of a block or of a compressed stream.
+ @constant corruptData The input is not in the format the stream decodes.
+ @constant integrityCheckFailed The hash of a block does not match its content.
+ @constant cipherFailure CommonCrypto rejected the key or the data, with the given CCCryptorStatus.
+ @constant compressionFailed zlib could not compress the data written.
+ @constant writeFailed The downstream accepted no bytes, or the stream was written to after it was closed.
+ @constant zlibUnavailable zlib could not set up a stream, usually for lack of memory.
+ @constant invalidCompressionLevel The compression level is outside -1...9.
+ */
+public enum IOStreamError: Error {
+    case readFailed
+    case truncated
+    case corruptData
+    case integrityCheckFailed(block: Int)
+    case cipherFailure(status: Int32)
+    case compressionFailed
+    case writeFailed
+    case zlibUnavailable
+    case invalidCompressionLevel(Int)
+}
+
+extension InputStream {
+    /// Reads until `count` bytes arrived or the stream ended. Returns the number of bytes read, or -1 on failure.
+    internal func _read(fully buffer: UnsafeMutablePointer<UInt8>, count: Int) -> Int {
+        var total = 0
+        while total < count {
+            let read = self.read(buffer + total, maxLength: count - total)
+            if read < 0 {
+                return -1
+            }
+            if read == 0 {
+                break
+            }
+            total += read
+        }
+        return total
+    }
+
+    /// The error to report when this stream, used as an upstream, returned -1.
+    internal var _failure: Error {
+        return (self as? FailableInputStream)?.error ?? IOStreamError.readFailed
+    }
+}
+
+extension OutputStream {
+    /// Writes all `count` bytes, however many calls the stream needs for it.
+    internal func _write(fully buffer: UnsafePointer<UInt8>, count: Int) throws {
+        var total = 0
+        while total < count {
+            let written = try write(buffer + total, maxLength: count - total)
+            guard written > 0 else {
+                throw IOStreamError.writeFailed
+            }
+            total += written
+        }
+    }
+}
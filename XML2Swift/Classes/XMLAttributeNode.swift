@@ -6,7 +6,11 @@
 //
 
 import Foundation
+#if canImport(libxml2)
 import libxml2
+#else
+import CLibXML2
+#endif
 
 class XMLAttributeNode: XMLNode {
 //    var attrsNsPtr: xmlNsPtr?
@@ -5,7 +5,7 @@
 //  Created by igork on 9/10/19.
 //
 
-import CoreFoundation
+import Foundation
 
 
 /*!
@@ -35,17 +35,15 @@ open class XMLDTD : XMLNode {
 
     public convenience init(data: Data, options mask: XMLNode.Options = []) throws {
         _SetupXMLParser()
-        var unmanagedError: Unmanaged<CFError>? = nil
-
-        guard let node = _XMLParseDTDFromData(unsafeBitCast(data as NSData, to: CFData.self), &unmanagedError) else {
-            if let error = unmanagedError?.takeRetainedValue() {
-                throw error
-            }
-            //TODO: throw a generic error?
-            fatalError("parsing dtd from data failed")
+        var error = _XMLError()
+        let parsed = data.withUnsafeBytes { (bytes: UnsafeRawBufferPointer) in
+            _XMLParseDTDFromBytes(bytes.baseAddress?.assumingMemoryBound(to: UInt8.self), bytes.count, &error)
+        }
+        guard let node = parsed else {
+            throw _parserError(error)
         }
 
-        // _XMLParseDTDFromData assigns "none" to DTD's name when there's no name for DTD.
+        // _XMLParseDTDFromBytes assigns "none" to DTD's name when there's no name for DTD.
         if _XMLNodeNameEqual(node, "none") {
             _XMLNodeForceSetName(node, nil)
         }
@@ -59,8 +57,7 @@ open class XMLDTD : XMLNode {
      */
     open var publicID: String? {
         get {
-            let returned = _XMLDTDCopyExternalID(_xmlDTD)
-            return returned == nil ? nil : unsafeBitCast(returned!, to: NSString.self) as String
+            return _string(from: _XMLDTDGetExternalIDSpan(_xmlDTD))
         }
 
         set {
@@ -78,8 +75,7 @@ open class XMLDTD : XMLNode {
      */
     open var systemID: String? {
         get {
-            let returned = _XMLDTDCopySystemID(_xmlDTD)
-            return returned == nil ? nil : unsafeBitCast(returned!, to: NSString.self) as String
+            return _string(from: _XMLDTDGetSystemIDSpan(_xmlDTD))
         }
 
         set {
@@ -197,7 +193,7 @@ open class XMLDTD : XMLNode {
             return unsafeBitCast(privateData, to: XMLDTD.self)
         }
 
-        return XMLDTD(ptr: node)
+        return _publish(XMLDTD(ptr: node))
     }
 
     internal override init(ptr: _XMLNodePtr) {
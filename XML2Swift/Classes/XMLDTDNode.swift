@@ -5,7 +5,7 @@
 //  Created by igork on 9/10/19.
 //
 
-import CoreFoundation
+import Foundation
 
 
 /*!
@@ -202,8 +202,7 @@ open class XMLDTDNode: XMLNode {
      */
     open var publicID: String? {
         get {
-            let returned = _XMLDTDNodeCopyPublicID(_xmlNode)
-            return returned == nil ? nil : unsafeBitCast(returned!, to: NSString.self) as String
+            return _string(from: _XMLDTDNodeGetPublicIDSpan(_xmlNode))
         }
         set {
             if let value = newValue {
@@ -220,8 +219,7 @@ open class XMLDTDNode: XMLNode {
      */
     open var systemID: String? {
         get {
-            let returned = _XMLDTDNodeCopySystemID(_xmlNode)
-            return returned == nil ? nil : unsafeBitCast(returned!, to: NSString.self) as String
+            return _string(from: _XMLDTDNodeGetSystemIDSpan(_xmlNode))
         }
         set {
             if let value = newValue {
@@ -242,8 +240,7 @@ open class XMLDTDNode: XMLNode {
                 return nil
             }
 
-            let returned = _XMLCopyEntityContent(_xmlNode)
-            return returned == nil ? nil : unsafeBitCast(returned!, to: NSString.self) as String
+            return _string(from: _XMLEntityGetContentSpan(_xmlNode))
         }
         set {
             guard dtdKind == .unparsed else {
@@ -269,7 +266,7 @@ open class XMLDTDNode: XMLNode {
             return unsafeBitCast(privateData, to: XMLDTDNode.self)
         }
 
-        return XMLDTDNode(ptr: node)
+        return _publish(XMLDTDNode(ptr: node))
     }
 
     internal override init(ptr: _XMLNodePtr) {
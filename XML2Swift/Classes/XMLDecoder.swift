@@ -0,0 +1,476 @@
+//
+//  XMLDecoder.swift
+//  XML2Swift
+//
+//  Created by igork on 10/19/26.
+//
+
+import Foundation
+
+/*!
+ @class XMLDecoder
+ @abstract Decodes <tt>Decodable</tt> values directly from the libxml2 tree, without creating XMLNode wrappers or intermediate strings.
+ @discussion Coding keys are matched against child element names first and attribute names second. Arrays are read from repeated child elements sharing the key's name, e.g. every <tt>Group</tt> child for a <tt>[Group]</tt> property keyed "Group"; a top level array is read from all child elements of the root. An absent key, or an empty element without attributes, decodes as <tt>nil</tt>.
+ */
+open class XMLDecoder {
+    /*!
+     @enum DateDecodingStrategy
+     @abstract How element and attribute text is turned into a <tt>Date</tt>. The default is <tt>iso8601</tt>; text without a zone designator is read as UTC.
+     */
+    public enum DateDecodingStrategy {
+        case deferredToDate
+        case secondsSince1970
+        case millisecondsSince1970
+        case iso8601
+        case formatted(DateFormatter)
+        case custom((Decoder) throws -> Date)
+    }
+
+    /*!
+     @enum DataDecodingStrategy
+     @abstract How element and attribute text is turned into <tt>Data</tt>. The default is <tt>base64</tt>.
+     */
+    public enum DataDecodingStrategy {
+        case deferredToData
+        case base64
+        case hex
+        case custom((Decoder) throws -> Data)
+    }
+
+    open var dateDecodingStrategy: DateDecodingStrategy = .iso8601
+    open var dataDecodingStrategy: DataDecodingStrategy = .base64
+    open var userInfo: [CodingUserInfoKey : Any] = [:]
+
+    internal struct _Options {
+        let dateDecodingStrategy: DateDecodingStrategy
+        let dataDecodingStrategy: DataDecodingStrategy
+        let userInfo: [CodingUserInfoKey : Any]
+    }
+
+    internal var _options: _Options {
+        return _Options(dateDecodingStrategy: dateDecodingStrategy, dataDecodingStrategy: dataDecodingStrategy, userInfo: userInfo)
+    }
+
+    public init() {}
+
+    /*!
+     @method decode:fromData:options:
+     @abstract Parses <tt>data</tt> and decodes a value of the given type from its root element. The parsed tree is released before returning.
+     */
+    open func decode<T: Decodable>(_ type: T.Type, from data: Data, options mask: XMLNode.Options = []) throws -> T {
+        _SetupXMLParser()
+        let parsed = data.withUnsafeBytes { (bytes: UnsafeRawBufferPointer) in
+            _XMLDocPtrFromBytesWithOptions(bytes.baseAddress?.assumingMemoryBound(to: UInt8.self), bytes.count, UInt32(mask.rawValue), nil)
+        }
+        guard let doc = parsed else {
+            throw DecodingError.dataCorrupted(DecodingError.Context(codingPath: [], debugDescription: "The given data was not valid XML."))
+        }
+        defer {
+            _XMLFreeDocument(doc)
+        }
+
+        guard let root = _XMLDocRootElement(doc) else {
+            throw DecodingError.valueNotFound(type, DecodingError.Context(codingPath: [], debugDescription: "The given data did not contain a root element."))
+        }
+
+        return try _XMLDecoderImpl(storage: .node(root), options: _options, codingPath: []).unbox(type)
+    }
+
+    /*!
+     @method decode:fromElement:
+     @abstract Decodes a value of the given type from an element of an existing document.
+     */
+    open func decode<T: Decodable>(_ type: T.Type, from element: XMLElement) throws -> T {
+        return try _XMLDecoderImpl(storage: .node(element._xmlNode), options: _options, codingPath: []).unbox(type)
+    }
+}
+
+internal struct _XMLCodingKey: CodingKey {
+    let stringValue: String
+    let intValue: Int?
+
+    init(stringValue: String) {
+        self.stringValue = stringValue
+        self.intValue = nil
+    }
+
+    init(intValue: Int) {
+        self.stringValue = "Index \(intValue)"
+        self.intValue = intValue
+    }
+}
+
+private func _XMLFindElement(from start: _XMLNodePtr?, named name: String?) -> _XMLNodePtr? {
+    guard let name = name else {
+        return _XMLNodeFindElement(start, nil)
+    }
+    return name.withCString { _XMLNodeFindElement(start, $0) }
+}
+
+private func _XMLNodeIsNil(_ node: _XMLNodePtr) -> Bool {
+    return _XMLNodeGetType(node) == _kXMLTypeElement && _XMLNodeGetFirstChild(node) == nil && _XMLNodeProperties(node) == nil
+}
+
+private func _XMLNodeStringContent(_ node: _XMLNodePtr) -> String {
+    return _string(from: _XMLNodeCopyContentSpan(node)) ?? ""
+}
+
+private enum _XMLDecodingStorage {
+    // An element, or an attribute of one.
+    case node(_XMLNodePtr)
+    // The children of parent matching name; resolved to the first match for single values
+    // and to every match for unkeyed containers, so that repeated elements decode as arrays.
+    case named(parent: _XMLNodePtr, name: String)
+}
+
+private final class _XMLDecoderImpl: Decoder {
+    let storage: _XMLDecodingStorage
+    let options: XMLDecoder._Options
+    let codingPath: [CodingKey]
+
+    var userInfo: [CodingUserInfoKey : Any] {
+        return options.userInfo
+    }
+
+    init(storage: _XMLDecodingStorage, options: XMLDecoder._Options, codingPath: [CodingKey]) {
+        self.storage = storage
+        self.options = options
+        self.codingPath = codingPath
+    }
+
+    func resolvedNode() throws -> _XMLNodePtr {
+        switch storage {
+        case .node(let node):
+            return node
+
+        case .named(let parent, let name):
+            if let child = _XMLFindElement(from: _XMLNodeGetFirstChild(parent), named: name) {
+                return child
+            }
+            if let attribute = _XMLNodeHasProp(parent, name, nil) {
+                return attribute
+            }
+            let key = codingPath.last ?? _XMLCodingKey(stringValue: name)
+            throw DecodingError.keyNotFound(key, DecodingError.Context(codingPath: Array(codingPath.dropLast()), debugDescription: "No element or attribute named \"\(name)\"."))
+        }
+    }
+
+    func container<Key>(keyedBy type: Key.Type) throws -> KeyedDecodingContainer<Key> where Key : CodingKey {
+        let node = try resolvedNode()
+        guard _XMLNodeGetType(node) == _kXMLTypeElement else {
+            throw DecodingError.typeMismatch([String : Any].self, DecodingError.Context(codingPath: codingPath, debugDescription: "Expected an element but found an attribute instead."))
+        }
+        return KeyedDecodingContainer(_XMLKeyedDecodingContainer<Key>(decoder: self, element: node))
+    }
+
+    func unkeyedContainer() throws -> UnkeyedDecodingContainer {
+        switch storage {
+        case .node(let node):
+            return _XMLUnkeyedDecodingContainer(decoder: self, parent: node, name: nil)
+        case .named(let parent, let name):
+            return _XMLUnkeyedDecodingContainer(decoder: self, parent: parent, name: name)
+        }
+    }
+
+    func singleValueContainer() throws -> SingleValueDecodingContainer {
+        return self
+    }
+
+    func unbox<T: Decodable>(_ type: T.Type) throws -> T {
+        if type == Date.self {
+            return try unboxDate() as! T
+        }
+        if type == Data.self {
+            return try unboxData() as! T
+        }
+        if type == URL.self {
+            let string = try decode(String.self)
+            guard let url = URL(string: string) else {
+                throw DecodingError.dataCorrupted(DecodingError.Context(codingPath: codingPath, debugDescription: "Invalid URL string \"\(string)\"."))
+            }
+            return url as! T
+        }
+        return try T(from: self)
+    }
+
+    private func unboxDate() throws -> Date {
+        switch options.dateDecodingStrategy {
+        case .deferredToDate:
+            return try Date(from: self)
+
+        case .secondsSince1970:
+            return Date(timeIntervalSince1970: try decode(Double.self))
+
+        case .millisecondsSince1970:
+            return Date(timeIntervalSince1970: try decode(Double.self) / 1000.0)
+
+        case .iso8601:
+            return try convertText(Date.self) { text in
+                var seconds: Double = 0
+                return _XMLTextGetISO8601Date(text, &seconds) ? Date(timeIntervalSince1970: seconds) : nil
+            }
+
+        case .formatted(let formatter):
+            let string = try decode(String.self)
+            guard let date = formatter.date(from: string) else {
+                throw DecodingError.dataCorrupted(DecodingError.Context(codingPath: codingPath, debugDescription: "Date string \"\(string)\" does not match format expected by formatter."))
+            }
+            return date
+
+        case .custom(let closure):
+            return try closure(self)
+        }
+    }
+
+    private func unboxData() throws -> Data {
+        switch options.dataDecodingStrategy {
+        case .deferredToData:
+            return try Data(from: self)
+
+        case .base64:
+            return try convertText(Data.self) { text in
+                _data(from: _XMLTextCopyBase64Span(text))
+            }
+
+        case .hex:
+            return try convertText(Data.self) { text in
+                _data(from: _XMLTextCopyHexSpan(text))
+            }
+
+        case .custom(let closure):
+            return try closure(self)
+        }
+    }
+
+    // Hands the node's UTF-8 text to convert without copying it when the node holds a single text child.
+    private func convertText<T>(_ type: T.Type, _ convert: (UnsafePointer<CChar>) -> T?) throws -> T {
+        let node = try resolvedNode()
+        let converted: T?
+        if let text = _XMLNodeGetContentNoCopy(node) {
+            converted = convert(text)
+        } else {
+            converted = _XMLNodeStringContent(node).withCString(convert)
+        }
+
+        guard let value = converted else {
+            throw DecodingError.dataCorrupted(DecodingError.Context(codingPath: codingPath, debugDescription: "Expected to decode \(type) but found \"\(_XMLNodeStringContent(node))\" instead."))
+        }
+        return value
+    }
+
+    private func decodeSigned<T: FixedWidthInteger & SignedInteger>(_ type: T.Type) throws -> T {
+        return try convertText(type) { text in
+            var value: Int64 = 0
+            return _XMLTextGetInt64(text, &value) ? T(exactly: value) : nil
+        }
+    }
+
+    private func decodeUnsigned<T: FixedWidthInteger & UnsignedInteger>(_ type: T.Type) throws -> T {
+        return try convertText(type) { text in
+            var value: UInt64 = 0
+            return _XMLTextGetUInt64(text, &value) ? T(exactly: value) : nil
+        }
+    }
+}
+
+extension _XMLDecoderImpl: SingleValueDecodingContainer {
+    func decodeNil() -> Bool {
+        guard let node = try? resolvedNode() else {
+            return true
+        }
+        return _XMLNodeIsNil(node)
+    }
+
+    func decode(_ type: Bool.Type) throws -> Bool {
+        return try convertText(type) { text in
+            var value = false
+            return _XMLTextGetBool(text, &value) ? value : nil
+        }
+    }
+
+    func decode(_ type: String.Type) throws -> String {
+        return _XMLNodeStringContent(try resolvedNode())
+    }
+
+    func decode(_ type: Double.Type) throws -> Double {
+        return try convertText(type) { text in
+            var value: Double = 0
+            return _XMLTextGetDouble(text, &value) ? value : nil
+        }
+    }
+
+    func decode(_ type: Float.Type) throws -> Float {
+        return Float(try decode(Double.self))
+    }
+
+    func decode(_ type: Int.Type) throws -> Int { return try decodeSigned(type) }
+    func decode(_ type: Int8.Type) throws -> Int8 { return try decodeSigned(type) }
+    func decode(_ type: Int16.Type) throws -> Int16 { return try decodeSigned(type) }
+    func decode(_ type: Int32.Type) throws -> Int32 { return try decodeSigned(type) }
+    func decode(_ type: Int64.Type) throws -> Int64 { return try decodeSigned(type) }
+    func decode(_ type: UInt.Type) throws -> UInt { return try decodeUnsigned(type) }
+    func decode(_ type: UInt8.Type) throws -> UInt8 { return try decodeUnsigned(type) }
+    func decode(_ type: UInt16.Type) throws -> UInt16 { return try decodeUnsigned(type) }
+    func decode(_ type: UInt32.Type) throws -> UInt32 { return try decodeUnsigned(type) }
+    func decode(_ type: UInt64.Type) throws -> UInt64 { return try decodeUnsigned(type) }
+
+    func decode<T>(_ type: T.Type) throws -> T where T : Decodable {
+        return try unbox(type)
+    }
+}
+
+private struct _XMLKeyedDecodingContainer<Key: CodingKey>: KeyedDecodingContainerProtocol {
+    let decoder: _XMLDecoderImpl
+    let element: _XMLNodePtr
+
+    var codingPath: [CodingKey] {
+        return decoder.codingPath
+    }
+
+    var allKeys: [Key] {
+        var names: [String] = []
+        var child = _XMLFindElement(from: _XMLNodeGetFirstChild(element), named: nil)
+        while let node = child {
+            if let name = _qualifiedName(of: node) {
+                names.append(name)
+            }
+            child = _XMLFindElement(from: _XMLNodeGetNextSibling(node), named: nil)
+        }
+        var attribute = _XMLNodeProperties(element)
+        while let node = attribute {
+            if let name = _qualifiedName(of: node) {
+                names.append(name)
+            }
+            attribute = _XMLNodeGetNextSibling(node)
+        }
+
+        var seen = Set<String>()
+        return names.filter { seen.insert($0).inserted }.compactMap { Key(stringValue: $0) }
+    }
+
+    private func childDecoder(forKey key: Key) -> _XMLDecoderImpl {
+        return _XMLDecoderImpl(storage: .named(parent: element, name: key.stringValue), options: decoder.options, codingPath: codingPath + [key])
+    }
+
+    func contains(_ key: Key) -> Bool {
+        return (try? childDecoder(forKey: key).resolvedNode()) != nil
+    }
+
+    func decodeNil(forKey key: Key) throws -> Bool {
+        return childDecoder(forKey: key).decodeNil()
+    }
+
+    func decode(_ type: Bool.Type, forKey key: Key) throws -> Bool { return try childDecoder(forKey: key).decode(type) }
+    func decode(_ type: String.Type, forKey key: Key) throws -> String { return try childDecoder(forKey: key).decode(type) }
+    func decode(_ type: Double.Type, forKey key: Key) throws -> Double { return try childDecoder(forKey: key).decode(type) }
+    func decode(_ type: Float.Type, forKey key: Key) throws -> Float { return try childDecoder(forKey: key).decode(type) }
+    func decode(_ type: Int.Type, forKey key: Key) throws -> Int { return try childDecoder(forKey: key).decode(type) }
+    func decode(_ type: Int8.Type, forKey key: Key) throws -> Int8 { return try childDecoder(forKey: key).decode(type) }
+    func decode(_ type: Int16.Type, forKey key: Key) throws -> Int16 { return try childDecoder(forKey: key).decode(type) }
+    func decode(_ type: Int32.Type, forKey key: Key) throws -> Int32 { return try childDecoder(forKey: key).decode(type) }
+    func decode(_ type: Int64.Type, forKey key: Key) throws -> Int64 { return try childDecoder(forKey: key).decode(type) }
+    func decode(_ type: UInt.Type, forKey key: Key) throws -> UInt { return try childDecoder(forKey: key).decode(type) }
+    func decode(_ type: UInt8.Type, forKey key: Key) throws -> UInt8 { return try childDecoder(forKey: key).decode(type) }
+    func decode(_ type: UInt16.Type, forKey key: Key) throws -> UInt16 { return try childDecoder(forKey: key).decode(type) }
+    func decode(_ type: UInt32.Type, forKey key: Key) throws -> UInt32 { return try childDecoder(forKey: key).decode(type) }
+    func decode(_ type: UInt64.Type, forKey key: Key) throws -> UInt64 { return try childDecoder(forKey: key).decode(type) }
+
+    func decode<T>(_ type: T.Type, forKey key: Key) throws -> T where T : Decodable {
+        return try childDecoder(forKey: key).unbox(type)
+    }
+
+    func nestedContainer<NestedKey>(keyedBy type: NestedKey.Type, forKey key: Key) throws -> KeyedDecodingContainer<NestedKey> where NestedKey : CodingKey {
+        return try childDecoder(forKey: key).container(keyedBy: type)
+    }
+
+    func nestedUnkeyedContainer(forKey key: Key) throws -> UnkeyedDecodingContainer {
+        return try childDecoder(forKey: key).unkeyedContainer()
+    }
+
+    func superDecoder() throws -> Decoder {
+        return _XMLDecoderImpl(storage: .node(element), options: decoder.options, codingPath: codingPath)
+    }
+
+    func superDecoder(forKey key: Key) throws -> Decoder {
+        return childDecoder(forKey: key)
+    }
+}
+
+private struct _XMLUnkeyedDecodingContainer: UnkeyedDecodingContainer {
+    let decoder: _XMLDecoderImpl
+    let name: String?
+    let count: Int?
+    private(set) var currentIndex: Int = 0
+    private var current: _XMLNodePtr?
+
+    init(decoder: _XMLDecoderImpl, parent: _XMLNodePtr, name: String?) {
+        self.decoder = decoder
+        self.name = name
+        self.current = _XMLFindElement(from: _XMLNodeGetFirstChild(parent), named: name)
+
+        var count = 0
+        var node = current
+        while let element = node {
+            count += 1
+            node = _XMLFindElement(from: _XMLNodeGetNextSibling(element), named: name)
+        }
+        self.count = count
+    }
+
+    var codingPath: [CodingKey] {
+        return decoder.codingPath
+    }
+
+    var isAtEnd: Bool {
+        return current == nil
+    }
+
+    private mutating func nextDecoder<T>(for type: T.Type) throws -> _XMLDecoderImpl {
+        guard let node = current else {
+            throw DecodingError.valueNotFound(type, DecodingError.Context(codingPath: codingPath + [_XMLCodingKey(intValue: currentIndex)], debugDescription: "Unkeyed container is at end."))
+        }
+        let next = _XMLDecoderImpl(storage: .node(node), options: decoder.options, codingPath: codingPath + [_XMLCodingKey(intValue: currentIndex)])
+        current = _XMLFindElement(from: _XMLNodeGetNextSibling(node), named: name)
+        currentIndex += 1
+        return next
+    }
+
+    mutating func decodeNil() throws -> Bool {
+        guard let node = current, _XMLNodeIsNil(node) else {
+            return false
+        }
+        _ = try nextDecoder(for: Any?.self)
+        return true
+    }
+
+    mutating func decode(_ type: Bool.Type) throws -> Bool { return try nextDecoder(for: type).decode(type) }
+    mutating func decode(_ type: String.Type) throws -> String { return try nextDecoder(for: type).decode(type) }
+    mutating func decode(_ type: Double.Type) throws -> Double { return try nextDecoder(for: type).decode(type) }
+    mutating func decode(_ type: Float.Type) throws -> Float { return try nextDecoder(for: type).decode(type) }
+    mutating func decode(_ type: Int.Type) throws -> Int { return try nextDecoder(for: type).decode(type) }
+    mutating func decode(_ type: Int8.Type) throws -> Int8 { return try nextDecoder(for: type).decode(type) }
+    mutating func decode(_ type: Int16.Type) throws -> Int16 { return try nextDecoder(for: type).decode(type) }
+    mutating func decode(_ type: Int32.Type) throws -> Int32 { return try nextDecoder(for: type).decode(type) }
+    mutating func decode(_ type: Int64.Type) throws -> Int64 { return try nextDecoder(for: type).decode(type) }
+    mutating func decode(_ type: UInt.Type) throws -> UInt { return try nextDecoder(for: type).decode(type) }
+    mutating func decode(_ type: UInt8.Type) throws -> UInt8 { return try nextDecoder(for: type).decode(type) }
+    mutating func decode(_ type: UInt16.Type) throws -> UInt16 { return try nextDecoder(for: type).decode(type) }
+    mutating func decode(_ type: UInt32.Type) throws -> UInt32 { return try nextDecoder(for: type).decode(type) }
+    mutating func decode(_ type: UInt64.Type) throws -> UInt64 { return try nextDecoder(for: type).decode(type) }
+
+    mutating func decode<T>(_ type: T.Type) throws -> T where T : Decodable {
+        return try nextDecoder(for: type).unbox(type)
+    }
+
+    mutating func nestedContainer<NestedKey>(keyedBy type: NestedKey.Type) throws -> KeyedDecodingContainer<NestedKey> where NestedKey : CodingKey {
+        return try nextDecoder(for: KeyedDecodingContainer<NestedKey>.self).container(keyedBy: type)
+    }
+
+    mutating func nestedUnkeyedContainer() throws -> UnkeyedDecodingContainer {
+        return try nextDecoder(for: UnkeyedDecodingContainer.self).unkeyedContainer()
+    }
+
+    mutating func superDecoder() throws -> Decoder {
+        return try nextDecoder(for: Decoder.self)
+    }
+}
@@ -0,0 +1,448 @@
+//
+//  XMLDiff.swift
+//  XML2Swift
+//
+//  Created by igork on 10/19/26.
+//
+
+import Foundation
+
+/*!
+ @struct XMLDiff
+ @abstract An edit script that turns one document into another, with a compact binary form for shipping it.
+ @discussion Nodes are addressed by paths of child indices starting at the document node. Every path refers to the tree as left by the operations before it, so operations must be applied in order. Inserted nodes are carried as XML and parsed in the context of their new parent, which resolves namespace prefixes declared on its ancestors.
+ */
+public struct XMLDiff: Equatable {
+    public enum Operation: Equatable {
+        /// Parses `xml`, a single node, and inserts it as the child at `index` of the node at `parent`.
+        case insert(parent: [Int], index: Int, xml: String)
+        case delete(path: [Int])
+        /// Replaces the content of a text, CDATA, comment or processing instruction node.
+        case setText(path: [Int], value: String)
+        case setAttribute(path: [Int], name: String, value: String)
+        case removeAttribute(path: [Int], name: String)
+    }
+
+    public enum PatchError: Error {
+        /// The serialized form is truncated or was not produced by `serialized`.
+        case malformedData
+        /// No node exists at the path, or it is not of the kind the operation expects.
+        case invalidPath([Int])
+        /// The XML carried by an insert operation could not be parsed in its target context.
+        case invalidFragment(String)
+    }
+
+    public let operations: [Operation]
+
+    public var isEmpty: Bool {
+        return operations.isEmpty
+    }
+
+    public init(operations: [Operation]) {
+        self.operations = operations
+    }
+
+    /*!
+     @method initFromDocument:toDocument:
+     @abstract Computes the operations that turn old into new.
+     @discussion Subtrees are compared by their cached structural hashes, so identical subtrees are matched by comparing two integers. Children are aligned on their hashes, elements that stay in place with the same name are diffed recursively, and only what remains is deleted or inserted.
+     */
+    public init(from old: XMLDocument, to new: XMLDocument) {
+        var differ = _XMLDiffer()
+        differ.diffChildren(old._xmlNode, new._xmlNode, path: [])
+        operations = differ.operations
+    }
+
+    /*!
+     @method applyToDocument:
+     @abstract Applies the operations to document in place.
+     @discussion Operations before a failing one stay applied.
+     */
+    public func apply(to document: XMLDocument) throws {
+        document._willMutate()
+        document._invalidateKeyIndexes()
+
+        for operation in operations {
+            switch operation {
+            case let .insert(parentPath, index, xml):
+                let parent = try XMLDiff._node(at: parentPath, in: document)
+                guard let node = _XMLNodeParseFragment(parent, xml, xml.utf8.count) else {
+                    throw PatchError.invalidFragment(xml)
+                }
+                guard _XMLNodeInsertChildAtIndex(parent, node, index) else {
+                    _XMLFreeNode(node)
+                    throw PatchError.invalidPath(parentPath + [index])
+                }
+                _XMLNodeInvalidateStructuralHash(parent)
+
+            case let .delete(path):
+                let node = try XMLDiff._node(at: path, in: document)
+                if _XMLNodeGetPrivateData(node) != nil {
+                    XMLNode._objectNodeForNode(node).detach()
+                } else {
+                    _XMLNodeInvalidateStructuralHash(node)
+                    _XMLUnlinkNode(node)
+                    _XMLFreeNode(node)
+                }
+
+            case let .setText(path, value):
+                let node = try XMLDiff._node(at: path, in: document)
+                switch _XMLNodeGetType(node) {
+                case _kXMLTypeText, _kXMLTypeCDataSection, _kXMLTypeComment, _kXMLTypeProcessingInstruction:
+                    _XMLNodeInvalidateStructuralHash(node)
+                    _XMLNodeSetContent(node, value)
+                default:
+                    throw PatchError.invalidPath(path)
+                }
+
+            case let .setAttribute(path, name, value):
+                let element = try XMLDiff._element(at: path, in: document)
+                if let attribute = element.attribute(forName: name) {
+                    attribute.stringValue = value
+                } else {
+                    element.addAttribute(XMLNode.attribute(withName: name, stringValue: value) as! XMLNode)
+                }
+
+            case let .removeAttribute(path, name):
+                try XMLDiff._element(at: path, in: document).removeAttribute(forName: name)
+            }
+        }
+    }
+
+    private static func _node(at path: [Int], in document: XMLDocument) throws -> _XMLNodePtr {
+        var node: _XMLNodePtr = document._xmlNode
+        for index in path {
+            var child = _XMLNodeGetFirstChild(node)
+            var remaining = index
+            while remaining > 0, let current = child {
+                child = _XMLNodeGetNextSibling(current)
+                remaining -= 1
+            }
+            guard index >= 0, let next = child else {
+                throw PatchError.invalidPath(path)
+            }
+            node = next
+        }
+        return node
+    }
+
+    private static func _element(at path: [Int], in document: XMLDocument) throws -> XMLElement {
+        let node = try _node(at: path, in: document)
+        guard _XMLNodeGetType(node) == _kXMLTypeElement else {
+            throw PatchError.invalidPath(path)
+        }
+        return XMLElement._objectNodeForNode(node)
+    }
+}
+
+// MARK: - Diffing
+
+private struct _XMLDiffer {
+    var operations: [XMLDiff.Operation] = []
+
+    // Alignment tables above this many cells fall back to matching common prefixes and suffixes only.
+    private static let maxAlignmentCells = 1 << 20
+
+    func hash(_ node: _XMLNodePtr) -> UInt64 {
+        return _XMLNodeGetStructuralHash(node)
+    }
+
+    /// Whether `old` can be turned into `new` in place rather than replaced.
+    private func canPair(_ old: _XMLNodePtr, _ new: _XMLNodePtr) -> Bool {
+        let type = _XMLNodeGetType(old)
+        guard type == _XMLNodeGetType(new) else { return false }
+
+        switch type {
+        case _kXMLTypeElement, _kXMLTypeProcessingInstruction:
+            return _XMLNodeGetLocalHash(old, false) == _XMLNodeGetLocalHash(new, false)
+        case _kXMLTypeText, _kXMLTypeCDataSection, _kXMLTypeComment:
+            return true
+        default:
+            return false
+        }
+    }
+
+    mutating func diffChildren(_ oldParent: _XMLNodePtr, _ newParent: _XMLNodePtr, path: [Int]) {
+        let old = _XMLDiffer.children(of: oldParent)
+        let new = _XMLDiffer.children(of: newParent)
+        let oldHashes = old.map { hash($0) }
+        let newHashes = new.map { hash($0) }
+
+        var index = 0
+        var oldStart = 0
+        var newStart = 0
+        for (oldIndex, newIndex) in _XMLDiffer.align(oldHashes, newHashes) {
+            diffGap(old[oldStart..<oldIndex], new[newStart..<newIndex], parent: path, index: &index)
+            index += 1
+            oldStart = oldIndex + 1
+            newStart = newIndex + 1
+        }
+        diffGap(old[oldStart...], new[newStart...], parent: path, index: &index)
+    }
+
+    /// Turns a run of unmatched old children into the corresponding run of new ones.
+    private mutating func diffGap(_ old: ArraySlice<_XMLNodePtr>, _ new: ArraySlice<_XMLNodePtr>, parent: [Int], index: inout Int) {
+        var oldIndex = old.startIndex
+        var newIndex = new.startIndex
+
+        while oldIndex < old.endIndex || newIndex < new.endIndex {
+            if oldIndex < old.endIndex && newIndex < new.endIndex && canPair(old[oldIndex], new[newIndex]) {
+                diffNode(old[oldIndex], new[newIndex], path: parent + [index])
+                oldIndex += 1
+                newIndex += 1
+                index += 1
+            } else if newIndex < new.endIndex && !old[oldIndex...].contains(where: { canPair($0, new[newIndex]) }) {
+                operations.append(.insert(parent: parent, index: index, xml: _XMLDiffer.xmlString(new[newIndex])))
+                newIndex += 1
+                index += 1
+            } else {
+                operations.append(.delete(path: parent + [index]))
+                oldIndex += 1
+            }
+        }
+    }
+
+    private mutating func diffNode(_ old: _XMLNodePtr, _ new: _XMLNodePtr, path: [Int]) {
+        guard hash(old) != hash(new) else { return }
+
+        guard _XMLNodeGetType(old) == _kXMLTypeElement else {
+            operations.append(.setText(path: path, value: _XMLDiffer.content(new)))
+            return
+        }
+
+        let oldAttributes = _XMLDiffer.attributes(of: old)
+        let newAttributes = _XMLDiffer.attributes(of: new)
+        for (name, _) in oldAttributes where !newAttributes.contains(where: { $0.name == name }) {
+            operations.append(.removeAttribute(path: path, name: name))
+        }
+        for (name, value) in newAttributes where !oldAttributes.contains(where: { $0.name == name && $0.value == value }) {
+            operations.append(.setAttribute(path: path, name: name, value: value))
+        }
+
+        diffChildren(old, new, path: path)
+    }
+
+    /// Index pairs of a longest common subsequence of two hash sequences, in increasing order.
+    static func align(_ old: [UInt64], _ new: [UInt64]) -> [(Int, Int)] {
+        var prefix = 0
+        while prefix < old.count && prefix < new.count && old[prefix] == new[prefix] {
+            prefix += 1
+        }
+        var suffix = 0
+        while suffix < old.count - prefix && suffix < new.count - prefix && old[old.count - 1 - suffix] == new[new.count - 1 - suffix] {
+            suffix += 1
+        }
+
+        var pairs = (0..<prefix).map { ($0, $0) }
+
+        let oldMiddle = Array(old[prefix..<(old.count - suffix)])
+        let newMiddle = Array(new[prefix..<(new.count - suffix)])
+        let rows = oldMiddle.count
+        let columns = newMiddle.count
+        if rows > 0 && columns > 0 && rows * columns <= maxAlignmentCells {
+            var lengths = [Int32](repeating: 0, count: (rows + 1) * (columns + 1))
+            for i in stride(from: rows - 1, through: 0, by: -1) {
+                for j in stride(from: columns - 1, through: 0, by: -1) {
+                    let cell = i * (columns + 1) + j
+                    if oldMiddle[i] == newMiddle[j] {
+                        lengths[cell] = lengths[cell + columns + 2] + 1
+                    } else {
+                        lengths[cell] = max(lengths[cell + columns + 1], lengths[cell + 1])
+                    }
+                }
+            }
+
+            var i = 0
+            var j = 0
+            while i < rows && j < columns {
+                if oldMiddle[i] == newMiddle[j] {
+                    pairs.append((prefix + i, prefix + j))
+                    i += 1
+                    j += 1
+                } else if lengths[(i + 1) * (columns + 1) + j] >= lengths[i * (columns + 1) + j + 1] {
+                    i += 1
+                } else {
+                    j += 1
+                }
+            }
+        }
+
+        pairs += (0..<suffix).map { (old.count - suffix + $0, new.count - suffix + $0) }
+        return pairs
+    }
+
+    static func children(of node: _XMLNodePtr) -> [_XMLNodePtr] {
+        var result: [_XMLNodePtr] = []
+        var child = _XMLNodeGetFirstChild(node)
+        while let current = child {
+            result.append(current)
+            child = _XMLNodeGetNextSibling(current)
+        }
+        return result
+    }
+
+    static func attributes(of node: _XMLNodePtr) -> [(name: String, value: String)] {
+        var result: [(name: String, value: String)] = []
+        var attribute = _XMLNodeProperties(node)
+        while let current = attribute {
+            let name = _qualifiedName(of: current) ?? ""
+            result.append((name, content(current)))
+            attribute = _XMLNodeGetNextSibling(current)
+        }
+        return result
+    }
+
+    static func content(_ node: _XMLNodePtr) -> String {
+        return _string(from: _XMLNodeCopyContentSpan(node)) ?? ""
+    }
+
+    static func xmlString(_ node: _XMLNodePtr) -> String {
+        return _string(from: _XMLNodeCopyStringSpan(node, 0)) ?? ""
+    }
+}
+
+// MARK: - Serialization
+
+extension XMLDiff {
+    private enum _Tag: UInt8 {
+        case insert = 1
+        case delete
+        case setText
+        case setAttribute
+        case removeAttribute
+    }
+
+    private static let _magic: [UInt8] = Array("XDF1".utf8)
+
+    /*!
+     @method serialized
+     @abstract The operations in a compact binary form: a four-byte signature, then per operation a tag byte followed by its path and strings, with integers as LEB128 varints and strings as a varint length and UTF-8 bytes.
+     */
+    public var serialized: Data {
+        var bytes = XMLDiff._magic
+        for operation in operations {
+            switch operation {
+            case let .insert(parent, index, xml):
+                bytes.append(_Tag.insert.rawValue)
+                XMLDiff._append(path: parent, to: &bytes)
+                XMLDiff._append(varint: UInt64(index), to: &bytes)
+                XMLDiff._append(string: xml, to: &bytes)
+
+            case let .delete(path):
+                bytes.append(_Tag.delete.rawValue)
+                XMLDiff._append(path: path, to: &bytes)
+
+            case let .setText(path, value):
+                bytes.append(_Tag.setText.rawValue)
+                XMLDiff._append(path: path, to: &bytes)
+                XMLDiff._append(string: value, to: &bytes)
+
+            case let .setAttribute(path, name, value):
+                bytes.append(_Tag.setAttribute.rawValue)
+                XMLDiff._append(path: path, to: &bytes)
+                XMLDiff._append(string: name, to: &bytes)
+                XMLDiff._append(string: value, to: &bytes)
+
+            case let .removeAttribute(path, name):
+                bytes.append(_Tag.removeAttribute.rawValue)
+                XMLDiff._append(path: path, to: &bytes)
+                XMLDiff._append(string: name, to: &bytes)
+            }
+        }
+        return Data(bytes)
+    }
+
+    /*!
+     @method initWithSerializedData:
+     @abstract Reads operations written by serialized.
+     */
+    public init(serialized data: Data) throws {
+        let bytes = [UInt8](data)
+        guard bytes.starts(with: XMLDiff._magic) else {
+            throw PatchError.malformedData
+        }
+
+        var cursor = XMLDiff._magic.count
+        var operations: [Operation] = []
+        while cursor < bytes.count {
+            guard let tag = _Tag(rawValue: bytes[cursor]) else {
+                throw PatchError.malformedData
+            }
+            cursor += 1
+
+            let path = try XMLDiff._readPath(bytes, &cursor)
+            switch tag {
+            case .insert:
+                let index = try XMLDiff._readVarint(bytes, &cursor)
+                guard index <= UInt64(Int.max) else { throw PatchError.malformedData }
+                operations.append(.insert(parent: path, index: Int(index), xml: try XMLDiff._readString(bytes, &cursor)))
+            case .delete:
+                operations.append(.delete(path: path))
+            case .setText:
+                operations.append(.setText(path: path, value: try XMLDiff._readString(bytes, &cursor)))
+            case .setAttribute:
+                let name = try XMLDiff._readString(bytes, &cursor)
+                operations.append(.setAttribute(path: path, name: name, value: try XMLDiff._readString(bytes, &cursor)))
+            case .removeAttribute:
+                operations.append(.removeAttribute(path: path, name: try XMLDiff._readString(bytes, &cursor)))
+            }
+        }
+        self.operations = operations
+    }
+
+    private static func _append(varint value: UInt64, to bytes: inout [UInt8]) {
+        var value = value
+        while value >= 0x80 {
+            bytes.append(UInt8(truncatingIfNeeded: value) | 0x80)
+            value >>= 7
+        }
+        bytes.append(UInt8(value))
+    }
+
+    private static func _append(path: [Int], to bytes: inout [UInt8]) {
+        _append(varint: UInt64(path.count), to: &bytes)
+        for index in path {
+            _append(varint: UInt64(index), to: &bytes)
+        }
+    }
+
+    private static func _append(string: String, to bytes: inout [UInt8]) {
+        _append(varint: UInt64(string.utf8.count), to: &bytes)
+        bytes.append(contentsOf: string.utf8)
+    }
+
+    private static func _readVarint(_ bytes: [UInt8], _ cursor: inout Int) throws -> UInt64 {
+        var value: UInt64 = 0
+        var shift: UInt64 = 0
+        while cursor < bytes.count && shift < 64 {
+            let byte = bytes[cursor]
+            cursor += 1
+            value |= UInt64(byte & 0x7f) << shift
+            if byte & 0x80 == 0 {
+                return value
+            }
+            shift += 7
+        }
+        throw PatchError.malformedData
+    }
+
+    private static func _readPath(_ bytes: [UInt8], _ cursor: inout Int) throws -> [Int] {
+        let count = try _readVarint(bytes, &cursor)
+        guard count <= UInt64(bytes.count - cursor) else { throw PatchError.malformedData }
+
+        return try (0..<Int(count)).map { _ in
+            let index = try _readVarint(bytes, &cursor)
+            guard index <= UInt64(Int.max) else { throw PatchError.malformedData }
+            return Int(index)
+        }
+    }
+
+    private static func _readString(_ bytes: [UInt8], _ cursor: inout Int) throws -> String {
+        let length = try _readVarint(bytes, &cursor)
+        guard length <= UInt64(bytes.count - cursor), let string = String(bytes: bytes[cursor..<(cursor + Int(length))], encoding: .utf8) else {
+            throw PatchError.malformedData
+        }
+        cursor += Int(length)
+        return string
+    }
+}
@@ -0,0 +1,145 @@
+//
+//  XMLDocument+Async.swift
+//  XML2Swift
+//
+//  Created by igork on 10/19/26.
+//
+
+import Foundation
+
+#if compiler(>=5.7)
+
+/// The queue parsing and serialization run on, so that neither blocks the calling task's executor.
+/// Each call blocks a thread for its whole duration, so no more run at once than there are cores;
+/// the rest wait in the queue instead of each taking a thread of its own.
+private let _XMLAsyncQueue: OperationQueue = {
+    let queue = OperationQueue()
+    queue.name = "XML2Swift.async"
+    queue.qualityOfService = .userInitiated
+    queue.maxConcurrentOperationCount = ProcessInfo.processInfo.activeProcessorCount
+    return queue
+}()
+
+/// Set from a task's cancellation handler and polled by the streams below between chunks.
+private final class _XMLCancellationFlag {
+    private let lock = NSLock()
+    private var cancelled = false
+
+    var isCancelled: Bool {
+        lock.lock()
+        defer { lock.unlock() }
+        return cancelled
+    }
+
+    func cancel() {
+        lock.lock()
+        cancelled = true
+        lock.unlock()
+    }
+}
+
+/// Hands data to the parser in the chunks it asks for. Once cancelled, the next read fails,
+/// which makes libxml2 halt the parser at the point it has reached.
+private final class _XMLCancellableInputStream: FailableInputStream {
+    private let data: Data
+    private let flag: _XMLCancellationFlag
+    private let progress: ((Int64) -> Void)?
+    private var offset = 0
+    private(set) var error: Error?
+
+    init(data: Data, flag: _XMLCancellationFlag, progress: ((Int64) -> Void)?) {
+        self.data = data
+        self.flag = flag
+        self.progress = progress
+    }
+
+    var hasBytesAvailable: Bool {
+        return offset < data.count
+    }
+
+    func read(_ buffer: UnsafeMutablePointer<UInt8>, maxLength len: Int) -> Int {
+        if flag.isCancelled {
+            error = CancellationError()
+        }
+        guard error == nil else {
+            return -1
+        }
+
+        let count = min(len, data.count - offset)
+        data.copyBytes(to: buffer, from: data.startIndex + offset..<data.startIndex + offset + count)
+        offset += count
+        progress?(Int64(offset))
+        return count
+    }
+}
+
+/// Collects the serialized bytes and throws from the next write once cancelled.
+private final class _XMLCancellableOutputStream: OutputStream {
+    private let flag: _XMLCancellationFlag
+    private let progress: ((Int64) -> Void)?
+    private(set) var data = Data()
+
+    init(flag: _XMLCancellationFlag, progress: ((Int64) -> Void)?) {
+        self.flag = flag
+        self.progress = progress
+    }
+
+    var hasSpaceAvailable: Bool {
+        return !flag.isCancelled
+    }
+
+    func write(_ buffer: UnsafePointer<UInt8>, maxLength len: Int) throws -> Int {
+        if flag.isCancelled {
+            throw CancellationError()
+        }
+        data.append(buffer, count: len)
+        progress?(Int64(data.count))
+        return len
+    }
+
+    func close() throws {
+    }
+}
+
+@available(iOS 13.0, macOS 10.15, tvOS 13.0, watchOS 6.0, *)
+private func _runOnXMLQueue<T>(_ work: @escaping (_XMLCancellationFlag) throws -> T) async throws -> T {
+    let flag = _XMLCancellationFlag()
+    return try await withTaskCancellationHandler(operation: {
+        try await withCheckedThrowingContinuation { (continuation: CheckedContinuation<T, Error>) in
+            _XMLAsyncQueue.addOperation {
+                continuation.resume(with: Result { try work(flag) })
+            }
+        }
+    }, onCancel: {
+        flag.cancel()
+    })
+}
+
+@available(iOS 13.0, macOS 10.15, tvOS 13.0, watchOS 6.0, *)
+extension XMLDocument {
+    /*!
+     @method parseData:options:progress:
+     @abstract Parses data on a background queue without blocking the calling task.
+     @discussion progress is called on that queue with the number of bytes handed to the parser so far. Cancelling the task stops the parser at the next chunk it reads and throws CancellationError; the partial tree is freed.
+     */
+    public static func parse(data: Data, options mask: XMLNode.Options = [], progress: ((Int64) -> Void)? = nil) async throws -> XMLDocument {
+        return try await _runOnXMLQueue { flag in
+            try XMLDocument(stream: _XMLCancellableInputStream(data: data, flag: flag, progress: progress), options: mask)
+        }
+    }
+
+    /*!
+     @method serializedWithOptions:progress:
+     @abstract Serializes the document like xmlData(options:), on a background queue without blocking the calling task.
+     @discussion progress is called on that queue with the number of bytes written so far. Cancelling the task stops at the next buffer libxml2 flushes and throws CancellationError. The document must not be mutated until the call returns.
+     */
+    public func serialized(options: XMLNode.Options = [], progress: ((Int64) -> Void)? = nil) async throws -> Data {
+        return try await _runOnXMLQueue { flag in
+            let stream = _XMLCancellableOutputStream(flag: flag, progress: progress)
+            try self.write(to: stream, options: options)
+            return stream.data
+        }
+    }
+}
+
+#endif
@@ -59,11 +59,27 @@ open class XMLDocument : XMLNode {
         return _XMLDocPtr(_xmlNode)
     }
 
+    private struct _KeyIndexName: Hashable {
+        let element: String
+        let attribute: String
+    }
+
+    private struct _KeyIndex {
+        var elements: [String: [_XMLNodePtr]] = [:]
+        var values: [_XMLNodePtr: String] = [:]
+        // Values whose elements were appended out of document order since the last lookup.
+        var unordered: Set<String> = []
+    }
+
+    private var _keyIndexes: [_KeyIndexName: _KeyIndex] = [:]
+    private var _keyIndexesAreStale = false
+
     public init?(withRead ioread: @escaping xmlInputReadCallback,
                  close ioclose: @escaping xmlInputCloseCallback,
                  context: UnsafeMutableRawPointer, options mask: Int) {
+        _SetupXMLParser()
         xmlKeepBlanksDefault(0)
-        guard let doc = xmlReadIO(ioread, ioclose, context, nil, nil, Int32(mask)) else {
+        guard let doc = _XMLDocPtrFromReadIO(ioread, ioclose, context, Int32(mask)) else {
             return nil
         }
         super.init(withPrimitive: doc)
@@ -101,17 +117,151 @@ open class XMLDocument : XMLNode {
     /*!
      @method initWithData:options:error:
      @abstract Returns a document created from data. Parse errors are returned in <tt>error</tt>.
+     @discussion With XMLNode.Options.documentTidyHTML the data is parsed as HTML, see init(html:options:).
      */
     public init(data: Data, options mask: XMLNode.Options = []) throws {
         _SetupXMLParser()
-        let docPtr: _XMLDocPtr = _XMLDocPtrFromDataWithOptions(unsafeBitCast(data as NSData, to: CFData.self), UInt32(mask.rawValue))
-        super.init(ptr: _XMLNodePtr(docPtr))
+        var error = _XMLError()
+        let docPtr = data.withUnsafeBytes { (bytes: UnsafeRawBufferPointer) in
+            _XMLDocPtrFromBytesWithOptions(bytes.baseAddress?.assumingMemoryBound(to: UInt8.self), bytes.count, UInt32(mask.rawValue), &error)
+        }
+        guard let doc = docPtr else {
+            throw _parserError(error)
+        }
+        super.init(ptr: _XMLNodePtr(doc))
+
+        if mask.contains(.documentValidate) {
+            try validate()
+        }
+    }
+
+    /*!
+     @method initWithHTMLData:options:error:
+     @abstract Returns a document created from HTML data with libxml2's HTML parser, which accepts unclosed and misnested tags and void elements such as <br> the way browsers do.
+     @discussion The document's content kind is XMLDocument.ContentKind.html, so it serializes as HTML: void elements are written without a close tag. The encoding is taken from a byte order mark or a meta charset; without either, input is read as UTF-8 and as ISO-8859-1 from the first byte that is not valid UTF-8, and characterEncoding is "UTF-8". Parser contexts are reused per thread. To parse from a stream, pass XMLNode.Options.documentTidyHTML to init(stream:options:).
+     */
+    public convenience init(html data: Data, options mask: XMLNode.Options = []) throws {
+        try self.init(data: data, options: mask.union(.documentTidyHTML))
+    }
+
+    /*!
+     @method initWithData:options:projection:error:
+     @abstract Returns a document created from data that keeps only the elements matching one of the <tt>projection</tt> patterns, their subtrees and their ancestors.
+     @discussion Patterns use the streamable XPath subset understood by libxml2, e.g. "/KeePassFile/Root/Group/Entry/String", "//Times" or "Name". Every other subtree is released as soon as the parser has moved past it, so peak memory stays proportional to the projected result. Unlike <tt>init(data:options:)</tt> the parser does not recover from errors: skipped content is still checked for well-formedness and malformed input throws. XMLNode.Options.documentTidyHTML is not supported and throws.
+     */
+    public init(data: Data, options mask: XMLNode.Options = [], projection patterns: [String]) throws {
+        _SetupXMLParser()
+        var error = _XMLError()
+        let docPtr = _withCStringArray(patterns) { (cPatterns, count) in
+            data.withUnsafeBytes { (bytes: UnsafeRawBufferPointer) in
+                _XMLDocPtrFromBytesWithProjection(bytes.baseAddress?.assumingMemoryBound(to: UInt8.self), bytes.count, UInt32(mask.rawValue), cPatterns, count, &error)
+            }
+        }
+        guard let doc = docPtr else {
+            throw _parserError(error)
+        }
+        super.init(ptr: _XMLNodePtr(doc))
 
         if mask.contains(.documentValidate) {
             try validate()
         }
     }
 
+    /*!
+     @struct ParseLimits
+     @abstract Upper bounds for a single parse. <tt>nil</tt> leaves a dimension unlimited.
+     @discussion <tt>maxBytes</tt> caps the heap memory libxml2 allocates while parsing, including its working buffers. <tt>maxNodes</tt> counts elements, attributes, text, comments and processing instructions. <tt>maxDepth</tt> is the element nesting depth; it applies on top of libxml2's own limit of 256 levels, which only <tt>XML_PARSE_HUGE</tt> lifts.
+     */
+    public struct ParseLimits {
+        public var maxBytes: Int?
+        public var maxNodes: Int?
+        public var maxDepth: Int?
+
+        public init(maxBytes: Int? = nil, maxNodes: Int? = nil, maxDepth: Int? = nil) {
+            self.maxBytes = maxBytes
+            self.maxNodes = maxNodes
+            self.maxDepth = maxDepth
+        }
+    }
+
+    /*!
+     @method initWithData:options:limits:error:
+     @abstract Returns a document created from data, or throws as soon as the parse exceeds one of the <tt>limits</tt>. Nothing parsed up to that point is kept.
+     @discussion Only XML is supported: with XMLNode.Options.documentTidyHTML this throws.
+     */
+    public init(data: Data, options mask: XMLNode.Options = [], limits: ParseLimits) throws {
+        _SetupXMLParser()
+        var error = _XMLError()
+        let docPtr = data.withUnsafeBytes { (bytes: UnsafeRawBufferPointer) in
+            _XMLDocPtrFromBytesWithLimits(bytes.baseAddress?.assumingMemoryBound(to: UInt8.self), bytes.count, UInt32(mask.rawValue),
+                                          limits.maxBytes ?? 0, limits.maxNodes ?? 0, limits.maxDepth ?? 0,
+                                          &error)
+        }
+        guard let doc = docPtr else {
+            throw _parserError(error)
+        }
+        super.init(ptr: _XMLNodePtr(doc))
+
+        if mask.contains(.documentValidate) {
+            try validate()
+        }
+    }
+
+    /*!
+     @method initWithStream:options:error:
+     @abstract Returns a document parsed while it is being read from <tt>stream</tt>, for instance the end of a chain such as CipherInputStream, HashedBlockInputStream and InflateInputStream. No copy of the whole input is made.
+     @discussion If a FailableInputStream in the chain fails, the document is discarded and the stream's error is thrown instead of the parse error it causes. With XMLNode.Options.documentTidyHTML the stream is parsed as HTML.
+     */
+    public init(stream: InputStream, options mask: XMLNode.Options = []) throws {
+        _SetupXMLParser()
+        let context = _XMLInputStreamContext(stream: stream)
+        var error = _XMLError()
+        let docPtr = context.withOpaquePointer {
+            return _XMLDocPtrFromIOWithOptions(_XMLInputStreamRead, _XMLInputStreamClose, $0, UInt32(mask.rawValue), &error)
+        }
+
+        // The parser recovers from a truncated input, so a failed stream may still produce a document.
+        if let streamError = (stream as? FailableInputStream)?.error {
+            if let doc = docPtr {
+                _XMLFreeDocument(doc)
+            }
+            throw streamError
+        }
+        guard let doc = docPtr else {
+            throw _parserError(error)
+        }
+        super.init(ptr: _XMLNodePtr(doc))
+
+        if mask.contains(.documentValidate) {
+            try validate()
+        }
+    }
+
+    /*!
+     @method initWithSnapshot:error:
+     @abstract Returns a document restored from data written by writeSnapshot(to:). Nothing is parsed: each name is interned once from the snapshot's table and nodes are created straight from their records.
+     @discussion Every index and offset is checked while reading, so truncated or corrupt data throws instead of producing a broken tree.
+     */
+    public init(snapshot: Data) throws {
+        _SetupXMLParser()
+        var error = _XMLError()
+        let docPtr = snapshot.withUnsafeBytes { (bytes: UnsafeRawBufferPointer) -> _XMLDocPtr? in
+            return _XMLDocCreateFromSnapshot(bytes.baseAddress?.assumingMemoryBound(to: UInt8.self), bytes.count, &error)
+        }
+        guard let doc = docPtr else {
+            throw _parserError(error)
+        }
+        super.init(ptr: _XMLNodePtr(doc))
+    }
+
+    /*!
+     @method initWithSnapshotContentsOfURL:error:
+     @abstract Restores a snapshot file, which is mapped into memory rather than read.
+     */
+    public convenience init(snapshotContentsOf url: URL) throws {
+        try self.init(snapshot: Data(contentsOf: url, options: .alwaysMapped))
+    }
+
     /*!
      @method initWithRootElement:
      @abstract Returns a document with a single child, the root element.
@@ -133,10 +283,10 @@ open class XMLDocument : XMLNode {
      */
     open var characterEncoding: String? {
         get {
-            let returned = _XMLDocCopyCharacterEncoding(_xmlDoc)
-            return returned == nil ? nil : unsafeBitCast(returned!, to: NSString.self) as String
+            return _string(from: _XMLDocGetCharacterEncodingSpan(_xmlDoc))
         }
         set {
+            _willMutate()
             if let value = newValue {
                 _XMLDocSetCharacterEncoding(_xmlDoc, value)
             } else {
@@ -151,10 +301,10 @@ open class XMLDocument : XMLNode {
      */
     open var version: String? {
         get {
-            let returned = _XMLDocCopyVersion(_xmlDoc)
-            return returned == nil ? nil : unsafeBitCast(returned!, to: NSString.self) as String
+            return _string(from: _XMLDocGetVersionSpan(_xmlDoc))
         }
         set {
+            _willMutate()
             if let value = newValue {
                 precondition(value == "1.0" || value == "1.1")
                 _XMLDocSetVersion(_xmlDoc, value)
@@ -173,6 +323,7 @@ open class XMLDocument : XMLNode {
             return _XMLDocStandalone(_xmlDoc)
         }
         set {
+            _willMutate()
             _XMLDocSetStandalone(_xmlDoc, newValue)
         }
     }//primitive
@@ -193,6 +344,7 @@ open class XMLDocument : XMLNode {
         }
 
         set {
+            _willMutate()
             var properties = _XMLDocProperties(_xmlDoc)
             switch newValue {
             case .html:
@@ -215,12 +367,14 @@ open class XMLDocument : XMLNode {
     /*!
      @method DTD
      @abstract Set the associated DTD. This DTD will be output with the document.
+     @discussion A DTD that is not attached to another document is adopted as is; only an attached one is copied.
      */
     /*@NSCopying*/ open var dtd: XMLDTD? {
         get {
             return XMLDTD._objectNodeForNode(_XMLDocDTD(_xmlDoc)!)
         }
         set {
+            _willMutate()
             if let currDTD = _XMLDocDTD(_xmlDoc) {
                 if _XMLNodeGetPrivateData(currDTD) != nil {
                     let DTD = XMLDTD._objectNodeForNode(currDTD)
@@ -232,7 +386,8 @@ open class XMLDocument : XMLNode {
             }
 
             if let value = newValue {
-                guard let dtd = value.copy() as? XMLDTD else {
+                let isAttached = _XMLNodeGetParent(value._xmlNode) != nil || _XMLNodeGetDocument(value._xmlNode) != nil
+                guard let dtd = isAttached ? value.copy() as? XMLDTD : value else {
                     fatalError("Failed to copy DTD")
                 }
                 _XMLDocSetDTD(_xmlDoc, dtd._xmlDTD)
@@ -248,13 +403,16 @@ open class XMLDocument : XMLNode {
      @abstract Set the root element. Removes all other children including comments and processing-instructions.
      */
     open func setRootElement(_ root: XMLElement) {
+        _willMutate()
         precondition(root.parent == nil)
 
         for child in _childNodes {
             child.detach()
         }
 
-        _XMLDocSetRootElement(_xmlDoc, root._xmlNode)
+        _updatingKeyIndexes(of: root._xmlNode) {
+            _XMLDocSetRootElement(_xmlDoc, root._xmlNode)
+        }
         _childNodes.insert(root)
     }
 
@@ -270,6 +428,111 @@ open class XMLDocument : XMLNode {
         return XMLNode._objectNodeForNode(rootPtr) as? XMLElement
     }
 
+    /*!
+     @method elementForID:
+     @abstract Returns the element carrying the given ID, either in an xml:id attribute or in an attribute declared with type ID by the DTD. This is a lookup in libxml2's ID table, not a search of the tree.
+     */
+    open func element(forID ID: String) -> XMLElement? {
+        guard let elementPtr = _XMLDocGetElementForID(_xmlDoc, ID) else {
+            return nil
+        }
+
+        return XMLNode._objectNodeForNode(elementPtr) as? XMLElement
+    }
+
+    /*!
+     @method addKeyIndexForAttribute:ofElementsNamed:
+     @abstract Indexes the elements named elementName by the value of their attributeName attribute, so that elementsWithAttribute:value:ofElementsNamed: becomes a hash lookup.
+     @discussion The index is built right away and kept current by the mutating APIs, which only revisit the elements they add, remove or edit. Only attributes without a namespace count, and defaults declared by the DTD are not indexed. Add indexes before sharing a frozen document between threads.
+     */
+    open func addKeyIndex(forAttribute attributeName: String, ofElementsNamed elementName: String) {
+        let name = _KeyIndexName(element: elementName, attribute: attributeName)
+        _keyIndexes[name] = _collectKeys(name)
+    }
+
+    /*!
+     @method elementsWithAttribute:value:ofElementsNamed:
+     @abstract The elements named elementName whose attributeName attribute has the given value, in document order. Without a matching key index the tree is searched.
+     */
+    open func elements(withAttribute attributeName: String, value: String, ofElementsNamed elementName: String) -> [XMLElement] {
+        let name = _KeyIndexName(element: elementName, attribute: attributeName)
+        if _keyIndexesAreStale {
+            for indexName in _keyIndexes.keys {
+                _keyIndexes[indexName] = _collectKeys(indexName)
+            }
+            _keyIndexesAreStale = false
+        }
+
+        guard var index = _keyIndexes.removeValue(forKey: name) else {
+            return (_collectKeys(name).elements[value] ?? []).compactMap { XMLNode._objectNodeForNode($0) as? XMLElement }
+        }
+
+        if index.unordered.remove(value) != nil {
+            index.elements[value]?.sort { _XMLNodeCompareDocumentOrder($0, $1) > 0 }
+        }
+        _keyIndexes[name] = index
+        return (index.elements[value] ?? []).compactMap { XMLNode._objectNodeForNode($0) as? XMLElement }
+    }
+
+    /// Rebuilds every key index on the next lookup, for changes made below the Swift API such as applying a diff.
+    internal func _invalidateKeyIndexes() {
+        _keyIndexesAreStale = !_keyIndexes.isEmpty
+    }
+
+    /// Drops the entries of node, and of its descendants when asked, from the key indexes of its document.
+    internal static func _removeKeys(of node: _XMLNodePtr, descendants: Bool) {
+        _updateKeyIndexes(of: node, descendants: descendants) { context, element, _ in
+            let index = context!.assumingMemoryBound(to: _KeyIndex.self)
+            guard let value = index.pointee.values.removeValue(forKey: element!) else { return }
+            index.pointee.elements[value]?.removeAll { $0 == element! }
+            if index.pointee.elements[value]?.isEmpty == true {
+                index.pointee.elements[value] = nil
+            }
+        }
+    }
+
+    /// Adds the entries of node, and of its descendants when asked, to the key indexes of its document.
+    internal static func _addKeys(of node: _XMLNodePtr, descendants: Bool) {
+        _updateKeyIndexes(of: node, descendants: descendants) { context, element, value in
+            let index = context!.assumingMemoryBound(to: _KeyIndex.self)
+            let value = String(cString: value!)
+            index.pointee.values[element!] = value
+            index.pointee.elements[value, default: []].append(element!)
+            index.pointee.unordered.insert(value)
+        }
+    }
+
+    private static func _updateKeyIndexes(of node: _XMLNodePtr, descendants: Bool, _ callback: _XMLKeyCallback) {
+        guard let documentPtr = _XMLNodeGetDocument(node), let documentData = _XMLNodeGetPrivateData(documentPtr) else { return }
+        let document = unsafeBitCast(documentData, to: XMLDocument.self)
+        guard !document._keyIndexes.isEmpty, !document._keyIndexesAreStale else { return }
+
+        // Detached subtrees keep their document pointer but are not indexed.
+        var top = node
+        while let parent = _XMLNodeGetParent(top) {
+            top = parent
+        }
+        guard top == document._xmlNode else { return }
+
+        for name in Array(document._keyIndexes.keys) {
+            // Taken out of the dictionary so the callback mutates the only copy.
+            var index = document._keyIndexes.removeValue(forKey: name)!
+            _XMLNodeCollectKeys(node, descendants, name.element, name.attribute, callback, &index)
+            document._keyIndexes[name] = index
+        }
+    }
+
+    private func _collectKeys(_ name: _KeyIndexName) -> _KeyIndex {
+        var index = _KeyIndex()
+        _XMLNodeCollectKeys(_xmlNode, true, name.element, name.attribute, { context, element, value in
+            let index = context!.assumingMemoryBound(to: _KeyIndex.self)
+            let value = String(cString: value!)
+            index.pointee.values[element!] = value
+            index.pointee.elements[value, default: []].append(element!)
+        }, &index)
+        return index
+    }
+
     open override var childCount: Int {
         return _XMLNodeGetElementChildCount(_xmlNode)
     }
@@ -339,6 +602,50 @@ open class XMLDocument : XMLNode {
         return string.data(using: .utf8) ?? Data()
     }
 
+    /*!
+     @method memoryFootprint
+     @abstract The heap memory, in bytes, currently held by the document's libxml2 tree: nodes, attributes, namespaces, text and its name dictionary. XMLNode wrappers are not included.
+     @discussion Computed by walking the tree, so the cost is linear in the number of nodes.
+     */
+    open var memoryFootprint: Int {
+        return Int(_XMLDocGetMemoryFootprint(_xmlDoc))
+    }
+
+    /*!
+     @method freeze
+     @abstract Returns an immutable deep copy of the document that any number of threads can query at the same time without locking.
+     @discussion Reads of a frozen document change no shared state: wrappers are published with a compare-and-swap instead of being registered with their parent, and elements are numbered in document order up front so XPath can sort results without writing to the tree. Mutating a node of the copy traps. Freezing a document that is already frozen returns the receiver.
+     */
+    open func freeze() -> XMLDocument {
+        if isFrozen {
+            return self
+        }
+
+        let copy = _XMLDocPtr(_XMLCopyNode(_xmlNode, true))
+        _XMLDocFreeze(copy)
+        return XMLDocument._objectNodeForNode(_XMLNodePtr(copy))
+    }
+
+    /*!
+     @method writeSnapshotToStream:error:
+     @abstract Writes the document in the binary snapshot format read by initWithSnapshot:error:.
+     @discussion A snapshot holds a table of interned names and one fixed-size record per node in document order, linked to its first child and next sibling by record index, followed by the text it refers to. Documents with a DTD cannot be snapshotted.
+     */
+    open func writeSnapshot(to stream: OutputStream) throws {
+        let context = _XMLOutputStreamContext(stream: stream)
+        var error = _XMLError()
+        let written = context.withOpaquePointer {
+            return _XMLDocWriteSnapshot(_xmlDoc, _XMLOutputStreamWrite, $0, &error)
+        }
+
+        if let streamError = context.error {
+            throw streamError
+        }
+        if !written {
+            throw _parserError(error)
+        }
+    }
+
     /*!
      @method objectByApplyingXSLT:arguments:error:
      @abstract Applies XSLT with arguments (NSString key/value pairs) to this document, returning a new document.
@@ -367,15 +674,20 @@ open class XMLDocument : XMLNode {
     }
 
     open func validate() throws {
-        var unmanagedError: Unmanaged<CFError>? = nil
-        let result = _XMLDocValidate(_xmlDoc, &unmanagedError)
-        if !result,
-            let unmanagedError = unmanagedError {
-            let error = unmanagedError.takeRetainedValue()
-            throw error
+        var error = _XMLError()
+        if !_XMLDocValidate(_xmlDoc, &error) {
+            throw _parserError(error)
         }
     }
 
+    /*!
+     @method validateAgainstSchema:error:
+     @abstract Validates this document against a compiled W3C XML Schema or RELAX NG schema.
+     */
+    open func validate(against schema: XMLSchema) throws {
+        try schema.validate(self)
+    }
+
     internal override class func _objectNodeForNode(_ node: _XMLNodePtr) -> XMLDocument {
         precondition(_XMLNodeGetType(node) == _kXMLTypeDocument)
 
@@ -383,7 +695,7 @@ open class XMLDocument : XMLNode {
             return unsafeBitCast(privateData, to: XMLDocument.self)
         }
 
-        return XMLDocument(ptr: node)
+        return _publish(XMLDocument(ptr: node))
     }
 
     internal override init(ptr: _XMLNodePtr) {
@@ -6,7 +6,11 @@
 //
 
 import Foundation
+#if canImport(libxml2)
 import libxml2
+#else
+import CLibXML2
+#endif
 
 public class XMLElement: XMLNode {
     public convenience init?(withName name: String) {
@@ -112,12 +116,11 @@ public class XMLElement: XMLNode {
      @abstract Adds an attribute. Attributes with duplicate names replace the old one.
      */
     open func addAttribute(_ attribute: XMLNode) {
-        guard let cfname = _XMLNodeCopyName(attribute._xmlNode) else {
+        _willMutate()
+        guard let name = _qualifiedName(of: attribute._xmlNode) else {
             fatalError("Attributes must have a name!")
         }
 
-        let name = unsafeBitCast(cfname, to: NSString.self) as String
-
         removeAttribute(forName: name)
         _XMLCompletePropURI(attribute._xmlNode, _xmlNode);
         addChild(attribute)
@@ -128,11 +131,14 @@ public class XMLElement: XMLNode {
      @abstract Removes an attribute based on its name.
      */
     open func removeAttribute(forName name: String) {
+        _willMutate()
         if let prop = _XMLNodeHasProp(_xmlNode, name, nil) {
             let propNode = XMLNode._objectNodeForNode(_XMLNodePtr(prop))
             _childNodes.remove(propNode)
             // We can't use `xmlRemoveProp` because someone else may still have a reference to this attribute
-            _XMLUnlinkNode(_XMLNodePtr(prop))
+            _updatingKeyIndexes(of: _XMLNodePtr(prop)) {
+                _XMLUnlinkNode(_XMLNodePtr(prop))
+            }
         }
     }
 
@@ -152,6 +158,7 @@ public class XMLElement: XMLNode {
         }
 
         set {
+            _willMutate()
             removeAttributes()
 
             guard let attributes = newValue else {
@@ -165,22 +172,24 @@ public class XMLElement: XMLNode {
     }
 
     private func removeAttributes() {
-        var nextAttribute = _XMLNodeProperties(_xmlNode)
-        while let attribute = nextAttribute {
-            var shouldFreeNode = true
-            if let privateData = _XMLNodeGetPrivateData(attribute) {
-                _childNodes.remove(unsafeBitCast(privateData, to: XMLNode.self))
+        _updatingKeyIndexes(of: _xmlNode, descendants: false) {
+            var nextAttribute = _XMLNodeProperties(_xmlNode)
+            while let attribute = nextAttribute {
+                var shouldFreeNode = true
+                if let privateData = _XMLNodeGetPrivateData(attribute) {
+                    _childNodes.remove(unsafeBitCast(privateData, to: XMLNode.self))
 
-                shouldFreeNode = false
-            }
+                    shouldFreeNode = false
+                }
 
-            let temp = _XMLNodeGetNextSibling(attribute)
-            _XMLUnlinkNode(attribute)
-            if shouldFreeNode {
-                _XMLFreeNode(attribute)
-            }
+                let temp = _XMLNodeGetNextSibling(attribute)
+                _XMLUnlinkNode(attribute)
+                if shouldFreeNode {
+                    _XMLFreeNode(attribute)
+                }
 
-            nextAttribute = temp
+                nextAttribute = temp
+            }
         }
     }
 
@@ -189,6 +198,7 @@ public class XMLElement: XMLNode {
      @abstract Set the attributes based on a name-value dictionary.
      */
     open func setAttributesWith(_ attributes: [String : String]) {
+        _willMutate()
         removeAttributes()
         for (name, value) in attributes {
             addAttribute(XMLNode.attribute(withName: name, stringValue: value) as! XMLNode)
@@ -218,6 +228,7 @@ public class XMLElement: XMLNode {
      @abstract Adds a namespace. Namespaces with duplicate names are not added.
      */
     open func addNamespace(_ aNamespace: XMLNode) {
+        _willMutate()
         if ((namespaces ?? []).compactMap({ $0.name }).contains(aNamespace.name ?? "")) {
             return
         }
@@ -229,6 +240,7 @@ public class XMLElement: XMLNode {
      @abstract Removes a namespace with a particular name.
      */
     open func removeNamespace(forPrefix name: String) {
+        _willMutate()
         _XMLRemoveNamespace(_xmlNode, name)
     }
 
@@ -251,6 +263,7 @@ public class XMLElement: XMLNode {
         }
 
         set {
+            _willMutate()
             if var nodes = newValue?.map({ $0._xmlNode }) {
                 nodes.withUnsafeMutableBufferPointer { bufPtr in
                     let address = bufPtr.baseAddress
@@ -376,43 +389,15 @@ public class XMLElement: XMLNode {
      @abstract Adjacent text nodes are coalesced. If the node's value is the empty string, it is removed. This should be called with a value of NO before using XQuery or XPath.
      */
     open func normalizeAdjacentTextNodesPreservingCDATA(_ preserve: Bool) {
-        // Replicate Darwin behavior: no change occurs at all in this case.
-        guard childCount != 1 else { return }
-
-        var text = ""
-        var index = 0
-        let count = childCount
-        var children: [XMLNode] = []
-
-        while index < count {
-            let child = self.children![index]
-            let isText = child.kind == .text
-            let isCDataToPreserve = preserve ? (isText && child.isCData) : false
-
-            if isText && !isCDataToPreserve {
-                if let stringValue = child.stringValue {
-                    text.append(contentsOf: stringValue)
-                }
-            } else {
-                if !text.isEmpty {
-                    let mergedText = XMLNode.text(withStringValue: text) as! XMLNode
-                    children.append(mergedText)
-                    text = ""
-                }
-                if child.kind == .element, let child = child as? XMLElement {
-                    child.normalizeAdjacentTextNodesPreservingCDATA(preserve)
-                }
-                children.append(child)
-            }
-
-            index += 1
-        }
-
-        if !text.isEmpty {
-            children.append(XMLNode.text(withStringValue: text) as! XMLNode)
+        _willMutate()
+        // Merges text in place in a single pass over the subtree; only nodes that change are touched.
+        _XMLNodeNormalizeAdjacentTextNodes(_xmlNode, preserve) { parentPtr, nodePtr in
+            // Wrapped nodes are only unlinked, their wrapper frees them once the former parent drops it.
+            guard let parentData = _XMLNodeGetPrivateData(parentPtr), let nodeData = _XMLNodeGetPrivateData(nodePtr) else { return }
+
+            let parent = unsafeBitCast(parentData, to: XMLNode.self)
+            parent._childNodes.remove(unsafeBitCast(nodeData, to: XMLNode.self))
         }
-
-        self.setChildren(children)
     }
 
     internal override class func _objectNodeForNode(_ node: _XMLNodePtr) -> XMLElement {
@@ -422,7 +407,7 @@ public class XMLElement: XMLNode {
             return unsafeBitCast(privateData, to: XMLElement.self)
         }
 
-        return XMLElement(ptr: node)
+        return _publish(XMLElement(ptr: node))
     }
 
     internal override init(ptr: _XMLNodePtr) {
@@ -0,0 +1,296 @@
+//
+//  XMLElementIndex.swift
+//  XML2Swift
+//
+//  Created by igork on 10/19/26.
+//
+
+import Foundation
+
+/*!
+ @class XMLElementIndex
+ @abstract A sidecar index of a large XML file that maps a key of selected elements to their byte ranges, so single elements can be parsed without reading the whole file.
+ @discussion build(for:keys:to:) streams through the file once with SAX callbacks, keeping only the currently open elements in memory, and writes the index sorted by key. Opening an index maps both files; a lookup is a binary search over the mapped index and elements(for:value:) parses only the matching ranges of the mapped source. A range spans the element from its start tag to its end tag, so namespaces declared on its ancestors are not seen when it is parsed. The source must be UTF-8 and must not change after indexing: its size and modification date are recorded and checked when the index is opened.
+ */
+public final class XMLElementIndex {
+    /*!
+     @struct Key
+     @abstract Selects the indexed elements and the value they are looked up by.
+     @discussion path is either absolute, e.g. "/KeePassFile/Root/Group", or starts with "//" to match the trailing steps anywhere, e.g. "//Group/Entry". Steps compare local names. name is "@attribute" to use an attribute of the element, or the name of a child element whose text is the value, e.g. "UUID".
+     */
+    public struct Key: Hashable {
+        public let path: String
+        public let name: String
+
+        public init(path: String, name: String) {
+            self.path = path
+            self.name = name
+        }
+    }
+
+    public enum IndexError: Error {
+        /// The index file is truncated or was not written by build(for:keys:to:).
+        case malformedIndex
+        /// The source file changed since it was indexed.
+        case staleIndex
+        /// An indexed range of the source does not hold a well-formed element.
+        case invalidFragment(Range<Int>)
+    }
+
+    private static let magic: [UInt8] = Array("XIDX".utf8)
+    private static let version: UInt32 = 1
+    private static let headerSize = 40
+    private static let keySize = 24
+    private static let entrySize = 32
+
+    private let _index: Data
+    private let _source: Data
+    private let _keys: [Key: UInt32]
+    private let _entryCount: Int
+    private let _entriesOffset: Int
+    private let _poolOffset: Int
+
+    /*!
+     @method initWithContentsOfURL:source:error:
+     @abstract Opens an index written by build(for:keys:to:) for source. Throws IndexError.staleIndex if source was modified since.
+     */
+    public init(contentsOf indexURL: URL, source: URL) throws {
+        let index = try Data(contentsOf: indexURL, options: .alwaysMapped)
+        guard index.count >= XMLElementIndex.headerSize, Array(index.prefix(4)) == XMLElementIndex.magic,
+            index._littleEndian(UInt32.self, at: 4) == XMLElementIndex.version else {
+            throw IndexError.malformedIndex
+        }
+
+        // Every count and offset comes from the file, so all arithmetic on them is checked.
+        guard let keyCount = Int(exactly: index._littleEndian(UInt32.self, at: 24)),
+            let entryCount = Int(exactly: index._littleEndian(UInt32.self, at: 28)),
+            let poolLength = Int(exactly: index._littleEndian(UInt64.self, at: 32)),
+            let entriesOffset = XMLElementIndex._offset(XMLElementIndex.headerSize, keyCount, XMLElementIndex.keySize),
+            let poolOffset = XMLElementIndex._offset(entriesOffset, entryCount, XMLElementIndex.entrySize),
+            XMLElementIndex._offset(poolOffset, poolLength, 1) == index.count else {
+            throw IndexError.malformedIndex
+        }
+
+        let (size, modified) = try XMLElementIndex._fingerprint(of: source)
+        guard index._littleEndian(UInt64.self, at: 8) == size, index._littleEndian(UInt64.self, at: 16) == modified else {
+            throw IndexError.staleIndex
+        }
+
+        func poolString(_ offset: UInt64, _ length: UInt32) throws -> String {
+            let (end, overflow) = offset.addingReportingOverflow(UInt64(length))
+            guard !overflow, end <= UInt64(poolLength) else {
+                throw IndexError.malformedIndex
+            }
+            let start = poolOffset + Int(offset)
+            return String(decoding: index[start..<start + Int(length)], as: UTF8.self)
+        }
+
+        // Lookups read entries without further checks, so each one is validated once here.
+        for i in 0..<entryCount {
+            let record = entriesOffset + i * XMLElementIndex.entrySize
+            let (valueEnd, overflow) = index._littleEndian(UInt64.self, at: record + 8)
+                .addingReportingOverflow(UInt64(index._littleEndian(UInt32.self, at: record + 4)))
+            let start = index._littleEndian(UInt64.self, at: record + 16)
+            let end = index._littleEndian(UInt64.self, at: record + 24)
+            guard !overflow, valueEnd <= UInt64(poolLength), start <= end, end <= size else {
+                throw IndexError.malformedIndex
+            }
+        }
+
+        var keys: [Key: UInt32] = [:]
+        for i in 0..<keyCount {
+            let record = XMLElementIndex.headerSize + i * XMLElementIndex.keySize
+            let path = try poolString(index._littleEndian(UInt64.self, at: record), index._littleEndian(UInt32.self, at: record + 8))
+            let name = try poolString(index._littleEndian(UInt64.self, at: record + 16), index._littleEndian(UInt32.self, at: record + 12))
+            keys[Key(path: path, name: name)] = UInt32(i)
+        }
+
+        _index = index
+        _source = try Data(contentsOf: source, options: .alwaysMapped)
+        _keys = keys
+        _entryCount = entryCount
+        _entriesOffset = entriesOffset
+        _poolOffset = poolOffset
+    }
+
+    /*!
+     @method rangesForKey:value:
+     @abstract The byte ranges of the source holding the elements indexed under key with the given value, in document order.
+     */
+    public func ranges(for key: Key, value: String) -> [Range<Int>] {
+        guard let keyIndex = _keys[key] else {
+            return []
+        }
+
+        let needle = Array(value.utf8)
+        var result: [Range<Int>] = []
+        var i = _lowerBound(key: keyIndex, value: needle)
+        while i < _entryCount && _compare(entry: i, key: keyIndex, value: needle) == 0 {
+            let record = _entriesOffset + i * XMLElementIndex.entrySize
+            let start = Int(_index._littleEndian(UInt64.self, at: record + 16))
+            let end = Int(_index._littleEndian(UInt64.self, at: record + 24))
+            result.append(start..<end)
+            i += 1
+        }
+        return result.sorted { $0.lowerBound < $1.lowerBound }
+    }
+
+    /*!
+     @method elementsForKey:value:error:
+     @abstract Parses the elements indexed under key with the given value. Each element is the root of its own document.
+     */
+    public func elements(for key: Key, value: String, options mask: XMLNode.Options = []) throws -> [XMLElement] {
+        return try ranges(for: key, value: value).map { range in
+            let document = try _source.withUnsafeBytes { (bytes: UnsafeRawBufferPointer) -> XMLDocument in
+                let fragment = Data(bytesNoCopy: UnsafeMutableRawPointer(mutating: bytes.baseAddress! + range.lowerBound),
+                                    count: range.count, deallocator: .none)
+                return try XMLDocument(data: fragment, options: mask)
+            }
+            guard let element = document.rootElement() else {
+                throw IndexError.invalidFragment(range)
+            }
+            return element
+        }
+    }
+
+    private func _compare(entry i: Int, key: UInt32, value: [UInt8]) -> Int {
+        let record = _entriesOffset + i * XMLElementIndex.entrySize
+        let entryKey = _index._littleEndian(UInt32.self, at: record)
+        if entryKey != key {
+            return entryKey < key ? -1 : 1
+        }
+
+        let length = Int(_index._littleEndian(UInt32.self, at: record + 4))
+        let offset = _poolOffset + Int(_index._littleEndian(UInt64.self, at: record + 8))
+        guard offset + length <= _index.count else {
+            return 1
+        }
+        return _index.withUnsafeBytes { (bytes: UnsafeRawBufferPointer) -> Int in
+            return value.withUnsafeBytes { (needle: UnsafeRawBufferPointer) -> Int in
+                let common = memcmp(bytes.baseAddress! + offset, needle.baseAddress ?? bytes.baseAddress!, min(length, needle.count))
+                return common != 0 ? Int(common) : length - needle.count
+            }
+        }
+    }
+
+    private func _lowerBound(key: UInt32, value: [UInt8]) -> Int {
+        var low = 0
+        var high = _entryCount
+        while low < high {
+            let middle = (low + high) / 2
+            if _compare(entry: middle, key: key, value: value) < 0 {
+                low = middle + 1
+            } else {
+                high = middle
+            }
+        }
+        return low
+    }
+
+    /// base + count * size, or nil if that overflows.
+    private static func _offset(_ base: Int, _ count: Int, _ size: Int) -> Int? {
+        let (bytes, productOverflow) = count.multipliedReportingOverflow(by: size)
+        let (offset, sumOverflow) = base.addingReportingOverflow(bytes)
+        return productOverflow || sumOverflow ? nil : offset
+    }
+
+    private static func _fingerprint(of url: URL) throws -> (size: UInt64, modified: UInt64) {
+        let attributes = try FileManager.default.attributesOfItem(atPath: url.path)
+        let size = (attributes[.size] as? NSNumber)?.uint64Value ?? 0
+        let modified = (attributes[.modificationDate] as? Date)?.timeIntervalSince1970 ?? 0
+        return (size, modified.bitPattern)
+    }
+}
+
+extension XMLElementIndex {
+    private final class _Collector {
+        var entries: [(key: UInt32, valueOffset: Int, valueLength: Int, start: Int64, end: Int64)] = []
+        var values: [UInt8] = []
+    }
+
+    /*!
+     @method buildForURL:keys:toURL:error:
+     @abstract Indexes every element of source selected by one of keys and writes the index to indexURL. Elements whose key value is missing are skipped.
+     */
+    public static func build(for source: URL, keys: [Key], to indexURL: URL) throws {
+        let fingerprint = try _fingerprint(of: source)
+        let collector = _Collector()
+        var error = _XMLError()
+
+        let indexed = _withCStringArray(keys.map { $0.path }) { (paths, count) in
+            _withCStringArray(keys.map { $0.name }) { (names, _) in
+                _XMLIndexFile(source.path, paths, names, count, { context, key, value, length, start, end in
+                    let collector = Unmanaged<_Collector>.fromOpaque(context!).takeUnretainedValue()
+                    let offset = collector.values.count
+                    if let value = value {
+                        value.withMemoryRebound(to: UInt8.self, capacity: length) {
+                            collector.values.append(contentsOf: UnsafeBufferPointer(start: $0, count: length))
+                        }
+                    }
+                    collector.entries.append((UInt32(key), offset, length, start, end))
+                }, Unmanaged.passUnretained(collector).toOpaque(), &error)
+            }
+        }
+        guard indexed else {
+            throw _parserError(error)
+        }
+
+        let values = collector.values
+        let entries = collector.entries.sorted { lhs, rhs in
+            if lhs.key != rhs.key {
+                return lhs.key < rhs.key
+            }
+            return values[lhs.valueOffset..<lhs.valueOffset + lhs.valueLength]
+                .lexicographicallyPrecedes(values[rhs.valueOffset..<rhs.valueOffset + rhs.valueLength])
+        }
+
+        // The pool holds the key strings after the values.
+        var pool = values
+        var keyRecords = Data()
+        for key in keys {
+            let path = Array(key.path.utf8)
+            let name = Array(key.name.utf8)
+            keyRecords._appendLittleEndian(UInt64(pool.count))
+            keyRecords._appendLittleEndian(UInt32(path.count))
+            keyRecords._appendLittleEndian(UInt32(name.count))
+            pool.append(contentsOf: path)
+            keyRecords._appendLittleEndian(UInt64(pool.count))
+            pool.append(contentsOf: name)
+        }
+
+        var data = Data(magic)
+        data._appendLittleEndian(version)
+        data._appendLittleEndian(fingerprint.size)
+        data._appendLittleEndian(fingerprint.modified)
+        data._appendLittleEndian(UInt32(keys.count))
+        data._appendLittleEndian(UInt32(entries.count))
+        data._appendLittleEndian(UInt64(pool.count))
+        data.append(keyRecords)
+        for entry in entries {
+            data._appendLittleEndian(entry.key)
+            data._appendLittleEndian(UInt32(entry.valueLength))
+            data._appendLittleEndian(UInt64(entry.valueOffset))
+            data._appendLittleEndian(UInt64(entry.start))
+            data._appendLittleEndian(UInt64(entry.end))
+        }
+        data.append(contentsOf: pool)
+
+        try data.write(to: indexURL, options: .atomic)
+    }
+}
+
+private extension Data {
+    func _littleEndian<T: FixedWidthInteger>(_ type: T.Type, at offset: Int) -> T {
+        var value: T = 0
+        Swift.withUnsafeMutableBytes(of: &value) { destination in
+            copyBytes(to: destination.bindMemory(to: UInt8.self), from: startIndex + offset..<startIndex + offset + MemoryLayout<T>.size)
+        }
+        return T(littleEndian: value)
+    }
+
+    mutating func _appendLittleEndian<T: FixedWidthInteger>(_ value: T) {
+        Swift.withUnsafeBytes(of: value.littleEndian) {
+            append(contentsOf: $0)
+        }
+    }
+}
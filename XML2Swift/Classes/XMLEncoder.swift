@@ -0,0 +1,505 @@
+//
+//  XMLEncoder.swift
+//  XML2Swift
+//
+//  Created by igork on 10/19/26.
+//
+
+import Foundation
+
+/*!
+ @class XMLEncoder
+ @abstract Encodes <tt>Encodable</tt> values by streaming tags, attributes and escaped text through libxml2's text writer, without building a tree.
+ @discussion The layout mirrors <tt>XMLDecoder</tt>: every key becomes a child element, or an attribute when <tt>attributeEncodingStrategy</tt> says so, and arrays become repeated elements named after their key. Elements are closed as soon as the next sibling is written, so memory stays constant however many records are encoded. Attribute keys must be encoded before any child element of the same container.
+ */
+open class XMLEncoder {
+    public struct OutputFormatting: OptionSet {
+        public let rawValue: UInt
+
+        public init(rawValue: UInt) {
+            self.rawValue = rawValue
+        }
+
+        public static let prettyPrinted = OutputFormatting(rawValue: 1 << 0)
+    }
+
+    /*!
+     @enum DateEncodingStrategy
+     @abstract How a <tt>Date</tt> is written. The default is <tt>iso8601</tt> in UTC.
+     */
+    public enum DateEncodingStrategy {
+        case deferredToDate
+        case secondsSince1970
+        case millisecondsSince1970
+        case iso8601
+        case formatted(DateFormatter)
+        case custom((Date, Encoder) throws -> Void)
+    }
+
+    /*!
+     @enum DataEncodingStrategy
+     @abstract How <tt>Data</tt> is written. The default is <tt>base64</tt>.
+     */
+    public enum DataEncodingStrategy {
+        case deferredToData
+        case base64
+        case hex
+        case custom((Data, Encoder) throws -> Void)
+    }
+
+    /*!
+     @enum AttributeEncodingStrategy
+     @abstract Which keys are written as attributes of their container's element instead of child elements.
+     */
+    public enum AttributeEncodingStrategy {
+        case never
+        case keys(Set<String>)
+        case custom((_ codingPath: [CodingKey]) -> Bool)
+    }
+
+    open var outputFormatting: OutputFormatting = []
+    open var dateEncodingStrategy: DateEncodingStrategy = .iso8601
+    open var dataEncodingStrategy: DataEncodingStrategy = .base64
+    open var attributeEncodingStrategy: AttributeEncodingStrategy = .never
+    open var userInfo: [CodingUserInfoKey : Any] = [:]
+
+    internal struct _Options {
+        let dateEncodingStrategy: DateEncodingStrategy
+        let dataEncodingStrategy: DataEncodingStrategy
+        let attributeEncodingStrategy: AttributeEncodingStrategy
+        let userInfo: [CodingUserInfoKey : Any]
+
+        func isAttribute(_ codingPath: [CodingKey]) -> Bool {
+            switch attributeEncodingStrategy {
+            case .never:
+                return false
+            case .keys(let keys):
+                return codingPath.last.map { keys.contains($0.stringValue) } ?? false
+            case .custom(let closure):
+                return closure(codingPath)
+            }
+        }
+    }
+
+    internal var _options: _Options {
+        return _Options(dateEncodingStrategy: dateEncodingStrategy, dataEncodingStrategy: dataEncodingStrategy, attributeEncodingStrategy: attributeEncodingStrategy, userInfo: userInfo)
+    }
+
+    public init() {}
+
+    /*!
+     @method encode:withRootKey:toStream:
+     @abstract Writes <tt>value</tt> as a document whose root element is named <tt>rootKey</tt>. The stream is flushed but left open.
+     */
+    open func encode<T: Encodable>(_ value: T, withRootKey rootKey: String, to stream: OutputStream) throws {
+        _SetupXMLParser()
+        let context = _XMLOutputStreamContext(stream: stream)
+
+        try context.withOpaquePointer { opaqueContext in
+            guard let writerPtr = _XMLWriterCreateIO(_XMLOutputStreamWrite, _XMLOutputStreamClose, opaqueContext, outputFormatting.contains(.prettyPrinted)) else {
+                throw EncodingError.invalidValue(value, EncodingError.Context(codingPath: [], debugDescription: "Could not create an XML writer for the stream."))
+            }
+            let writer = _XMLWriter(writer: writerPtr, context: context)
+            defer {
+                _XMLWriterFree(writerPtr)
+            }
+
+            let start = _XMLInstrumentationNow()
+            defer {
+                _XMLInstrumentationRecord(_kXMLTimingSerialization, start)
+            }
+
+            writer.check(_XMLWriterStartDocument(writerPtr))
+            writer.startElement(rootKey)
+            try _XMLEncoderImpl(writer: writer, options: _options, codingPath: [], target: .open(depth: 1)).box(value)
+            writer.check(_XMLWriterEndDocument(writerPtr))
+            try writer.throwIfFailed()
+        }
+    }
+
+    /*!
+     @method encode:withRootKey:
+     @abstract Returns <tt>value</tt> encoded as a document whose root element is named <tt>rootKey</tt>.
+     */
+    open func encode<T: Encodable>(_ value: T, withRootKey rootKey: String) throws -> Data {
+        let stream = DataOutputStream()
+        try encode(value, withRootKey: rootKey, to: stream)
+        return stream.data
+    }
+}
+
+// Tracks the elements open in the text writer. Encoder methods that can not throw record the
+// first failure here; it is rethrown by the next throwing call.
+private final class _XMLWriter {
+    let writer: _XMLWriterPtr
+    let context: _XMLOutputStreamContext
+    private(set) var depth = 0
+    private(set) var innermostHasContent = false
+    private(set) var error: Error?
+
+    init(writer: _XMLWriterPtr, context: _XMLOutputStreamContext) {
+        self.writer = writer
+        self.context = context
+    }
+
+    func check(_ status: Int32) {
+        if status < 0 && error == nil {
+            error = context.error ?? EncodingError.invalidValue(status, EncodingError.Context(codingPath: [], debugDescription: "The XML writer failed."))
+        }
+    }
+
+    func fail(_ error: Error) {
+        if self.error == nil {
+            self.error = error
+        }
+    }
+
+    func throwIfFailed() throws {
+        if let error = error {
+            throw error
+        }
+    }
+
+    func startElement(_ name: String) {
+        guard error == nil else { return }
+        check(name.withCString { _XMLWriterStartElement(writer, $0) })
+        depth += 1
+        innermostHasContent = false
+    }
+
+    func endElements(downTo target: Int) {
+        while depth > target && error == nil {
+            check(_XMLWriterEndElement(writer))
+            depth -= 1
+            innermostHasContent = true
+        }
+    }
+
+    func writeText(_ text: String) {
+        guard error == nil else { return }
+        check(text.withCString { _XMLWriterWriteString(writer, $0) })
+        innermostHasContent = true
+    }
+
+    func writeAttribute(_ name: String, value: String) {
+        guard error == nil else { return }
+        check(name.withCString { cName in value.withCString { _XMLWriterWriteAttribute(writer, cName, $0) } })
+    }
+
+    func writeData(_ data: Data, hex: Bool) {
+        guard error == nil else { return }
+        check(data.withUnsafeBytes { (bytes: UnsafeRawBufferPointer) -> Int32 in
+            let base = bytes.bindMemory(to: UInt8.self).baseAddress ?? UnsafePointer(bitPattern: 1)!
+            return hex ? _XMLWriterWriteBinHex(writer, base, bytes.count) : _XMLWriterWriteBase64(writer, base, bytes.count)
+        })
+        innermostHasContent = true
+    }
+}
+
+private enum _XMLEncodingTarget {
+    // The value is written into the element already open at depth.
+    case open(depth: Int)
+    // The value becomes a child element of the element open at parentDepth.
+    case element(name: String, parentDepth: Int)
+    // The value becomes an attribute of the element open at depth.
+    case attribute(name: String, depth: Int)
+}
+
+private final class _XMLEncoderImpl: Encoder {
+    let writer: _XMLWriter
+    let options: XMLEncoder._Options
+    let codingPath: [CodingKey]
+    let target: _XMLEncodingTarget
+    private var openedDepth: Int?
+
+    var userInfo: [CodingUserInfoKey : Any] {
+        return options.userInfo
+    }
+
+    init(writer: _XMLWriter, options: XMLEncoder._Options, codingPath: [CodingKey], target: _XMLEncodingTarget) {
+        self.writer = writer
+        self.options = options
+        self.codingPath = codingPath
+        self.target = target
+    }
+
+    // Opens the element this value is written into, once, and returns its depth.
+    private func openElement() -> Int {
+        if let depth = openedDepth {
+            return depth
+        }
+
+        let depth: Int
+        switch target {
+        case .open(let openDepth):
+            depth = openDepth
+
+        case .element(let name, let parentDepth):
+            writer.endElements(downTo: parentDepth)
+            writer.startElement(name)
+            depth = parentDepth + 1
+
+        case .attribute:
+            writer.fail(EncodingError.invalidValue(codingPath, EncodingError.Context(codingPath: codingPath, debugDescription: "Only single values can be encoded as attributes.")))
+            depth = writer.depth
+        }
+
+        openedDepth = depth
+        return depth
+    }
+
+    func container<Key>(keyedBy type: Key.Type) -> KeyedEncodingContainer<Key> where Key : CodingKey {
+        return KeyedEncodingContainer(_XMLKeyedEncodingContainer<Key>(encoder: self, depth: openElement()))
+    }
+
+    func unkeyedContainer() -> UnkeyedEncodingContainer {
+        switch target {
+        case .element(let name, let parentDepth):
+            return _XMLUnkeyedEncodingContainer(encoder: self, itemName: name, depth: parentDepth)
+        case .open, .attribute:
+            return _XMLUnkeyedEncodingContainer(encoder: self, itemName: "item", depth: openElement())
+        }
+    }
+
+    func singleValueContainer() -> SingleValueEncodingContainer {
+        return self
+    }
+
+    func box<T: Encodable>(_ value: T) throws {
+        if let date = value as? Date {
+            try boxDate(date)
+        } else if let data = value as? Data {
+            try boxData(data)
+        } else if let url = value as? URL {
+            try writeText(url.absoluteString)
+        } else {
+            try value.encode(to: self)
+        }
+        try writer.throwIfFailed()
+    }
+
+    private func boxDate(_ date: Date) throws {
+        switch options.dateEncodingStrategy {
+        case .deferredToDate:
+            try date.encode(to: self)
+
+        case .secondsSince1970:
+            try encode(date.timeIntervalSince1970)
+
+        case .millisecondsSince1970:
+            try encode(date.timeIntervalSince1970 * 1000.0)
+
+        case .iso8601:
+            var buffer = [CChar](repeating: 0, count: 32)
+            guard _XMLFormatISO8601Date(date.timeIntervalSince1970, &buffer, buffer.count) >= 0 else {
+                throw EncodingError.invalidValue(date, EncodingError.Context(codingPath: codingPath, debugDescription: "Date is out of the ISO 8601 range."))
+            }
+            try writeText(String(cString: buffer))
+
+        case .formatted(let formatter):
+            try writeText(formatter.string(from: date))
+
+        case .custom(let closure):
+            try closure(date, self)
+        }
+    }
+
+    private func boxData(_ data: Data) throws {
+        switch options.dataEncodingStrategy {
+        case .deferredToData:
+            try data.encode(to: self)
+
+        case .base64:
+            try writeContent(data.base64EncodedString()) {
+                writer.writeData(data, hex: false)
+            }
+
+        case .hex:
+            try writeContent(data.hexString()) {
+                writer.writeData(data, hex: true)
+            }
+
+        case .custom(let closure):
+            try closure(data, self)
+        }
+    }
+
+    private func writeText(_ text: String) throws {
+        try writeContent(text) {
+            writer.writeText(text)
+        }
+    }
+
+    // Element content is streamed by write; attributes need the whole value up front.
+    private func writeContent(_ attributeValue: @autoclosure () -> String, _ write: () -> Void) throws {
+        switch target {
+        case .open(let depth):
+            writer.endElements(downTo: depth)
+            write()
+
+        case .element(let name, let parentDepth):
+            writer.endElements(downTo: parentDepth)
+            writer.startElement(name)
+            write()
+            writer.endElements(downTo: parentDepth)
+
+        case .attribute(let name, let depth):
+            guard writer.depth == depth && !writer.innermostHasContent else {
+                throw EncodingError.invalidValue(name, EncodingError.Context(codingPath: codingPath, debugDescription: "Attributes must be encoded before any child element of their container."))
+            }
+            writer.writeAttribute(name, value: attributeValue())
+        }
+        try writer.throwIfFailed()
+    }
+
+    private func formatted<T: BinaryFloatingPoint & LosslessStringConvertible>(_ value: T) -> String {
+        if value.isNaN {
+            return "NaN"
+        }
+        if value.isInfinite {
+            return value < 0 ? "-INF" : "INF"
+        }
+        return value.description
+    }
+}
+
+extension _XMLEncoderImpl: SingleValueEncodingContainer {
+    func encodeNil() throws {
+        switch target {
+        case .element(let name, let parentDepth):
+            writer.endElements(downTo: parentDepth)
+            writer.startElement(name)
+            writer.endElements(downTo: parentDepth)
+        case .open, .attribute:
+            break
+        }
+        try writer.throwIfFailed()
+    }
+
+    func encode(_ value: Bool) throws { try writeText(value ? "true" : "false") }
+    func encode(_ value: String) throws { try writeText(value) }
+    func encode(_ value: Double) throws { try writeText(formatted(value)) }
+    func encode(_ value: Float) throws { try writeText(formatted(value)) }
+    func encode(_ value: Int) throws { try writeText(String(value)) }
+    func encode(_ value: Int8) throws { try writeText(String(value)) }
+    func encode(_ value: Int16) throws { try writeText(String(value)) }
+    func encode(_ value: Int32) throws { try writeText(String(value)) }
+    func encode(_ value: Int64) throws { try writeText(String(value)) }
+    func encode(_ value: UInt) throws { try writeText(String(value)) }
+    func encode(_ value: UInt8) throws { try writeText(String(value)) }
+    func encode(_ value: UInt16) throws { try writeText(String(value)) }
+    func encode(_ value: UInt32) throws { try writeText(String(value)) }
+    func encode(_ value: UInt64) throws { try writeText(String(value)) }
+
+    func encode<T>(_ value: T) throws where T : Encodable {
+        try box(value)
+    }
+}
+
+private struct _XMLKeyedEncodingContainer<Key: CodingKey>: KeyedEncodingContainerProtocol {
+    let encoder: _XMLEncoderImpl
+    let depth: Int
+
+    var codingPath: [CodingKey] {
+        return encoder.codingPath
+    }
+
+    private func childEncoder(forKey key: Key) -> _XMLEncoderImpl {
+        let path = codingPath + [key]
+        let target: _XMLEncodingTarget = encoder.options.isAttribute(path)
+            ? .attribute(name: key.stringValue, depth: depth)
+            : .element(name: key.stringValue, parentDepth: depth)
+        return _XMLEncoderImpl(writer: encoder.writer, options: encoder.options, codingPath: path, target: target)
+    }
+
+    mutating func encodeNil(forKey key: Key) throws { try childEncoder(forKey: key).encodeNil() }
+    mutating func encode(_ value: Bool, forKey key: Key) throws { try childEncoder(forKey: key).encode(value) }
+    mutating func encode(_ value: String, forKey key: Key) throws { try childEncoder(forKey: key).encode(value) }
+    mutating func encode(_ value: Double, forKey key: Key) throws { try childEncoder(forKey: key).encode(value) }
+    mutating func encode(_ value: Float, forKey key: Key) throws { try childEncoder(forKey: key).encode(value) }
+    mutating func encode(_ value: Int, forKey key: Key) throws { try childEncoder(forKey: key).encode(value) }
+    mutating func encode(_ value: Int8, forKey key: Key) throws { try childEncoder(forKey: key).encode(value) }
+    mutating func encode(_ value: Int16, forKey key: Key) throws { try childEncoder(forKey: key).encode(value) }
+    mutating func encode(_ value: Int32, forKey key: Key) throws { try childEncoder(forKey: key).encode(value) }
+    mutating func encode(_ value: Int64, forKey key: Key) throws { try childEncoder(forKey: key).encode(value) }
+    mutating func encode(_ value: UInt, forKey key: Key) throws { try childEncoder(forKey: key).encode(value) }
+    mutating func encode(_ value: UInt8, forKey key: Key) throws { try childEncoder(forKey: key).encode(value) }
+    mutating func encode(_ value: UInt16, forKey key: Key) throws { try childEncoder(forKey: key).encode(value) }
+    mutating func encode(_ value: UInt32, forKey key: Key) throws { try childEncoder(forKey: key).encode(value) }
+    mutating func encode(_ value: UInt64, forKey key: Key) throws { try childEncoder(forKey: key).encode(value) }
+
+    mutating func encode<T>(_ value: T, forKey key: Key) throws where T : Encodable {
+        try childEncoder(forKey: key).box(value)
+    }
+
+    mutating func nestedContainer<NestedKey>(keyedBy keyType: NestedKey.Type, forKey key: Key) -> KeyedEncodingContainer<NestedKey> where NestedKey : CodingKey {
+        return childEncoder(forKey: key).container(keyedBy: keyType)
+    }
+
+    mutating func nestedUnkeyedContainer(forKey key: Key) -> UnkeyedEncodingContainer {
+        return childEncoder(forKey: key).unkeyedContainer()
+    }
+
+    mutating func superEncoder() -> Encoder {
+        return _XMLEncoderImpl(writer: encoder.writer, options: encoder.options, codingPath: codingPath, target: .open(depth: depth))
+    }
+
+    mutating func superEncoder(forKey key: Key) -> Encoder {
+        return childEncoder(forKey: key)
+    }
+}
+
+private struct _XMLUnkeyedEncodingContainer: UnkeyedEncodingContainer {
+    let encoder: _XMLEncoderImpl
+    let itemName: String
+    let depth: Int
+    private(set) var count: Int = 0
+
+    init(encoder: _XMLEncoderImpl, itemName: String, depth: Int) {
+        self.encoder = encoder
+        self.itemName = itemName
+        self.depth = depth
+    }
+
+    var codingPath: [CodingKey] {
+        return encoder.codingPath
+    }
+
+    private mutating func nextEncoder() -> _XMLEncoderImpl {
+        let next = _XMLEncoderImpl(writer: encoder.writer, options: encoder.options, codingPath: codingPath + [_XMLCodingKey(intValue: count)], target: .element(name: itemName, parentDepth: depth))
+        count += 1
+        return next
+    }
+
+    mutating func encodeNil() throws { try nextEncoder().encodeNil() }
+    mutating func encode(_ value: Bool) throws { try nextEncoder().encode(value) }
+    mutating func encode(_ value: String) throws { try nextEncoder().encode(value) }
+    mutating func encode(_ value: Double) throws { try nextEncoder().encode(value) }
+    mutating func encode(_ value: Float) throws { try nextEncoder().encode(value) }
+    mutating func encode(_ value: Int) throws { try nextEncoder().encode(value) }
+    mutating func encode(_ value: Int8) throws { try nextEncoder().encode(value) }
+    mutating func encode(_ value: Int16) throws { try nextEncoder().encode(value) }
+    mutating func encode(_ value: Int32) throws { try nextEncoder().encode(value) }
+    mutating func encode(_ value: Int64) throws { try nextEncoder().encode(value) }
+    mutating func encode(_ value: UInt) throws { try nextEncoder().encode(value) }
+    mutating func encode(_ value: UInt8) throws { try nextEncoder().encode(value) }
+    mutating func encode(_ value: UInt16) throws { try nextEncoder().encode(value) }
+    mutating func encode(_ value: UInt32) throws { try nextEncoder().encode(value) }
+    mutating func encode(_ value: UInt64) throws { try nextEncoder().encode(value) }
+
+    mutating func encode<T>(_ value: T) throws where T : Encodable {
+        try nextEncoder().box(value)
+    }
+
+    mutating func nestedContainer<NestedKey>(keyedBy keyType: NestedKey.Type) -> KeyedEncodingContainer<NestedKey> where NestedKey : CodingKey {
+        return nextEncoder().container(keyedBy: keyType)
+    }
+
+    mutating func nestedUnkeyedContainer() -> UnkeyedEncodingContainer {
+        return nextEncoder().unkeyedContainer()
+    }
+
+    mutating func superEncoder() -> Encoder {
+        return nextEncoder()
+    }
+}
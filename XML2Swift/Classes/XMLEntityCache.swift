@@ -0,0 +1,103 @@
+//
+//  XMLEntityCache.swift
+//  XML2Swift
+//
+//  Created by igork on 10/19/26.
+//
+
+import Foundation
+
+/*!
+ @class XMLEntityCache
+ @abstract A process-wide cache of external DTDs and entities, so documents parsed with nodeLoadExternalEntitiesAlways and XMLDTD(contentsOf:) stop reading and parsing the same files again and again.
+ @discussion The cache is installed as libxml2's external entity loader the first time it is configured and is empty, with a capacity of zero, until capacity is set. Entries are keyed by system ID after catalog resolution, hold the raw bytes of local files and, for DTDs loaded with XMLDTD(contentsOf:), the parsed DTD, which is handed out as a copy. The least recently used entries are evicted once their total size exceeds capacity. Remote identifiers are never cached; map them to local copies with the catalog. The cache does not notice files changing on disk: call removeAll() after updating them.
+ */
+public enum XMLEntityCache {
+    /*!
+     @method capacity
+     @abstract The maximum number of bytes kept, counting a parsed DTD as large as its source. Zero, the default, disables caching.
+     */
+    public static var capacity: Int {
+        get {
+            return _XMLEntityCacheGetCapacity()
+        }
+        set {
+            _SetupXMLParser()
+            _XMLEntityCacheSetCapacity(newValue)
+        }
+    }
+
+    /*!
+     @method allowsNetworkAccess
+     @abstract When false, an external DTD or entity whose system ID is still a remote URL after catalog resolution is not loaded and the parser reports a warning. Defaults to true.
+     */
+    public static var allowsNetworkAccess: Bool {
+        get {
+            return _XMLEntityCacheGetAllowsNetwork()
+        }
+        set {
+            _SetupXMLParser()
+            _XMLEntityCacheSetAllowsNetwork(newValue)
+        }
+    }
+
+    /// Loads made from the cache, including copies of parsed DTDs.
+    public static var hitCount: Int64 {
+        return _statistics().hits
+    }
+
+    /// Local files read because they were not in the cache.
+    public static var missCount: Int64 {
+        return _statistics().misses
+    }
+
+    /// The number of bytes currently held.
+    public static var size: Int {
+        return _statistics().size
+    }
+
+    /// Empties the cache and resets its counters.
+    public static func removeAll() {
+        _XMLEntityCacheRemoveAll()
+    }
+
+    /*!
+     @method loadCatalogWithContentsOfURL:error:
+     @abstract Adds the entries of an OASIS XML catalog file to the default catalog used to resolve public and system IDs.
+     */
+    public static func loadCatalog(contentsOf url: URL) throws {
+        _SetupXMLParser()
+        var error = _XMLError()
+        guard _XMLEntityCacheLoadCatalog(url.path, &error) else {
+            throw _parserError(error)
+        }
+    }
+
+    /*!
+     @method mapSystemID:toURL:
+     @abstract Resolves a system ID, such as the http URL of a partner's DTD, to a local copy.
+     */
+    @discardableResult
+    public static func map(systemID: String, to url: URL) -> Bool {
+        _SetupXMLParser()
+        return _XMLEntityCacheAddCatalogEntry(false, systemID, url.absoluteString)
+    }
+
+    /*!
+     @method mapPublicID:toURL:
+     @abstract Resolves a public ID, such as "-//W3C//DTD XHTML 1.0 Strict//EN", to a local copy.
+     */
+    @discardableResult
+    public static func map(publicID: String, to url: URL) -> Bool {
+        _SetupXMLParser()
+        return _XMLEntityCacheAddCatalogEntry(true, publicID, url.absoluteString)
+    }
+
+    private static func _statistics() -> (hits: Int64, misses: Int64, size: Int) {
+        var hits: Int64 = 0
+        var misses: Int64 = 0
+        var size = 0
+        _XMLEntityCacheGetStatistics(&hits, &misses, &size)
+        return (hits, misses, size)
+    }
+}
@@ -0,0 +1,123 @@
+//
+//  XMLInstrumentation.swift
+//  XML2Swift
+//
+//  Created by igork on 10/19/26.
+//
+
+import Foundation
+
+/*!
+ @class XMLInstrumentation
+ @abstract Process-wide counters and timing histograms for parsing, wrapping, querying, validating and serializing.
+ @discussion Collection is compiled in only when the library is built with <tt>XML2SWIFT_INSTRUMENTATION=1</tt> defined for C and passed to Swift through <tt>-Xcc -DXML2SWIFT_INSTRUMENTATION=1</tt>. Without it every hook is an empty inline function, <tt>isEnabled</tt> is false and snapshots are all zero. Counters are updated with relaxed atomics, so a snapshot taken while other threads work is not an atomic cut across counters.
+ */
+public enum XMLInstrumentation {
+    public enum Counter: CaseIterable {
+        /// Bytes handed to the parser or to streaming validation.
+        case bytesParsed
+        /// Nodes allocated by libxml2, both by the parser and through the tree API.
+        case nodesCreated
+        /// XMLNode wrappers created for libxml2 nodes.
+        case wrappersMaterialized
+        /// Strings copied out of the tree by the name, content, prefix, path and serialization accessors.
+        case stringCopies
+        case xpathCompilations
+        case xpathEvaluations
+        /// Bytes produced by xmlString/xmlData and by XMLEncoder.
+        case serializedBytes
+
+        internal var _counter: _XMLCounter {
+            switch self {
+            case .bytesParsed: return _kXMLCounterBytesParsed
+            case .nodesCreated: return _kXMLCounterNodesCreated
+            case .wrappersMaterialized: return _kXMLCounterWrappersMaterialized
+            case .stringCopies: return _kXMLCounterStringCopies
+            case .xpathCompilations: return _kXMLCounterXPathCompilations
+            case .xpathEvaluations: return _kXMLCounterXPathEvaluations
+            case .serializedBytes: return _kXMLCounterSerializedBytes
+            }
+        }
+    }
+
+    public enum Timing: CaseIterable {
+        case parse
+        case xpath
+        case validation
+        case serialization
+
+        internal var _timing: _XMLTiming {
+            switch self {
+            case .parse: return _kXMLTimingParse
+            case .xpath: return _kXMLTimingXPath
+            case .validation: return _kXMLTimingValidation
+            case .serialization: return _kXMLTimingSerialization
+            }
+        }
+    }
+
+    /*!
+     @struct Histogram
+     @abstract Durations of one kind of operation. <tt>buckets[i]</tt> counts operations that took between 2^i and 2^(i+1) nanoseconds.
+     */
+    public struct Histogram {
+        public let count: Int64
+        public let totalNanoseconds: Int64
+        public let buckets: [Int64]
+
+        /*!
+         @method percentile:
+         @abstract Returns the upper bound, in nanoseconds, of the bucket holding the given percentile (0...100), or nil when nothing was recorded.
+         */
+        public func percentile(_ percentile: Double) -> Int64? {
+            guard count > 0 else { return nil }
+
+            let rank = Int64((Double(count) * percentile / 100.0).rounded(.up))
+            var seen: Int64 = 0
+            for (index, bucketCount) in buckets.enumerated() {
+                seen += bucketCount
+                if seen >= max(rank, 1) {
+                    return Int64(1) << Int64(index + 1)
+                }
+            }
+            return Int64(1) << Int64(buckets.count)
+        }
+    }
+
+    public struct Snapshot {
+        public let counters: [Counter : Int64]
+        public let timings: [Timing : Histogram]
+    }
+
+    /// Whether the library was built with instrumentation compiled in.
+    public static var isEnabled: Bool {
+        return _XMLInstrumentationEnabled()
+    }
+
+    public static func value(of counter: Counter) -> Int64 {
+        return _XMLInstrumentationCounterValue(counter._counter)
+    }
+
+    public static func histogram(for timing: Timing) -> Histogram {
+        let buckets = (0..<Int(_kXMLTimingBucketCount)).map { _XMLInstrumentationTimingBucket(timing._timing, $0) }
+        return Histogram(count: _XMLInstrumentationTimingCount(timing._timing),
+                         totalNanoseconds: _XMLInstrumentationTimingTotal(timing._timing),
+                         buckets: buckets)
+    }
+
+    public static func snapshot() -> Snapshot {
+        var counters: [Counter : Int64] = [:]
+        for counter in Counter.allCases {
+            counters[counter] = value(of: counter)
+        }
+        var timings: [Timing : Histogram] = [:]
+        for timing in Timing.allCases {
+            timings[timing] = histogram(for: timing)
+        }
+        return Snapshot(counters: counters, timings: timings)
+    }
+
+    public static func reset() {
+        _XMLInstrumentationReset()
+    }
+}
@@ -8,9 +8,61 @@
 import Foundation
 
 var _SetupXMLParser: () -> Void = {
+    _XMLMemoryInstall()
     xmlInitParser();
+    _XMLInstrumentationInstall()
     return {}
 }()
 
+/// Calls `work` with a C array of NUL-terminated copies of `strings` and its length.
+func _withCStringArray<R>(_ strings: [String], _ work: (UnsafePointer<UnsafePointer<CChar>?>?, Int) throws -> R) rethrows -> R {
+    let cStrings = strings.map { UnsafePointer(strdup($0)) }
+    defer {
+        cStrings.forEach { free(UnsafeMutablePointer(mutating: $0)) }
+    }
 
+    return try cStrings.withUnsafeBufferPointer {
+        try work($0.baseAddress, $0.count)
+    }
+}
 
+/// Decodes a span returned by one of the `_XML...Span` functions and releases it. A span without bytes is nil.
+func _string(from span: _XMLSpan) -> String? {
+    defer {
+        _XMLSpanRelease(span)
+    }
+
+    guard let bytes = span.bytes else {
+        return nil
+    }
+    return String(decoding: UnsafeBufferPointer(start: bytes, count: span.length), as: UTF8.self)
+}
+
+/// Copies the bytes of `span` and releases it. A span without bytes is nil.
+func _data(from span: _XMLSpan) -> Data? {
+    defer {
+        _XMLSpanRelease(span)
+    }
+
+    guard let bytes = span.bytes else {
+        return nil
+    }
+    return Data(bytes: bytes, count: span.length)
+}
+
+/// The qualified name of `node`. Prefixed names are built in a stack buffer and only allocated when longer than it.
+func _qualifiedName(of node: _XMLNodePtr) -> String? {
+    var buffer: (UInt64, UInt64, UInt64, UInt64, UInt64, UInt64, UInt64, UInt64,
+                 UInt64, UInt64, UInt64, UInt64, UInt64, UInt64, UInt64, UInt64) = (0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0)
+    return withUnsafeMutableBytes(of: &buffer) { raw in
+        _string(from: _XMLNodeGetNameSpan(node, raw.baseAddress?.assumingMemoryBound(to: UInt8.self), raw.count))
+    }
+}
+
+/// The error described by `error`. `code` is the libxml2 error code, or 0 when the C core failed on its own.
+func _parserError(_ error: _XMLError) -> NSError {
+    let message = withUnsafeBytes(of: error.message) { raw in
+        String(cString: raw.baseAddress!.assumingMemoryBound(to: CChar.self))
+    }
+    return NSError(domain: "NSXMLParserErrorDomain", code: Int(error.code), userInfo: [NSLocalizedDescriptionKey: message])
+}
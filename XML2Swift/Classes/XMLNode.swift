@@ -6,8 +6,11 @@
 //
 
 import Foundation
-import CoreFoundation
+#if canImport(libxml2)
 import libxml2
+#else
+import CLibXML2
+#endif
 
 extension XMLNode {
     /*!
@@ -119,23 +122,21 @@ open class XMLNode: NSObject, NSCopying {
         get {
             switch kind {
             case .entityDeclaration:
-                let returned = _XMLCopyEntityContent(_XMLEntityPtr(_xmlNode))
-                return returned == nil ? nil : unsafeBitCast(returned!, to: NSString.self) as String
+                return _string(from: _XMLEntityGetContentSpan(_XMLEntityPtr(_xmlNode)))
 
             case .namespace:
-                let returned = _XMLNamespaceCopyValue(_xmlNode)
-                return returned == nil ? nil : unsafeBitCast(returned!, to: NSString.self) as String
+                return _string(from: _XMLNamespaceGetValueSpan(_xmlNode))
 
             case .element:
                 // As with Darwin, children's string values are just concanated without spaces.
                 return children?.compactMap({ $0.stringValue }).joined() ?? ""
 
             default:
-                let returned = _XMLNodeCopyContent(_xmlNode)
-                return returned == nil ? nil : unsafeBitCast(returned!, to: NSString.self) as String
+                return _string(from: _XMLNodeCopyContentSpan(_xmlNode))
             }
         }
         set {
+            _willMutate()
             switch kind {
             case .namespace:
                 if let newValue = newValue {
@@ -147,13 +148,14 @@ open class XMLNode: NSObject, NSCopying {
                 _XMLNodeSetContent(_xmlNode, newValue)
 
             default:
-                _removeAllChildNodesExceptAttributes() // in case anyone is holding a reference to any of these children we're about to destroy
-                if let string = newValue {
-                    let returned = _XMLEncodeEntities(_XMLNodeGetDocument(_xmlNode), string)
-                    let newContent = returned == nil ? "" : unsafeBitCast(returned!, to: NSString.self) as String
-                    _XMLNodeSetContent(_xmlNode, newContent)
-                } else {
-                    _XMLNodeSetContent(_xmlNode, nil)
+                _updatingKeyIndexes(of: _xmlNode) {
+                    _removeAllChildNodesExceptAttributes() // in case anyone is holding a reference to any of these children we're about to destroy
+                    if let string = newValue {
+                        let newContent = _string(from: _XMLEncodeEntities(_XMLNodeGetDocument(_xmlNode), string)) ?? ""
+                        _XMLNodeSetContent(_xmlNode, newContent)
+                    } else {
+                        _XMLNodeSetContent(_xmlNode, nil)
+                    }
                 }
             }
         }
@@ -172,7 +174,9 @@ open class XMLNode: NSObject, NSCopying {
         var nextChild = _XMLNodeGetFirstChild(_xmlNode)
         while let child = nextChild {
             nextChild = _XMLNodeGetNextSibling(child)
-            _XMLUnlinkNode(child)
+            _updatingKeyIndexes(of: child) {
+                _XMLUnlinkNode(child)
+            }
         }
         _childNodes.removeAll(keepingCapacity: true)
     }
@@ -180,7 +184,7 @@ open class XMLNode: NSObject, NSCopying {
     var index: UInt?
     var level: UInt?
     var parent: XMLNode?
-    internal let _xmlNode: _XMLNodePtr!
+    internal private(set) var _xmlNode: _XMLNodePtr!
     internal var _xmlDocument: XMLDocument?
 
     /*!
@@ -204,7 +208,25 @@ open class XMLNode: NSObject, NSCopying {
      @abstract The representation of this node as it would appear in an XML document, with various output options available.
      */
     open func xmlString(options: Options) -> String {
-        return unsafeBitCast(_XMLCopyStringWithOptions(_xmlNode, UInt32(options.rawValue)), to: NSString.self) as String
+        return _string(from: _XMLNodeCopyStringSpan(_xmlNode, UInt32(options.rawValue))) ?? ""
+    }
+
+    /*!
+     @method writeToStream:options:error:
+     @abstract Serializes the node like XMLStringWithOptions: straight into <tt>stream</tt> as UTF-8, without building the whole string first. The stream is flushed but left open.
+     */
+    open func write(to stream: OutputStream, options: Options = []) throws {
+        let context = _XMLOutputStreamContext(stream: stream)
+        let saved = context.withOpaquePointer {
+            return _XMLNodeSaveToIO(_xmlNode, UInt32(options.rawValue), _XMLOutputStreamWrite, _XMLOutputStreamClose, $0)
+        }
+
+        if let error = context.error {
+            throw error
+        }
+        if !saved {
+            throw IOStreamError.writeFailed
+        }
     }
 
     /*!
@@ -251,17 +273,15 @@ open class XMLNode: NSObject, NSCopying {
      @returns An array whose elements are a kind of NSXMLNode.
      */
     open func nodes(forXPath xpath: String) throws -> [XMLNode] {
-        guard let nodes = _XMLNodesForXPath(_xmlNode, xpath) else {
+        var count = 0
+        guard let nodes = _XMLNodesForXPath(_xmlNode, xpath, &count) else {
             return []
         }
-
-        var result: [XMLNode] = []
-        for i in 0..<CFArrayGetCount(nodes as! CFArray) {
-            let nodePtr = CFArrayGetValueAtIndex(nodes as! CFArray, i)!
-            result.append(XMLNode._objectNodeForNode(_XMLNodePtr(mutating: nodePtr)))
+        defer {
+            free(nodes)
         }
 
-        return result
+        return UnsafeBufferPointer(start: nodes, count: count).map { XMLNode._objectNodeForNode($0) }
     }
 
     /*!
@@ -284,6 +304,11 @@ open class XMLNode: NSObject, NSCopying {
     deinit {
         guard _xmlNode != nil else { return }
 
+        if _XMLNodeIsFrozen(_xmlNode) && _XMLNodeGetPrivateData(_xmlNode) != Unmanaged.passUnretained(self).toOpaque() {
+            // Lost the race in _publish(_:); the node belongs to the winning wrapper.
+            return
+        }
+
         for node in _childNodes {
             node.detach()
         }
@@ -307,10 +332,21 @@ open class XMLNode: NSObject, NSCopying {
 
     internal init(ptr: _XMLNodePtr) {
         _SetupXMLParser()
-        precondition(_XMLNodeGetPrivateData(ptr) == nil, "Only one XMLNode per xmlNodePtr allowed")
+        let frozen = _XMLNodeIsFrozen(ptr)
+        precondition(frozen || _XMLNodeGetPrivateData(ptr) == nil, "Only one XMLNode per xmlNodePtr allowed")
 
         _xmlNode = ptr
         super.init()
+        _XMLInstrumentationAdd(_kXMLCounterWrappersMaterialized, 1)
+
+        if frozen {
+            // A frozen tree never changes, so the parent does not need to track its children,
+            // and _publish(_:) rather than this initializer stores the wrapper in _private.
+            if let documentPtr = _XMLNodeGetDocument(_xmlNode), documentPtr != ptr {
+                _xmlDocument = XMLDocument._objectNodeForNode(documentPtr)
+            }
+            return
+        }
 
         if let parent = _XMLNodeGetParent(_xmlNode) {
             let parentNode = XMLNode._objectNodeForNode(parent)
@@ -365,8 +401,24 @@ open class XMLNode: NSObject, NSCopying {
         }
     }
 
+    /*!
+     @method copyWithZone:
+     @abstract Returns a deep copy of the node that is not attached to any document.
+     */
     public func copy(with zone: NSZone? = nil) -> Any {
-        return copy(with: nil)
+        return XMLNode._objectNodeForNode(_XMLCopyNode(_xmlNode, true))
+    }
+
+    /*!
+     @method cloneIntoDocument:
+     @abstract Returns a deep copy of the node that belongs to document, ready to be inserted into it.
+     @discussion Cheaper than copy() when stamping out many records from a template: element and attribute names of the clone are interned in the document's name dictionary rather than duplicated, and a document that has no dictionary yet borrows the template document's one. Documents that share a dictionary must not be modified from different threads at the same time.
+     */
+    open func clone(into document: XMLDocument) -> XMLNode {
+        precondition(kind != .document && kind != .DTDKind && kind != .namespace, "Use copy() for documents, DTDs and namespaces")
+        document._willMutate()
+
+        return XMLNode._objectNodeForNode(_XMLCloneNode(_xmlNode, _XMLDocPtr(document._xmlNode))!)
     }
 
     init(withPrimitive primitive: xmlDocPtr) {
@@ -520,7 +572,11 @@ open class XMLNode: NSObject, NSCopying {
      @abstract Returns an element, attribute, entity, or notation DTD node based on the full XML string.
      */
     open var kind: XMLNode.Kind  {
-        switch _XMLNodeGetType(_xmlNode) {
+        return XMLNode._kind(of: _xmlNode)
+    }
+
+    internal static func _kind(of node: _XMLNodePtr) -> XMLNode.Kind {
+        switch _XMLNodeGetType(node) {
         case _kXMLTypeElement:
             return .element
 
@@ -602,8 +658,11 @@ open class XMLNode: NSObject, NSCopying {
      @abstract Detaches this node from its parent.
      */
     open func detach() {
+        _willMutate()
         guard let parentPtr = _XMLNodeGetParent(_xmlNode) else { return }
-        _XMLUnlinkNode(_xmlNode)
+        _updatingKeyIndexes(of: _xmlNode, in: parentPtr) {
+            _XMLUnlinkNode(_xmlNode)
+        }
 
         guard let parentNodePtr = _XMLNodeGetPrivateData(parentPtr) else { return }
 
@@ -618,8 +677,7 @@ open class XMLNode: NSObject, NSCopying {
     open var xPath: String? {
         guard _XMLNodeGetDocument(_xmlNode) != nil else { return nil }
 
-        let returned = _XMLCopyPathForNode(_xmlNode)
-        return returned == nil ? nil : unsafeBitCast(returned!, to: NSString.self) as String
+        return _string(from: _XMLNodeCopyPathSpan(_xmlNode))
     }
 
     /*!
@@ -627,8 +685,7 @@ open class XMLNode: NSObject, NSCopying {
      @abstract Returns the local name bar if this attribute or element's name is foo:bar
      */
     open var localName: String? {
-        let returned = _XMLNodeCopyLocalName(_xmlNode)
-        return returned == nil ? nil : unsafeBitCast(returned!, to: NSString.self) as String
+        return _string(from: _XMLNodeGetLocalNameSpan(_xmlNode))
     }
 
     /*!
@@ -636,8 +693,7 @@ open class XMLNode: NSObject, NSCopying {
      @abstract Returns the prefix foo if this attribute or element's name if foo:bar
      */
     open var prefix: String? {
-        let returned = _XMLNodeCopyPrefix(_xmlNode)
-        return returned == nil ? nil : unsafeBitCast(returned!, to: NSString.self) as String
+        return _string(from: _XMLNodeGetPrefixSpan(_xmlNode))
     }
 
     /*!
@@ -646,14 +702,16 @@ open class XMLNode: NSObject, NSCopying {
      */
     open var uri: String? {
         get {
-            let returned = _XMLNodeCopyURI(_xmlNode)
-            return returned == nil ? nil : unsafeBitCast(returned!, to: NSString.self) as String
+            return _XMLNodeCopyURI(_xmlNode).map { String(cString: $0) }
         }
         set {
-            if let URI = newValue {
-                _XMLNodeSetURI(_xmlNode, URI)
-            } else {
-                _XMLNodeSetURI(_xmlNode, nil)
+            _willMutate()
+            _updatingKeyIndexes(of: _xmlNode, descendants: false) {
+                if let URI = newValue {
+                    _XMLNodeSetURI(_xmlNode, URI)
+                } else {
+                    _XMLNodeSetURI(_xmlNode, nil)
+                }
             }
         }
     }
@@ -734,12 +792,13 @@ open class XMLNode: NSObject, NSCopying {
                 // As with Darwin, name is always nil when the node is comment or text.
                 return nil
             case .namespace:
-                return _XMLNamespaceCopyPrefix(_xmlNode).map({ unsafeBitCast($0, to: NSString.self) as String }) ?? ""
+                return _string(from: _XMLNamespaceGetPrefixSpan(_xmlNode)) ?? ""
             default:
-                return _XMLNodeCopyName(_xmlNode).map({ unsafeBitCast($0, to: NSString.self) as String })
+                return _qualifiedName(of: _xmlNode)
             }
         }
         set {
+            _willMutate()
             switch kind {
             case .document:
                 // As with Darwin, ignore the name when the node is document.
@@ -751,10 +810,12 @@ open class XMLNode: NSObject, NSCopying {
             case .namespace:
                 _XMLNamespaceSetPrefix(_xmlNode, newValue, Int64(newValue?.utf8.count ?? 0))
             default:
-                if let newName = newValue {
-                    _XMLNodeSetName(_xmlNode, newName)
-                } else {
-                    _XMLNodeSetName(_xmlNode, "")
+                _updatingKeyIndexes(of: _xmlNode, descendants: false) {
+                    if let newName = newValue {
+                        _XMLNodeSetName(_xmlNode, newName)
+                    } else {
+                        _XMLNodeSetName(_xmlNode, "")
+                    }
                 }
             }
         }
@@ -775,6 +836,7 @@ open class XMLNode: NSObject, NSCopying {
             }
         }
         set {
+            _willMutate()
             _objectValue = newValue
             if let describableValue = newValue as? CustomStringConvertible {
                 stringValue = "\(describableValue.description)"
@@ -862,33 +924,128 @@ open class XMLNode: NSObject, NSCopying {
                 return unsafeBitCast(_private, to: XMLNode.self)
             }
 
-            return XMLNode(ptr: node)
+            return _publish(XMLNode(ptr: node))
         }
     }
 
+    /*!
+     @method _publish:
+     @abstract Stores a new wrapper of a frozen node in its _private field with a compare-and-swap. When another thread got there first its wrapper is returned and this one is dropped, so every thread sees the same wrapper. Wrappers of mutable nodes are stored by init(ptr:) and returned unchanged.
+     */
+    internal class func _publish<T: XMLNode>(_ wrapper: T) -> T {
+        guard wrapper.isFrozen else { return wrapper }
+
+        let retained = Unmanaged.passRetained(wrapper)
+        if _XMLNodeCompareAndSwapPrivateData(wrapper._xmlNode, nil, retained.toOpaque()) {
+            return wrapper
+        }
+
+        retained.release()
+        return unsafeBitCast(_XMLNodeGetPrivateData(wrapper._xmlNode)!, to: T.self)
+    }
+
+    /*!
+     @method isFrozen
+     @abstract Whether this node belongs to a document returned by -[XMLDocument freeze]. Such nodes cannot be changed and can be read from any number of threads at once.
+     */
+    open var isFrozen: Bool {
+        return _xmlNode != nil && _XMLNodeIsFrozen(_xmlNode)
+    }
+
+    /*!
+     @method structuralHash
+     @abstract A hash of the subtree rooted at this node covering names, namespaces, attributes and text, equal for structurally identical subtrees.
+     @discussion Computed bottom-up and cached per node, so asking again after a change only rehashes the path from the changed node to this one: every mutating API drops the cached hashes of the node it changes and of its ancestors. Attribute and namespace order do not affect the hash. Changes made directly through libxml2 are not tracked.
+     */
+    open var structuralHash: UInt64 {
+        return _XMLNodeGetStructuralHash(_xmlNode)
+    }
+
+    /// Frees a document that was only lent to the caller, such as a streamed match. Its wrappers give up their nodes, so one kept past this point traps on use instead of reading freed memory.
+    internal static func _freeLentDocument(_ doc: _XMLDocPtr) {
+        func release(_ node: _XMLNodePtr) {
+            let type = _XMLNodeGetType(node)
+            if type == _kXMLTypeElement {
+                var nextAttribute = _XMLNodeProperties(node)
+                while let attribute = nextAttribute {
+                    nextAttribute = _XMLNodeGetNextSibling(attribute)
+                    release(attribute)
+                }
+            }
+            // The children of an entity reference belong to the entity declaration.
+            if type != _kXMLTypeEntityReference {
+                var nextChild = _XMLNodeGetFirstChild(node)
+                while let child = nextChild {
+                    nextChild = _XMLNodeGetNextSibling(child)
+                    release(child)
+                }
+            }
+
+            guard let privateData = _XMLNodeGetPrivateData(node) else { return }
+            _XMLNodeSetPrivateData(node, nil)
+            let wrapper = Unmanaged<XMLNode>.fromOpaque(privateData)
+            let object = wrapper.takeUnretainedValue()
+            object._xmlNode = nil
+            object._xmlDocument = nil
+            object._childNodes.removeAll()
+            wrapper.release()
+        }
+
+        release(_XMLNodePtr(doc))
+        _XMLFreeDocument(doc)
+    }
+
+    /// Called by every mutating API before it changes the node: traps on frozen nodes and drops cached structural hashes up to the root.
+    internal func _willMutate() {
+        precondition(!isFrozen, "Nodes of a frozen document cannot be modified")
+        _XMLNodeInvalidateStructuralHash(_xmlNode)
+    }
+
+    /// Runs a change that adds, removes or edits node, keeping the document's key indexes current: the affected elements lose their entries before the change and get them back afterwards if they are still in the document. An attribute stands for its element, otherwise the descendants of node are revisited too unless only node itself changes.
+    internal func _updatingKeyIndexes<R>(of node: _XMLNodePtr, in parent: _XMLNodePtr? = nil, descendants: Bool = true, _ change: () throws -> R) rethrows -> R {
+        let isAttribute = _XMLNodeGetType(node) == _kXMLTypeAttribute
+        guard let target = isAttribute ? (parent ?? _XMLNodeGetParent(node)) : Optional(node) else {
+            return try change()
+        }
+
+        XMLDocument._removeKeys(of: target, descendants: descendants && !isAttribute)
+        let result = try change()
+        XMLDocument._addKeys(of: target, descendants: descendants && !isAttribute)
+        return result
+    }
+
     // libxml2 believes any node can have children, though XMLNode disagrees.
     // Nevertheless, this belongs here so that XMLElement and XMLDocument can share
     // the same implementation.
     internal func _insertChild(_ child: XMLNode, atIndex index: Int) {
+        _willMutate()
         precondition(index >= 0)
         precondition(index <= childCount)
         precondition(child.parent == nil)
 
-        _childNodes.insert(child)
-
-        if index == 0 {
-            let first = _XMLNodeGetFirstChild(_xmlNode)!
-            _XMLNodeAddPrevSibling(first, child._xmlNode)
-        } else {
-            let currChild = self.child(at: index - 1)!._xmlNode
-            _XMLNodeAddNextSibling(currChild!, child._xmlNode)
+        let linked = _updatingKeyIndexes(of: child._xmlNode, in: _xmlNode) { () -> Bool in
+            if index == 0 {
+                let first = _XMLNodeGetFirstChild(_xmlNode)!
+                return _XMLNodeAddPrevSibling(first, child._xmlNode)
+            } else {
+                let currChild = self.child(at: index - 1)!._xmlNode
+                return _XMLNodeAddNextSibling(currChild!, child._xmlNode)
+            }
+        }
+        // Text next to text is merged into the neighbouring node; child itself stays detached.
+        if linked {
+            _childNodes.insert(child)
         }
     }
 
     // see above
     internal func _insertChildren(_ children: [XMLNode], atIndex index: Int) {
-        for (childIndex, node) in children.enumerated() {
-            _insertChild(node, atIndex: index + childIndex)
+        var position = index
+        for node in children {
+            _insertChild(node, atIndex: position)
+            if node.parent != nil {
+                position += 1
+            }
         }
     }
 
@@ -898,16 +1055,20 @@ open class XMLNode: NSObject, NSCopying {
      */
     // See above!
     internal func _removeChildAtIndex(_ index: Int) {
+        _willMutate()
         guard let child = child(at: index) else {
             fatalError("index out of bounds")
         }
 
         _childNodes.remove(child)
-        _XMLUnlinkNode(child._xmlNode)
+        _updatingKeyIndexes(of: child._xmlNode) {
+            _XMLUnlinkNode(child._xmlNode)
+        }
     }
 
     // see above
     internal func _setChildren(_ children: [XMLNode]?) {
+        _willMutate()
         _removeAllChildren()
         guard let children = children else {
             return
@@ -924,10 +1085,16 @@ open class XMLNode: NSObject, NSCopying {
      */
     // see above
     internal func _addChild(_ child: XMLNode) {
+        _willMutate()
         precondition(child.parent == nil)
 
-        _XMLNodeAddChild(_xmlNode, child._xmlNode)
-        _childNodes.insert(child)
+        let linked = _updatingKeyIndexes(of: child._xmlNode, in: _xmlNode) {
+            _XMLNodeAddChild(_xmlNode, child._xmlNode)
+        }
+        // Text next to text is merged into the neighbouring node; child itself stays detached.
+        if linked {
+            _childNodes.insert(child)
+        }
     }
 
     /*!
@@ -936,9 +1103,14 @@ open class XMLNode: NSObject, NSCopying {
      */
     // see above
     internal func _replaceChildAtIndex(_ index: Int, withNode node: XMLNode) {
+        _willMutate()
         let child = self.child(at: index)!
         _childNodes.remove(child)
-        _XMLNodeReplaceNode(child._xmlNode, node._xmlNode)
+        _updatingKeyIndexes(of: node._xmlNode, in: _xmlNode) {
+            _updatingKeyIndexes(of: child._xmlNode) {
+                _XMLNodeReplaceNode(child._xmlNode, node._xmlNode)
+            }
+        }
         _childNodes.insert(node)
     }
 }
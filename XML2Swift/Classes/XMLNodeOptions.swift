@@ -1,5 +1,4 @@
 import Foundation
-import ObjectiveC
 
 extension XMLNode {
 
@@ -0,0 +1,240 @@
+//
+//  XMLNodeRef.swift
+//  XML2Swift
+//
+//  Created by igork on 10/19/26.
+//
+
+import Foundation
+
+/*!
+ @struct XMLNodeRef
+ @abstract A read-only handle to a node of a libxml2 tree that does not create an XMLNode wrapper.
+ @discussion Navigating with XMLNodeRef touches only the underlying xmlNode pointers, so walking a document allocates nothing per node; strings are copied only when name, stringValue and similar accessors are called. The handle keeps the owning document alive. Use node to get the full XMLNode when needed. A handle is invalidated when its node is removed from the tree and freed, exactly like a raw xmlNodePtr.
+ */
+public struct XMLNodeRef {
+    internal let _xmlNode: _XMLNodePtr
+    internal let _owner: XMLNode
+
+    internal init(_ node: _XMLNodePtr, owner: XMLNode) {
+        _xmlNode = node
+        _owner = owner
+    }
+
+    /*!
+     @method document
+     @abstract The document the node belongs to, or nil for a node created outside of any document.
+     */
+    public var document: XMLDocument? {
+        return _owner as? XMLDocument
+    }
+
+    /*!
+     @method node
+     @abstract The XMLNode wrapping this node, created on first use.
+     */
+    public var node: XMLNode {
+        return XMLNode._objectNodeForNode(_xmlNode)
+    }
+
+    public var kind: XMLNode.Kind {
+        return XMLNode._kind(of: _xmlNode)
+    }
+
+    /*!
+     @method name
+     @abstract The node's name, with the same rules as -[XMLNode name].
+     */
+    public var name: String? {
+        switch kind {
+        case .comment, .text:
+            return nil
+        case .namespace:
+            return _string(from: _XMLNamespaceGetPrefixSpan(_xmlNode)) ?? ""
+        default:
+            return _qualifiedName(of: _xmlNode)
+        }
+    }
+
+    public var localName: String? {
+        return _string(from: _XMLNodeGetLocalNameSpan(_xmlNode))
+    }
+
+    /*!
+     @method stringValue
+     @abstract The text content of the node. For elements and documents it is the concatenated text of all descendants.
+     */
+    public var stringValue: String? {
+        return _string(from: _XMLNodeCopyContentSpan(_xmlNode))
+    }
+
+    public var parent: XMLNodeRef? {
+        return _XMLNodeGetParent(_xmlNode).map { XMLNodeRef($0, owner: _owner) }
+    }
+
+    public var nextSibling: XMLNodeRef? {
+        return _XMLNodeGetNextSibling(_xmlNode).map { XMLNodeRef($0, owner: _owner) }
+    }
+
+    public var firstChild: XMLNodeRef? {
+        return _XMLNodeGetFirstChild(_xmlNode).map { XMLNodeRef($0, owner: _owner) }
+    }
+
+    /*!
+     @method children
+     @abstract The node's children in document order, excluding attributes and namespaces.
+     */
+    public var children: Siblings {
+        return Siblings(first: _XMLNodeGetFirstChild(_xmlNode), owner: _owner)
+    }
+
+    /*!
+     @method descendants
+     @abstract Every node below this one in document order, excluding attributes and namespaces. The walk follows the tree's own links and keeps no stack.
+     */
+    public var descendants: Descendants {
+        return Descendants(root: _xmlNode, owner: _owner)
+    }
+
+    /*!
+     @method attributes
+     @abstract The element's attribute nodes. Empty for other kinds of nodes.
+     */
+    public var attributes: Siblings {
+        guard kind == .element else {
+            return Siblings(first: nil, owner: _owner)
+        }
+        return Siblings(first: _XMLNodeProperties(_xmlNode), owner: _owner)
+    }
+
+    /*!
+     @method attributeValue:
+     @abstract Returns the value of the attribute with the given name, or nil if the element has no such attribute.
+     */
+    public func attributeValue(forName name: String) -> String? {
+        guard kind == .element, let attribute = _XMLNodeHasProp(_xmlNode, name, nil) else {
+            return nil
+        }
+        return XMLNodeRef(attribute, owner: _owner).stringValue
+    }
+
+    /*!
+     @method element:
+     @abstract Returns the first child element with the given name.
+     */
+    public func element(forName name: String) -> XMLNodeRef? {
+        return _XMLNodeFindElement(_XMLNodeGetFirstChild(_xmlNode), name).map { XMLNodeRef($0, owner: _owner) }
+    }
+
+    /*!
+     @method elements:
+     @abstract Returns the child elements with the given name.
+     */
+    public func elements(forName name: String) -> [XMLNodeRef] {
+        var result: [XMLNodeRef] = []
+        var next = _XMLNodeFindElement(_XMLNodeGetFirstChild(_xmlNode), name)
+        while let element = next {
+            result.append(XMLNodeRef(element, owner: _owner))
+            next = _XMLNodeFindElement(_XMLNodeGetNextSibling(element), name)
+        }
+        return result
+    }
+
+    /*!
+     @method nodesForXPath:
+     @abstract Returns the nodes matched by an XPath evaluated with this node as the context item, without wrapping them.
+     */
+    public func nodes(forXPath xpath: String) throws -> [XMLNodeRef] {
+        var count = 0
+        guard let nodes = _XMLNodesForXPath(_xmlNode, xpath, &count) else {
+            return []
+        }
+        defer {
+            free(nodes)
+        }
+
+        return UnsafeBufferPointer(start: nodes, count: count).map { XMLNodeRef($0, owner: _owner) }
+    }
+}
+
+extension XMLNodeRef {
+    /// The nodes linked through `next` starting at one node: children or attributes.
+    public struct Siblings: Sequence {
+        fileprivate let first: _XMLNodePtr?
+        fileprivate let owner: XMLNode
+
+        public struct Iterator: IteratorProtocol {
+            fileprivate var pending: _XMLNodePtr?
+            fileprivate let owner: XMLNode
+
+            public mutating func next() -> XMLNodeRef? {
+                guard let node = pending else { return nil }
+                pending = _XMLNodeGetNextSibling(node)
+                return XMLNodeRef(node, owner: owner)
+            }
+        }
+
+        public func makeIterator() -> Iterator {
+            return Iterator(pending: first, owner: owner)
+        }
+    }
+
+    /// A pre-order walk of a subtree that climbs back up through `parent` instead of keeping a stack.
+    public struct Descendants: Sequence {
+        fileprivate let root: _XMLNodePtr
+        fileprivate let owner: XMLNode
+
+        public struct Iterator: IteratorProtocol {
+            fileprivate let root: _XMLNodePtr
+            fileprivate var current: _XMLNodePtr?
+            fileprivate let owner: XMLNode
+
+            public mutating func next() -> XMLNodeRef? {
+                guard let node = current else { return nil }
+
+                // An entity reference shares the declaration's children, whose parent links lead
+                // out of the subtree, and DTD declarations are not part of the tree proper.
+                let type = _XMLNodeGetType(node)
+                if type != _kXMLTypeEntityReference && type != _kXMLTypeDTD, let child = _XMLNodeGetFirstChild(node) {
+                    current = child
+                } else {
+                    var cursor: _XMLNodePtr? = node
+                    current = nil
+                    while let candidate = cursor, candidate != root {
+                        if let sibling = _XMLNodeGetNextSibling(candidate) {
+                            current = sibling
+                            break
+                        }
+                        cursor = _XMLNodeGetParent(candidate)
+                    }
+                }
+
+                return XMLNodeRef(node, owner: owner)
+            }
+        }
+
+        public func makeIterator() -> Iterator {
+            return Iterator(root: root, current: _XMLNodeGetFirstChild(root), owner: owner)
+        }
+    }
+}
+
+extension XMLNodeRef: Hashable {
+    public static func == (lhs: XMLNodeRef, rhs: XMLNodeRef) -> Bool {
+        return lhs._xmlNode == rhs._xmlNode
+    }
+
+    public func hash(into hasher: inout Hasher) {
+        hasher.combine(_xmlNode)
+    }
+}
+
+extension XMLNode {
+    /*!
+     @method nodeRef
+     @abstract A lightweight handle to this node for allocation-free reading, see XMLNodeRef.
+     */
+    public var nodeRef: XMLNodeRef {
+        return XMLNodeRef(_xmlNode, owner: _xmlDocument ?? self)
+    }
+}
@@ -0,0 +1,158 @@
+//
+//  XMLSchema.swift
+//  XML2Swift
+//
+//  Created by igork on 10/19/26.
+//
+
+import Foundation
+
+/*!
+ @class XMLSchema
+ @abstract A compiled W3C XML Schema.
+ @discussion A schema is immutable once compiled and may be shared by any number of threads. Every thread validates with its own lightweight validation context, created the first time that thread uses the schema. Use schema(contentsOf:) to pay the compilation cost once per process.
+ */
+open class XMLSchema {
+    internal let _xmlSchema: _XMLSchemaPtr
+
+    public enum ValidationError: Error {
+        /// The document is not valid, but libxml2 reported nothing that describes why.
+        case invalid
+    }
+
+    internal class var _kind: Int {
+        return _kXMLSchemaKindXSD
+    }
+
+    internal init(kind: Int, data: Data, url: URL?) throws {
+        _SetupXMLParser()
+        var error = _XMLError()
+        let parsed = data.withUnsafeBytes { (bytes: UnsafeRawBufferPointer) in
+            _XMLSchemaCreateWithBytes(kind, bytes.baseAddress?.assumingMemoryBound(to: UInt8.self), bytes.count, url?.absoluteString, &error)
+        }
+        guard let schema = parsed else {
+            throw _parserError(error)
+        }
+        _xmlSchema = schema
+    }
+
+    internal required init(kind: Int, url: URL) throws {
+        _SetupXMLParser()
+        var error = _XMLError()
+
+        guard let schema = _XMLSchemaCreateWithURL(kind, url.absoluteString, &error) else {
+            throw _parserError(error)
+        }
+        _xmlSchema = schema
+    }
+
+    /*!
+     @method initWithData:URL:error:
+     @abstract Compiles a schema from data. The URL, if given, is used to resolve includes and imports.
+     */
+    public convenience init(data: Data, url: URL? = nil) throws {
+        try self.init(kind: _kXMLSchemaKindXSD, data: data, url: url)
+    }
+
+    /*!
+     @method initWithContentsOfURL:error:
+     @abstract Compiles the schema at a URL.
+     */
+    public convenience init(contentsOf url: URL) throws {
+        try self.init(kind: _kXMLSchemaKindXSD, url: url)
+    }
+
+    deinit {
+        _XMLSchemaFree(_xmlSchema)
+    }
+
+    private static var _compiledSchemas: [String: XMLSchema] = [:]
+    private static let _compiledSchemasLock = NSLock()
+
+    /*!
+     @method schemaWithContentsOfURL:error:
+     @abstract Returns the schema at a URL, compiling it only the first time it is requested in this process.
+     */
+    open class func schema(contentsOf url: URL) throws -> XMLSchema {
+        let key = "\(_kind):\(url.absoluteString)"
+
+        _compiledSchemasLock.lock()
+        defer { _compiledSchemasLock.unlock() }
+
+        if let schema = _compiledSchemas[key] {
+            return schema
+        }
+
+        let schema = try self.init(kind: _kind, url: url)
+        _compiledSchemas[key] = schema
+        return schema
+    }
+
+    /*!
+     @method validateDocument:error:
+     @abstract Validates a parsed document against this schema.
+     */
+    open func validate(_ document: XMLDocument) throws {
+        var error = _XMLError()
+        if !_XMLSchemaValidateDocument(_xmlSchema, _XMLDocPtr(document._xmlNode), &error) {
+            guard error.message.0 != 0 else {
+                throw ValidationError.invalid
+            }
+            throw _parserError(error)
+        }
+    }
+
+    /*!
+     @method validateStream:error:
+     @abstract Validates a document while it is being read, without building a tree. Memory use is bounded by the document's depth rather than its size.
+     */
+    open func validate(stream: InputStream) throws {
+        let context = _XMLInputStreamContext(stream: stream)
+        var error = _XMLError()
+
+        let valid = context.withOpaquePointer {
+            return _XMLSchemaValidateIO(_xmlSchema, _XMLInputStreamRead, _XMLInputStreamClose, $0, &error)
+        }
+
+        if !valid {
+            guard error.message.0 != 0 else {
+                throw ValidationError.invalid
+            }
+            throw _parserError(error)
+        }
+    }
+
+    /*!
+     @method validateData:error:
+     @abstract Validates serialized XML without building a tree.
+     */
+    open func validate(data: Data) throws {
+        try validate(stream: DataInputStream(withData: data))
+    }
+}
+
+/*!
+ @class XMLRelaxNG
+ @abstract A compiled RELAX NG schema. Shares its threading and caching behavior with XMLSchema.
+ */
+open class XMLRelaxNG: XMLSchema {
+    internal override class var _kind: Int {
+        return _kXMLSchemaKindRelaxNG
+    }
+
+    /*!
+     @method initWithData:URL:error:
+     @abstract Compiles a RELAX NG schema from data. The URL, if given, is used to resolve includes and external references.
+     */
+    public convenience init(data: Data, url: URL? = nil) throws {
+        try self.init(kind: _kXMLSchemaKindRelaxNG, data: data, url: url)
+    }
+
+    /*!
+     @method initWithContentsOfURL:error:
+     @abstract Compiles the RELAX NG schema at a URL.
+     */
+    public convenience init(contentsOf url: URL) throws {
+        try self.init(kind: _kXMLSchemaKindRelaxNG, url: url)
+    }
+}
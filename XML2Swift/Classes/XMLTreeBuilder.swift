@@ -0,0 +1,129 @@
+//
+//  XMLTreeBuilder.swift
+//  XML2Swift
+//
+//  Created by igork on 10/19/26.
+//
+
+import Foundation
+
+/*!
+ @struct XMLTreeBuilder
+ @abstract Describes a subtree as a compact instruction buffer that is turned into libxml2 nodes by a single call.
+ @discussion Unlike building with XMLElement(name:), addChild and addAttribute, no wrapper is created for the nodes inside the subtree and nothing is checked per step: attribute names must be unique per element and adjacent text is not merged. Strings must not contain NUL characters, which XML does not allow anyway; appending one is a precondition failure.
+ */
+public struct XMLTreeBuilder {
+    public enum BuildError: Error {
+        /// libxml2 could not create one of the described nodes; nothing was inserted.
+        case nodeCreationFailed
+    }
+
+    internal var _instructions: [UInt8] = []
+    internal var _topLevelCount = 0
+    private var _depth = 0
+
+    public init() {
+    }
+
+    /*!
+     @method element:attributes:content:
+     @abstract Appends an element whose children are added by content.
+     */
+    public mutating func element(_ name: String, attributes: KeyValuePairs<String, String> = [:], content: (inout XMLTreeBuilder) throws -> Void = { _ in }) rethrows {
+        _appendNode(_kXMLBuildOpStartElement, name)
+        for (attributeName, value) in attributes {
+            _append(_kXMLBuildOpAttribute, attributeName, value)
+        }
+
+        _depth += 1
+        try content(&self)
+        _depth -= 1
+        _instructions.append(UInt8(_kXMLBuildOpEndElement.rawValue))
+    }
+
+    /*!
+     @method element:attributes:stringValue:
+     @abstract Appends an element holding a single text node.
+     */
+    public mutating func element(_ name: String, attributes: KeyValuePairs<String, String> = [:], stringValue: String) {
+        element(name, attributes: attributes) { $0.text(stringValue) }
+    }
+
+    public mutating func text(_ string: String) {
+        _appendNode(_kXMLBuildOpText, string)
+    }
+
+    public mutating func cdata(_ string: String) {
+        _appendNode(_kXMLBuildOpCData, string)
+    }
+
+    public mutating func comment(_ string: String) {
+        _appendNode(_kXMLBuildOpComment, string)
+    }
+
+    private mutating func _appendNode(_ op: _XMLBuildOp, _ string: String) {
+        if _depth == 0 {
+            _topLevelCount += 1
+        }
+        _append(op, string)
+    }
+
+    private mutating func _append(_ op: _XMLBuildOp, _ strings: String...) {
+        _instructions.append(UInt8(op.rawValue))
+        for string in strings {
+            let utf8 = string.utf8
+            precondition(!utf8.contains(0), "XMLTreeBuilder strings must not contain NUL characters")
+            withUnsafeBytes(of: UInt32(utf8.count)) { _instructions.append(contentsOf: $0) }
+            _instructions.append(contentsOf: utf8)
+            _instructions.append(0)
+        }
+    }
+
+    internal func _build(parent: _XMLNodePtr?, document: _XMLDocPtr?) -> _XMLNodePtr? {
+        return _instructions.withUnsafeBufferPointer {
+            _XMLBuildTree(parent, document, $0.baseAddress!, $0.count)
+        }
+    }
+}
+
+extension XMLElement {
+    /*!
+     @method initWithDocument:building:
+     @abstract Creates the element described by body, which must add exactly one top-level element. Only the returned element is wrapped.
+     @discussion When document is given the nodes are created for it, so their names are interned in its dictionary, but the element is not inserted anywhere. Throws <tt>XMLTreeBuilder.BuildError</tt> if libxml2 fails to create a node.
+     */
+    public convenience init(document: XMLDocument? = nil, building body: (inout XMLTreeBuilder) throws -> Void) throws {
+        var builder = XMLTreeBuilder()
+        try body(&builder)
+        precondition(builder._topLevelCount == 1 && builder._instructions.first == UInt8(_kXMLBuildOpStartElement.rawValue),
+                     "The builder must describe exactly one element")
+
+        guard let node = builder._build(parent: nil, document: document.map { _XMLDocPtr($0._xmlNode) }) else {
+            throw XMLTreeBuilder.BuildError.nodeCreationFailed
+        }
+        self.init(ptr: node)
+    }
+
+    /*!
+     @method appendChildrenBuilding:
+     @abstract Appends the nodes described by body after the element's existing children without wrapping any of them.
+     @discussion If libxml2 fails to create a node, the nodes already appended are removed again and <tt>XMLTreeBuilder.BuildError</tt> is thrown.
+     */
+    public func appendChildren(building body: (inout XMLTreeBuilder) throws -> Void) throws {
+        _willMutate()
+
+        var builder = XMLTreeBuilder()
+        try body(&builder)
+        guard !builder._instructions.isEmpty else { return }
+
+        guard let first = builder._build(parent: _xmlNode, document: nil) else {
+            throw XMLTreeBuilder.BuildError.nodeCreationFailed
+        }
+
+        var nextNode: _XMLNodePtr? = first
+        while let node = nextNode {
+            XMLDocument._addKeys(of: node, descendants: true)
+            nextNode = _XMLNodeGetNextSibling(node)
+        }
+    }
+}
@@ -0,0 +1,377 @@
+//
+//  XMLXPath.swift
+//  XML2Swift
+//
+//  Created by igork on 10/19/26.
+//
+
+import Foundation
+
+/*!
+ @enum XMLXPathResult
+ @abstract The typed value of an XPath expression evaluated with evaluate(xpath:).
+ @discussion Scalar results such as count(//Entry) or string(/a/@b) are read straight from the libxml2 result, so no node is copied or wrapped. A node set keeps the libxml2 result alive and wraps a node only when it is accessed.
+ */
+public enum XMLXPathResult {
+    case nodes(Nodes)
+    case number(Double)
+    case string(String)
+    case boolean(Bool)
+
+    /*!
+     @class Nodes
+     @abstract The nodes matched by an expression, in document order. Each subscript access wraps one node; use refs to read them without wrapping at all.
+     @discussion Like XMLNodeRef, the collection keeps the owning document alive but is invalidated when a matched node is removed from the tree and freed.
+     */
+    public struct Nodes: RandomAccessCollection {
+        fileprivate let _result: _Result
+
+        public var startIndex: Int {
+            return 0
+        }
+
+        public var endIndex: Int {
+            return _result.count
+        }
+
+        public subscript(position: Int) -> XMLNode {
+            precondition(indices.contains(position), "Index out of range")
+            return XMLNode._objectNodeForNode(_XMLXPathObjectGetNode(_result.object, position))
+        }
+
+        /*!
+         @method refs
+         @abstract The matched nodes as XMLNodeRef handles, which never create a wrapper.
+         */
+        public var refs: LazyMapCollection<Range<Int>, XMLNodeRef> {
+            let result = _result
+            return indices.lazy.map { XMLNodeRef(_XMLXPathObjectGetNode(result.object, $0), owner: result.owner) }
+        }
+    }
+
+    /// Owns the libxml2 result object and the document its nodes belong to.
+    fileprivate final class _Result {
+        let object: _XMLXPathObjectPtr
+        let owner: XMLNode
+        let count: Int
+
+        init(object: _XMLXPathObjectPtr, owner: XMLNode) {
+            self.object = object
+            self.owner = owner
+            self.count = _XMLXPathObjectGetNodeCount(object)
+        }
+
+        deinit {
+            _XMLXPathObjectFree(object)
+        }
+    }
+
+    /// The node set, or an empty array for scalar results.
+    public var nodes: [XMLNode] {
+        if case let .nodes(nodes) = self {
+            return Array(nodes)
+        }
+        return []
+    }
+}
+
+extension XMLNode {
+    /*!
+     @method evaluateXPath:error:
+     @abstract Evaluates an XPath expression with this node as the context item and returns its typed value. Throws when the expression is invalid.
+     @discussion Aggregate expressions like count(), sum() or boolean tests allocate nothing beyond the result. Other result types, which XPath 1.0 expressions do not produce, come back as an empty string.
+     */
+    public func evaluate(xpath: String) throws -> XMLXPathResult {
+        var error = _XMLError()
+        guard let object = _XMLEvaluateXPath(_xmlNode, xpath, &error) else {
+            throw _parserError(error)
+        }
+
+        switch _XMLXPathObjectGetType(object) {
+        case _kXMLXPathResultNodeSet:
+            return .nodes(XMLXPathResult.Nodes(_result: XMLXPathResult._Result(object: object, owner: _xmlDocument ?? self)))
+        case _kXMLXPathResultBoolean:
+            defer { _XMLXPathObjectFree(object) }
+            return .boolean(_XMLXPathObjectGetBoolean(object))
+        case _kXMLXPathResultNumber:
+            defer { _XMLXPathObjectFree(object) }
+            return .number(_XMLXPathObjectGetNumber(object))
+        default:
+            defer { _XMLXPathObjectFree(object) }
+            return .string(String(cString: _XMLXPathObjectGetString(object)))
+        }
+    }
+}
+
+/*!
+ @class XMLXPathBatch
+ @abstract A set of XPath expressions compiled once and evaluated against many documents on all cores.
+ @discussion Documents are split between workers, each with its own XPath context that is reused for every document it evaluates, so a batch compiles each expression once and creates one context per worker instead of one per call. Results hold no nodes: node sets are reduced to the string values of the matched nodes. Documents passed in must not be mutated while a batch runs; frozen documents are ideal.
+ */
+public final class XMLXPathBatch {
+    /// The value of one expression for one document.
+    public enum Value: Equatable {
+        case number(Double)
+        case string(String)
+        case boolean(Bool)
+        /// The string values of the matched nodes, in document order.
+        case strings([String])
+    }
+
+    /*!
+     @struct Results
+     @abstract The values of every expression for every document, stored in one flat array with a row per document.
+     */
+    public struct Results: RandomAccessCollection {
+        public let expressionCount: Int
+        fileprivate var _values: [Value]
+        fileprivate var _errors: [Error?]
+
+        public var startIndex: Int {
+            return 0
+        }
+
+        public var endIndex: Int {
+            return _errors.count
+        }
+
+        /// The values of the document at position in the order of the expressions, or nil if it could not be parsed or evaluated.
+        public subscript(position: Int) -> ArraySlice<Value>? {
+            guard _errors[position] == nil else {
+                return nil
+            }
+            return _values[position * expressionCount..<(position + 1) * expressionCount]
+        }
+
+        /// Why the document at position has no values.
+        public func error(at position: Int) -> Error? {
+            return _errors[position]
+        }
+    }
+
+    public enum BatchError: Error {
+        /// The data could not be parsed as a document.
+        case invalidDocument
+        /// The expression at the given position could not be evaluated against the document.
+        case evaluationFailed(expression: Int)
+    }
+
+    public let expressions: [String]
+    private let _namespaces: [(prefix: String, uri: String)]
+    private let _compiled: [_XMLXPathCompiledPtr]
+
+    /*!
+     @method initWithExpressions:namespaces:error:
+     @abstract Compiles expressions. Prefixes used in them are resolved with namespaces, which maps prefixes to URIs, rather than with the declarations of each document.
+     */
+    public init(_ expressions: [String], namespaces: [String: String] = [:]) throws {
+        _SetupXMLParser()
+        var compiled: [_XMLXPathCompiledPtr] = []
+        for xpath in expressions {
+            var error = _XMLError()
+            guard let expression = _XMLXPathCompile(xpath, &error) else {
+                compiled.forEach(_XMLXPathCompiledFree)
+                throw _parserError(error)
+            }
+            compiled.append(expression)
+        }
+
+        self.expressions = expressions
+        _namespaces = namespaces.map { ($0.key, $0.value) }
+        _compiled = compiled
+    }
+
+    deinit {
+        _compiled.forEach(_XMLXPathCompiledFree)
+    }
+
+    /*!
+     @method evaluateDocuments:concurrency:
+     @abstract Evaluates every expression with each document's root as the context item.
+     */
+    public func evaluate(_ documents: [XMLDocument], concurrency: Int = ProcessInfo.processInfo.activeProcessorCount) -> Results {
+        return _evaluate(count: documents.count, concurrency: concurrency) { context, index, row in
+            let document = documents[index]
+            guard let root = _XMLDocRootElement(_XMLDocPtr(document._xmlNode)) else {
+                throw BatchError.invalidDocument
+            }
+            try self._evaluate(context, root, &row)
+        }
+    }
+
+    /*!
+     @method evaluateData:options:concurrency:
+     @abstract Parses each document on a worker, evaluates every expression and frees it before moving on, so at most one document per worker is in memory.
+     */
+    public func evaluate(_ documents: [Data], options mask: XMLNode.Options = [], concurrency: Int = ProcessInfo.processInfo.activeProcessorCount) -> Results {
+        return _evaluate(count: documents.count, concurrency: concurrency) { context, index, row in
+            let parsed = documents[index].withUnsafeBytes { (bytes: UnsafeRawBufferPointer) in
+                _XMLDocPtrFromBytesWithOptions(bytes.baseAddress?.assumingMemoryBound(to: UInt8.self), bytes.count, UInt32(mask.rawValue), nil)
+            }
+            guard let doc = parsed else {
+                throw BatchError.invalidDocument
+            }
+            defer { _XMLFreeDocument(doc) }
+            guard let root = _XMLDocRootElement(doc) else {
+                throw BatchError.invalidDocument
+            }
+            try self._evaluate(context, root, &row)
+        }
+    }
+
+    private func _evaluate(count: Int, concurrency: Int, _ body: (_XMLXPathContextPtr, Int, inout UnsafeMutableBufferPointer<Value>.SubSequence) throws -> Void) -> Results {
+        let width = _compiled.count
+        var values = [Value](repeating: .boolean(false), count: count * width)
+        var errors = [Error?](repeating: nil, count: count)
+        let workers = max(1, min(concurrency, count))
+
+        values.withUnsafeMutableBufferPointer { values in
+            errors.withUnsafeMutableBufferPointer { errors in
+                // Every worker writes only the rows of its own documents, so the buffers need no locking.
+                DispatchQueue.concurrentPerform(iterations: workers) { worker in
+                    let context = _withCStringArray(self._namespaces.map { $0.prefix }) { (prefixes, namespaceCount) in
+                        _withCStringArray(self._namespaces.map { $0.uri }) { (uris, _) in
+                            _XMLXPathContextCreate(prefixes, uris, namespaceCount)
+                        }
+                    }
+                    defer { _XMLXPathContextFree(context) }
+
+                    for index in stride(from: worker, to: count, by: workers) {
+                        var row = values[index * width..<(index + 1) * width]
+                        do {
+                            try body(context, index, &row)
+                        } catch {
+                            errors[index] = error
+                        }
+                    }
+                }
+            }
+        }
+
+        return Results(expressionCount: width, _values: values, _errors: errors)
+    }
+
+    private func _evaluate(_ context: _XMLXPathContextPtr, _ node: _XMLNodePtr, _ row: inout UnsafeMutableBufferPointer<Value>.SubSequence) throws {
+        for (i, compiled) in _compiled.enumerated() {
+            guard let object = _XMLXPathContextEvaluate(context, compiled, node) else {
+                throw BatchError.evaluationFailed(expression: i)
+            }
+            defer { _XMLXPathObjectFree(object) }
+
+            let value: Value
+            switch _XMLXPathObjectGetType(object) {
+            case _kXMLXPathResultNodeSet:
+                value = .strings((0..<_XMLXPathObjectGetNodeCount(object)).map { XMLXPathBatch._stringValue(of: _XMLXPathObjectGetNode(object, $0)) })
+            case _kXMLXPathResultBoolean:
+                value = .boolean(_XMLXPathObjectGetBoolean(object))
+            case _kXMLXPathResultNumber:
+                value = .number(_XMLXPathObjectGetNumber(object))
+            default:
+                value = .string(String(cString: _XMLXPathObjectGetString(object)))
+            }
+            row[row.startIndex + i] = value
+        }
+    }
+
+    private static func _stringValue(of node: _XMLNodePtr) -> String {
+        return _string(from: _XMLNodeCopyContentSpan(node)) ?? ""
+    }
+}
+
+/*!
+ @class XMLStreamingXPath
+ @abstract Evaluates a forward-only subset of XPath while a document is being parsed, so matches can be read from inputs far too large to load.
+ @discussion The subset is an absolute location path of child (/) and descendant (//) steps. Each step is an element name, a prefixed name, prefix:* or *, optionally followed by predicates of the form [@name] or [@name='value']. Unprefixed names match elements without a namespace, as in XPath 1.0; prefixes are resolved with the namespaces passed to the initializer. Only the currently open elements and the subtree of the current match are kept in memory.
+ */
+public final class XMLStreamingXPath {
+    private final class _Matcher {
+        let body: (XMLElement, inout Bool) throws -> Void
+        var error: Error?
+
+        init(_ body: @escaping (XMLElement, inout Bool) throws -> Void) {
+            self.body = body
+        }
+
+        /// Hands the root element of doc to body and reports whether the parse should go on.
+        func match(_ doc: _XMLDocPtr) -> Bool {
+            var stop = false
+            do {
+                try body(XMLDocument._objectNodeForNode(doc).rootElement()!, &stop)
+            } catch {
+                self.error = error
+                return false
+            }
+            return !stop
+        }
+    }
+
+    public let expression: String
+    private let _query: _XMLStreamQueryPtr
+
+    /*!
+     @method initWithExpression:namespaces:error:
+     @abstract Compiles xpath, throwing if it is outside the streamable subset.
+     */
+    public init(_ xpath: String, namespaces: [String: String] = [:]) throws {
+        var error = _XMLError()
+        let query = _withCStringArray(Array(namespaces.keys)) { (prefixes, count) in
+            _withCStringArray(Array(namespaces.values)) { (uris, _) in
+                _XMLStreamQueryCreate(xpath, prefixes, uris, count, &error)
+            }
+        }
+        guard let compiled = query else {
+            throw _parserError(error)
+        }
+
+        expression = xpath
+        _query = compiled
+    }
+
+    deinit {
+        _XMLStreamQueryFree(_query)
+    }
+
+    /*!
+     @method evaluateStream:options:usingBlock:error:
+     @abstract Parses stream and calls body with each matching element, in document order, as soon as its end tag has been read. Setting the Bool argument to true stops the parse.
+     @discussion Each element is the root of a document of its own, holding a copy of the matched subtree; namespaces declared on its ancestors are redeclared on it. That document is freed as soon as body returns, so the element and every node reached from it must not be used afterwards: keep a copy() instead. Elements nested in a match are matched as well. Errors thrown by body end the parse and are rethrown.
+     */
+    public func evaluate(stream: InputStream, options mask: XMLNode.Options = [], _ body: (XMLElement, inout Bool) throws -> Void) throws {
+        _SetupXMLParser()
+        let context = _XMLInputStreamContext(stream: stream)
+        var error = _XMLError()
+
+        let succeeded = try withoutActuallyEscaping(body) { body -> Bool in
+            let matcher = _Matcher(body)
+            let succeeded = context.withOpaquePointer { streamContext in
+                _XMLStreamQueryRun(self._query, _XMLInputStreamRead, _XMLInputStreamClose, streamContext, UInt32(mask.rawValue), { matchContext, doc in
+                    let matcher = Unmanaged<_Matcher>.fromOpaque(matchContext!).takeUnretainedValue()
+                    let proceed = matcher.match(doc!)
+                    XMLNode._freeLentDocument(doc!)
+                    return proceed
+                }, Unmanaged.passUnretained(matcher).toOpaque(), &error)
+            }
+            if let error = matcher.error {
+                throw error
+            }
+            return succeeded
+        }
+
+        if let streamError = (stream as? FailableInputStream)?.error {
+            throw streamError
+        }
+        guard succeeded else {
+            throw _parserError(error)
+        }
+    }
+
+    /*!
+     @method evaluateContentsOfURL:options:usingBlock:error:
+     @abstract Streams the file at url through evaluate(stream:options:_:).
+     */
+    public func evaluate(contentsOf url: URL, options mask: XMLNode.Options = [], _ body: (XMLElement, inout Bool) throws -> Void) throws {
+        let fileHandle = try FileHandle(forReadingFrom: url)
+        defer { fileHandle.closeFile() }
+        try evaluate(stream: FileInputStream(withFileHandle: fileHandle), options: mask, body)
+    }
+}
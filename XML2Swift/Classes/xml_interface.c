@@ -5,82 +5,115 @@
 //  Created by igork on 9/8/19.
 //
 
+#if !defined(__APPLE__) && !defined(_GNU_SOURCE)
+// glibc declares strtod_l only for GNU builds.
+#define _GNU_SOURCE
+#endif
+
 #include "xml_interface.h"
+#include <errno.h>
+#include <limits.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <libxml/xmlschemas.h>
+#include <libxml/relaxng.h>
+#include <libxml/xmlreader.h>
+#include <libxml/xmlwriter.h>
+#include <libxml/catalog.h>
+#include <libxml/uri.h>
+#include <libxml/HTMLparser.h>
+#include <libxml/HTMLtree.h>
+#include <libxml/SAX2.h>
+#include <zlib.h>
+#ifdef __APPLE__
+#include <mach/mach_time.h>
+#include <malloc/malloc.h>
+#include <xlocale.h>
+#else
+#include <malloc.h>
+#include <locale.h>
+#endif
 
 /*
  libxml2 does not have nullability annotations and does not import well into swift when given potentially differing versions of the library that might be installed on the host operating system. This is a simple C wrapper to simplify some of that interface layer to libxml2.
  */
 
-CFIndex _kXMLInterfaceRecover = XML_PARSE_RECOVER;
-CFIndex _kXMLInterfaceNoEnt = XML_PARSE_NOENT;
-CFIndex _kXMLInterfaceDTDLoad = XML_PARSE_DTDLOAD;
-CFIndex _kXMLInterfaceDTDAttr = XML_PARSE_DTDATTR;
-CFIndex _kXMLInterfaceDTDValid = XML_PARSE_DTDVALID;
-CFIndex _kXMLInterfaceNoError = XML_PARSE_NOERROR;
-CFIndex _kXMLInterfaceNoWarning = XML_PARSE_NOWARNING;
-CFIndex _kXMLInterfacePedantic = XML_PARSE_PEDANTIC;
-CFIndex _kXMLInterfaceNoBlanks = XML_PARSE_NOBLANKS;
-CFIndex _kXMLInterfaceSAX1 = XML_PARSE_SAX1;
-CFIndex _kXMLInterfaceXInclude = XML_PARSE_XINCLUDE;
-CFIndex _kXMLInterfaceNoNet = XML_PARSE_NONET;
-CFIndex _kXMLInterfaceNoDict = XML_PARSE_NODICT;
-CFIndex _kXMLInterfaceNSClean = XML_PARSE_NSCLEAN;
-CFIndex _kXMLInterfaceNoCdata = XML_PARSE_NOCDATA;
-CFIndex _kXMLInterfaceNoXIncnode = XML_PARSE_NOXINCNODE;
-CFIndex _kXMLInterfaceCompact = XML_PARSE_COMPACT;
-CFIndex _kXMLInterfaceOld10 = XML_PARSE_OLD10;
-CFIndex _kXMLInterfaceNoBasefix = XML_PARSE_NOBASEFIX;
-CFIndex _kXMLInterfaceHuge = XML_PARSE_HUGE;
-CFIndex _kXMLInterfaceOldsax = XML_PARSE_OLDSAX;
-CFIndex _kXMLInterfaceIgnoreEnc = XML_PARSE_IGNORE_ENC;
-CFIndex _kXMLInterfaceBigLines = XML_PARSE_BIG_LINES;
-
-CFIndex _kXMLTypeInvalid = 0;
-CFIndex _kXMLTypeDocument = XML_DOCUMENT_NODE;
-CFIndex _kXMLTypeElement = XML_ELEMENT_NODE;
-CFIndex _kXMLTypeAttribute = XML_ATTRIBUTE_NODE;
-CFIndex _kXMLTypeProcessingInstruction = XML_PI_NODE;
-CFIndex _kXMLTypeComment = XML_COMMENT_NODE;
-CFIndex _kXMLTypeText = XML_TEXT_NODE;
-CFIndex _kXMLTypeCDataSection = XML_CDATA_SECTION_NODE;
-CFIndex _kXMLTypeDTD = XML_DTD_NODE;
-CFIndex _kXMLDocTypeHTML = XML_DOC_HTML;
-CFIndex _kXMLTypeNamespace = 22; // libxml2 does not define namespaces as nodes, so we have to fake it
-
-CFIndex _kXMLDTDNodeTypeEntity = XML_ENTITY_DECL;
-CFIndex _kXMLDTDNodeTypeAttribute = XML_ATTRIBUTE_DECL;
-CFIndex _kXMLDTDNodeTypeElement = XML_ELEMENT_DECL;
-CFIndex _kXMLDTDNodeTypeNotation = XML_NOTATION_NODE;
-
-CFIndex _kXMLDTDNodeElementTypeUndefined = XML_ELEMENT_TYPE_UNDEFINED;
-CFIndex _kXMLDTDNodeElementTypeEmpty = XML_ELEMENT_TYPE_EMPTY;
-CFIndex _kXMLDTDNodeElementTypeAny = XML_ELEMENT_TYPE_ANY;
-CFIndex _kXMLDTDNodeElementTypeMixed = XML_ELEMENT_TYPE_MIXED;
-CFIndex _kXMLDTDNodeElementTypeElement = XML_ELEMENT_TYPE_ELEMENT;
-
-CFIndex _kXMLDTDNodeEntityTypeInternalGeneral = XML_INTERNAL_GENERAL_ENTITY;
-CFIndex _kXMLDTDNodeEntityTypeExternalGeneralParsed = XML_EXTERNAL_GENERAL_PARSED_ENTITY;
-CFIndex _kXMLDTDNodeEntityTypeExternalGeneralUnparsed = XML_EXTERNAL_GENERAL_UNPARSED_ENTITY;
-CFIndex _kXMLDTDNodeEntityTypeInternalParameter = XML_INTERNAL_PARAMETER_ENTITY;
-CFIndex _kXMLDTDNodeEntityTypeExternalParameter = XML_EXTERNAL_PARAMETER_ENTITY;
-CFIndex _kXMLDTDNodeEntityTypeInternalPredefined = XML_INTERNAL_PREDEFINED_ENTITY;
-
-CFIndex _kXMLDTDNodeAttributeTypeCData = XML_ATTRIBUTE_CDATA;
-CFIndex _kXMLDTDNodeAttributeTypeID = XML_ATTRIBUTE_ID;
-CFIndex _kXMLDTDNodeAttributeTypeIDRef = XML_ATTRIBUTE_IDREF;
-CFIndex _kXMLDTDNodeAttributeTypeIDRefs = XML_ATTRIBUTE_IDREFS;
-CFIndex _kXMLDTDNodeAttributeTypeEntity = XML_ATTRIBUTE_ENTITY;
-CFIndex _kXMLDTDNodeAttributeTypeEntities = XML_ATTRIBUTE_ENTITIES;
-CFIndex _kXMLDTDNodeAttributeTypeNMToken = XML_ATTRIBUTE_NMTOKEN;
-CFIndex _kXMLDTDNodeAttributeTypeNMTokens = XML_ATTRIBUTE_NMTOKENS;
-CFIndex _kXMLDTDNodeAttributeTypeEnumeration = XML_ATTRIBUTE_ENUMERATION;
-CFIndex _kXMLDTDNodeAttributeTypeNotation = XML_ATTRIBUTE_NOTATION;
-
-CFIndex _kXMLNodePreserveWhitespace = 1 << 25;
-CFIndex _kXMLNodeCompactEmptyElement = 1 << 2;
-CFIndex _kXMLNodePrettyPrint = 1 << 17;
-CFIndex _kXMLNodeLoadExternalEntitiesNever = 1 << 19;
-CFIndex _kXMLNodeLoadExternalEntitiesAlways = 1 << 14;
+_XMLIndex _kXMLInterfaceRecover = XML_PARSE_RECOVER;
+_XMLIndex _kXMLInterfaceNoEnt = XML_PARSE_NOENT;
+_XMLIndex _kXMLInterfaceDTDLoad = XML_PARSE_DTDLOAD;
+_XMLIndex _kXMLInterfaceDTDAttr = XML_PARSE_DTDATTR;
+_XMLIndex _kXMLInterfaceDTDValid = XML_PARSE_DTDVALID;
+_XMLIndex _kXMLInterfaceNoError = XML_PARSE_NOERROR;
+_XMLIndex _kXMLInterfaceNoWarning = XML_PARSE_NOWARNING;
+_XMLIndex _kXMLInterfacePedantic = XML_PARSE_PEDANTIC;
+_XMLIndex _kXMLInterfaceNoBlanks = XML_PARSE_NOBLANKS;
+_XMLIndex _kXMLInterfaceSAX1 = XML_PARSE_SAX1;
+_XMLIndex _kXMLInterfaceXInclude = XML_PARSE_XINCLUDE;
+_XMLIndex _kXMLInterfaceNoNet = XML_PARSE_NONET;
+_XMLIndex _kXMLInterfaceNoDict = XML_PARSE_NODICT;
+_XMLIndex _kXMLInterfaceNSClean = XML_PARSE_NSCLEAN;
+_XMLIndex _kXMLInterfaceNoCdata = XML_PARSE_NOCDATA;
+_XMLIndex _kXMLInterfaceNoXIncnode = XML_PARSE_NOXINCNODE;
+_XMLIndex _kXMLInterfaceCompact = XML_PARSE_COMPACT;
+_XMLIndex _kXMLInterfaceOld10 = XML_PARSE_OLD10;
+_XMLIndex _kXMLInterfaceNoBasefix = XML_PARSE_NOBASEFIX;
+_XMLIndex _kXMLInterfaceHuge = XML_PARSE_HUGE;
+_XMLIndex _kXMLInterfaceOldsax = XML_PARSE_OLDSAX;
+_XMLIndex _kXMLInterfaceIgnoreEnc = XML_PARSE_IGNORE_ENC;
+_XMLIndex _kXMLInterfaceBigLines = XML_PARSE_BIG_LINES;
+
+_XMLIndex _kXMLTypeInvalid = 0;
+_XMLIndex _kXMLTypeDocument = XML_DOCUMENT_NODE;
+_XMLIndex _kXMLTypeElement = XML_ELEMENT_NODE;
+_XMLIndex _kXMLTypeAttribute = XML_ATTRIBUTE_NODE;
+_XMLIndex _kXMLTypeProcessingInstruction = XML_PI_NODE;
+_XMLIndex _kXMLTypeComment = XML_COMMENT_NODE;
+_XMLIndex _kXMLTypeText = XML_TEXT_NODE;
+_XMLIndex _kXMLTypeCDataSection = XML_CDATA_SECTION_NODE;
+_XMLIndex _kXMLTypeDTD = XML_DTD_NODE;
+_XMLIndex _kXMLTypeEntityReference = XML_ENTITY_REF_NODE;
+_XMLIndex _kXMLDocTypeHTML = XML_DOC_HTML;
+_XMLIndex _kXMLTypeNamespace = 22; // libxml2 does not define namespaces as nodes, so we have to fake it
+
+_XMLIndex _kXMLDTDNodeTypeEntity = XML_ENTITY_DECL;
+_XMLIndex _kXMLDTDNodeTypeAttribute = XML_ATTRIBUTE_DECL;
+_XMLIndex _kXMLDTDNodeTypeElement = XML_ELEMENT_DECL;
+_XMLIndex _kXMLDTDNodeTypeNotation = XML_NOTATION_NODE;
+
+_XMLIndex _kXMLDTDNodeElementTypeUndefined = XML_ELEMENT_TYPE_UNDEFINED;
+_XMLIndex _kXMLDTDNodeElementTypeEmpty = XML_ELEMENT_TYPE_EMPTY;
+_XMLIndex _kXMLDTDNodeElementTypeAny = XML_ELEMENT_TYPE_ANY;
+_XMLIndex _kXMLDTDNodeElementTypeMixed = XML_ELEMENT_TYPE_MIXED;
+_XMLIndex _kXMLDTDNodeElementTypeElement = XML_ELEMENT_TYPE_ELEMENT;
+
+_XMLIndex _kXMLDTDNodeEntityTypeInternalGeneral = XML_INTERNAL_GENERAL_ENTITY;
+_XMLIndex _kXMLDTDNodeEntityTypeExternalGeneralParsed = XML_EXTERNAL_GENERAL_PARSED_ENTITY;
+_XMLIndex _kXMLDTDNodeEntityTypeExternalGeneralUnparsed = XML_EXTERNAL_GENERAL_UNPARSED_ENTITY;
+_XMLIndex _kXMLDTDNodeEntityTypeInternalParameter = XML_INTERNAL_PARAMETER_ENTITY;
+_XMLIndex _kXMLDTDNodeEntityTypeExternalParameter = XML_EXTERNAL_PARAMETER_ENTITY;
+_XMLIndex _kXMLDTDNodeEntityTypeInternalPredefined = XML_INTERNAL_PREDEFINED_ENTITY;
+
+_XMLIndex _kXMLDTDNodeAttributeTypeCData = XML_ATTRIBUTE_CDATA;
+_XMLIndex _kXMLDTDNodeAttributeTypeID = XML_ATTRIBUTE_ID;
+_XMLIndex _kXMLDTDNodeAttributeTypeIDRef = XML_ATTRIBUTE_IDREF;
+_XMLIndex _kXMLDTDNodeAttributeTypeIDRefs = XML_ATTRIBUTE_IDREFS;
+_XMLIndex _kXMLDTDNodeAttributeTypeEntity = XML_ATTRIBUTE_ENTITY;
+_XMLIndex _kXMLDTDNodeAttributeTypeEntities = XML_ATTRIBUTE_ENTITIES;
+_XMLIndex _kXMLDTDNodeAttributeTypeNMToken = XML_ATTRIBUTE_NMTOKEN;
+_XMLIndex _kXMLDTDNodeAttributeTypeNMTokens = XML_ATTRIBUTE_NMTOKENS;
+_XMLIndex _kXMLDTDNodeAttributeTypeEnumeration = XML_ATTRIBUTE_ENUMERATION;
+_XMLIndex _kXMLDTDNodeAttributeTypeNotation = XML_ATTRIBUTE_NOTATION;
+
+_XMLIndex _kXMLNodePreserveWhitespace = 1 << 25;
+_XMLIndex _kXMLNodeCompactEmptyElement = 1 << 2;
+_XMLIndex _kXMLNodePrettyPrint = 1 << 17;
+_XMLIndex _kXMLNodeLoadExternalEntitiesNever = 1 << 19;
+_XMLIndex _kXMLNodeLoadExternalEntitiesAlways = 1 << 14;
+_XMLIndex _kXMLDocumentTidyHTML = 1 << 9;
 
 // We define this structure because libxml2's "notation" node does not contain the fields
 // nearly all other libxml2 node fields contain, that we use extensively.
@@ -118,6 +151,23 @@ _XMLDTDNodePtr _Nullable _XMLDTDNewElementDesc(_XMLDTDPtr dtd, const unsigned ch
     return result;
 }
 
+static inline _XMLSpan _borrowedSpan(const xmlChar* _Nullable string) {
+    _XMLSpan span = { string, string != NULL ? strlen((const char*)string) : 0, false };
+    return span;
+}
+
+static inline _XMLSpan _ownedSpan(xmlChar* _Nullable string) {
+    _XMLSpan span = _borrowedSpan(string);
+    span.owned = string != NULL;
+    return span;
+}
+
+void _XMLSpanRelease(_XMLSpan span) {
+    if (span.owned) {
+        xmlFree((void*)span.bytes);
+    }
+}
+
 static inline void _removeHashEntry(xmlHashTablePtr table, const xmlChar* name, xmlNodePtr node);
 static inline void _removeHashEntry(xmlHashTablePtr table, const xmlChar* name, xmlNodePtr node) {
     if (xmlHashLookup(table, name) == node) {
@@ -203,8 +253,8 @@ void _XMLDocSetRootElement(_XMLDocPtr doc, _XMLNodePtr node) {
     xmlDocSetRootElement(doc, node);
 }
 
-CFStringRef _XMLDocCopyCharacterEncoding(_XMLDocPtr doc) {
-    return CFStringCreateWithCString(NULL, (const char*)((xmlDocPtr)doc)->encoding, kCFStringEncodingUTF8);
+_XMLSpan _XMLDocGetCharacterEncodingSpan(_XMLDocPtr doc) {
+    return _borrowedSpan(((xmlDocPtr)doc)->encoding);
 }
 
 void _XMLDocSetCharacterEncoding(_XMLDocPtr doc,  const unsigned char* _Nullable  encoding) {
@@ -217,8 +267,8 @@ void _XMLDocSetCharacterEncoding(_XMLDocPtr doc,  const unsigned char* _Nullable
     docPtr->encoding = xmlStrdup(encoding);
 }
 
-CFStringRef _XMLDocCopyVersion(_XMLDocPtr doc) {
-    return CFStringCreateWithCString(NULL, (const char*)((xmlDocPtr)doc)->version, kCFStringEncodingUTF8);
+_XMLSpan _XMLDocGetVersionSpan(_XMLDocPtr doc) {
+    return _borrowedSpan(((xmlDocPtr)doc)->version);
 }
 
 void _XMLDocSetVersion(_XMLDocPtr doc, const unsigned char* version) {
@@ -259,11 +309,53 @@ void _XMLDocSetDTD(_XMLDocPtr doc, _XMLDTDPtr _Nullable dtd) {
     }
 }
 
-CFIndex _XMLNodeGetElementChildCount(_XMLNodePtr node) {
+_XMLIndex _XMLNodeGetElementChildCount(_XMLNodePtr node) {
     return xmlChildElementCount(node);
 }
 
-void _XMLNodeAddChild(_XMLNodePtr node, _XMLNodePtr child) {
+// Links node between prev and next under parent, exactly where it is asked to go.
+static void _XMLLinkNode(xmlNodePtr _Nullable parent, xmlNodePtr _Nullable prev, xmlNodePtr node, xmlNodePtr _Nullable next) {
+    xmlDocPtr doc = parent != NULL ? parent->doc : prev != NULL ? prev->doc : next != NULL ? next->doc : node->doc;
+    if (node->doc != doc) {
+        xmlSetTreeDoc(node, doc);
+    }
+    node->parent = parent;
+    node->prev = prev;
+    node->next = next;
+    if (prev != NULL) {
+        prev->next = node;
+    } else if (parent != NULL) {
+        parent->children = node;
+    }
+    if (next != NULL) {
+        next->prev = node;
+    } else if (parent != NULL) {
+        parent->last = node;
+    }
+}
+
+// xmlAddChild and its siblings merge a text node into an adjacent text node and free it. The merge
+// is kept, but node is only copied into its neighbour and left unlinked, so that its wrapper does
+// not point at freed memory. Returns false when there was no text to merge with.
+static bool _XMLMergeTextNode(xmlNodePtr _Nullable prev, xmlNodePtr node, xmlNodePtr _Nullable next) {
+    if (node->type != XML_TEXT_NODE) {
+        return false;
+    }
+
+    if (prev != NULL && prev->type == XML_TEXT_NODE && prev->name == node->name) {
+        xmlNodeAddContent(prev, node->content);
+        return true;
+    }
+    if (next != NULL && next->type == XML_TEXT_NODE && next->name == node->name) {
+        xmlChar* content = xmlStrcat(xmlStrdup(node->content), next->content);
+        xmlNodeSetContent(next, content);
+        xmlFree(content);
+        return true;
+    }
+    return false;
+}
+
+bool _XMLNodeAddChild(_XMLNodePtr node, _XMLNodePtr child) {
     if (((xmlNodePtr)node)->type == XML_NOTATION_NODE) {// the "artificial" node we created
         if (((xmlNodePtr)node)->type == XML_DTD_NODE) {// the only circumstance under which this actually makes sense
             xmlNotationPtr notation = ((_XMLNotation*)child)->notation;
@@ -275,17 +367,47 @@ void _XMLNodeAddChild(_XMLNodePtr node, _XMLNodePtr child) {
             }
             xmlHashAddEntry(dtd->notations, notation->name, notation);
         }
-        return;
+        return true;
     }
-    xmlAddChild(node, child);
+    xmlNodePtr parent = (xmlNodePtr)node;
+    xmlNodePtr childPtr = (xmlNodePtr)child;
+    if (childPtr->type == XML_ATTRIBUTE_NODE) {
+        xmlAddChild(parent, childPtr);
+        return true;
+    }
+    if (_XMLMergeTextNode(parent->last, childPtr, NULL)) {
+        return false;
+    }
+    _XMLLinkNode(parent, parent->last, childPtr, NULL);
+    return true;
 }
 
-void _XMLNodeAddPrevSibling(_XMLNodePtr node, _XMLNodePtr prevSibling) {
-    xmlAddPrevSibling(node, prevSibling);
+bool _XMLNodeAddPrevSibling(_XMLNodePtr node, _XMLNodePtr prevSibling) {
+    xmlNodePtr nodePtr = (xmlNodePtr)node;
+    xmlNodePtr sibling = (xmlNodePtr)prevSibling;
+    if (nodePtr->type == XML_ATTRIBUTE_NODE || sibling->type == XML_ATTRIBUTE_NODE) {
+        xmlAddPrevSibling(nodePtr, sibling);
+        return true;
+    }
+    if (_XMLMergeTextNode(nodePtr->prev, sibling, nodePtr)) {
+        return false;
+    }
+    _XMLLinkNode(nodePtr->parent, nodePtr->prev, sibling, nodePtr);
+    return true;
 }
 
-void _XMLNodeAddNextSibling(_XMLNodePtr node, _XMLNodePtr nextSibling) {
-    xmlAddNextSibling(node, nextSibling);
+bool _XMLNodeAddNextSibling(_XMLNodePtr node, _XMLNodePtr nextSibling) {
+    xmlNodePtr nodePtr = (xmlNodePtr)node;
+    xmlNodePtr sibling = (xmlNodePtr)nextSibling;
+    if (nodePtr->type == XML_ATTRIBUTE_NODE || sibling->type == XML_ATTRIBUTE_NODE) {
+        xmlAddNextSibling(nodePtr, sibling);
+        return true;
+    }
+    if (_XMLMergeTextNode(nodePtr, sibling, nodePtr->next)) {
+        return false;
+    }
+    _XMLLinkNode(nodePtr->parent, nodePtr, sibling, nodePtr->next);
+    return true;
 }
 
 void _XMLNodeReplaceNode(_XMLNodePtr node, _XMLNodePtr replacement) {
@@ -308,7 +430,13 @@ _XMLNodePtr _XMLCopyNode(_XMLNodePtr node, bool recursive) {
     int recurse = recursive ? 1 : 0;
     switch (((xmlNodePtr)node)->type) {
         case XML_DOCUMENT_NODE:
-            return xmlCopyDoc(node, recurse);
+        {
+            xmlDocPtr copy = xmlCopyDoc(node, recurse);
+            if (copy != NULL) {
+                copy->properties |= ((xmlDocPtr)node)->properties & XML_DOC_HTML;
+            }
+            return copy;
+        }
 
         case XML_DTD_NODE:
             return xmlCopyDtd(node);
@@ -416,8 +544,8 @@ void _XMLNodeSetURI(_XMLNodePtr node, const unsigned char* URI) {
 
 
 
-_XMLDocPtr _XMLDocPtrFromDataWithOptions(CFDataRef data, unsigned int options) {
-    uint32_t xmlOptions = 0;
+static inline int _parseOptionsForNodeOptions(unsigned int options) {
+    int xmlOptions = 0;
 
     if ((options & _kXMLNodePreserveWhitespace) == 0) {
         xmlOptions |= XML_PARSE_NOBLANKS;
@@ -436,13 +564,72 @@ _XMLDocPtr _XMLDocPtrFromDataWithOptions(CFDataRef data, unsigned int options) {
     xmlOptions |= XML_PARSE_RECOVER;
     xmlOptions |= XML_PARSE_NSCLEAN;
 
-    return xmlReadMemory((const char*)CFDataGetBytePtr(data), CFDataGetLength(data), NULL, NULL, xmlOptions);
+    return xmlOptions;
+}
+
+static void _setErrorInfo(_XMLError* _Nullable error, int32_t code, const char* message) {
+    if (error == NULL) {
+        return;
+    }
+    error->code = code;
+    // libxml2 messages end with a newline that is of no use in an error description.
+    size_t length = strlen(message);
+    while (length > 0 && message[length - 1] == '\n') {
+        length--;
+    }
+    if (length >= sizeof(error->message)) {
+        length = sizeof(error->message) - 1;
+    }
+    memcpy(error->message, message, length);
+    error->message[length] = '\0';
+}
+
+static void _setLastErrorInfo(_XMLError* _Nullable error, const char* fallback) {
+    xmlErrorPtr lastError = xmlGetLastError();
+    if (lastError != NULL && lastError->message != NULL) {
+        _setErrorInfo(error, lastError->code, lastError->message);
+    } else {
+        _setErrorInfo(error, 0, fallback);
+    }
+}
+
+// Collects every message libxml2 reports during one call, keeping the code of the first and as
+// much text as fits. The result is handed to the caller with _setErrorInfo.
+static void _appendErrorInfo(_XMLError* messages, int32_t code, const char* message) {
+    if (messages->code == 0) {
+        messages->code = code;
+    }
+    size_t used = strlen(messages->message);
+    size_t length = strlen(message);
+    if (length > sizeof(messages->message) - 1 - used) {
+        length = sizeof(messages->message) - 1 - used;
+    }
+    memcpy(messages->message + used, message, length);
+    messages->message[used + length] = '\0';
 }
 
-static inline xmlChar* _getQName(xmlNodePtr node) {
-    const xmlChar* prefix = NULL;
-    const xmlChar* ncname = node->name;
+_XMLDocPtr _Nullable _XMLDocPtrFromBytesWithOptions(const uint8_t* _Nullable bytes, size_t length, unsigned int options, _XMLError* _Nullable error) {
+    if (options & _kXMLDocumentTidyHTML) {
+        return _XMLHTMLDocPtrFromBytes(bytes, length, options, error);
+    }
+    if (length > INT_MAX) {
+        _setErrorInfo(error, 0, "The document is too large");
+        return NULL;
+    }
+
+    int xmlOptions = _parseOptionsForNodeOptions(options);
+    uint64_t start = _XMLInstrumentationNow();
+    xmlDocPtr doc = xmlReadMemory(bytes != NULL ? (const char*)bytes : "", (int)length, NULL, NULL, xmlOptions);
+    _XMLInstrumentationRecord(_kXMLTimingParse, start);
+    _XMLInstrumentationAdd(_kXMLCounterBytesParsed, (int64_t)length);
+
+    if (doc == NULL) {
+        _setLastErrorInfo(error, "Document could not be parsed");
+    }
+    return doc;
+}
 
+static inline const xmlChar* _Nullable _getQNamePrefix(xmlNodePtr node) {
     switch (node->type) {
         case XML_DOCUMENT_NODE:
         case XML_NOTATION_NODE:
@@ -453,35 +640,30 @@ static inline xmlChar* _getQName(xmlNodePtr node) {
         case XML_NAMESPACE_DECL:
         case XML_XINCLUDE_START:
         case XML_XINCLUDE_END:
-            break;
+            return NULL;
 
         default:
-            if (node->ns != NULL) {
-                prefix = node->ns->prefix;
-            }
-    }
-
-    return xmlBuildQName(ncname, prefix, NULL, 0);
-}
-
-CFStringRef _XMLNodeCopyLocalName(_XMLNodePtr node) {
-    xmlChar* prefix = NULL;
-    const xmlChar* result = xmlSplitQName2(_getQName((xmlNodePtr)node), &prefix);
-    if (result == NULL) {
-        result = ((xmlNodePtr)node)->name;
+            return node->ns != NULL ? node->ns->prefix : NULL;
     }
-
-    return CFStringCreateWithCString(NULL, (const char*)result, kCFStringEncodingUTF8);
 }
 
-CFStringRef _Nullable _XMLNamespaceCopyPrefix(_XMLNodePtr node) {
-    xmlNsPtr ns = ((xmlNodePtr)node)->ns;
+#pragma mark - UTF-8 spans
 
-    if (ns->prefix == NULL) {
-        return NULL;
+_XMLSpan _XMLNodeGetLocalNameSpan(_XMLNodePtr node) {
+    // The local name is what follows the first colon of the qualified name. With a namespace prefix
+    // that is the whole stored name, otherwise the stored name may carry a prefix of its own.
+    const xmlChar* name = ((xmlNodePtr)node)->name;
+    if (name != NULL && _getQNamePrefix((xmlNodePtr)node) == NULL && name[0] != ':') {
+        const xmlChar* colon = xmlStrchr(name, ':');
+        if (colon != NULL) {
+            name = colon + 1;
+        }
     }
+    return _borrowedSpan(name);
+}
 
-    return CFStringCreateWithCString(NULL, (const char*)ns->prefix, kCFStringEncodingUTF8);
+_XMLSpan _XMLNamespaceGetPrefixSpan(_XMLNodePtr node) {
+    return _borrowedSpan(((xmlNodePtr)node)->ns->prefix);
 }
 
 static inline const xmlChar* _getNamespacePrefix(const char* name) {
@@ -499,115 +681,200 @@ _XMLNodePtr _XMLNewNamespace(const char* name, const char* stringValue) {
     return node;
 }
 
-CFStringRef _XMLCopyStringWithOptions(_XMLNodePtr node, uint32_t options) {
+static inline int _saveOptionsForNodeOptions(uint32_t options) {
+    int xmlOptions = XML_SAVE_AS_XML;
+
+    if (options & _kXMLNodePreserveWhitespace) {
+        xmlOptions |= XML_SAVE_WSNONSIG;
+    }
+
+    if (!(options & _kXMLNodeCompactEmptyElement)) {
+        xmlOptions |= XML_SAVE_NO_EMPTY;
+    }
+
+    if (options & _kXMLNodePrettyPrint) {
+        xmlOptions |= XML_SAVE_FORMAT;
+    }
+
+    return xmlOptions;
+}
+
+static inline bool _serializesAsHTML(xmlNodePtr node) {
+    switch (node->type) {
+        case XML_DOCUMENT_NODE:
+            return (((xmlDocPtr)node)->properties & XML_DOC_HTML) != 0;
+
+        case XML_ELEMENT_NODE:
+        case XML_ATTRIBUTE_NODE:
+        case XML_TEXT_NODE:
+        case XML_CDATA_SECTION_NODE:
+        case XML_ENTITY_REF_NODE:
+        case XML_COMMENT_NODE:
+        case XML_PI_NODE:
+            return node->doc != NULL && (node->doc->properties & XML_DOC_HTML) != 0;
+
+        default:
+            return false;
+    }
+}
+
+// htmlNodeDumpFormatOutput writes void elements such as <br> without a close tag. Documents are
+// written child by child: dumping the document node itself, like xmlSaveTree with XML_SAVE_AS_HTML,
+// temporarily changes its type and rewrites its meta charset, which frozen documents must not see.
+static int _htmlDumpToOutput(xmlOutputBufferPtr _Nullable output, xmlNodePtr node, uint32_t options) {
+    if (output == NULL) {
+        return -1;
+    }
+
+    int format = (options & _kXMLNodePrettyPrint) ? 1 : 0;
+    if (node->type == XML_DOCUMENT_NODE) {
+        xmlDocPtr doc = (xmlDocPtr)node;
+        for (xmlNodePtr child = doc->children; child != NULL; child = child->next) {
+            if (child->type == XML_DTD_NODE) {
+                xmlDtdPtr dtd = (xmlDtdPtr)child;
+                xmlOutputBufferWriteString(output, "<!DOCTYPE ");
+                xmlOutputBufferWriteString(output, (const char*)dtd->name);
+                if (dtd->ExternalID != NULL) {
+                    xmlOutputBufferWriteString(output, " PUBLIC \"");
+                    xmlOutputBufferWriteString(output, (const char*)dtd->ExternalID);
+                    xmlOutputBufferWriteString(output, "\"");
+                    if (dtd->SystemID != NULL) {
+                        xmlOutputBufferWriteString(output, " \"");
+                        xmlOutputBufferWriteString(output, (const char*)dtd->SystemID);
+                        xmlOutputBufferWriteString(output, "\"");
+                    }
+                } else if (dtd->SystemID != NULL) {
+                    xmlOutputBufferWriteString(output, " SYSTEM \"");
+                    xmlOutputBufferWriteString(output, (const char*)dtd->SystemID);
+                    xmlOutputBufferWriteString(output, "\"");
+                }
+                xmlOutputBufferWriteString(output, ">");
+            } else {
+                htmlNodeDumpFormatOutput(output, doc, child, "UTF-8", format);
+            }
+            xmlOutputBufferWriteString(output, "\n");
+        }
+    } else {
+        htmlNodeDumpFormatOutput(output, node->doc, node, "UTF-8", format);
+    }
+
+    return xmlOutputBufferClose(output) < 0 ? -1 : 0;
+}
+
+_XMLSpan _XMLNodeCopyStringSpan(_XMLNodePtr node, uint32_t options) {
+    _XMLInstrumentationAdd(_kXMLCounterStringCopies, 1);
     if (((xmlNodePtr)node)->type == XML_ENTITY_DECL &&
         ((xmlEntityPtr)node)->etype == XML_INTERNAL_PREDEFINED_ENTITY) {
         // predefined entities need special handling, libxml2 just tosses an error and returns a NULL string
         // if we try to use xmlSaveTree on a predefined entity
-        CFMutableStringRef result = CFStringCreateMutable(NULL, 0);
-        CFStringAppend(result, CFStringCreateWithCString(NULL, "<!ENTITY ", kCFStringEncodingUTF8));
-        CFStringAppendCString(result, (const char*)((xmlEntityPtr)node)->name, kCFStringEncodingUTF8);
-        CFStringAppend(result, CFStringCreateWithCString(NULL, " \"", kCFStringEncodingUTF8));
-        CFStringAppendCString(result, (const char*)((xmlEntityPtr)node)->content, kCFStringEncodingUTF8);
-        CFStringAppend(result, CFStringCreateWithCString(NULL, "\">", kCFStringEncodingUTF8));
-
-        return result;
+        xmlChar* result = xmlStrdup((const xmlChar*)"<!ENTITY ");
+        result = xmlStrcat(result, ((xmlEntityPtr)node)->name);
+        result = xmlStrcat(result, (const xmlChar*)" \"");
+        result = xmlStrcat(result, ((xmlEntityPtr)node)->content);
+        result = xmlStrcat(result, (const xmlChar*)"\">");
+
+        return _ownedSpan(result);
     } else if (((xmlNodePtr)node)->type == XML_NOTATION_NODE) {
         // This is not actually a thing that occurs naturally in libxml2
         xmlNotationPtr notation = ((_XMLNotation*)node)->notation;
-        CFMutableStringRef result = CFStringCreateMutable(NULL, 0);
-        CFStringAppend(result, CFStringCreateWithCString(NULL, "<!NOTATION ", kCFStringEncodingUTF8));
-        CFStringAppendCString(result, (const char*)notation->name, kCFStringEncodingUTF8);
-        CFStringAppend(result, CFStringCreateWithCString(NULL, " ", kCFStringEncodingUTF8));
+        xmlChar* result = xmlStrdup((const xmlChar*)"<!NOTATION ");
+        result = xmlStrcat(result, notation->name);
+        result = xmlStrcat(result, (const xmlChar*)" ");
         if (notation->PublicID == NULL && notation->SystemID != NULL) {
-            CFStringAppend(result, CFStringCreateWithCString(NULL, "SYSTEM ", kCFStringEncodingUTF8));
+            result = xmlStrcat(result, (const xmlChar*)"SYSTEM ");
         } else if (notation->PublicID != NULL) {
-            CFStringAppend(result, CFStringCreateWithCString(NULL, "PUBLIC \"", kCFStringEncodingUTF8));
-            CFStringAppendCString(result, (const char*)notation->PublicID, kCFStringEncodingUTF8);
-            CFStringAppend(result, CFStringCreateWithCString(NULL, "\"", kCFStringEncodingUTF8));
+            result = xmlStrcat(result, (const xmlChar*)"PUBLIC \"");
+            result = xmlStrcat(result, notation->PublicID);
+            result = xmlStrcat(result, (const xmlChar*)"\"");
         }
 
         if (notation->SystemID != NULL) {
-            CFStringAppend(result, CFStringCreateWithCString(NULL, "\"", kCFStringEncodingUTF8));
-            CFStringAppendCString(result, (const char*)notation->SystemID, kCFStringEncodingUTF8);
-            CFStringAppend(result, CFStringCreateWithCString(NULL, "\"", kCFStringEncodingUTF8));
+            result = xmlStrcat(result, (const xmlChar*)"\"");
+            result = xmlStrcat(result, notation->SystemID);
+            result = xmlStrcat(result, (const xmlChar*)"\"");
         }
 
-        CFStringAppend(result, CFStringCreateWithCString(NULL, " >", kCFStringEncodingUTF8));
+        result = xmlStrcat(result, (const xmlChar*)" >");
 
-        return result;
+        return _ownedSpan(result);
     }
 
     xmlBufferPtr buffer = xmlBufferCreate();
 
-    uint32_t xmlOptions = XML_SAVE_AS_XML;
-
-    if (options & _kXMLNodePreserveWhitespace) {
-        xmlOptions |= XML_SAVE_WSNONSIG;
-    }
-
-    if (!(options & _kXMLNodeCompactEmptyElement)) {
-        xmlOptions |= XML_SAVE_NO_EMPTY;
-    }
-
-    if (options & _kXMLNodePrettyPrint) {
-        xmlOptions |= XML_SAVE_FORMAT;
-    }
-
-    xmlSaveCtxtPtr ctx = xmlSaveToBuffer(buffer, "utf-8", xmlOptions);
-    xmlSaveTree(ctx, node);
-    int error = xmlSaveClose(ctx);
-
-    if (error == -1) {
-        return CFStringCreateWithCString(NULL, "", kCFStringEncodingUTF8);
+    uint64_t start = _XMLInstrumentationNow();
+    int error;
+    if (_serializesAsHTML(node)) {
+        error = _htmlDumpToOutput(xmlOutputBufferCreateBuffer(buffer, NULL), node, options);
+    } else {
+        xmlSaveCtxtPtr ctx = xmlSaveToBuffer(buffer, "utf-8", _saveOptionsForNodeOptions(options));
+        xmlSaveTree(ctx, node);
+        error = xmlSaveClose(ctx);
     }
+    _XMLInstrumentationRecord(_kXMLTimingSerialization, start);
+    _XMLInstrumentationAdd(_kXMLCounterSerializedBytes, xmlBufferLength(buffer));
 
-    const xmlChar* bufferContents = xmlBufferContent(buffer);
-
-    CFStringRef result = CFStringCreateWithCString(NULL, (const char*)bufferContents, kCFStringEncodingUTF8);
-
+    // Detaching hands the bytes over without copying them.
+    size_t length = (size_t)xmlBufferLength(buffer);
+    xmlChar* bytes = error != -1 ? xmlBufferDetach(buffer) : NULL;
     xmlBufferFree(buffer);
 
-    return result;
+    _XMLSpan span = { bytes != NULL ? bytes : (const xmlChar*)"", bytes != NULL ? length : 0, bytes != NULL };
+    return span;
 }
 
-CFArrayRef _XMLNodesForXPath(_XMLNodePtr node, const unsigned char* xpath) {
-
-    if (((xmlNodePtr)node)->doc == NULL) {
-        return NULL;
-    }
-
-    if (((xmlNodePtr)node)->type == XML_DOCUMENT_NODE) {
+static xmlXPathObjectPtr _Nullable _evaluateXPath(xmlNodePtr node, const xmlChar* xpath) {
+    if (node->type == XML_DOCUMENT_NODE) {
         node = ((xmlDocPtr)node)->children;
+        if (node == NULL) {
+            return NULL;
+        }
     }
 
-    xmlXPathContextPtr context = xmlXPathNewContext(((xmlNodePtr)node)->doc);
-    xmlNsPtr ns = ((xmlNodePtr)node)->ns;
+    xmlXPathContextPtr context = xmlXPathNewContext(node->doc);
+    xmlNsPtr ns = node->ns;
     while (ns != NULL) {
         xmlXPathRegisterNs(context, ns->prefix, ns->href);
         ns = ns->next;
     }
+    uint64_t start = _XMLInstrumentationNow();
     xmlXPathObjectPtr evalResult = xmlXPathNodeEval(node, xpath, context);
+    _XMLInstrumentationRecord(_kXMLTimingXPath, start);
+    // xmlXPathNodeEval compiles the expression on every call.
+    _XMLInstrumentationAdd(_kXMLCounterXPathCompilations, 1);
+    _XMLInstrumentationAdd(_kXMLCounterXPathEvaluations, 1);
 
-    xmlNodeSetPtr nodes = evalResult->nodesetval;
-    int count = nodes ? nodes->nodeNr : 0;
+    xmlXPathFreeContext(context);
+    return evalResult;
+}
 
-    CFMutableArrayRef results = CFArrayCreateMutable(NULL, count, NULL);
-    for (int i = 0; i < count; i++) {
-        CFArrayAppendValue(results, nodes->nodeTab[i]);
+// The matched nodes in a malloc'd array the caller frees, or NULL when nothing matched or the expression failed.
+_XMLNodePtr _Nonnull * _Nullable _XMLNodesForXPath(_XMLNodePtr node, const unsigned char* xpath, _XMLIndex* count) {
+    *count = 0;
+    if (((xmlNodePtr)node)->doc == NULL) {
+        return NULL;
+    }
+
+    xmlXPathObjectPtr evalResult = _evaluateXPath(node, xpath);
+    if (evalResult == NULL) {
+        return NULL;
+    }
+
+    xmlNodeSetPtr nodes = evalResult->nodesetval;
+    int nodeCount = nodes ? nodes->nodeNr : 0;
+    _XMLNodePtr* results = nodeCount > 0 ? malloc((size_t)nodeCount * sizeof(_XMLNodePtr)) : NULL;
+    if (results != NULL) {
+        memcpy(results, nodes->nodeTab, (size_t)nodeCount * sizeof(_XMLNodePtr));
+        *count = nodeCount;
     }
 
-    xmlXPathFreeContext(context);
     xmlXPathFreeObject(evalResult);
 
     return results;
 }
 
-CFStringRef _Nullable _XMLCopyPathForNode(_XMLNodePtr node) {
-    xmlChar* path = xmlGetNodePath(node);
-    CFStringRef result = CFStringCreateWithCString(NULL, (const char*)path, kCFStringEncodingUTF8);
-    xmlFree(path);
-    return result;
+_XMLSpan _XMLNodeCopyPathSpan(_XMLNodePtr node) {
+    _XMLInstrumentationAdd(_kXMLCounterStringCopies, 1);
+    return _ownedSpan(xmlGetNodePath(node));
 }
 
 
@@ -684,25 +951,28 @@ void _XMLNodeSetPrivateData(_XMLNodePtr node, void* data) {
 }
 
 void* _Nullable  _XMLNodeGetPrivateData(_XMLNodePtr node) {
-    return ((xmlNodePtr)node)->_private;
+    return __atomic_load_n(&((xmlNodePtr)node)->_private, __ATOMIC_ACQUIRE);
 }
 
+bool _XMLNodeCompareAndSwapPrivateData(_XMLNodePtr node, void* _Nullable expected, void* data) {
+    return __atomic_compare_exchange_n(&((xmlNodePtr)node)->_private, &expected, data, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
 
 
-CFStringRef _Nullable _XMLNodeCopyName(_XMLNodePtr node) {
-    xmlNodePtr xmlNode = (xmlNodePtr)node;
-
-    xmlChar* qName = _getQName(xmlNode);
 
-    if (qName != NULL) {
-        CFStringRef result = CFStringCreateWithCString(NULL, (const char*)qName, kCFStringEncodingUTF8);
-        if (qName != xmlNode->name) {
-            xmlFree(qName);
-        }
-        return result;
-    } else {
-        return NULL;
+_XMLSpan _XMLNodeGetNameSpan(_XMLNodePtr node, uint8_t* _Nullable buffer, size_t capacity) {
+    xmlNodePtr xmlNode = (xmlNodePtr)node;
+    const xmlChar* prefix = _getQNamePrefix(xmlNode);
+    if (prefix == NULL || xmlNode->name == NULL) {
+        return _borrowedSpan(xmlNode->name);
     }
+
+    // xmlBuildQName writes into the caller's buffer when the name fits and allocates otherwise.
+    _XMLInstrumentationAdd(_kXMLCounterStringCopies, 1);
+    xmlChar* qName = xmlBuildQName(xmlNode->name, prefix, (xmlChar*)buffer, capacity > INT_MAX ? INT_MAX : (int)capacity);
+    _XMLSpan span = _borrowedSpan(qName);
+    span.owned = qName != NULL && qName != (xmlChar*)buffer && qName != xmlNode->name;
+    return span;
 }
 
 void _XMLNodeForceSetName(_XMLNodePtr node, const char* _Nullable name) {
@@ -715,24 +985,18 @@ void _XMLNodeSetName(_XMLNodePtr node, const char* name) {
     xmlNodeSetName(node, (const xmlChar*)name);
 }
 
-Boolean _XMLNodeNameEqual(_XMLNodePtr node, const char* name) {
+bool _XMLNodeNameEqual(_XMLNodePtr node, const char* name) {
     return (xmlStrcmp(((xmlNodePtr)node)->name, (xmlChar*)name) == 0) ? true : false;
 }
 
-CFStringRef _XMLCopyEntityContent(_XMLEntityPtr entity) {
+_XMLSpan _XMLEntityGetContentSpan(_XMLEntityPtr entity) {
     const xmlChar* content = ((xmlEntityPtr)entity)->content;
-    if (!content) {
-        return NULL;
-    }
-
-    CFIndex length = ((xmlEntityPtr)entity)->length;
-    CFStringRef result = CFStringCreateWithBytes(NULL, content, length, kCFStringEncodingUTF8, false);
-
-    return result;
+    _XMLSpan span = { content, content != NULL ? (size_t)((xmlEntityPtr)entity)->length : 0, false };
+    return span;
 }
 
 // Namespaces
-_XMLNodePtr _Nonnull * _Nullable _XMLNamespaces(_XMLNodePtr node, CFIndex* count) {
+_XMLNodePtr _Nonnull * _Nullable _XMLNamespaces(_XMLNodePtr node, _XMLIndex* count) {
     *count = 0;
     xmlNs* ns = ((xmlNode*)node)->nsDef;
     while (ns != NULL) {
@@ -761,7 +1025,7 @@ static inline void _removeAllNamespaces(xmlNodePtr node) {
     }
 }
 
-void _XMLSetNamespaces(_XMLNodePtr node, _XMLNodePtr _Nullable * _Nullable nodes, CFIndex count) {
+void _XMLSetNamespaces(_XMLNodePtr node, _XMLNodePtr _Nullable * _Nullable nodes, _XMLIndex count) {
     _removeAllNamespaces(node);
 
     if (nodes == NULL || count == 0) {
@@ -771,20 +1035,14 @@ void _XMLSetNamespaces(_XMLNodePtr node, _XMLNodePtr _Nullable * _Nullable nodes
     xmlNodePtr nsNode = (xmlNodePtr)nodes[0];
     ((xmlNodePtr)node)->nsDef = xmlCopyNamespace(nsNode->ns);
     xmlNsPtr currNs = ((xmlNodePtr)node)->nsDef;
-    for (CFIndex i = 1; i < count; i++) {
+    for (_XMLIndex i = 1; i < count; i++) {
         currNs->next = xmlCopyNamespace(((xmlNodePtr)nodes[i])->ns);
         currNs = currNs->next;
     }
 }
 
-CFStringRef _Nullable _XMLNamespaceCopyValue(_XMLNodePtr node) {
-    xmlNsPtr ns = ((xmlNode*)node)->ns;
-
-    if (ns->href == NULL) {
-        return NULL;
-    }
-
-    return CFStringCreateWithCString(NULL, (const char*)ns->href, kCFStringEncodingUTF8);
+_XMLSpan _XMLNamespaceGetValueSpan(_XMLNodePtr node) {
+    return _borrowedSpan(((xmlNode*)node)->ns->href);
 }
 
 void _XMLNamespaceSetPrefix(_XMLNodePtr node, const char* prefix, int64_t length) {
@@ -793,29 +1051,48 @@ void _XMLNamespaceSetPrefix(_XMLNodePtr node, const char* prefix, int64_t length
     ns->prefix = xmlStrndup(_getNamespacePrefix(prefix), length);
 }
 
-CFStringRef _XMLNodeCopyContent(_XMLNodePtr node) {
-    switch (((xmlNodePtr)node)->type) {
+_XMLSpan _XMLNodeCopyContentSpan(_XMLNodePtr node) {
+    xmlNodePtr nodePtr = (xmlNodePtr)node;
+    switch (nodePtr->type) {
         case XML_ELEMENT_DECL:
         {
-            char* buffer = calloc(2048, 1);
+            _XMLInstrumentationAdd(_kXMLCounterStringCopies, 1);
+            char* buffer = xmlMalloc(2048);
+            if (buffer == NULL) {
+                return _borrowedSpan(NULL);
+            }
+            buffer[0] = '\0';
             xmlSnprintfElementContent(buffer, 2047, ((xmlElementPtr)node)->content, 1);
-            CFStringRef result = CFStringCreateWithCString(NULL, buffer, kCFStringEncodingUTF8);
-            free(buffer);
-            return result;
+            return _ownedSpan((xmlChar*)buffer);
         }
 
-        default:
-        {
-            xmlChar* content = xmlNodeGetContent(node);
-            if (content == NULL) {
-                return NULL;
+        case XML_TEXT_NODE:
+        case XML_CDATA_SECTION_NODE:
+        case XML_COMMENT_NODE:
+        case XML_PI_NODE:
+            if (nodePtr->content != NULL) {
+                return _borrowedSpan(nodePtr->content);
             }
-            CFStringRef result = CFStringCreateWithCString(NULL, (const char*)content, kCFStringEncodingUTF8);
-            xmlFree(content);
+            break;
 
-            return result;
+        case XML_ELEMENT_NODE:
+        case XML_ATTRIBUTE_NODE:
+        {
+            // A single text child is handed out as it is, like _XMLNodeGetContentNoCopy does.
+            xmlNodePtr child = nodePtr->children;
+            if (child != NULL && child->next == NULL && child->content != NULL
+                && (child->type == XML_TEXT_NODE || child->type == XML_CDATA_SECTION_NODE)) {
+                return _borrowedSpan(child->content);
+            }
+            break;
         }
+
+        default:
+            break;
     }
+
+    _XMLInstrumentationAdd(_kXMLCounterStringCopies, 1);
+    return _ownedSpan(xmlNodeGetContent(node));
 }
 
 void _XMLNamespaceSetValue(_XMLNodePtr node, const char* value, int64_t length) {
@@ -968,17 +1245,13 @@ void _XMLNodeSetContent(_XMLNodePtr node, const unsigned char* _Nullable  conten
 
             // rather than writing custom code to parse the new content into the correct
             // xmlElementContent structures, let's leverage what we've already got.
-            CFMutableStringRef xmlString = CFStringCreateMutable(NULL, 0);
-            CFStringAppend(xmlString, CFStringCreateWithCString(NULL, "<!ELEMENT ", kCFStringEncodingUTF8));
-            CFStringAppendCString(xmlString, (const char*)element->name, kCFStringEncodingUTF8);
-            CFStringAppend(xmlString, CFStringCreateWithCString(NULL, " ", kCFStringEncodingUTF8));
-            CFStringAppendCString(xmlString, (const char*)content, kCFStringEncodingUTF8);
-            CFStringAppend(xmlString, CFStringCreateWithCString(NULL, ">", kCFStringEncodingUTF8));
-
-            size_t bufferSize = CFStringGetMaximumSizeForEncoding(CFStringGetLength(xmlString), kCFStringEncodingUTF8) + 1;
-            char* buffer = calloc(bufferSize, 1);
-            CFStringGetCString(xmlString, buffer, bufferSize, kCFStringEncodingUTF8);
-            xmlElementPtr resultNode = _XMLParseDTDNode((const xmlChar*)buffer);
+            xmlChar* declaration = xmlStrdup((const xmlChar*)"<!ELEMENT ");
+            declaration = xmlStrcat(declaration, element->name);
+            declaration = xmlStrcat(declaration, (const xmlChar*)" ");
+            declaration = xmlStrcat(declaration, content);
+            declaration = xmlStrcat(declaration, (const xmlChar*)">");
+            xmlElementPtr resultNode = _XMLParseDTDNode(declaration);
+            xmlFree(declaration);
 
             if (resultNode) {
                 xmlFreeDocElementContent(element->doc, element->content);
@@ -1002,7 +1275,7 @@ void _XMLNodeSetContent(_XMLNodePtr node, const unsigned char* _Nullable  conten
 
         default:
             if (content == NULL) {
-                xmlNodeSetContent(node, nil);
+                xmlNodeSetContent(node, NULL);
                 return;
             }
 
@@ -1014,68 +1287,59 @@ _XMLDocPtr _XMLNodeGetDocument(_XMLNodePtr node) {
     return ((xmlNodePtr)node)->doc;
 }
 
-CFStringRef _XMLEncodeEntities(_XMLDocPtr doc, const unsigned char* string) {
+_XMLSpan _XMLEncodeEntities(_XMLDocPtr _Nullable doc, const unsigned char* _Nullable string) {
     if (!string) {
-        return NULL;
+        return _borrowedSpan(NULL);
     }
 
-    const xmlChar* stringResult = xmlEncodeEntitiesReentrant(doc, string);
-
-    CFStringRef result = CFStringCreateWithCString(NULL, (const char*)stringResult, kCFStringEncodingUTF8);
-
-    xmlFree((xmlChar*)stringResult);
-
-    return result;
+    return _ownedSpan(xmlEncodeEntitiesReentrant(doc, string));
 }
 
-CFStringRef _XMLNodeCopyPrefix(_XMLNodePtr node) {
-    xmlChar* result = NULL;
-    xmlChar* unused = xmlSplitQName2(_getQName((xmlNodePtr)node), &result);
-
-    CFStringRef resultString = CFStringCreateWithCString(NULL, (const char*)result, kCFStringEncodingUTF8);
-    xmlFree(result);
-    xmlFree(unused);
+_XMLSpan _XMLNodeGetPrefixSpan(_XMLNodePtr node) {
+    // The prefix is what precedes the first colon of the qualified name, if anything does.
+    xmlNodePtr xmlNode = (xmlNodePtr)node;
+    const xmlChar* prefix = _getQNamePrefix(xmlNode);
+    if (prefix != NULL || xmlNode->name == NULL) {
+        return _borrowedSpan(prefix);
+    }
 
-    return resultString;
+    const xmlChar* colon = xmlNode->name[0] != ':' ? xmlStrchr(xmlNode->name, ':') : NULL;
+    if (colon == NULL) {
+        return _borrowedSpan(NULL);
+    }
+    _XMLSpan span = { xmlNode->name, (size_t)(colon - xmlNode->name), false };
+    return span;
 }
 
 void _XMLValidityErrorHandler(void* ctxt, const char* msg, ...);
 void _XMLValidityErrorHandler(void* ctxt, const char* msg, ...) {
-    char* formattedMessage = calloc(1, 1024);
+    char formattedMessage[1024];
 
     va_list args;
     va_start(args, msg);
-    vsprintf(formattedMessage, msg, args);
+    vsnprintf(formattedMessage, sizeof(formattedMessage), msg, args);
     va_end(args);
 
-    CFStringRef message = CFStringCreateWithCString(NULL, formattedMessage, kCFStringEncodingUTF8);
-    CFStringAppend(ctxt, message);
-    CFRelease(message);
-    free(formattedMessage);
+    _appendErrorInfo(ctxt, 0, formattedMessage);
 }
 
-bool _XMLDocValidate(_XMLDocPtr doc, CFErrorRef _Nullable * error) {
-    CFMutableStringRef errorMessage = CFStringCreateMutable(NULL, 0);
+bool _XMLDocValidate(_XMLDocPtr doc, _XMLError* _Nullable error) {
+    _XMLError messages = { 0 };
 
     xmlValidCtxtPtr ctxt = xmlNewValidCtxt();
     ctxt->error = &_XMLValidityErrorHandler;
-    ctxt->userData = errorMessage;
+    ctxt->userData = &messages;
 
+    uint64_t start = _XMLInstrumentationNow();
     int result = xmlValidateDocument(ctxt, doc);
+    _XMLInstrumentationRecord(_kXMLTimingValidation, start);
 
     xmlFreeValidCtxt(ctxt);
 
-    if (result == 0 && error != NULL) {
-        CFMutableDictionaryRef userInfo = CFDictionaryCreateMutable(NULL, 1, &kCFCopyStringDictionaryKeyCallBacks, &kCFTypeDictionaryValueCallBacks);
-        CFDictionarySetValue(userInfo, kCFErrorLocalizedDescriptionKey, errorMessage);
-
-        *error = CFErrorCreate(NULL, CFStringCreateWithCString(NULL, "NSXMLParserErrorDomain", kCFStringEncodingUTF8), 0, userInfo);
-
-        CFRelease(userInfo);
+    if (result == 0) {
+        _setErrorInfo(error, messages.code, messages.message);
     }
 
-    CFRelease(errorMessage);
-
     return result != 0;
 }
 
@@ -1095,7 +1359,7 @@ _XMLNodePtr _XMLNodeProperties(_XMLNodePtr node) {
     return ((xmlNodePtr)node)->properties;
 }
 
-CFIndex _XMLNodeGetType(_XMLNodePtr node) {
+_XMLIndex _XMLNodeGetType(_XMLNodePtr node) {
     if (!node) {
         return _kXMLTypeInvalid;
     }
@@ -1106,37 +1370,31 @@ _XMLNodePtr _XMLNodeGetFirstChild(_XMLNodePtr node) {
     return ((xmlNodePtr)node)->children;
 }
 
+static xmlDtdPtr _Nullable _entityCacheParseDTD(const xmlChar* URL);
+
 _XMLDTDPtr _Nullable _XMLParseDTD(const unsigned char* URL) {
-    return xmlParseDTD(NULL, URL);
+    return _entityCacheParseDTD(URL);
 }
 
-_XMLDTDPtr _Nullable _XMLParseDTDFromData(CFDataRef data, CFErrorRef _Nullable * error) {
-    xmlParserInputBufferPtr inBuffer = xmlParserInputBufferCreateMem((const char*)CFDataGetBytePtr(data), CFDataGetLength(data), XML_CHAR_ENCODING_UTF8);
-
-    xmlSAXHandler handler;
-    handler.error = &_XMLValidityErrorHandler;
-    CFMutableStringRef errorMessage = CFStringCreateMutable(NULL, 0);
-    handler._private = errorMessage;
-
-    xmlDtdPtr dtd = xmlIOParseDTD(NULL, inBuffer, XML_CHAR_ENCODING_UTF8);
-
-    if (dtd == NULL && error != NULL) {
-        CFMutableDictionaryRef userInfo = CFDictionaryCreateMutable(NULL, 1, &kCFCopyStringDictionaryKeyCallBacks, &kCFTypeDictionaryValueCallBacks);
-        CFDictionarySetValue(userInfo, (void *)kCFErrorLocalizedDescriptionKey, (void *)errorMessage);
+_XMLDTDPtr _Nullable _XMLParseDTDFromBytes(const uint8_t* _Nullable bytes, size_t length, _XMLError* _Nullable error) {
+    if (length > INT_MAX) {
+        _setErrorInfo(error, 0, "The DTD is too large");
+        return NULL;
+    }
 
-        *error = CFErrorCreate(NULL, CFStringCreateWithCString(NULL, "NSXMLParserErrorDomain", kCFStringEncodingUTF8), 0, userInfo);
+    xmlResetLastError();
+    xmlParserInputBufferPtr inBuffer = xmlParserInputBufferCreateMem(bytes != NULL ? (const char*)bytes : "", (int)length, XML_CHAR_ENCODING_UTF8);
+    xmlDtdPtr dtd = inBuffer != NULL ? xmlIOParseDTD(NULL, inBuffer, XML_CHAR_ENCODING_UTF8) : NULL;
 
-        CFRelease(userInfo);
+    if (dtd == NULL) {
+        _setLastErrorInfo(error, "DTD could not be parsed");
     }
-    CFRelease(errorMessage);
 
     return dtd;
 }
 
 _XMLDTDNodePtr _XMLParseDTDNode(const unsigned char* xmlString) {
-    CFDataRef data = CFDataCreateWithBytesNoCopy(NULL, xmlString, xmlStrlen(xmlString), (kCFAllocatorNull));
-    xmlDtdPtr dtd = _XMLParseDTDFromData(data, NULL);
-    CFRelease(data);
+    xmlDtdPtr dtd = _XMLParseDTDFromBytes(xmlString, (size_t)xmlStrlen(xmlString), NULL);
 
     if (dtd == NULL) {
         return NULL;
@@ -1153,13 +1411,8 @@ _XMLDTDNodePtr _XMLParseDTDNode(const unsigned char* xmlString) {
     return node;
 }
 
-CFStringRef _Nullable _XMLDTDCopyExternalID(_XMLDTDPtr dtd) {
-    const unsigned char* externalID = ((xmlDtdPtr)dtd)->ExternalID;
-    if (externalID) {
-        return CFStringCreateWithCString(NULL, (const char*)externalID, kCFStringEncodingUTF8);
-    }
-
-    return NULL;
+_XMLSpan _XMLDTDGetExternalIDSpan(_XMLDTDPtr dtd) {
+    return _borrowedSpan(((xmlDtdPtr)dtd)->ExternalID);
 }
 
 void _XMLDTDSetExternalID(_XMLDTDPtr dtd, const unsigned char* externalID) {
@@ -1178,13 +1431,8 @@ void _XMLDTDSetExternalID(_XMLDTDPtr dtd, const unsigned char* externalID) {
     dtdPtr->ExternalID = xmlStrdup(externalID);
 }
 
-CFStringRef _Nullable _XMLDTDCopySystemID(_XMLDTDPtr dtd) {
-    const unsigned char* systemID = ((xmlDtdPtr)dtd)->SystemID;
-    if (systemID) {
-        return CFStringCreateWithCString(NULL, (const char*)systemID, kCFStringEncodingUTF8);
-    }
-
-    return NULL;
+_XMLSpan _XMLDTDGetSystemIDSpan(_XMLDTDPtr dtd) {
+    return _borrowedSpan(((xmlDtdPtr)dtd)->SystemID);
 }
 
 void _XMLDTDSetSystemID(_XMLDTDPtr dtd, const unsigned char* systemID) {
@@ -1253,28 +1501,28 @@ _XMLDTDNodePtr _Nullable _XMLDTDGetPredefinedEntity(const unsigned char* name) {
     return xmlGetPredefinedEntity(name);
 }
 
-CFIndex _XMLDTDElementNodeGetType(_XMLDTDNodePtr node) {
+_XMLIndex _XMLDTDElementNodeGetType(_XMLDTDNodePtr node) {
     return ((xmlElementPtr)node)->etype;
 }
 
-CFIndex _XMLDTDEntityNodeGetType(_XMLDTDNodePtr node) {
+_XMLIndex _XMLDTDEntityNodeGetType(_XMLDTDNodePtr node) {
     return ((xmlEntityPtr)node)->etype;
 }
 
-CFIndex _XMLDTDAttributeNodeGetType(_XMLDTDNodePtr node) {
+_XMLIndex _XMLDTDAttributeNodeGetType(_XMLDTDNodePtr node) {
     return ((xmlAttributePtr)node)->atype;
 }
 
-CFStringRef _Nullable _XMLDTDNodeCopySystemID(_XMLDTDNodePtr node) {
+_XMLSpan _XMLDTDNodeGetSystemIDSpan(_XMLDTDNodePtr node) {
     switch (((xmlNodePtr)node)->type) {
         case XML_ENTITY_DECL:
-            return CFStringCreateWithCString(NULL, (const char*)((xmlEntityPtr)node)->SystemID, kCFStringEncodingUTF8);
+            return _borrowedSpan(((xmlEntityPtr)node)->SystemID);
 
         case XML_NOTATION_NODE:
-            return CFStringCreateWithCString(NULL, (const char*)((_XMLNotation*)node)->notation->SystemID, kCFStringEncodingUTF8);
+            return _borrowedSpan(((_XMLNotation*)node)->notation->SystemID);
 
         default:
-            return NULL;
+            return _borrowedSpan(NULL);
     }
 }
 
@@ -1307,16 +1555,16 @@ void _XMLDTDNodeSetSystemID(_XMLDTDNodePtr node, const unsigned char* systemID)
     }
 }
 
-CFStringRef _Nullable _XMLDTDNodeCopyPublicID(_XMLDTDNodePtr node) {
+_XMLSpan _XMLDTDNodeGetPublicIDSpan(_XMLDTDNodePtr node) {
     switch (((xmlNodePtr)node)->type) {
         case XML_ENTITY_DECL:
-            return CFStringCreateWithCString(NULL, (const char*)((xmlEntityPtr)node)->ExternalID, kCFStringEncodingUTF8);
+            return _borrowedSpan(((xmlEntityPtr)node)->ExternalID);
 
         case XML_NOTATION_NODE:
-            return CFStringCreateWithCString(NULL, (const char*)((_XMLNotation*)node)->notation->PublicID, kCFStringEncodingUTF8);
+            return _borrowedSpan(((_XMLNotation*)node)->notation->PublicID);
 
         default:
-            return NULL;
+            return _borrowedSpan(NULL);
     }
 }
 
@@ -1349,3 +1597,3505 @@ void _XMLDTDNodeSetPublicID(_XMLDTDNodePtr node, const unsigned char* publicID)
     }
 }
 
+// Schemas
+
+_XMLIndex _kXMLSchemaKindXSD = 1;
+_XMLIndex _kXMLSchemaKindRelaxNG = 2;
+
+// A compiled schema is immutable once xmlSchemaParse/xmlRelaxNGParse return, so a single
+// instance can be shared by every thread. Validation contexts are not, so each thread lazily
+// creates its own and keeps it in a thread-specific list keyed by the schema identifier.
+// Every context is also linked from its schema, so freeing the schema frees the contexts of all
+// threads at once; the emptied entries stay in those threads' lists until they next validate.
+typedef struct _XMLValidationContext {
+    uint64_t schemaIdentifier;
+    _XMLIndex kind;
+    struct _XMLSchemaHandle* _Nullable schema;
+    void* _Nullable context;
+    struct _XMLValidationContext* next;
+    struct _XMLValidationContext* schemaNext;
+} _XMLValidationContext;
+
+typedef struct _XMLSchemaHandle {
+    _XMLIndex kind;
+    uint64_t identifier;
+    void* schema;
+    xmlDocPtr sourceDocument;
+    _XMLValidationContext* contexts;
+} _XMLSchemaHandle;
+
+typedef struct {
+    uint64_t generation;
+    _XMLValidationContext* head;
+} _XMLValidationContextList;
+
+static uint64_t _nextSchemaIdentifier = 1;
+static pthread_key_t _validationContextKey;
+static pthread_once_t _validationContextKeyOnce = PTHREAD_ONCE_INIT;
+// Guards the schemas' context lists and the schema and context fields of every entry.
+static pthread_mutex_t _validationContextLock = PTHREAD_MUTEX_INITIALIZER;
+// Bumped whenever a schema is freed, so threads know to drop the entries it emptied.
+static uint64_t _validationContextGeneration = 0;
+
+static void _freeLibxmlValidationContext(_XMLIndex kind, void* context) {
+    if (kind == _kXMLSchemaKindXSD) {
+        xmlSchemaFreeValidCtxt(context);
+    } else {
+        xmlRelaxNGFreeValidCtxt(context);
+    }
+}
+
+// Called with _validationContextLock held.
+static void _freeValidationContext(_XMLValidationContext* entry) {
+    _XMLSchemaHandle* handle = entry->schema;
+    if (handle != NULL) {
+        _XMLValidationContext** link = &handle->contexts;
+        while (*link != entry) {
+            link = &(*link)->schemaNext;
+        }
+        *link = entry->schemaNext;
+    }
+    if (entry->context != NULL) {
+        _freeLibxmlValidationContext(entry->kind, entry->context);
+    }
+    free(entry);
+}
+
+static void _validationContextListDestructor(void* value) {
+    _XMLValidationContextList* list = (_XMLValidationContextList*)value;
+    pthread_mutex_lock(&_validationContextLock);
+    _XMLValidationContext* entry = list->head;
+    while (entry != NULL) {
+        _XMLValidationContext* next = entry->next;
+        _freeValidationContext(entry);
+        entry = next;
+    }
+    pthread_mutex_unlock(&_validationContextLock);
+    free(list);
+}
+
+static void _createValidationContextKey(void) {
+    pthread_key_create(&_validationContextKey, &_validationContextListDestructor);
+}
+
+static _XMLValidationContextList* _Nullable _threadValidationContextList(void) {
+    pthread_once(&_validationContextKeyOnce, &_createValidationContextKey);
+
+    _XMLValidationContextList* list = pthread_getspecific(_validationContextKey);
+    if (list == NULL) {
+        list = calloc(1, sizeof(_XMLValidationContextList));
+        if (list == NULL) {
+            return NULL;
+        }
+        pthread_setspecific(_validationContextKey, list);
+    }
+
+    if (list->generation != __atomic_load_n(&_validationContextGeneration, __ATOMIC_ACQUIRE)) {
+        pthread_mutex_lock(&_validationContextLock);
+        _XMLValidationContext** link = &list->head;
+        while (*link != NULL) {
+            _XMLValidationContext* entry = *link;
+            if (entry->schema == NULL) {
+                *link = entry->next;
+                _freeValidationContext(entry);
+            } else {
+                link = &entry->next;
+            }
+        }
+        list->generation = _validationContextGeneration;
+        pthread_mutex_unlock(&_validationContextLock);
+    }
+
+    return list;
+}
+
+static void* _Nullable _threadValidationContext(_XMLSchemaHandle* handle) {
+    _XMLValidationContextList* list = _threadValidationContextList();
+    if (list == NULL) {
+        return NULL;
+    }
+
+    // Identifiers are never reused and the schema is alive while it validates, so the entry
+    // found here cannot be emptied by another thread while it is in use.
+    for (_XMLValidationContext* entry = list->head; entry != NULL; entry = entry->next) {
+        if (entry->schemaIdentifier == handle->identifier) {
+            return entry->context;
+        }
+    }
+
+    void* context = handle->kind == _kXMLSchemaKindXSD
+        ? (void*)xmlSchemaNewValidCtxt(handle->schema)
+        : (void*)xmlRelaxNGNewValidCtxt(handle->schema);
+    if (context == NULL) {
+        return NULL;
+    }
+
+    _XMLValidationContext* entry = calloc(1, sizeof(_XMLValidationContext));
+    if (entry == NULL) {
+        _freeLibxmlValidationContext(handle->kind, context);
+        return NULL;
+    }
+    entry->schemaIdentifier = handle->identifier;
+    entry->kind = handle->kind;
+    entry->schema = handle;
+    entry->context = context;
+    entry->next = list->head;
+    list->head = entry;
+
+    pthread_mutex_lock(&_validationContextLock);
+    entry->schemaNext = handle->contexts;
+    handle->contexts = entry;
+    pthread_mutex_unlock(&_validationContextLock);
+
+    return context;
+}
+
+static void _XMLStructuredErrorHandler(void* userData, xmlErrorPtr error) {
+    if (error == NULL || error->message == NULL) {
+        return;
+    }
+
+    _appendErrorInfo(userData, error->code, error->message);
+}
+
+static _XMLSchemaPtr _Nullable _compileSchema(_XMLIndex kind, xmlDocPtr document, const unsigned char* _Nullable URL, _XMLError* _Nullable error) {
+    _XMLError messages = { 0 };
+    void* schema = NULL;
+
+    if (kind == _kXMLSchemaKindXSD) {
+        xmlSchemaParserCtxtPtr ctxt = document ? xmlSchemaNewDocParserCtxt(document) : xmlSchemaNewParserCtxt((const char*)URL);
+        if (ctxt) {
+            xmlSchemaSetParserStructuredErrors(ctxt, &_XMLStructuredErrorHandler, &messages);
+            schema = xmlSchemaParse(ctxt);
+            xmlSchemaFreeParserCtxt(ctxt);
+        }
+    } else {
+        xmlRelaxNGParserCtxtPtr ctxt = document ? xmlRelaxNGNewDocParserCtxt(document) : xmlRelaxNGNewParserCtxt((const char*)URL);
+        if (ctxt) {
+            xmlRelaxNGSetParserStructuredErrors(ctxt, &_XMLStructuredErrorHandler, &messages);
+            schema = xmlRelaxNGParse(ctxt);
+            xmlRelaxNGFreeParserCtxt(ctxt);
+        }
+    }
+
+    if (schema == NULL) {
+        _setErrorInfo(error, messages.code, messages.message);
+        return NULL;
+    }
+
+    _XMLSchemaHandle* handle = calloc(1, sizeof(_XMLSchemaHandle));
+    handle->kind = kind;
+    handle->identifier = __atomic_fetch_add(&_nextSchemaIdentifier, 1, __ATOMIC_RELAXED);
+    handle->schema = schema;
+
+    return handle;
+}
+
+_XMLSchemaPtr _Nullable _XMLSchemaCreateWithBytes(_XMLIndex kind, const uint8_t* _Nullable bytes, size_t length, const unsigned char* _Nullable URL, _XMLError* _Nullable error) {
+    if (length > INT_MAX) {
+        _setErrorInfo(error, 0, "The schema is too large");
+        return NULL;
+    }
+
+    // Going through a document (rather than xmlSchemaNewMemParserCtxt) lets includes and
+    // imports resolve relative to the schema's own URL.
+    xmlDocPtr document = xmlReadMemory(bytes != NULL ? (const char*)bytes : "", (int)length, (const char*)URL, NULL, XML_PARSE_NONET);
+    if (document == NULL) {
+        _setErrorInfo(error, 0, "Schema is not a well-formed XML document");
+        return NULL;
+    }
+
+    _XMLSchemaHandle* handle = _compileSchema(kind, document, URL, error);
+    if (handle == NULL) {
+        xmlFreeDoc(document);
+        return NULL;
+    }
+
+    // XSD schemas keep pointers into the document they were compiled from.
+    handle->sourceDocument = document;
+    return handle;
+}
+
+_XMLSchemaPtr _Nullable _XMLSchemaCreateWithURL(_XMLIndex kind, const unsigned char* URL, _XMLError* _Nullable error) {
+    return _compileSchema(kind, NULL, URL, error);
+}
+
+void _XMLSchemaFree(_XMLSchemaPtr schema) {
+    _XMLSchemaHandle* handle = (_XMLSchemaHandle*)schema;
+
+    // The contexts of every thread go before the schema they point to. Their entries are
+    // dropped by the owning threads, which notice the new generation on their next lookup.
+    pthread_mutex_lock(&_validationContextLock);
+    for (_XMLValidationContext* entry = handle->contexts; entry != NULL; entry = entry->schemaNext) {
+        _freeLibxmlValidationContext(entry->kind, entry->context);
+        entry->context = NULL;
+        entry->schema = NULL;
+    }
+    handle->contexts = NULL;
+    __atomic_add_fetch(&_validationContextGeneration, 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&_validationContextLock);
+
+    if (handle->kind == _kXMLSchemaKindXSD) {
+        xmlSchemaFree(handle->schema);
+    } else {
+        xmlRelaxNGFree(handle->schema);
+    }
+
+    if (handle->sourceDocument) {
+        xmlFreeDoc(handle->sourceDocument);
+    }
+
+    free(handle);
+}
+
+bool _XMLSchemaValidateDocument(_XMLSchemaPtr schema, _XMLDocPtr doc, _XMLError* _Nullable error) {
+    _XMLSchemaHandle* handle = (_XMLSchemaHandle*)schema;
+    void* context = _threadValidationContext(handle);
+    if (context == NULL) {
+        _setErrorInfo(error, 0, "Could not create a validation context");
+        return false;
+    }
+
+    _XMLError messages = { 0 };
+    int result;
+    uint64_t start = _XMLInstrumentationNow();
+
+    if (handle->kind == _kXMLSchemaKindXSD) {
+        xmlSchemaSetValidStructuredErrors(context, &_XMLStructuredErrorHandler, &messages);
+        result = xmlSchemaValidateDoc(context, doc);
+        xmlSchemaSetValidStructuredErrors(context, NULL, NULL);
+    } else {
+        xmlRelaxNGSetValidStructuredErrors(context, &_XMLStructuredErrorHandler, &messages);
+        result = xmlRelaxNGValidateDoc(context, doc);
+        xmlRelaxNGSetValidStructuredErrors(context, NULL, NULL);
+    }
+    _XMLInstrumentationRecord(_kXMLTimingValidation, start);
+
+    if (result != 0) {
+        _setErrorInfo(error, messages.code, messages.message);
+    }
+
+    return result == 0;
+}
+
+bool _XMLSchemaValidateIO(_XMLSchemaPtr schema, xmlInputReadCallback ioread, xmlInputCloseCallback ioclose, void* context, _XMLError* _Nullable error) {
+    _XMLSchemaHandle* handle = (_XMLSchemaHandle*)schema;
+    void* validationContext = _threadValidationContext(handle);
+    if (validationContext == NULL) {
+        _setErrorInfo(error, 0, "Could not create a validation context");
+        return false;
+    }
+
+    // The reader discards each subtree once it has been validated, so memory stays
+    // bounded by document depth rather than size.
+    xmlTextReaderPtr reader = xmlReaderForIO(ioread, ioclose, context, NULL, NULL, XML_PARSE_NONET);
+    if (reader == NULL) {
+        _setErrorInfo(error, 0, "Could not create a reader for the input stream");
+        return false;
+    }
+
+    _XMLError messages = { 0 };
+    xmlTextReaderSetStructuredErrorHandler(reader, &_XMLStructuredErrorHandler, &messages);
+
+    int result = handle->kind == _kXMLSchemaKindXSD
+        ? xmlTextReaderSchemaValidateCtxt(reader, validationContext, 0)
+        : xmlTextReaderRelaxNGValidateCtxt(reader, validationContext, 0);
+
+    uint64_t start = _XMLInstrumentationNow();
+    if (result == 0) {
+        while ((result = xmlTextReaderRead(reader)) == 1) {
+        }
+    }
+    _XMLInstrumentationRecord(_kXMLTimingValidation, start);
+    _XMLInstrumentationAdd(_kXMLCounterBytesParsed, xmlTextReaderByteConsumed(reader));
+
+    bool valid = result == 0 && xmlTextReaderIsValid(reader) == 1;
+    xmlFreeTextReader(reader);
+
+    if (handle->kind == _kXMLSchemaKindXSD) {
+        xmlSchemaSetValidStructuredErrors(validationContext, NULL, NULL);
+    } else {
+        xmlRelaxNGSetValidStructuredErrors(validationContext, NULL, NULL);
+    }
+
+    if (!valid) {
+        _setErrorInfo(error, messages.code, messages.message);
+    }
+
+    return valid;
+}
+
+// Projection
+
+_XMLDocPtr _Nullable _XMLDocPtrFromBytesWithProjection(const uint8_t* _Nullable bytes, size_t length, unsigned int options, const char* _Nonnull const* _Nullable patterns, _XMLIndex count, _XMLError* _Nullable error) {
+    // Projection runs on xmlTextReader, which has no HTML counterpart.
+    if (options & _kXMLDocumentTidyHTML) {
+        _setErrorInfo(error, 0, "Projection is not supported for HTML documents");
+        return NULL;
+    }
+    if (length > INT_MAX) {
+        _setErrorInfo(error, 0, "The document is too large");
+        return NULL;
+    }
+
+    // Projection is built on the reader: it materializes one node at a time and frees every
+    // node it has moved past unless a preserve pattern matched it or one of its descendants.
+    // Recovery is switched off so that skipped subtrees are still checked for well-formedness.
+    int xmlOptions = _parseOptionsForNodeOptions(options) & ~XML_PARSE_RECOVER;
+    xmlTextReaderPtr reader = xmlReaderForMemory(bytes != NULL ? (const char*)bytes : "", (int)length, NULL, NULL, xmlOptions);
+    if (reader == NULL) {
+        _setErrorInfo(error, 0, "Could not create a reader for the document");
+        return NULL;
+    }
+
+    for (_XMLIndex i = 0; i < count; i++) {
+        if (xmlTextReaderPreservePattern(reader, (const xmlChar*)patterns[i], NULL) < 0) {
+            char message[256];
+            snprintf(message, sizeof(message), "Invalid projection pattern: %s", patterns[i]);
+            _setErrorInfo(error, 0, message);
+            xmlFreeTextReader(reader);
+            return NULL;
+        }
+    }
+
+    _XMLError messages = { 0 };
+    xmlTextReaderSetStructuredErrorHandler(reader, &_XMLStructuredErrorHandler, &messages);
+
+    uint64_t start = _XMLInstrumentationNow();
+    int result;
+    while ((result = xmlTextReaderRead(reader)) == 1) {
+    }
+    _XMLInstrumentationRecord(_kXMLTimingParse, start);
+    _XMLInstrumentationAdd(_kXMLCounterBytesParsed, (int64_t)length);
+
+    xmlDocPtr doc = NULL;
+    if (result == 0) {
+        // Asking for the document marks it as owned by the caller, so freeing the reader leaves it alone.
+        doc = xmlTextReaderCurrentDoc(reader);
+    } else {
+        _setErrorInfo(error, messages.code, messages.message);
+    }
+
+    xmlFreeTextReader(reader);
+
+    return doc;
+}
+
+// Decoding
+
+_XMLNodePtr _Nullable _XMLNodeFindElement(_XMLNodePtr _Nullable start, const char* _Nullable name) {
+    xmlNodePtr cur = (xmlNodePtr)start;
+    if (cur == NULL) {
+        return NULL;
+    }
+
+    // Parsed documents intern every element name in their dictionary. Dictionary strings are
+    // unique, so a name owned by the dictionary matches only if it is the interned pointer;
+    // bytes are compared only for names added through the API without the dictionary.
+    xmlDictPtr dict = cur->doc != NULL ? cur->doc->dict : NULL;
+    const xmlChar* interned = NULL;
+    if (name != NULL && dict != NULL) {
+        interned = xmlDictExists(dict, (const xmlChar*)name, -1);
+    }
+
+    for (; cur != NULL; cur = cur->next) {
+        if (cur->type != XML_ELEMENT_NODE) {
+            continue;
+        }
+        if (name == NULL || cur->name == interned) {
+            return cur;
+        }
+        if (dict != NULL && xmlDictOwns(dict, cur->name) == 1) {
+            continue;
+        }
+        if (xmlStrEqual(cur->name, (const xmlChar*)name)) {
+            return cur;
+        }
+    }
+
+    return NULL;
+}
+
+const char* _Nullable _XMLNodeGetContentNoCopy(_XMLNodePtr node) {
+    xmlNodePtr nodePtr = (xmlNodePtr)node;
+
+    switch (nodePtr->type) {
+        case XML_TEXT_NODE:
+        case XML_CDATA_SECTION_NODE:
+        case XML_COMMENT_NODE:
+        case XML_PI_NODE:
+            return nodePtr->content ? (const char*)nodePtr->content : "";
+
+        case XML_ELEMENT_NODE:
+        case XML_ATTRIBUTE_NODE: {
+            xmlNodePtr child = nodePtr->children;
+            if (child == NULL) {
+                return "";
+            }
+            if (child->next == NULL && (child->type == XML_TEXT_NODE || child->type == XML_CDATA_SECTION_NODE)) {
+                return child->content ? (const char*)child->content : "";
+            }
+            // Mixed content has to be concatenated, callers fall back to _XMLNodeCopyContentSpan.
+            return NULL;
+        }
+
+        default:
+            return NULL;
+    }
+}
+
+static inline bool _isXMLSpace(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+static inline const char* _skipXMLSpace(const char* text) {
+    while (_isXMLSpace(*text)) {
+        text++;
+    }
+    return text;
+}
+
+static inline size_t _trimmedXMLLength(const char* text) {
+    size_t length = strlen(text);
+    while (length > 0 && _isXMLSpace(text[length - 1])) {
+        length--;
+    }
+    return length;
+}
+
+bool _XMLTextGetInt64(const char* text, int64_t* value) {
+    const char* start = _skipXMLSpace(text);
+    char* end = NULL;
+
+    errno = 0;
+    long long result = strtoll(start, &end, 10);
+    if (end == start || errno == ERANGE || *_skipXMLSpace(end) != '\0') {
+        return false;
+    }
+
+    *value = result;
+    return true;
+}
+
+bool _XMLTextGetUInt64(const char* text, uint64_t* value) {
+    const char* start = _skipXMLSpace(text);
+    char* end = NULL;
+
+    // strtoull silently negates values with a leading minus sign.
+    if (*start == '-') {
+        return false;
+    }
+
+    errno = 0;
+    unsigned long long result = strtoull(start, &end, 10);
+    if (end == start || errno == ERANGE || *_skipXMLSpace(end) != '\0') {
+        return false;
+    }
+
+    *value = result;
+    return true;
+}
+
+static locale_t _numericLocale = (locale_t)0;
+static pthread_once_t _numericLocaleOnce = PTHREAD_ONCE_INIT;
+
+static void _createNumericLocale(void) {
+    _numericLocale = newlocale(LC_NUMERIC_MASK, "C", (locale_t)0);
+}
+
+bool _XMLTextGetDouble(const char* text, double* value) {
+    const char* start = _skipXMLSpace(text);
+    char* end = NULL;
+
+    // XML numbers always use '.', whatever the process locale says.
+    pthread_once(&_numericLocaleOnce, _createNumericLocale);
+    if (_numericLocale == (locale_t)0) {
+        return false;
+    }
+
+    errno = 0;
+    double result = strtod_l(start, &end, _numericLocale);
+    if (end == start || errno == ERANGE || *_skipXMLSpace(end) != '\0') {
+        return false;
+    }
+
+    *value = result;
+    return true;
+}
+
+bool _XMLTextGetBool(const char* text, bool* value) {
+    const char* start = _skipXMLSpace(text);
+    size_t length = _trimmedXMLLength(start);
+
+    if ((length == 4 && xmlStrncasecmp((const xmlChar*)start, BAD_CAST "true", 4) == 0) || (length == 1 && *start == '1')) {
+        *value = true;
+        return true;
+    }
+    if ((length == 5 && xmlStrncasecmp((const xmlChar*)start, BAD_CAST "false", 5) == 0) || (length == 1 && *start == '0')) {
+        *value = false;
+        return true;
+    }
+
+    return false;
+}
+
+static inline bool _scanDigits(const char** cursor, int count, int* value) {
+    int result = 0;
+    for (int i = 0; i < count; i++) {
+        char c = (*cursor)[i];
+        if (c < '0' || c > '9') {
+            return false;
+        }
+        result = result * 10 + (c - '0');
+    }
+    *cursor += count;
+    *value = result;
+    return true;
+}
+
+// Days between 1970-01-01 and the given proleptic Gregorian date.
+static inline int64_t _daysFromCivil(int64_t year, int month, int day) {
+    year -= month <= 2;
+    int64_t era = (year >= 0 ? year : year - 399) / 400;
+    int64_t yearOfEra = year - era * 400;
+    int64_t dayOfYear = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+    int64_t dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+    return era * 146097 + dayOfEra - 719468;
+}
+
+static inline int _daysInMonth(int year, int month) {
+    static const int days[12] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+    bool leap = (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
+    return month == 2 && leap ? 29 : days[month - 1];
+}
+
+bool _XMLTextGetISO8601Date(const char* text, double* secondsSince1970) {
+    const char* cursor = _skipXMLSpace(text);
+    int year, month, day, hour = 0, minute = 0, second = 0;
+    double fraction = 0;
+    int offset = 0;
+
+    if (!_scanDigits(&cursor, 4, &year) || *cursor++ != '-' ||
+        !_scanDigits(&cursor, 2, &month) || *cursor++ != '-' ||
+        !_scanDigits(&cursor, 2, &day)) {
+        return false;
+    }
+    if (month < 1 || month > 12 || day < 1 || day > _daysInMonth(year, month)) {
+        return false;
+    }
+
+    if (*cursor == 'T' || *cursor == 't' || *cursor == ' ') {
+        cursor++;
+        if (!_scanDigits(&cursor, 2, &hour) || *cursor++ != ':' || !_scanDigits(&cursor, 2, &minute)) {
+            return false;
+        }
+        if (*cursor == ':') {
+            cursor++;
+            if (!_scanDigits(&cursor, 2, &second)) {
+                return false;
+            }
+            if (*cursor == '.' || *cursor == ',') {
+                cursor++;
+                double scale = 0.1;
+                if (*cursor < '0' || *cursor > '9') {
+                    return false;
+                }
+                while (*cursor >= '0' && *cursor <= '9') {
+                    fraction += (*cursor++ - '0') * scale;
+                    scale /= 10;
+                }
+            }
+        }
+        if (hour > 23 || minute > 59 || second > 60) {
+            return false;
+        }
+
+        // A missing designator is read as UTC, which is what KeePass and most feeds emit.
+        if (*cursor == 'Z' || *cursor == 'z') {
+            cursor++;
+        } else if (*cursor == '+' || *cursor == '-') {
+            int sign = *cursor++ == '-' ? -1 : 1;
+            int offsetHours, offsetMinutes = 0;
+            if (!_scanDigits(&cursor, 2, &offsetHours)) {
+                return false;
+            }
+            if (*cursor == ':') {
+                cursor++;
+            }
+            if (*cursor >= '0' && *cursor <= '9' && !_scanDigits(&cursor, 2, &offsetMinutes)) {
+                return false;
+            }
+            offset = sign * (offsetHours * 3600 + offsetMinutes * 60);
+        }
+    }
+
+    if (*_skipXMLSpace(cursor) != '\0') {
+        return false;
+    }
+
+    int64_t seconds = _daysFromCivil(year, month, day) * 86400 + hour * 3600 + minute * 60 + second - offset;
+    *secondsSince1970 = (double)seconds + fraction;
+    return true;
+}
+
+static inline int _base64Value(char c) {
+    if (c >= 'A' && c <= 'Z') return c - 'A';
+    if (c >= 'a' && c <= 'z') return c - 'a' + 26;
+    if (c >= '0' && c <= '9') return c - '0' + 52;
+    if (c == '+' || c == '-') return 62;
+    if (c == '/' || c == '_') return 63;
+    return -1;
+}
+
+// The decoded bytes are owned by the span, which has no bytes when text is not valid base64.
+_XMLSpan _XMLTextCopyBase64Span(const char* text) {
+    size_t length = strlen(text);
+    _XMLSpan span = { NULL, 0, false };
+    uint8_t* bytes = xmlMalloc(length / 4 * 3 + 3);
+    if (bytes == NULL) {
+        return span;
+    }
+    size_t written = 0;
+    uint32_t accumulator = 0;
+    int bits = 0;
+    bool padding = false;
+
+    for (size_t i = 0; i < length; i++) {
+        char c = text[i];
+        if (_isXMLSpace(c)) {
+            continue;
+        }
+        if (c == '=') {
+            padding = true;
+            continue;
+        }
+        int value = _base64Value(c);
+        if (value < 0 || padding) {
+            xmlFree(bytes);
+            return span;
+        }
+        accumulator = (accumulator << 6) | (uint32_t)value;
+        bits += 6;
+        if (bits >= 8) {
+            bits -= 8;
+            bytes[written++] = (uint8_t)(accumulator >> bits);
+        }
+    }
+
+    // Six leftover bits can not come from a valid encoding.
+    if (bits >= 6) {
+        xmlFree(bytes);
+        return span;
+    }
+
+    span.bytes = bytes;
+    span.length = written;
+    span.owned = true;
+    return span;
+}
+
+static inline int _hexValue(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+// The decoded bytes are owned by the span, which has no bytes when text is not valid hex.
+_XMLSpan _XMLTextCopyHexSpan(const char* text) {
+    const char* start = _skipXMLSpace(text);
+    size_t length = _trimmedXMLLength(start);
+    _XMLSpan span = { NULL, 0, false };
+    if (length % 2 != 0) {
+        return span;
+    }
+
+    // One spare byte so that empty text still gets a buffer.
+    uint8_t* bytes = xmlMalloc(length / 2 + 1);
+    if (bytes == NULL) {
+        return span;
+    }
+
+    for (size_t i = 0; i < length; i += 2) {
+        int high = _hexValue(start[i]);
+        int low = _hexValue(start[i + 1]);
+        if (high < 0 || low < 0) {
+            xmlFree(bytes);
+            return span;
+        }
+        bytes[i / 2] = (uint8_t)((high << 4) | low);
+    }
+
+    span.bytes = bytes;
+    span.length = length / 2;
+    span.owned = true;
+    return span;
+}
+
+_XMLIndex _XMLFormatISO8601Date(double secondsSince1970, char* buffer, _XMLIndex capacity) {
+    double whole = floor(secondsSince1970);
+    time_t seconds = (time_t)whole;
+    long milliseconds = lround((secondsSince1970 - whole) * 1000);
+    if (milliseconds == 1000) {
+        seconds += 1;
+        milliseconds = 0;
+    }
+
+    struct tm components;
+    if (gmtime_r(&seconds, &components) == NULL) {
+        return -1;
+    }
+
+    int length;
+    if (milliseconds > 0) {
+        length = snprintf(buffer, (size_t)capacity, "%04d-%02d-%02dT%02d:%02d:%02d.%03ldZ",
+                          components.tm_year + 1900, components.tm_mon + 1, components.tm_mday,
+                          components.tm_hour, components.tm_min, components.tm_sec, milliseconds);
+    } else {
+        length = snprintf(buffer, (size_t)capacity, "%04d-%02d-%02dT%02d:%02d:%02dZ",
+                          components.tm_year + 1900, components.tm_mon + 1, components.tm_mday,
+                          components.tm_hour, components.tm_min, components.tm_sec);
+    }
+
+    return length < capacity ? length : -1;
+}
+
+// Writer
+
+_XMLWriterPtr _Nullable _XMLWriterCreateIO(xmlOutputWriteCallback iowrite, xmlOutputCloseCallback ioclose, void* context, bool indent) {
+    xmlOutputBufferPtr output = xmlOutputBufferCreateIO(iowrite, ioclose, context, NULL);
+    if (output == NULL) {
+        return NULL;
+    }
+
+    // The writer owns the output buffer from here on and closes it when freed.
+    xmlTextWriterPtr writer = xmlNewTextWriter(output);
+    if (writer == NULL) {
+        xmlOutputBufferClose(output);
+        return NULL;
+    }
+
+    if (indent) {
+        xmlTextWriterSetIndent(writer, 1);
+        xmlTextWriterSetIndentString(writer, BAD_CAST "    ");
+    }
+
+    return writer;
+}
+
+int _XMLWriterStartDocument(_XMLWriterPtr writer) {
+    return xmlTextWriterStartDocument(writer, NULL, "UTF-8", NULL);
+}
+
+int _XMLWriterEndDocument(_XMLWriterPtr writer) {
+    // Closes any element still open and flushes the output buffer to the stream.
+    return xmlTextWriterEndDocument(writer);
+}
+
+int _XMLWriterStartElement(_XMLWriterPtr writer, const char* name) {
+    return xmlTextWriterStartElement(writer, (const xmlChar*)name);
+}
+
+int _XMLWriterEndElement(_XMLWriterPtr writer) {
+    return xmlTextWriterEndElement(writer);
+}
+
+int _XMLWriterWriteAttribute(_XMLWriterPtr writer, const char* name, const char* value) {
+    return xmlTextWriterWriteAttribute(writer, (const xmlChar*)name, (const xmlChar*)value);
+}
+
+int _XMLWriterWriteString(_XMLWriterPtr writer, const char* text) {
+    return xmlTextWriterWriteString(writer, (const xmlChar*)text);
+}
+
+int _XMLWriterWriteBase64(_XMLWriterPtr writer, const uint8_t* bytes, _XMLIndex length) {
+    return xmlTextWriterWriteBase64(writer, (const char*)bytes, 0, (int)length);
+}
+
+int _XMLWriterWriteBinHex(_XMLWriterPtr writer, const uint8_t* bytes, _XMLIndex length) {
+    // xmlTextWriterWriteBinHex emits uppercase digits; attributes go through Data.hexString(),
+    // which is lowercase, so element content is encoded here the same way.
+    static const char digits[] = "0123456789abcdef";
+    char buffer[1024];
+    int total = 0;
+
+    for (_XMLIndex offset = 0; offset < length;) {
+        _XMLIndex chunk = length - offset < (_XMLIndex)(sizeof(buffer) / 2) ? length - offset : (_XMLIndex)(sizeof(buffer) / 2);
+        for (_XMLIndex i = 0; i < chunk; i++) {
+            buffer[i * 2] = digits[bytes[offset + i] >> 4];
+            buffer[i * 2 + 1] = digits[bytes[offset + i] & 0x0f];
+        }
+        int written = xmlTextWriterWriteRawLen(writer, (const xmlChar*)buffer, (int)(chunk * 2));
+        if (written < 0) {
+            return written;
+        }
+        total += written;
+        offset += chunk;
+    }
+
+    return total;
+}
+
+void _XMLWriterFree(_XMLWriterPtr writer) {
+    xmlFreeTextWriter(writer);
+}
+
+// Instrumentation
+
+#if XML2SWIFT_INSTRUMENTATION
+
+int64_t _XMLInstrumentationCounters[_kXMLCounterCount];
+
+typedef struct {
+    int64_t count;
+    int64_t total;
+    int64_t buckets[_kXMLTimingBucketCount];
+} _XMLTimingHistogram;
+
+static _XMLTimingHistogram _XMLInstrumentationTimings[_kXMLTimingCount];
+
+uint64_t _XMLInstrumentationNow(void) {
+#ifdef __APPLE__
+    static mach_timebase_info_data_t timebase;
+    if (timebase.denom == 0) {
+        mach_timebase_info(&timebase);
+    }
+    return mach_absolute_time() * timebase.numer / timebase.denom;
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec;
+#endif
+}
+
+void _XMLInstrumentationRecord(_XMLTiming timing, uint64_t start) {
+    uint64_t elapsed = _XMLInstrumentationNow() - start;
+    int bucket = 0;
+    while (bucket < _kXMLTimingBucketCount - 1 && (elapsed >> (bucket + 1)) != 0) {
+        bucket++;
+    }
+
+    _XMLTimingHistogram* histogram = &_XMLInstrumentationTimings[timing];
+    __atomic_fetch_add(&histogram->count, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&histogram->total, (int64_t)elapsed, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&histogram->buckets[bucket], 1, __ATOMIC_RELAXED);
+}
+
+static void _XMLInstrumentationNodeCreated(xmlNodePtr node) {
+    _XMLInstrumentationAdd(_kXMLCounterNodesCreated, 1);
+}
+
+void _XMLInstrumentationInstall(void) {
+    // Called for every node libxml2 allocates, whether by the parser or through the tree API.
+    // xmlRegisterNodeDefault only affects the calling thread; the thread default is what
+    // threads that have not touched libxml2 yet start with.
+    xmlThrDefRegisterNodeDefault(&_XMLInstrumentationNodeCreated);
+    xmlRegisterNodeDefault(&_XMLInstrumentationNodeCreated);
+}
+
+int64_t _XMLInstrumentationCounterValue(_XMLCounter counter) {
+    return __atomic_load_n(&_XMLInstrumentationCounters[counter], __ATOMIC_RELAXED);
+}
+
+int64_t _XMLInstrumentationTimingCount(_XMLTiming timing) {
+    return __atomic_load_n(&_XMLInstrumentationTimings[timing].count, __ATOMIC_RELAXED);
+}
+
+int64_t _XMLInstrumentationTimingTotal(_XMLTiming timing) {
+    return __atomic_load_n(&_XMLInstrumentationTimings[timing].total, __ATOMIC_RELAXED);
+}
+
+int64_t _XMLInstrumentationTimingBucket(_XMLTiming timing, _XMLIndex bucket) {
+    return __atomic_load_n(&_XMLInstrumentationTimings[timing].buckets[bucket], __ATOMIC_RELAXED);
+}
+
+void _XMLInstrumentationReset(void) {
+    for (int i = 0; i < _kXMLCounterCount; i++) {
+        __atomic_store_n(&_XMLInstrumentationCounters[i], 0, __ATOMIC_RELAXED);
+    }
+    for (int i = 0; i < _kXMLTimingCount; i++) {
+        _XMLTimingHistogram* histogram = &_XMLInstrumentationTimings[i];
+        __atomic_store_n(&histogram->count, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&histogram->total, 0, __ATOMIC_RELAXED);
+        for (int j = 0; j < _kXMLTimingBucketCount; j++) {
+            __atomic_store_n(&histogram->buckets[j], 0, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+#endif
+
+// Memory
+
+typedef struct {
+    _XMLIndex maxBytes;
+    _XMLIndex maxNodes;
+    _XMLIndex maxDepth;
+    _XMLIndex bytes;
+    _XMLIndex nodes;
+    _XMLIndex depth;
+    const char* exceeded;
+    startElementNsSAX2Func startElementNs;
+    endElementNsSAX2Func endElementNs;
+    charactersSAXFunc characters;
+    cdataBlockSAXFunc cdataBlock;
+    commentSAXFunc comment;
+    processingInstructionSAXFunc processingInstruction;
+    ignorableWhitespaceSAXFunc ignorableWhitespace;
+} _XMLParseBudget;
+
+static pthread_key_t _parseBudgetKey;
+// Parses with a budget running on any thread. While it is zero the hooks skip the
+// thread-specific lookup and go straight to the system allocator.
+static int _activeParseBudgets = 0;
+static pthread_once_t _memoryHooksOnce = PTHREAD_ONCE_INIT;
+
+static inline size_t _XMLMallocSize(const void* ptr) {
+#ifdef __APPLE__
+    return malloc_size(ptr);
+#else
+    return malloc_usable_size((void*)ptr);
+#endif
+}
+
+// Allocations are charged to the budget of the parse running on the calling thread, if any.
+// Once the byte budget would be exceeded the hooks fail the allocation, which libxml2 turns
+// into a memory error that stops the parser.
+static inline _XMLParseBudget* _Nullable _currentParseBudget(void) {
+    if (__atomic_load_n(&_activeParseBudgets, __ATOMIC_RELAXED) == 0) {
+        return NULL;
+    }
+    return pthread_getspecific(_parseBudgetKey);
+}
+
+static void* _XMLBudgetMalloc(size_t size) {
+    _XMLParseBudget* budget = _currentParseBudget();
+    if (budget != NULL && budget->maxBytes > 0 && budget->bytes + (_XMLIndex)size > budget->maxBytes) {
+        budget->exceeded = "memory";
+        return NULL;
+    }
+
+    void* ptr = malloc(size);
+    if (budget != NULL && ptr != NULL) {
+        budget->bytes += _XMLMallocSize(ptr);
+    }
+    return ptr;
+}
+
+static void* _XMLBudgetRealloc(void* ptr, size_t size) {
+    _XMLParseBudget* budget = _currentParseBudget();
+    if (budget == NULL) {
+        return realloc(ptr, size);
+    }
+
+    _XMLIndex oldSize = ptr != NULL ? (_XMLIndex)_XMLMallocSize(ptr) : 0;
+    if (budget->maxBytes > 0 && budget->bytes - oldSize + (_XMLIndex)size > budget->maxBytes) {
+        budget->exceeded = "memory";
+        return NULL;
+    }
+
+    void* result = realloc(ptr, size);
+    if (result != NULL) {
+        budget->bytes += (_XMLIndex)_XMLMallocSize(result) - oldSize;
+    }
+    return result;
+}
+
+static void _XMLBudgetFree(void* ptr) {
+    _XMLParseBudget* budget = _currentParseBudget();
+    if (budget != NULL && ptr != NULL) {
+        budget->bytes -= _XMLMallocSize(ptr);
+    }
+    free(ptr);
+}
+
+static char* _XMLBudgetStrdup(const char* string) {
+    size_t length = strlen(string) + 1;
+    char* copy = _XMLBudgetMalloc(length);
+    if (copy != NULL) {
+        memcpy(copy, string, length);
+    }
+    return copy;
+}
+
+static void _installMemoryHooks(void) {
+    pthread_key_create(&_parseBudgetKey, NULL);
+    xmlMemSetup(&_XMLBudgetFree, &_XMLBudgetMalloc, &_XMLBudgetRealloc, &_XMLBudgetStrdup);
+}
+
+void _XMLMemoryInstall(void) {
+    // libxml2 requires the allocator to be set before anything else is allocated.
+    pthread_once(&_memoryHooksOnce, &_installMemoryHooks);
+}
+
+static inline bool _budgetExhausted(xmlParserCtxtPtr ctxt, _XMLParseBudget* budget) {
+    if (budget->exceeded == NULL) {
+        if (budget->maxNodes > 0 && budget->nodes > budget->maxNodes) {
+            budget->exceeded = "node";
+        } else if (budget->maxDepth > 0 && budget->depth > budget->maxDepth) {
+            budget->exceeded = "depth";
+        }
+    }
+    if (budget->exceeded != NULL) {
+        xmlStopParser(ctxt);
+        return true;
+    }
+    return false;
+}
+
+static void _budgetStartElementNs(void* ctx, const xmlChar* localname, const xmlChar* prefix, const xmlChar* URI, int nb_namespaces, const xmlChar** namespaces, int nb_attributes, int nb_defaulted, const xmlChar** attributes) {
+    xmlParserCtxtPtr ctxt = (xmlParserCtxtPtr)ctx;
+    _XMLParseBudget* budget = ctxt->_private;
+    budget->depth += 1;
+    budget->nodes += 1 + nb_attributes;
+    if (!_budgetExhausted(ctxt, budget)) {
+        budget->startElementNs(ctx, localname, prefix, URI, nb_namespaces, namespaces, nb_attributes, nb_defaulted, attributes);
+    }
+}
+
+static void _budgetEndElementNs(void* ctx, const xmlChar* localname, const xmlChar* prefix, const xmlChar* URI) {
+    xmlParserCtxtPtr ctxt = (xmlParserCtxtPtr)ctx;
+    _XMLParseBudget* budget = ctxt->_private;
+    budget->depth -= 1;
+    budget->endElementNs(ctx, localname, prefix, URI);
+}
+
+static void _budgetCharacters(void* ctx, const xmlChar* ch, int len) {
+    xmlParserCtxtPtr ctxt = (xmlParserCtxtPtr)ctx;
+    _XMLParseBudget* budget = ctxt->_private;
+    // Adjacent character callbacks are merged into one text node; counting each is a safe upper bound.
+    budget->nodes += 1;
+    if (!_budgetExhausted(ctxt, budget)) {
+        budget->characters(ctx, ch, len);
+    }
+}
+
+static void _budgetIgnorableWhitespace(void* ctx, const xmlChar* ch, int len) {
+    xmlParserCtxtPtr ctxt = (xmlParserCtxtPtr)ctx;
+    _XMLParseBudget* budget = ctxt->_private;
+    // With blanks removed libxml2 installs a handler that drops the text; anything else keeps it.
+    if (budget->ignorableWhitespace != &xmlSAX2IgnorableWhitespace) {
+        budget->nodes += 1;
+    }
+    if (!_budgetExhausted(ctxt, budget)) {
+        budget->ignorableWhitespace(ctx, ch, len);
+    }
+}
+
+static void _budgetCDataBlock(void* ctx, const xmlChar* value, int len) {
+    xmlParserCtxtPtr ctxt = (xmlParserCtxtPtr)ctx;
+    _XMLParseBudget* budget = ctxt->_private;
+    budget->nodes += 1;
+    if (!_budgetExhausted(ctxt, budget)) {
+        budget->cdataBlock(ctx, value, len);
+    }
+}
+
+static void _budgetComment(void* ctx, const xmlChar* value) {
+    xmlParserCtxtPtr ctxt = (xmlParserCtxtPtr)ctx;
+    _XMLParseBudget* budget = ctxt->_private;
+    budget->nodes += 1;
+    if (!_budgetExhausted(ctxt, budget)) {
+        budget->comment(ctx, value);
+    }
+}
+
+static void _budgetProcessingInstruction(void* ctx, const xmlChar* target, const xmlChar* data) {
+    xmlParserCtxtPtr ctxt = (xmlParserCtxtPtr)ctx;
+    _XMLParseBudget* budget = ctxt->_private;
+    budget->nodes += 1;
+    if (!_budgetExhausted(ctxt, budget)) {
+        budget->processingInstruction(ctx, target, data);
+    }
+}
+
+_XMLDocPtr _Nullable _XMLDocPtrFromBytesWithLimits(const uint8_t* _Nullable bytes, size_t length, unsigned int options, _XMLIndex maxBytes, _XMLIndex maxNodes, _XMLIndex maxDepth, _XMLError* _Nullable error) {
+    // The budgets are enforced from the XML parser's SAX callbacks; parsing HTML here would ignore them.
+    if (options & _kXMLDocumentTidyHTML) {
+        _setErrorInfo(error, 0, "Parse limits are not supported for HTML documents");
+        return NULL;
+    }
+    if (length > INT_MAX) {
+        _setErrorInfo(error, 0, "The document is too large");
+        return NULL;
+    }
+
+    _XMLParseBudget budget = {
+        .maxBytes = maxBytes,
+        .maxNodes = maxNodes,
+        .maxDepth = maxDepth,
+    };
+
+    // The budget is installed before the context exists so that everything the parse frees was
+    // charged to it first; otherwise blocks from xmlNewParserCtxt would be subtracted uncharged.
+    uint64_t start = _XMLInstrumentationNow();
+    __atomic_fetch_add(&_activeParseBudgets, 1, __ATOMIC_RELAXED);
+    pthread_setspecific(_parseBudgetKey, &budget);
+
+    xmlDocPtr doc = NULL;
+    xmlParserCtxtPtr ctxt = xmlNewParserCtxt();
+    if (ctxt != NULL) {
+        budget.startElementNs = ctxt->sax->startElementNs;
+        budget.endElementNs = ctxt->sax->endElementNs;
+        budget.characters = ctxt->sax->characters;
+        budget.cdataBlock = ctxt->sax->cdataBlock;
+        budget.comment = ctxt->sax->comment;
+        budget.processingInstruction = ctxt->sax->processingInstruction;
+        budget.ignorableWhitespace = ctxt->sax->ignorableWhitespace;
+        ctxt->_private = &budget;
+        ctxt->sax->startElementNs = &_budgetStartElementNs;
+        ctxt->sax->endElementNs = &_budgetEndElementNs;
+        ctxt->sax->characters = &_budgetCharacters;
+        ctxt->sax->cdataBlock = &_budgetCDataBlock;
+        ctxt->sax->comment = &_budgetComment;
+        ctxt->sax->processingInstruction = &_budgetProcessingInstruction;
+        // The parser treats whitespace as significant when both handlers are the same function,
+        // so that identity has to survive the wrapping.
+        if (budget.ignorableWhitespace == budget.characters) {
+            ctxt->sax->ignorableWhitespace = &_budgetCharacters;
+        } else if (budget.ignorableWhitespace != NULL) {
+            ctxt->sax->ignorableWhitespace = &_budgetIgnorableWhitespace;
+        }
+
+        doc = xmlCtxtReadMemory(ctxt, bytes != NULL ? (const char*)bytes : "", (int)length, NULL, NULL, _parseOptionsForNodeOptions(options));
+        xmlFreeParserCtxt(ctxt);
+    }
+
+    pthread_setspecific(_parseBudgetKey, NULL);
+    __atomic_fetch_sub(&_activeParseBudgets, 1, __ATOMIC_RELAXED);
+    _XMLInstrumentationRecord(_kXMLTimingParse, start);
+    _XMLInstrumentationAdd(_kXMLCounterBytesParsed, (int64_t)length);
+
+    if (ctxt == NULL && budget.exceeded == NULL) {
+        _setErrorInfo(error, 0, "Could not create a parser context");
+        return NULL;
+    }
+
+    // Recovery may still hand back the part parsed before the budget ran out; it is discarded.
+    if (budget.exceeded != NULL) {
+        if (doc != NULL) {
+            xmlFreeDoc(doc);
+            doc = NULL;
+        }
+        char message[128];
+        snprintf(message, sizeof(message), "Document exceeds the %s budget of the parse", budget.exceeded);
+        _setErrorInfo(error, 0, message);
+    } else if (doc == NULL) {
+        _setErrorInfo(error, 0, "Document could not be parsed");
+    }
+
+    return doc;
+}
+
+static inline size_t _stringFootprint(xmlDictPtr dict, const xmlChar* string) {
+    if (string == NULL || (dict != NULL && xmlDictOwns(dict, string))) {
+        return 0;
+    }
+    return _XMLMallocSize(string);
+}
+
+static size_t _nodeFootprint(xmlDictPtr dict, xmlNodePtr node) {
+    size_t size = _XMLMallocSize(node);
+
+    switch (node->type) {
+        case XML_ELEMENT_NODE: {
+            size += _stringFootprint(dict, node->name);
+            for (xmlNsPtr ns = node->nsDef; ns != NULL; ns = ns->next) {
+                size += _XMLMallocSize(ns) + _stringFootprint(dict, ns->href) + _stringFootprint(dict, ns->prefix);
+            }
+            for (xmlAttrPtr attr = node->properties; attr != NULL; attr = attr->next) {
+                size += _XMLMallocSize(attr) + _stringFootprint(dict, attr->name);
+                for (xmlNodePtr child = attr->children; child != NULL; child = child->next) {
+                    size += _nodeFootprint(dict, child);
+                }
+            }
+            break;
+        }
+
+        case XML_TEXT_NODE:
+        case XML_CDATA_SECTION_NODE:
+        case XML_COMMENT_NODE:
+            // Short text may be stored inline in the properties field (XML_PARSE_COMPACT).
+            if (node->content != (xmlChar*)&node->properties) {
+                size += _stringFootprint(dict, node->content);
+            }
+            break;
+
+        case XML_PI_NODE:
+            size += _stringFootprint(dict, node->name) + _stringFootprint(dict, node->content);
+            break;
+
+        case XML_ENTITY_REF_NODE:
+            size += _stringFootprint(dict, node->name);
+            break;
+
+        default:
+            break;
+    }
+
+    return size;
+}
+
+_XMLIndex _XMLDocGetMemoryFootprint(_XMLDocPtr doc) {
+    xmlDocPtr docPtr = (xmlDocPtr)doc;
+    xmlDictPtr dict = docPtr->dict;
+    size_t size = _XMLMallocSize(docPtr);
+
+    size += _stringFootprint(dict, docPtr->URL) + _stringFootprint(dict, docPtr->version) + _stringFootprint(dict, docPtr->encoding);
+    if (dict != NULL) {
+        size += xmlDictGetUsage(dict);
+    }
+
+    xmlNodePtr cur = docPtr->children;
+    while (cur != NULL) {
+        size += _nodeFootprint(dict, cur);
+
+        // Entity references share the entity's children and DTD declarations are not part of the tree proper.
+        if (cur->children != NULL && cur->type != XML_ENTITY_REF_NODE && cur->type != XML_DTD_NODE) {
+            cur = cur->children;
+            continue;
+        }
+
+        while (cur != NULL && cur->next == NULL) {
+            cur = cur->parent;
+            if (cur == (xmlNodePtr)docPtr) {
+                cur = NULL;
+            }
+        }
+        if (cur != NULL) {
+            cur = cur->next;
+        }
+    }
+
+    return (_XMLIndex)size;
+}
+
+
+#pragma mark - Frozen documents
+
+// Stored in xmlDoc.properties next to libxml2's own XML_DOC_* flags, which stop at XML_DOC_HTML (1 << 7).
+#define _XML_DOC_FROZEN (1 << 16)
+
+void _XMLDocFreeze(_XMLDocPtr doc) {
+    xmlDocPtr xmlDoc = (xmlDocPtr)doc;
+    // Numbers elements in document order so XPath sorts node sets without comparing ancestors.
+    xmlXPathOrderDocElems(xmlDoc);
+    xmlDoc->properties |= _XML_DOC_FROZEN;
+}
+
+bool _XMLNodeIsFrozen(_XMLNodePtr node) {
+    xmlDocPtr doc;
+    if (((xmlNodePtr)node)->type == XML_NAMESPACE_DECL) {
+        doc = ((xmlNsPtr)node)->context;
+    } else {
+        doc = ((xmlNodePtr)node)->doc;
+    }
+    return doc != NULL && (doc->properties & _XML_DOC_FROZEN) != 0;
+}
+
+#pragma mark - Cloning
+
+_XMLNodePtr _Nullable _XMLCloneNode(_XMLNodePtr node, _XMLDocPtr target) {
+    xmlNodePtr nodePtr = (xmlNodePtr)node;
+    xmlDocPtr targetDoc = (xmlDocPtr)target;
+
+    // xmlDocCopyNode interns element and attribute names in the target's dictionary instead of
+    // duplicating them. The target always gets a dictionary of its own: the source is left untouched,
+    // which matters for frozen documents read from several threads, and xmlDict itself is not thread-safe.
+    if (targetDoc->dict == NULL) {
+        targetDoc->dict = xmlDictCreate();
+    }
+
+    return xmlDocCopyNode(nodePtr, targetDoc, 1);
+}
+
+#pragma mark - Tree building
+
+static void _XMLBuildLink(xmlNodePtr parent, xmlNodePtr node) {
+    node->parent = parent;
+    if (parent->last != NULL) {
+        parent->last->next = node;
+        node->prev = parent->last;
+    } else {
+        parent->children = node;
+    }
+    parent->last = node;
+}
+
+// An operand is a 32-bit length in host byte order, that many bytes and a NUL, so that libxml2 can
+// use the bytes in place. Returns NULL when the operand runs past end or holds a NUL of its own.
+static const xmlChar* _Nullable _XMLBuildReadOperand(const uint8_t** cursor, const uint8_t* end, uint32_t* length) {
+    uint32_t count;
+    if ((size_t)(end - *cursor) < sizeof(count)) {
+        return NULL;
+    }
+    memcpy(&count, *cursor, sizeof(count));
+    const uint8_t* bytes = *cursor + sizeof(count);
+    if ((size_t)(end - bytes) <= count || bytes[count] != 0 || memchr(bytes, 0, count) != NULL) {
+        return NULL;
+    }
+
+    *cursor = bytes + count + 1;
+    *length = count;
+    return bytes;
+}
+
+_XMLNodePtr _Nullable _XMLBuildTree(_XMLNodePtr _Nullable parent, _XMLDocPtr _Nullable doc, const uint8_t* instructions, _XMLIndex length) {
+    xmlNodePtr top = (xmlNodePtr)parent;
+    xmlDocPtr docPtr = top != NULL ? top->doc : (xmlDocPtr)doc;
+    xmlNodePtr current = top;
+    xmlNodePtr first = NULL;
+    const uint8_t* cursor = instructions;
+    const uint8_t* end = instructions + length;
+
+    // Every string operand follows its opcode, see _XMLBuildReadOperand. Nodes are linked directly as
+    // the last child of the open element: text is never merged and attributes are not checked for duplicates.
+    while (cursor < end) {
+        uint8_t op = *cursor++;
+        if (op == _kXMLBuildOpEndElement) {
+            if (current == top) {
+                goto fail;
+            }
+            current = current->parent;
+            continue;
+        }
+
+        uint32_t operandLength;
+        const xmlChar* operand = _XMLBuildReadOperand(&cursor, end, &operandLength);
+        if (operand == NULL) {
+            goto fail;
+        }
+
+        xmlNodePtr node = NULL;
+        switch (op) {
+            case _kXMLBuildOpStartElement:
+                node = xmlNewDocNode(docPtr, NULL, operand, NULL);
+                break;
+
+            case _kXMLBuildOpAttribute: {
+                uint32_t valueLength;
+                const xmlChar* value = _XMLBuildReadOperand(&cursor, end, &valueLength);
+                if (value == NULL || current == NULL || current == top || xmlNewProp(current, operand, value) == NULL) {
+                    goto fail;
+                }
+                continue;
+            }
+
+            case _kXMLBuildOpText:
+                node = xmlNewDocText(docPtr, operand);
+                break;
+
+            case _kXMLBuildOpCData:
+                node = operandLength <= INT_MAX ? xmlNewCDataBlock(docPtr, operand, (int)operandLength) : NULL;
+                break;
+
+            case _kXMLBuildOpComment:
+                node = xmlNewDocComment(docPtr, operand);
+                break;
+
+            default:
+                goto fail;
+        }
+
+        if (node == NULL) {
+            goto fail;
+        }
+
+        if (current != NULL) {
+            _XMLBuildLink(current, node);
+        } else if (first != NULL) {
+            // Without a parent only a single top-level node can be returned and freed.
+            xmlFreeNode(node);
+            goto fail;
+        }
+
+        if (first == NULL) {
+            first = node;
+        }
+        if (op == _kXMLBuildOpStartElement) {
+            current = node;
+        }
+    }
+
+    if (current != top) {
+        goto fail;
+    }
+    return first;
+
+fail:
+    if (top == NULL) {
+        if (first != NULL) {
+            xmlFreeNode(first);
+        }
+        return NULL;
+    }
+
+    // Everything built so far was appended after the parent's existing children, starting at first.
+    while (first != NULL) {
+        xmlNodePtr next = first->next;
+        xmlUnlinkNode(first);
+        xmlFreeNode(first);
+        first = next;
+    }
+    return NULL;
+}
+
+#pragma mark - Text normalization
+
+static bool _XMLIsMergeableText(xmlNodePtr node, bool preserveCDATA) {
+    return node->type == XML_TEXT_NODE || (!preserveCDATA && node->type == XML_CDATA_SECTION_NODE);
+}
+
+static void _XMLRemoveMergedNode(xmlNodePtr node, _XMLDetachedNodeCallback detached) {
+    xmlNodePtr parent = node->parent;
+    xmlUnlinkNode(node);
+    if (node->_private != NULL) {
+        // Owned by its wrapper, which frees it once the parent wrapper lets go of it.
+        detached(parent, node);
+    } else {
+        xmlFreeNode(node);
+    }
+}
+
+static void _XMLNormalizeChildren(xmlNodePtr element, bool preserveCDATA, _XMLDetachedNodeCallback detached) {
+    xmlNodePtr cur = element->children;
+    while (cur != NULL) {
+        if (!_XMLIsMergeableText(cur, preserveCDATA)) {
+            cur = cur->next;
+            continue;
+        }
+
+        // The first node of a run absorbs the others, so a lone text node is left untouched.
+        xmlNodePtr keep = cur;
+        xmlNodePtr next = keep->next;
+        bool merged = false;
+        while (next != NULL && _XMLIsMergeableText(next, preserveCDATA)) {
+            xmlNodePtr following = next->next;
+            merged = true;
+            if (next->content != NULL && next->content[0] != 0) {
+                xmlTextConcat(keep, next->content, xmlStrlen(next->content));
+            }
+            _XMLRemoveMergedNode(next, detached);
+            next = following;
+        }
+
+        if (merged || keep->type == XML_CDATA_SECTION_NODE || keep->content == NULL || keep->content[0] == 0) {
+            _XMLNodeInvalidateStructuralHash(keep);
+        }
+
+        if (keep->content == NULL || keep->content[0] == 0) {
+            _XMLRemoveMergedNode(keep, detached);
+        } else if (keep->type == XML_CDATA_SECTION_NODE) {
+            keep->type = XML_TEXT_NODE;
+            keep->name = xmlStringText;
+        }
+        cur = next;
+    }
+}
+
+void _XMLNodeNormalizeAdjacentTextNodes(_XMLNodePtr node, bool preserveCDATA, _XMLDetachedNodeCallback detached) {
+    xmlNodePtr root = (xmlNodePtr)node;
+    xmlNodePtr cur = root;
+
+    // Pre-order walk over elements without recursion. As on Darwin an element with a single child is
+    // left alone, and so is everything below it.
+    while (cur != NULL) {
+        xmlNodePtr next = NULL;
+        if (cur->children != NULL && cur->children != cur->last) {
+            _XMLNormalizeChildren(cur, preserveCDATA, detached);
+            next = xmlFirstElementChild(cur);
+        }
+
+        for (xmlNodePtr up = cur; next == NULL && up != root; up = up->parent) {
+            next = xmlNextElementSibling(up);
+        }
+        cur = next;
+    }
+}
+
+#pragma mark - Structural hashing
+
+#define _XML_HASH_SEED 0xcbf29ce484222325ULL
+#define _XML_HASH_PRIME 0x100000001b3ULL
+
+static uint64_t _XMLHashBytes(uint64_t hash, const xmlChar* _Nullable bytes) {
+    if (bytes == NULL) {
+        return (hash ^ 0xfe) * _XML_HASH_PRIME;
+    }
+    for (; *bytes != 0; bytes++) {
+        hash = (hash ^ *bytes) * _XML_HASH_PRIME;
+    }
+    // Terminate every string so that "ab" + "c" and "a" + "bc" hash differently.
+    return (hash ^ 0xff) * _XML_HASH_PRIME;
+}
+
+uint64_t _XMLHashCombine(uint64_t seed, uint64_t value) {
+    uint64_t x = seed ^ (value + 0x9e3779b97f4a7c15ULL + (seed << 6) + (seed >> 2));
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+static uint64_t _XMLHashAttribute(xmlAttrPtr attr) {
+    uint64_t hash = _XMLHashBytes(_XML_HASH_SEED, attr->name);
+    hash = _XMLHashBytes(hash, attr->ns ? attr->ns->href : NULL);
+
+    xmlNodePtr value = attr->children;
+    if (value == NULL || (value->next == NULL && value->type == XML_TEXT_NODE)) {
+        hash = _XMLHashBytes(hash, value ? value->content : (const xmlChar*)"");
+    } else {
+        xmlChar* string = xmlNodeListGetString(attr->doc, value, 1);
+        hash = _XMLHashBytes(hash, string);
+        xmlFree(string);
+    }
+    return _XMLHashCombine(hash, 0);
+}
+
+uint64_t _XMLNodeGetLocalHash(_XMLNodePtr node, bool includeAttributes) {
+    xmlNodePtr nodePtr = (xmlNodePtr)node;
+    uint64_t hash = _XMLHashCombine(_XML_HASH_SEED, (uint64_t)nodePtr->type);
+
+    switch (nodePtr->type) {
+        case XML_ELEMENT_NODE: {
+            hash = _XMLHashBytes(hash, nodePtr->name);
+            hash = _XMLHashBytes(hash, nodePtr->ns ? nodePtr->ns->href : NULL);
+
+            // Attributes and namespace declarations are unordered, so their hashes are summed.
+            uint64_t declarations = 0;
+            for (xmlNsPtr ns = nodePtr->nsDef; ns != NULL; ns = ns->next) {
+                declarations += _XMLHashCombine(_XMLHashBytes(_XMLHashBytes(_XML_HASH_SEED, ns->prefix), ns->href), 1);
+            }
+            hash = _XMLHashCombine(hash, declarations);
+
+            if (includeAttributes) {
+                uint64_t attributes = 0;
+                for (xmlAttrPtr attr = nodePtr->properties; attr != NULL; attr = attr->next) {
+                    attributes += _XMLHashAttribute(attr);
+                }
+                hash = _XMLHashCombine(hash, attributes);
+            }
+            return hash;
+        }
+
+        case XML_TEXT_NODE:
+        case XML_CDATA_SECTION_NODE:
+        case XML_COMMENT_NODE:
+            return _XMLHashBytes(hash, nodePtr->content);
+
+        case XML_PI_NODE:
+            return _XMLHashBytes(_XMLHashBytes(hash, nodePtr->name), nodePtr->content);
+
+        default:
+            return _XMLHashBytes(hash, nodePtr->name);
+    }
+}
+
+static void* _Nullable * _Nullable _XMLNodeHashSlot(xmlNodePtr node) {
+#if UINTPTR_MAX == UINT64_MAX
+    // Only node kinds whose struct carries a psvi field can cache. Text and CDATA nodes are left
+    // out: with XML_PARSE_BIG_LINES the parser keeps line numbers above 65535 in their psvi, and
+    // their hash is cheap to recompute from the content anyway.
+    switch (node->type) {
+        case XML_ELEMENT_NODE:
+        case XML_COMMENT_NODE:
+        case XML_PI_NODE:
+        case XML_ENTITY_REF_NODE:
+            return &node->psvi;
+
+        case XML_DOCUMENT_NODE:
+        case XML_HTML_DOCUMENT_NODE:
+            return &((xmlDocPtr)node)->psvi;
+
+        default:
+            return NULL;
+    }
+#else
+    return NULL;
+#endif
+}
+
+uint64_t _XMLNodeGetStructuralHash(_XMLNodePtr node) {
+    xmlNodePtr nodePtr = (xmlNodePtr)node;
+    void** slot = _XMLNodeHashSlot(nodePtr);
+    if (slot != NULL) {
+        // Relaxed atomics: readers of a frozen document may fill the cache concurrently, always with the same value.
+        void* cached = __atomic_load_n(slot, __ATOMIC_RELAXED);
+        if (cached != NULL) {
+            return (uint64_t)(uintptr_t)cached;
+        }
+    }
+
+    uint64_t hash = _XMLNodeGetLocalHash(node, true);
+    if (nodePtr->type != XML_ENTITY_REF_NODE) {
+        for (xmlNodePtr child = nodePtr->children; child != NULL; child = child->next) {
+            hash = _XMLHashCombine(hash, _XMLNodeGetStructuralHash(child));
+        }
+    }
+    // Zero marks an empty cache slot.
+    if (hash == 0) {
+        hash = 1;
+    }
+
+    if (slot != NULL) {
+        __atomic_store_n(slot, (void*)(uintptr_t)hash, __ATOMIC_RELAXED);
+    }
+    return hash;
+}
+
+void _XMLNodeInvalidateStructuralHash(_XMLNodePtr node) {
+    // A cached hash implies cached hashes for every cacheable node below, so once an ancestor has
+    // nothing cached none of its own ancestors can have anything cached either.
+    for (xmlNodePtr cur = (xmlNodePtr)node; cur != NULL; cur = cur->parent) {
+        void** slot = _XMLNodeHashSlot(cur);
+        if (slot == NULL) {
+            if (cur->type == XML_ATTRIBUTE_NODE || cur == (xmlNodePtr)node) {
+                continue;
+            }
+            return;
+        }
+        if (*slot == NULL && cur != (xmlNodePtr)node) {
+            return;
+        }
+        *slot = NULL;
+    }
+}
+
+#pragma mark - Patching
+
+_XMLNodePtr _Nullable _XMLNodeParseFragment(_XMLNodePtr context, const char* xml, _XMLIndex length) {
+    // An empty text node serializes to nothing, so an empty fragment stands for one.
+    if (length == 0) {
+        return xmlNewDocText(((xmlNodePtr)context)->doc, BAD_CAST "");
+    }
+
+    xmlNodePtr list = NULL;
+    if (xmlParseInNodeContext((xmlNodePtr)context, xml, (int)length, 0, &list) != XML_ERR_OK || list == NULL || list->next != NULL) {
+        xmlFreeNodeList(list);
+        return NULL;
+    }
+    return list;
+}
+
+bool _XMLNodeInsertChildAtIndex(_XMLNodePtr node, _XMLNodePtr child, _XMLIndex index) {
+    xmlNodePtr parent = (xmlNodePtr)node;
+    xmlNodePtr childPtr = (xmlNodePtr)child;
+
+    xmlNodePtr next = parent->children;
+    for (_XMLIndex i = 0; i < index; i++) {
+        if (next == NULL) {
+            return false;
+        }
+        next = next->next;
+    }
+
+    _XMLLinkNode(parent, next != NULL ? next->prev : parent->last, childPtr, next);
+    return true;
+}
+
+#pragma mark - Stream adapters
+
+_XMLDocPtr _Nullable _XMLDocPtrFromReadIO(xmlInputReadCallback ioread, xmlInputCloseCallback ioclose, void* context, int parserOptions) {
+    // Same as xmlReadIO, but keeps the context around long enough to count the bytes consumed.
+    xmlParserCtxtPtr ctxt = xmlNewParserCtxt();
+    if (ctxt == NULL) {
+        if (ioclose != NULL) {
+            ioclose(context);
+        }
+        return NULL;
+    }
+
+    uint64_t start = _XMLInstrumentationNow();
+    xmlDocPtr doc = xmlCtxtReadIO(ctxt, ioread, ioclose, context, NULL, NULL, parserOptions);
+    _XMLInstrumentationRecord(_kXMLTimingParse, start);
+    if (ctxt->input != NULL) {
+        _XMLInstrumentationAdd(_kXMLCounterBytesParsed, xmlByteConsumed(ctxt));
+    }
+    xmlFreeParserCtxt(ctxt);
+    return doc;
+}
+
+_XMLDocPtr _Nullable _XMLDocPtrFromIOWithOptions(xmlInputReadCallback ioread, xmlInputCloseCallback ioclose, void* context, unsigned int options, _XMLError* _Nullable error) {
+    if (options & _kXMLDocumentTidyHTML) {
+        _XMLError htmlError;
+        _XMLDocPtr doc = _XMLHTMLDocPtrFromIO(ioread, ioclose, context, options, &htmlError);
+        if (doc == NULL) {
+            _setErrorInfo(error, 0, htmlError.message);
+        }
+        return doc;
+    }
+
+    xmlParserCtxtPtr ctxt = xmlNewParserCtxt();
+    if (ctxt == NULL) {
+        _setErrorInfo(error, 0, "Could not create a parser for the input stream");
+        return NULL;
+    }
+
+    uint64_t start = _XMLInstrumentationNow();
+    xmlDocPtr doc = xmlCtxtReadIO(ctxt, ioread, ioclose, context, NULL, NULL, _parseOptionsForNodeOptions(options));
+    _XMLInstrumentationRecord(_kXMLTimingParse, start);
+    if (ctxt->input != NULL) {
+        _XMLInstrumentationAdd(_kXMLCounterBytesParsed, xmlByteConsumed(ctxt));
+    }
+    xmlFreeParserCtxt(ctxt);
+
+    if (doc == NULL) {
+        _setErrorInfo(error, 0, "Document could not be parsed");
+    }
+    return doc;
+}
+
+typedef struct {
+    z_stream z;
+    bool deflating;
+} _XMLZStream;
+
+_XMLZStreamPtr _Nullable _XMLZStreamCreateInflate(void) {
+    _XMLZStream* stream = calloc(1, sizeof(_XMLZStream));
+    if (stream == NULL) {
+        return NULL;
+    }
+
+    // 32 added to the window bits makes zlib detect a gzip or a zlib header by itself.
+    if (inflateInit2(&stream->z, MAX_WBITS + 32) != Z_OK) {
+        free(stream);
+        return NULL;
+    }
+    return stream;
+}
+
+_XMLIndex _XMLZStreamProcess(_XMLZStreamPtr stream, const uint8_t* _Nullable input, _XMLIndex inputLength, _XMLIndex* consumed, uint8_t* output, _XMLIndex outputLength, bool flush, bool* ended) {
+    _XMLZStream* zstream = (_XMLZStream*)stream;
+    z_stream* z = &zstream->z;
+
+    // zlib counts in uInt, so very large buffers are processed in several calls by the caller.
+    uInt available = (uInt)(inputLength > UINT_MAX ? UINT_MAX : inputLength);
+    uInt capacity = (uInt)(outputLength > UINT_MAX ? UINT_MAX : outputLength);
+    z->next_in = (Bytef*)input;
+    z->avail_in = available;
+    z->next_out = output;
+    z->avail_out = capacity;
+
+    int result = zstream->deflating ? deflate(z, flush ? Z_FINISH : Z_NO_FLUSH) : inflate(z, Z_NO_FLUSH);
+
+    *consumed = available - z->avail_in;
+    *ended = (result == Z_STREAM_END);
+    z->next_in = NULL;
+    z->next_out = NULL;
+
+    // Z_BUF_ERROR only means that no progress was possible with the buffers given.
+    if (result != Z_OK && result != Z_STREAM_END && result != Z_BUF_ERROR) {
+        return -1;
+    }
+    return capacity - z->avail_out;
+}
+
+_XMLZStreamPtr _Nullable _XMLZStreamCreateDeflate(int level, bool gzip) {
+    _XMLZStream* stream = calloc(1, sizeof(_XMLZStream));
+    if (stream == NULL) {
+        return NULL;
+    }
+
+    // 16 added to the window bits writes a gzip header and trailer instead of the zlib ones.
+    stream->deflating = true;
+    if (deflateInit2(&stream->z, level, Z_DEFLATED, gzip ? MAX_WBITS + 16 : MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        free(stream);
+        return NULL;
+    }
+    return stream;
+}
+
+void _XMLZStreamFree(_XMLZStreamPtr stream) {
+    _XMLZStream* zstream = (_XMLZStream*)stream;
+    if (zstream->deflating) {
+        deflateEnd(&zstream->z);
+    } else {
+        inflateEnd(&zstream->z);
+    }
+    free(zstream);
+}
+
+bool _XMLNodeSaveToIO(_XMLNodePtr node, uint32_t options, xmlOutputWriteCallback iowrite, xmlOutputCloseCallback ioclose, void* context) {
+    if (_serializesAsHTML(node)) {
+        uint64_t start = _XMLInstrumentationNow();
+        int error = _htmlDumpToOutput(xmlOutputBufferCreateIO(iowrite, ioclose, context, NULL), node, options);
+        _XMLInstrumentationRecord(_kXMLTimingSerialization, start);
+        return error != -1;
+    }
+
+    xmlSaveCtxtPtr ctx = xmlSaveToIO(iowrite, ioclose, context, "utf-8", _saveOptionsForNodeOptions(options));
+    if (ctx == NULL) {
+        return false;
+    }
+
+    uint64_t start = _XMLInstrumentationNow();
+    long result = xmlSaveTree(ctx, (xmlNodePtr)node);
+    // Flushes what is still buffered; a write that failed on the way makes it return -1 as well.
+    int error = xmlSaveClose(ctx);
+    _XMLInstrumentationRecord(_kXMLTimingSerialization, start);
+
+    return result != -1 && error != -1;
+}
+
+#pragma mark - Snapshots
+
+// Integers are stored in host byte order; every platform the pod builds for is little-endian.
+#define _XML_SNAPSHOT_VERSION 2
+#define _XML_SNAPSHOT_NO_VALUE UINT32_MAX
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t nameCount;
+    uint32_t namespaceCount;
+    uint32_t nodeCount;
+    uint32_t poolLength;
+    // The XML_DOC_HTML bit of xmlDoc.properties, and the document URL in the string pool.
+    uint32_t properties;
+    uint32_t urlOffset;
+    uint32_t urlLength;
+} _XMLSnapshotHeader;
+
+// Names are interned once and point into the string pool, where every string is NUL-terminated.
+typedef struct {
+    uint32_t offset;
+    uint32_t length;
+} _XMLSnapshotName;
+
+// Declared on the element record owner, sorted by owner. Owner 0 stands for the implicit xml namespace.
+typedef struct {
+    uint32_t owner;
+    uint32_t prefix;
+    uint32_t href;
+} _XMLSnapshotNamespace;
+
+// Records are in document order, each element followed by its attributes and then its children.
+// name and ns are one-based indexes with 0 for none; firstChild and nextSibling are record
+// indexes with 0 for none, since record 0 is always the document.
+typedef struct {
+    uint8_t type;
+    uint8_t flags;
+    uint16_t reserved;
+    uint32_t parent;
+    uint32_t name;
+    uint32_t ns;
+    uint32_t valueOffset;
+    uint32_t valueLength;
+    uint32_t firstChild;
+    uint32_t nextSibling;
+} _XMLSnapshotRecord;
+
+typedef struct {
+    uint8_t* bytes;
+    size_t length;
+    size_t capacity;
+} _XMLByteBuffer;
+
+static bool _byteBufferAppend(_XMLByteBuffer* buffer, const void* bytes, size_t length) {
+    if (buffer->length + length > buffer->capacity) {
+        size_t capacity = buffer->capacity != 0 ? buffer->capacity : 4096;
+        while (capacity < buffer->length + length) {
+            capacity *= 2;
+        }
+        uint8_t* grown = realloc(buffer->bytes, capacity);
+        if (grown == NULL) {
+            return false;
+        }
+        buffer->bytes = grown;
+        buffer->capacity = capacity;
+    }
+    memcpy(buffer->bytes + buffer->length, bytes, length);
+    buffer->length += length;
+    return true;
+}
+
+typedef struct {
+    xmlHashTablePtr nameIndexes;
+    xmlHashTablePtr namespaceIndexes;
+    _XMLByteBuffer names;
+    _XMLByteBuffer namespaces;
+    _XMLByteBuffer records;
+    _XMLByteBuffer lastChildren;
+    _XMLByteBuffer pool;
+    uint32_t nameCount;
+    uint32_t namespaceCount;
+    uint32_t nodeCount;
+    const char* _Nullable failure;
+} _XMLSnapshotWriter;
+
+static inline _XMLSnapshotRecord* _snapshotRecord(_XMLSnapshotWriter* writer, uint32_t index) {
+    return (_XMLSnapshotRecord*)writer->records.bytes + index;
+}
+
+static uint32_t _snapshotAppendString(_XMLSnapshotWriter* writer, const xmlChar* string, size_t length) {
+    if (writer->pool.length + length + 1 >= UINT32_MAX) {
+        writer->failure = "The document is too large for a snapshot";
+        return 0;
+    }
+
+    uint32_t offset = (uint32_t)writer->pool.length;
+    if (!_byteBufferAppend(&writer->pool, string, length) || !_byteBufferAppend(&writer->pool, "", 1)) {
+        writer->failure = "Out of memory";
+    }
+    return offset;
+}
+
+static uint32_t _snapshotName(_XMLSnapshotWriter* writer, const xmlChar* _Nullable name) {
+    if (name == NULL) {
+        return 0;
+    }
+
+    uintptr_t index = (uintptr_t)xmlHashLookup(writer->nameIndexes, name);
+    if (index != 0) {
+        return (uint32_t)index;
+    }
+
+    size_t length = strlen((const char*)name);
+    _XMLSnapshotName entry = { _snapshotAppendString(writer, name, length), (uint32_t)length };
+    if (!_byteBufferAppend(&writer->names, &entry, sizeof(entry))) {
+        writer->failure = "Out of memory";
+        return 0;
+    }
+    writer->nameCount++;
+    xmlHashAddEntry(writer->nameIndexes, name, (void*)(uintptr_t)writer->nameCount);
+    return writer->nameCount;
+}
+
+// Namespaces are told apart by identity rather than by prefix and URI, and xmlHashTable keys are
+// strings, so a namespace is keyed by its address.
+static void _snapshotNamespaceKey(xmlNsPtr ns, char key[32]) {
+    snprintf(key, 32, "%p", (void*)ns);
+}
+
+static uint32_t _snapshotDeclareNamespace(_XMLSnapshotWriter* writer, xmlNsPtr ns, uint32_t owner) {
+    _XMLSnapshotNamespace entry = { owner, _snapshotName(writer, ns->prefix), _snapshotName(writer, ns->href) };
+    if (!_byteBufferAppend(&writer->namespaces, &entry, sizeof(entry))) {
+        writer->failure = "Out of memory";
+        return 0;
+    }
+    writer->namespaceCount++;
+    char key[32];
+    _snapshotNamespaceKey(ns, key);
+    xmlHashAddEntry(writer->namespaceIndexes, (const xmlChar*)key, (void*)(uintptr_t)writer->namespaceCount);
+    return writer->namespaceCount;
+}
+
+// A namespace that is in use without being declared on an ancestor is declared on the node using it.
+static uint32_t _snapshotNamespace(_XMLSnapshotWriter* writer, xmlNsPtr _Nullable ns, uint32_t owner) {
+    if (ns == NULL) {
+        return 0;
+    }
+
+    char key[32];
+    _snapshotNamespaceKey(ns, key);
+    uintptr_t index = (uintptr_t)xmlHashLookup(writer->namespaceIndexes, (const xmlChar*)key);
+    if (index != 0) {
+        return (uint32_t)index;
+    }
+    return _snapshotDeclareNamespace(writer, ns, xmlStrEqual(ns->href, XML_XML_NAMESPACE) ? 0 : owner);
+}
+
+static uint32_t _snapshotAppendRecord(_XMLSnapshotWriter* writer, xmlElementType type, uint32_t parent, uint32_t name, uint32_t ns, const xmlChar* _Nullable value) {
+    if (writer->nodeCount == UINT32_MAX) {
+        writer->failure = "The document is too large for a snapshot";
+        return 0;
+    }
+
+    _XMLSnapshotRecord record = { 0 };
+    record.type = (uint8_t)type;
+    record.parent = parent;
+    record.name = name;
+    record.ns = ns;
+    record.valueLength = _XML_SNAPSHOT_NO_VALUE;
+    if (value != NULL) {
+        size_t length = strlen((const char*)value);
+        record.valueOffset = _snapshotAppendString(writer, value, length);
+        record.valueLength = (uint32_t)length;
+    }
+
+    uint32_t none = 0;
+    if (!_byteBufferAppend(&writer->records, &record, sizeof(record)) ||
+        !_byteBufferAppend(&writer->lastChildren, &none, sizeof(none))) {
+        writer->failure = "Out of memory";
+        return 0;
+    }
+
+    uint32_t index = writer->nodeCount++;
+    if (index != 0 && type != XML_ATTRIBUTE_NODE) {
+        uint32_t* lastChildren = (uint32_t*)writer->lastChildren.bytes;
+        if (lastChildren[parent] == 0) {
+            _snapshotRecord(writer, parent)->firstChild = index;
+        } else {
+            _snapshotRecord(writer, lastChildren[parent])->nextSibling = index;
+        }
+        lastChildren[parent] = index;
+    }
+    return index;
+}
+
+static uint32_t _snapshotAppendNode(_XMLSnapshotWriter* writer, xmlNodePtr node, uint32_t parent) {
+    switch (node->type) {
+        case XML_ELEMENT_NODE: {
+            uint32_t index = writer->nodeCount;
+            for (xmlNsPtr ns = node->nsDef; ns != NULL; ns = ns->next) {
+                _snapshotDeclareNamespace(writer, ns, index);
+            }
+            uint32_t ns = _snapshotNamespace(writer, node->ns, index);
+            _snapshotAppendRecord(writer, XML_ELEMENT_NODE, parent, _snapshotName(writer, node->name), ns, NULL);
+
+            for (xmlAttrPtr attribute = node->properties; attribute != NULL && writer->failure == NULL; attribute = attribute->next) {
+                xmlChar* value = xmlNodeGetContent((xmlNodePtr)attribute);
+                uint32_t attributeNS = _snapshotNamespace(writer, attribute->ns, index);
+                _snapshotAppendRecord(writer, XML_ATTRIBUTE_NODE, index, _snapshotName(writer, attribute->name), attributeNS, value);
+                xmlFree(value);
+            }
+            return index;
+        }
+
+        case XML_TEXT_NODE:
+        case XML_CDATA_SECTION_NODE:
+        case XML_COMMENT_NODE:
+            return _snapshotAppendRecord(writer, node->type, parent, 0, 0, node->content != NULL ? node->content : (const xmlChar*)"");
+
+        case XML_PI_NODE:
+            return _snapshotAppendRecord(writer, XML_PI_NODE, parent, _snapshotName(writer, node->name), 0, node->content);
+
+        case XML_ENTITY_REF_NODE:
+            return _snapshotAppendRecord(writer, XML_ENTITY_REF_NODE, parent, _snapshotName(writer, node->name), 0, NULL);
+
+        case XML_DTD_NODE:
+            writer->failure = "Documents with a DTD cannot be snapshotted";
+            return 0;
+
+        default:
+            writer->failure = "The document contains a node that cannot be snapshotted";
+            return 0;
+    }
+}
+
+static bool _snapshotWrite(xmlOutputWriteCallback iowrite, void* context, const void* bytes, size_t length) {
+    const char* cursor = bytes;
+    while (length > 0) {
+        int chunk = length > (1 << 30) ? (1 << 30) : (int)length;
+        int written = iowrite(context, cursor, chunk);
+        if (written <= 0) {
+            return false;
+        }
+        cursor += written;
+        length -= (size_t)written;
+    }
+    return true;
+}
+
+bool _XMLDocWriteSnapshot(_XMLDocPtr doc, xmlOutputWriteCallback iowrite, void* context, _XMLError* _Nullable error) {
+    xmlDocPtr docPtr = (xmlDocPtr)doc;
+    _XMLSnapshotWriter writer = { 0 };
+    writer.nameIndexes = xmlHashCreate(0);
+    writer.namespaceIndexes = xmlHashCreate(0);
+
+    uint64_t start = _XMLInstrumentationNow();
+    uint32_t urlOffset = 0;
+    uint32_t urlLength = _XML_SNAPSHOT_NO_VALUE;
+    if (docPtr->URL != NULL) {
+        size_t length = strlen((const char*)docPtr->URL);
+        urlOffset = _snapshotAppendString(&writer, docPtr->URL, length);
+        urlLength = (uint32_t)length;
+    }
+    uint32_t documentIndex = _snapshotAppendRecord(&writer, XML_DOCUMENT_NODE, 0, _snapshotName(&writer, docPtr->encoding), 0, docPtr->version);
+    if (writer.failure == NULL) {
+        _snapshotRecord(&writer, documentIndex)->flags = (uint8_t)(docPtr->standalone + 2);
+    }
+
+    // Pre-order walk over the tree's own links; the parent record is found through the records.
+    uint32_t parent = documentIndex;
+    xmlNodePtr node = docPtr->children;
+    while (node != NULL && writer.failure == NULL) {
+        uint32_t index = _snapshotAppendNode(&writer, node, parent);
+        if (node->type == XML_ELEMENT_NODE && node->children != NULL) {
+            parent = index;
+            node = node->children;
+            continue;
+        }
+        while (node->next == NULL && node->parent != (xmlNodePtr)docPtr) {
+            node = node->parent;
+            parent = _snapshotRecord(&writer, parent)->parent;
+        }
+        node = node->next;
+    }
+
+    bool written = false;
+    if (writer.failure == NULL) {
+        _XMLSnapshotHeader header = { { 'X', 'S', 'N', 'P' }, _XML_SNAPSHOT_VERSION, writer.nameCount, writer.namespaceCount, writer.nodeCount, (uint32_t)writer.pool.length,
+                                      (uint32_t)(docPtr->properties & XML_DOC_HTML), urlOffset, urlLength };
+        written = _snapshotWrite(iowrite, context, &header, sizeof(header)) &&
+            _snapshotWrite(iowrite, context, writer.names.bytes, writer.names.length) &&
+            _snapshotWrite(iowrite, context, writer.namespaces.bytes, writer.namespaces.length) &&
+            _snapshotWrite(iowrite, context, writer.records.bytes, writer.records.length) &&
+            _snapshotWrite(iowrite, context, writer.pool.bytes, writer.pool.length);
+        if (!written) {
+            writer.failure = "The snapshot could not be written";
+        }
+    }
+    _XMLInstrumentationRecord(_kXMLTimingSerialization, start);
+
+    if (writer.failure != NULL) {
+        _setErrorInfo(error, 0, writer.failure);
+    }
+
+    xmlHashFree(writer.nameIndexes, NULL);
+    xmlHashFree(writer.namespaceIndexes, NULL);
+    free(writer.names.bytes);
+    free(writer.namespaces.bytes);
+    free(writer.records.bytes);
+    free(writer.lastChildren.bytes);
+    free(writer.pool.bytes);
+
+    return written;
+}
+
+typedef struct {
+    xmlDocPtr doc;
+    const _XMLSnapshotNamespace* namespaces;
+    uint32_t namespaceCount;
+    const xmlChar** names;
+    uint32_t nameCount;
+    xmlNsPtr* nsPtrs;
+    const uint8_t* pool;
+    uint32_t poolLength;
+} _XMLSnapshotReader;
+
+static bool _snapshotString(_XMLSnapshotReader* reader, uint32_t offset, uint32_t length, const xmlChar** string) {
+    if ((uint64_t)offset + length >= reader->poolLength || reader->pool[offset + length] != 0) {
+        return false;
+    }
+    *string = reader->pool + offset;
+    return true;
+}
+
+static bool _snapshotResolveName(_XMLSnapshotReader* reader, uint32_t name, const xmlChar** result) {
+    if (name > reader->nameCount) {
+        return false;
+    }
+    *result = name != 0 ? reader->names[name - 1] : NULL;
+    return true;
+}
+
+static bool _snapshotResolveNamespace(_XMLSnapshotReader* reader, uint32_t ns, xmlNodePtr element, xmlNsPtr* result) {
+    if (ns == 0) {
+        *result = NULL;
+        return true;
+    }
+    if (ns > reader->namespaceCount) {
+        return false;
+    }
+    if (reader->namespaces[ns - 1].owner == 0) {
+        *result = xmlSearchNs(reader->doc, element, (const xmlChar*)"xml");
+    } else {
+        *result = reader->nsPtrs[ns - 1];
+    }
+    return *result != NULL;
+}
+
+_XMLDocPtr _Nullable _XMLDocCreateFromSnapshot(const uint8_t* _Nullable bytes, _XMLIndex length, _XMLError* _Nullable error) {
+    _XMLSnapshotHeader header;
+    if (length < (_XMLIndex)sizeof(header)) {
+        _setErrorInfo(error, 0, "The data is not a snapshot");
+        return NULL;
+    }
+    memcpy(&header, bytes, sizeof(header));
+    if (memcmp(header.magic, "XSNP", 4) != 0 || header.version != _XML_SNAPSHOT_VERSION) {
+        _setErrorInfo(error, 0, "The data is not a snapshot or was written by another version");
+        return NULL;
+    }
+
+    uint64_t namesOffset = sizeof(header);
+    uint64_t namespacesOffset = namesOffset + (uint64_t)header.nameCount * sizeof(_XMLSnapshotName);
+    uint64_t recordsOffset = namespacesOffset + (uint64_t)header.namespaceCount * sizeof(_XMLSnapshotNamespace);
+    uint64_t poolOffset = recordsOffset + (uint64_t)header.nodeCount * sizeof(_XMLSnapshotRecord);
+    if (header.nodeCount == 0 || poolOffset + header.poolLength != (uint64_t)length) {
+        _setErrorInfo(error, 0, "The snapshot is truncated");
+        return NULL;
+    }
+
+    _XMLSnapshotReader reader = {
+        .namespaces = (const _XMLSnapshotNamespace*)(bytes + namespacesOffset),
+        .namespaceCount = header.namespaceCount,
+        .nameCount = header.nameCount,
+        .pool = bytes + poolOffset,
+        .poolLength = header.poolLength,
+    };
+    const char* failure = "The snapshot is corrupt";
+    uint64_t start = _XMLInstrumentationNow();
+
+    _XMLSnapshotRecord record;
+    memcpy(&record, bytes + recordsOffset, sizeof(record));
+    const xmlChar* version = (const xmlChar*)"1.0";
+    if (record.type != XML_DOCUMENT_NODE ||
+        (record.valueLength != _XML_SNAPSHOT_NO_VALUE && !_snapshotString(&reader, record.valueOffset, record.valueLength, &version))) {
+        _setErrorInfo(error, 0, failure);
+        return NULL;
+    }
+
+    const xmlChar* url = NULL;
+    if (header.urlLength != _XML_SNAPSHOT_NO_VALUE && !_snapshotString(&reader, header.urlOffset, header.urlLength, &url)) {
+        _setErrorInfo(error, 0, failure);
+        return NULL;
+    }
+
+    xmlDocPtr doc = xmlNewDoc(version);
+    doc->dict = xmlDictCreate();
+    doc->standalone = (int)record.flags - 2;
+    doc->properties |= (int)(header.properties & XML_DOC_HTML);
+    if (url != NULL) {
+        doc->URL = xmlStrdup(url);
+    }
+    reader.doc = doc;
+    reader.names = malloc(sizeof(xmlChar*) * (header.nameCount + 1));
+    reader.nsPtrs = calloc(header.namespaceCount + 1, sizeof(xmlNsPtr));
+    xmlNodePtr* nodes = malloc(sizeof(xmlNodePtr) * header.nodeCount);
+    if (doc->dict == NULL || reader.names == NULL || reader.nsPtrs == NULL || nodes == NULL) {
+        failure = "Out of memory";
+        goto fail;
+    }
+    nodes[0] = (xmlNodePtr)doc;
+
+    // Names are looked up in the dictionary once; every node then shares the interned string.
+    for (uint32_t i = 0; i < header.nameCount; i++) {
+        _XMLSnapshotName name;
+        memcpy(&name, bytes + namesOffset + i * sizeof(name), sizeof(name));
+        const xmlChar* string;
+        if (!_snapshotString(&reader, name.offset, name.length, &string)) {
+            goto fail;
+        }
+        reader.names[i] = xmlDictLookup(doc->dict, string, (int)name.length);
+    }
+
+    const xmlChar* encoding;
+    if (!_snapshotResolveName(&reader, record.name, &encoding)) {
+        goto fail;
+    }
+    if (encoding != NULL) {
+        doc->encoding = xmlStrdup(encoding);
+    }
+
+    uint32_t nextNamespace = 0;
+    for (uint32_t i = 1; i < header.nodeCount; i++) {
+        memcpy(&record, bytes + recordsOffset + i * sizeof(record), sizeof(record));
+
+        const xmlChar* name;
+        const xmlChar* value = NULL;
+        if (record.parent >= i || !_snapshotResolveName(&reader, record.name, &name) ||
+            (record.valueLength != _XML_SNAPSHOT_NO_VALUE && !_snapshotString(&reader, record.valueOffset, record.valueLength, &value))) {
+            goto fail;
+        }
+
+        xmlNodePtr parent = nodes[record.parent];
+        if (parent->type != XML_ELEMENT_NODE && parent->type != XML_DOCUMENT_NODE) {
+            goto fail;
+        }
+
+        xmlNodePtr node = NULL;
+        switch (record.type) {
+            case XML_ELEMENT_NODE:
+                if (name == NULL) {
+                    goto fail;
+                }
+                node = xmlNewDocNodeEatName(doc, NULL, (xmlChar*)name, NULL);
+                _XMLBuildLink(parent, node);
+                nodes[i] = node;
+
+                for (; nextNamespace < header.namespaceCount; nextNamespace++) {
+                    _XMLSnapshotNamespace entry;
+                    memcpy(&entry, reader.namespaces + nextNamespace, sizeof(entry));
+                    if (entry.owner == 0) {
+                        continue;
+                    }
+                    if (entry.owner < i) {
+                        goto fail;
+                    }
+                    if (entry.owner > i) {
+                        break;
+                    }
+
+                    const xmlChar* prefix;
+                    const xmlChar* href;
+                    if (!_snapshotResolveName(&reader, entry.prefix, &prefix) || !_snapshotResolveName(&reader, entry.href, &href) ||
+                        (reader.nsPtrs[nextNamespace] = xmlNewNs(node, href, prefix)) == NULL) {
+                        goto fail;
+                    }
+                }
+
+                if (!_snapshotResolveNamespace(&reader, record.ns, node, &node->ns)) {
+                    goto fail;
+                }
+                break;
+
+            case XML_ATTRIBUTE_NODE: {
+                xmlNsPtr ns;
+                if (name == NULL || parent->type != XML_ELEMENT_NODE || !_snapshotResolveNamespace(&reader, record.ns, parent, &ns)) {
+                    goto fail;
+                }
+                node = (xmlNodePtr)xmlNewNsProp(parent, ns, name, value);
+                nodes[i] = node;
+                continue;
+            }
+
+            case XML_TEXT_NODE:
+                node = value != NULL ? xmlNewDocTextLen(doc, value, (int)record.valueLength) : NULL;
+                break;
+
+            case XML_CDATA_SECTION_NODE:
+                node = value != NULL ? xmlNewCDataBlock(doc, value, (int)record.valueLength) : NULL;
+                break;
+
+            case XML_COMMENT_NODE:
+                node = value != NULL ? xmlNewDocComment(doc, value) : NULL;
+                break;
+
+            case XML_PI_NODE:
+                node = name != NULL ? xmlNewDocPI(doc, name, value) : NULL;
+                break;
+
+            case XML_ENTITY_REF_NODE:
+                node = name != NULL ? xmlNewReference(doc, name) : NULL;
+                break;
+
+            default:
+                break;
+        }
+
+        if (node == NULL) {
+            goto fail;
+        }
+        if (record.type != XML_ELEMENT_NODE) {
+            _XMLBuildLink(parent, node);
+            nodes[i] = node;
+        }
+    }
+
+    _XMLInstrumentationRecord(_kXMLTimingParse, start);
+    free(reader.names);
+    free(reader.nsPtrs);
+    free(nodes);
+    return doc;
+
+fail:
+    _setErrorInfo(error, 0, failure);
+    free(reader.names);
+    free(reader.nsPtrs);
+    free(nodes);
+    xmlFreeDoc(doc);
+    return NULL;
+}
+
+#pragma mark - Element index
+
+typedef struct {
+    _XMLIndex key;
+    _XMLIndex depth;
+    int64_t start;
+    _XMLByteBuffer value;
+    bool hasValue;
+    bool capturing;
+} _XMLIndexMatch;
+
+typedef struct {
+    xmlParserCtxtPtr ctxt;
+    const char* const* paths;
+    const char* const* keyNames;
+    _XMLIndex keyCount;
+    _XMLIndexMatchCallback match;
+    void* context;
+    _XMLByteBuffer path;
+    _XMLByteBuffer pathLengths;
+    _XMLByteBuffer matches;
+    _XMLIndex depth;
+    bool failed;
+} _XMLIndexState;
+
+static bool _indexPathMatches(_XMLIndexState* state, const char* pattern) {
+    const char* path = (const char*)state->path.bytes;
+    size_t length = state->path.length;
+    if (pattern[0] == '/' && pattern[1] == '/') {
+        // "//a/b" matches any path ending in "/a/b".
+        size_t suffixLength = strlen(pattern + 1);
+        return length >= suffixLength && memcmp(path + length - suffixLength, pattern + 1, suffixLength) == 0;
+    }
+    return strlen(pattern) == length && memcmp(path, pattern, length) == 0;
+}
+
+static void _indexStartElementNs(void* ctx, const xmlChar* localname, const xmlChar* prefix, const xmlChar* URI, int nb_namespaces, const xmlChar** namespaces, int nb_attributes, int nb_defaulted, const xmlChar** attributes) {
+    _XMLIndexState* state = (_XMLIndexState*)ctx;
+    size_t parentLength = state->path.length;
+    size_t nameLength = strlen((const char*)localname);
+    if (!_byteBufferAppend(&state->pathLengths, &parentLength, sizeof(parentLength)) ||
+        !_byteBufferAppend(&state->path, "/", 1) || !_byteBufferAppend(&state->path, localname, nameLength)) {
+        state->failed = true;
+        xmlStopParser(state->ctxt);
+        return;
+    }
+    state->depth++;
+
+    // A key held by a child element: start collecting its text.
+    _XMLIndexMatch* open = (_XMLIndexMatch*)state->matches.bytes;
+    _XMLIndex openCount = (_XMLIndex)(state->matches.length / sizeof(_XMLIndexMatch));
+    for (_XMLIndex i = 0; i < openCount; i++) {
+        const char* keyName = state->keyNames[open[i].key];
+        if (keyName[0] != '@' && !open[i].hasValue && state->depth == open[i].depth + 1 && strcmp(keyName, (const char*)localname) == 0) {
+            open[i].capturing = true;
+        }
+    }
+
+    int64_t start = -1;
+    for (_XMLIndex key = 0; key < state->keyCount; key++) {
+        if (!_indexPathMatches(state, state->paths[key])) {
+            continue;
+        }
+
+        if (start < 0) {
+            // The callback comes before '>' is consumed; nothing can contain '<' inside a start tag,
+            // so the last '<' in the buffer opens this element.
+            xmlParserInputPtr input = state->ctxt->input;
+            const xmlChar* cursor = input->cur;
+            while (cursor > input->base && *cursor != '<') {
+                cursor--;
+            }
+            start = xmlByteConsumed(state->ctxt) - (long)(input->cur - cursor);
+        }
+
+        _XMLIndexMatch match = { .key = key, .depth = state->depth, .start = start };
+        const char* keyName = state->keyNames[key];
+        if (keyName[0] == '@') {
+            // Attributes come as (localname, prefix, URI, value, end) quintuples.
+            for (int i = 0; i < nb_attributes; i++) {
+                const xmlChar** attribute = attributes + i * 5;
+                if (strcmp((const char*)attribute[0], keyName + 1) == 0) {
+                    match.hasValue = _byteBufferAppend(&match.value, attribute[3], (size_t)(attribute[4] - attribute[3]));
+                    break;
+                }
+            }
+        }
+        if (!_byteBufferAppend(&state->matches, &match, sizeof(match))) {
+            free(match.value.bytes);
+            state->failed = true;
+            xmlStopParser(state->ctxt);
+            return;
+        }
+    }
+}
+
+static void _indexEndElementNs(void* ctx, const xmlChar* localname, const xmlChar* prefix, const xmlChar* URI) {
+    _XMLIndexState* state = (_XMLIndexState*)ctx;
+
+    _XMLIndexMatch* open = (_XMLIndexMatch*)state->matches.bytes;
+    _XMLIndex openCount = (_XMLIndex)(state->matches.length / sizeof(_XMLIndexMatch));
+    for (_XMLIndex i = 0; i < openCount; i++) {
+        if (open[i].capturing && state->depth == open[i].depth + 1) {
+            open[i].capturing = false;
+            open[i].hasValue = true;
+        }
+    }
+
+    // Matches close innermost first, so they are always at the end of the stack.
+    while (openCount > 0 && open[openCount - 1].depth == state->depth) {
+        _XMLIndexMatch* match = &open[--openCount];
+        if (match->hasValue) {
+            // The end tag, or the "/>" of an empty element, has been consumed at this point.
+            state->match(state->context, match->key, (const char*)match->value.bytes, (_XMLIndex)match->value.length, match->start, xmlByteConsumed(state->ctxt));
+        }
+        free(match->value.bytes);
+        state->matches.length -= sizeof(_XMLIndexMatch);
+    }
+
+    size_t parentLength;
+    memcpy(&parentLength, state->pathLengths.bytes + state->pathLengths.length - sizeof(parentLength), sizeof(parentLength));
+    state->pathLengths.length -= sizeof(parentLength);
+    state->path.length = parentLength;
+    state->depth--;
+}
+
+static void _indexCharacters(void* ctx, const xmlChar* characters, int length) {
+    _XMLIndexState* state = (_XMLIndexState*)ctx;
+    _XMLIndexMatch* open = (_XMLIndexMatch*)state->matches.bytes;
+    _XMLIndex openCount = (_XMLIndex)(state->matches.length / sizeof(_XMLIndexMatch));
+    for (_XMLIndex i = 0; i < openCount; i++) {
+        if (open[i].capturing && state->depth == open[i].depth + 1 && !_byteBufferAppend(&open[i].value, characters, (size_t)length)) {
+            state->failed = true;
+            xmlStopParser(state->ctxt);
+        }
+    }
+}
+
+bool _XMLIndexFile(const char* path, const char* _Nonnull const* _Nullable paths, const char* _Nonnull const* _Nullable keyNames, _XMLIndex keyCount, _XMLIndexMatchCallback match, void* context, _XMLError* _Nullable error) {
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) {
+        _setErrorInfo(error, 0, "The file could not be opened");
+        return false;
+    }
+
+    // Only the callbacks the index needs: no tree is built and memory stays bounded by depth.
+    xmlSAXHandler sax;
+    memset(&sax, 0, sizeof(sax));
+    sax.initialized = XML_SAX2_MAGIC;
+    sax.startElementNs = &_indexStartElementNs;
+    sax.endElementNs = &_indexEndElementNs;
+    sax.characters = &_indexCharacters;
+    sax.cdataBlock = &_indexCharacters;
+
+    _XMLIndexState state = { 0 };
+    state.paths = paths;
+    state.keyNames = keyNames;
+    state.keyCount = keyCount;
+    state.match = match;
+    state.context = context;
+
+    uint64_t start = _XMLInstrumentationNow();
+    char chunk[64 * 1024];
+    size_t count = fread(chunk, 1, 4, file);
+    state.ctxt = xmlCreatePushParserCtxt(&sax, &state, chunk, (int)count, path);
+    bool parsed = false;
+    if (state.ctxt != NULL) {
+        xmlCtxtUseOptions(state.ctxt, XML_PARSE_NOENT | XML_PARSE_NONET | XML_PARSE_HUGE);
+        int result = 0;
+        while (result == 0 && !state.failed && (count = fread(chunk, 1, sizeof(chunk), file)) > 0) {
+            result = xmlParseChunk(state.ctxt, chunk, (int)count, 0);
+        }
+        if (result == 0 && !state.failed) {
+            result = xmlParseChunk(state.ctxt, NULL, 0, 1);
+        }
+        parsed = result == 0 && !state.failed && state.ctxt->wellFormed;
+        _XMLInstrumentationAdd(_kXMLCounterBytesParsed, xmlByteConsumed(state.ctxt));
+        xmlFreeParserCtxt(state.ctxt);
+    }
+    _XMLInstrumentationRecord(_kXMLTimingParse, start);
+    fclose(file);
+
+    _XMLIndexMatch* open = (_XMLIndexMatch*)state.matches.bytes;
+    for (size_t i = 0; i < state.matches.length / sizeof(_XMLIndexMatch); i++) {
+        free(open[i].value.bytes);
+    }
+    free(state.matches.bytes);
+    free(state.path.bytes);
+    free(state.pathLengths.bytes);
+
+    if (!parsed) {
+        _setErrorInfo(error, 0, state.failed ? "Out of memory" : "The file is not well-formed XML");
+    }
+    return parsed;
+}
+
+#pragma mark - ID and key lookup
+
+_XMLNodePtr _Nullable _XMLDocGetElementForID(_XMLDocPtr doc, const char* ID) {
+    xmlAttrPtr attribute = xmlGetID((xmlDocPtr)doc, (const xmlChar*)ID);
+    // For IDs registered by a streaming parse xmlGetID hands back the document itself.
+    if (attribute == NULL || (void*)attribute == doc) {
+        return NULL;
+    }
+
+    // Detaching an element leaves its IDs registered, so only report elements still in the tree.
+    xmlNodePtr element = attribute->parent;
+    for (xmlNodePtr cur = element; cur != NULL; cur = cur->parent) {
+        if (cur == (xmlNodePtr)doc) {
+            return element;
+        }
+    }
+    return NULL;
+}
+
+// Walks node, and its subtree when descendants is set, reporting the elements named elementName that carry
+// attributeName without a namespace. Defaults the DTD declares for the attribute are not reported.
+void _XMLNodeCollectKeys(_XMLNodePtr node, bool descendants, const char* elementName, const char* attributeName, _XMLKeyCallback callback, void* context) {
+    xmlNodePtr root = (xmlNodePtr)node;
+    xmlNodePtr current = root;
+    while (current != NULL) {
+        if (current->type == XML_ELEMENT_NODE && xmlStrEqual(current->name, (const xmlChar*)elementName)) {
+            xmlAttrPtr attribute = xmlHasNsProp(current, (const xmlChar*)attributeName, NULL);
+            if (attribute != NULL && attribute->type == XML_ATTRIBUTE_NODE) {
+                xmlChar* value = xmlNodeGetContent((xmlNodePtr)attribute);
+                callback(context, current, value != NULL ? (const char*)value : "");
+                xmlFree(value);
+            }
+        }
+
+        if (!descendants) {
+            break;
+        }
+        bool isContainer = current->type == XML_ELEMENT_NODE || current->type == XML_DOCUMENT_NODE || current->type == XML_HTML_DOCUMENT_NODE;
+        if (isContainer && current->children != NULL) {
+            current = current->children;
+            continue;
+        }
+        if (current == root) {
+            break;
+        }
+        while (current->next == NULL && current->parent != root) {
+            current = current->parent;
+        }
+        current = current->next;
+    }
+}
+
+// 1 if first comes before second in document order, -1 if after and 0 if they are the same node.
+int _XMLNodeCompareDocumentOrder(_XMLNodePtr first, _XMLNodePtr second) {
+    return xmlXPathCmpNodes((xmlNodePtr)first, (xmlNodePtr)second);
+}
+
+#pragma mark - XPath results
+
+_XMLIndex _kXMLXPathResultNodeSet = XPATH_NODESET;
+_XMLIndex _kXMLXPathResultBoolean = XPATH_BOOLEAN;
+_XMLIndex _kXMLXPathResultNumber = XPATH_NUMBER;
+_XMLIndex _kXMLXPathResultString = XPATH_STRING;
+
+_XMLXPathObjectPtr _Nullable _XMLEvaluateXPath(_XMLNodePtr node, const char* xpath, _XMLError* _Nullable error) {
+    xmlXPathObjectPtr result = ((xmlNodePtr)node)->doc != NULL ? _evaluateXPath(node, (const xmlChar*)xpath) : NULL;
+    if (result == NULL) {
+        _setLastErrorInfo(error, "The XPath expression could not be evaluated");
+    }
+    return result;
+}
+
+_XMLIndex _XMLXPathObjectGetType(_XMLXPathObjectPtr object) {
+    return ((xmlXPathObjectPtr)object)->type;
+}
+
+bool _XMLXPathObjectGetBoolean(_XMLXPathObjectPtr object) {
+    return ((xmlXPathObjectPtr)object)->boolval != 0;
+}
+
+double _XMLXPathObjectGetNumber(_XMLXPathObjectPtr object) {
+    return ((xmlXPathObjectPtr)object)->floatval;
+}
+
+const char* _XMLXPathObjectGetString(_XMLXPathObjectPtr object) {
+    const xmlChar* string = ((xmlXPathObjectPtr)object)->stringval;
+    return string != NULL ? (const char*)string : "";
+}
+
+_XMLIndex _XMLXPathObjectGetNodeCount(_XMLXPathObjectPtr object) {
+    xmlNodeSetPtr nodes = ((xmlXPathObjectPtr)object)->nodesetval;
+    return nodes != NULL ? nodes->nodeNr : 0;
+}
+
+_XMLNodePtr _XMLXPathObjectGetNode(_XMLXPathObjectPtr object, _XMLIndex index) {
+    xmlNodePtr node = ((xmlXPathObjectPtr)object)->nodesetval->nodeTab[index];
+    if (node->type == XML_NAMESPACE_DECL) {
+        // Node sets hold copies of namespaces, freed along with the result, whose next points to the
+        // element they were found on. Hand out the declaration from the tree instead.
+        xmlNsPtr ns = (xmlNsPtr)node;
+        xmlNodePtr element = (xmlNodePtr)ns->next;
+        if (element != NULL && element->type == XML_ELEMENT_NODE) {
+            xmlNsPtr declared = xmlSearchNs(element->doc, element, ns->prefix);
+            if (declared != NULL) {
+                return declared;
+            }
+        }
+    }
+    return node;
+}
+
+void _XMLXPathObjectFree(_XMLXPathObjectPtr object) {
+    xmlXPathFreeObject((xmlXPathObjectPtr)object);
+}
+
+#pragma mark - Compiled XPath
+
+_XMLXPathCompiledPtr _Nullable _XMLXPathCompile(const char* xpath, _XMLError* _Nullable error) {
+    xmlXPathCompExprPtr compiled = xmlXPathCompile((const xmlChar*)xpath);
+    _XMLInstrumentationAdd(_kXMLCounterXPathCompilations, 1);
+    if (compiled == NULL) {
+        _setLastErrorInfo(error, "The XPath expression could not be compiled");
+    }
+    return compiled;
+}
+
+void _XMLXPathCompiledFree(_XMLXPathCompiledPtr compiled) {
+    xmlXPathFreeCompExpr((xmlXPathCompExprPtr)compiled);
+}
+
+_XMLXPathContextPtr _XMLXPathContextCreate(const char* _Nonnull const* _Nullable prefixes, const char* _Nonnull const* _Nullable uris, _XMLIndex count) {
+    xmlXPathContextPtr context = xmlXPathNewContext(NULL);
+    for (_XMLIndex i = 0; i < count; i++) {
+        xmlXPathRegisterNs(context, (const xmlChar*)prefixes[i], (const xmlChar*)uris[i]);
+    }
+    return context;
+}
+
+void _XMLXPathContextFree(_XMLXPathContextPtr context) {
+    xmlXPathFreeContext((xmlXPathContextPtr)context);
+}
+
+_XMLXPathObjectPtr _Nullable _XMLXPathContextEvaluate(_XMLXPathContextPtr context, _XMLXPathCompiledPtr compiled, _XMLNodePtr node) {
+    xmlXPathContextPtr xpathContext = (xmlXPathContextPtr)context;
+    xmlNodePtr nodePtr = (xmlNodePtr)node;
+    if (nodePtr->doc == NULL) {
+        return NULL;
+    }
+
+    // The context is reused across documents: only the document and the context item change,
+    // the namespaces registered at creation stay.
+    xpathContext->doc = nodePtr->doc;
+    xpathContext->node = nodePtr->type == XML_DOCUMENT_NODE ? (xmlNodePtr)nodePtr->doc : nodePtr;
+    uint64_t start = _XMLInstrumentationNow();
+    xmlXPathObjectPtr result = xmlXPathCompiledEval((xmlXPathCompExprPtr)compiled, xpathContext);
+    _XMLInstrumentationRecord(_kXMLTimingXPath, start);
+    _XMLInstrumentationAdd(_kXMLCounterXPathEvaluations, 1);
+    return result;
+}
+
+#pragma mark - Streaming XPath
+
+typedef struct {
+    xmlChar* _Nullable localName;   // NULL matches any name
+    xmlChar* _Nullable href;        // NULL matches names without a namespace
+    bool anyNamespace;
+} _XMLStreamNameTest;
+
+typedef struct {
+    _XMLStreamNameTest attribute;
+    xmlChar* _Nullable value;       // NULL only tests that the attribute is present
+} _XMLStreamPredicate;
+
+typedef struct {
+    bool descendant;
+    _XMLStreamNameTest name;
+    _XMLStreamPredicate* _Nullable predicates;
+    int predicateCount;
+} _XMLStreamStep;
+
+typedef struct {
+    _XMLStreamStep* _Nullable steps;
+    int stepCount;
+} _XMLStreamQuery;
+
+static inline bool _isStreamNameChar(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_' || c == '-' || c == '.' || (c & 0x80) != 0;
+}
+
+static inline void _skipStreamSpaces(const char** cursor) {
+    while (**cursor == ' ' || **cursor == '\t' || **cursor == '\n' || **cursor == '\r') {
+        (*cursor)++;
+    }
+}
+
+static bool _parseStreamNameTest(const char** cursor, const char* _Nonnull const* _Nullable prefixes, const char* _Nonnull const* _Nullable uris, _XMLIndex count, _XMLStreamNameTest* test) {
+    const char* p = *cursor;
+    if (*p == '*') {
+        test->anyNamespace = true;
+        *cursor = p + 1;
+        return true;
+    }
+
+    const char* start = p;
+    while (_isStreamNameChar(*p)) {
+        p++;
+    }
+    if (p == start) {
+        return false;
+    }
+
+    if (*p == ':' && (p[1] == '*' || _isStreamNameChar(p[1]))) {
+        size_t prefixLength = p - start;
+        _XMLIndex i = 0;
+        while (i < count && !(strlen(prefixes[i]) == prefixLength && strncmp(prefixes[i], start, prefixLength) == 0)) {
+            i++;
+        }
+        if (i == count) {
+            return false;
+        }
+        test->href = xmlStrdup((const xmlChar*)uris[i]);
+        p++;
+        if (*p == '*') {
+            *cursor = p + 1;
+            return true;
+        }
+        start = p;
+        while (_isStreamNameChar(*p)) {
+            p++;
+        }
+    }
+
+    test->localName = xmlStrndup((const xmlChar*)start, (int)(p - start));
+    *cursor = p;
+    return true;
+}
+
+static bool _parseStreamPredicate(const char** cursor, const char* _Nonnull const* _Nullable prefixes, const char* _Nonnull const* _Nullable uris, _XMLIndex count, _XMLStreamPredicate* predicate) {
+    const char* p = *cursor;
+    _skipStreamSpaces(&p);
+    if (*p++ != '@' || !_parseStreamNameTest(&p, prefixes, uris, count, &predicate->attribute)) {
+        return false;
+    }
+    _skipStreamSpaces(&p);
+
+    if (*p == '=') {
+        p++;
+        _skipStreamSpaces(&p);
+        char quote = *p;
+        if (quote != '\'' && quote != '"') {
+            return false;
+        }
+        const char* start = ++p;
+        while (*p != '\0' && *p != quote) {
+            p++;
+        }
+        if (*p != quote) {
+            return false;
+        }
+        predicate->value = xmlStrndup((const xmlChar*)start, (int)(p - start));
+        p++;
+        _skipStreamSpaces(&p);
+    }
+
+    if (*p != ']') {
+        return false;
+    }
+    *cursor = p + 1;
+    return true;
+}
+
+static void _freeStreamNameTest(_XMLStreamNameTest* test) {
+    xmlFree(test->localName);
+    xmlFree(test->href);
+}
+
+void _XMLStreamQueryFree(_XMLStreamQueryPtr query) {
+    _XMLStreamQuery* streamQuery = (_XMLStreamQuery*)query;
+    for (int i = 0; i < streamQuery->stepCount; i++) {
+        _XMLStreamStep* step = &streamQuery->steps[i];
+        _freeStreamNameTest(&step->name);
+        for (int j = 0; j < step->predicateCount; j++) {
+            _freeStreamNameTest(&step->predicates[j].attribute);
+            xmlFree(step->predicates[j].value);
+        }
+        free(step->predicates);
+    }
+    free(streamQuery->steps);
+    free(streamQuery);
+}
+
+_XMLStreamQueryPtr _Nullable _XMLStreamQueryCreate(const char* xpath, const char* _Nonnull const* _Nullable prefixes, const char* _Nonnull const* _Nullable uris, _XMLIndex count, _XMLError* _Nullable error) {
+    // The subset is an absolute location path of child and descendant steps, each an element
+    // name test optionally followed by [@attribute] or [@attribute='value'] predicates.
+    _XMLStreamQuery* query = calloc(1, sizeof(_XMLStreamQuery));
+    const char* p = xpath;
+    bool valid = *p == '/';
+
+    while (valid && *p == '/') {
+        _XMLStreamStep* steps = realloc(query->steps, (query->stepCount + 1) * sizeof(_XMLStreamStep));
+        if (steps == NULL) {
+            valid = false;
+            break;
+        }
+        query->steps = steps;
+        _XMLStreamStep* step = &query->steps[query->stepCount++];
+        memset(step, 0, sizeof(_XMLStreamStep));
+
+        step->descendant = p[1] == '/';
+        p += step->descendant ? 2 : 1;
+        valid = _parseStreamNameTest(&p, prefixes, uris, count, &step->name);
+
+        while (valid && *p == '[') {
+            _XMLStreamPredicate* predicates = realloc(step->predicates, (step->predicateCount + 1) * sizeof(_XMLStreamPredicate));
+            if (predicates == NULL) {
+                valid = false;
+                break;
+            }
+            step->predicates = predicates;
+            _XMLStreamPredicate* predicate = &step->predicates[step->predicateCount++];
+            memset(predicate, 0, sizeof(_XMLStreamPredicate));
+            p++;
+            valid = _parseStreamPredicate(&p, prefixes, uris, count, predicate);
+        }
+    }
+
+    if (!valid || *p != '\0') {
+        _XMLStreamQueryFree(query);
+        char message[256];
+        snprintf(message, sizeof(message), "Unsupported streaming XPath: %s", xpath);
+        _setErrorInfo(error, 0, message);
+        return NULL;
+    }
+
+    return query;
+}
+
+static bool _matchesStreamNameTest(const _XMLStreamNameTest* test, const xmlChar* name, xmlNsPtr _Nullable ns) {
+    if (test->localName != NULL && !xmlStrEqual(test->localName, name)) {
+        return false;
+    }
+    if (test->anyNamespace) {
+        return true;
+    }
+    const xmlChar* href = ns != NULL ? ns->href : NULL;
+    return test->href == NULL ? href == NULL : href != NULL && xmlStrEqual(test->href, href);
+}
+
+static bool _matchesStreamPredicate(const _XMLStreamPredicate* predicate, xmlNodePtr element) {
+    for (xmlAttrPtr attribute = element->properties; attribute != NULL; attribute = attribute->next) {
+        if (!_matchesStreamNameTest(&predicate->attribute, attribute->name, attribute->ns)) {
+            continue;
+        }
+        if (predicate->value == NULL) {
+            return true;
+        }
+
+        xmlNodePtr text = attribute->children;
+        if (text != NULL && text->next == NULL && text->type == XML_TEXT_NODE) {
+            if (xmlStrEqual(text->content, predicate->value)) {
+                return true;
+            }
+        } else {
+            xmlChar* value = xmlNodeGetContent((xmlNodePtr)attribute);
+            bool equal = xmlStrEqual(value != NULL ? value : (const xmlChar*)"", predicate->value);
+            xmlFree(value);
+            if (equal) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+static bool _matchesStreamSteps(const _XMLStreamQuery* query, int index, xmlNodePtr _Nullable node) {
+    if (node == NULL || node->type != XML_ELEMENT_NODE) {
+        return false;
+    }
+
+    const _XMLStreamStep* step = &query->steps[index];
+    if (!_matchesStreamNameTest(&step->name, node->name, node->ns)) {
+        return false;
+    }
+    for (int i = 0; i < step->predicateCount; i++) {
+        if (!_matchesStreamPredicate(&step->predicates[i], node)) {
+            return false;
+        }
+    }
+
+    // Steps are matched from the last one upwards through the ancestors the reader keeps,
+    // so only the open elements ever need to be in memory.
+    if (index == 0) {
+        return step->descendant || (node->parent != NULL && node->parent->type == XML_DOCUMENT_NODE);
+    }
+    if (!step->descendant) {
+        return _matchesStreamSteps(query, index - 1, node->parent);
+    }
+    for (xmlNodePtr ancestor = node->parent; ancestor != NULL && ancestor->type == XML_ELEMENT_NODE; ancestor = ancestor->parent) {
+        if (_matchesStreamSteps(query, index - 1, ancestor)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool _XMLStreamQueryRun(_XMLStreamQueryPtr query, xmlInputReadCallback ioread, xmlInputCloseCallback ioclose, void* context, unsigned int options, _XMLStreamMatchCallback match, void* matchContext, _XMLError* _Nullable error) {
+    const _XMLStreamQuery* streamQuery = (const _XMLStreamQuery*)query;
+
+    // Like projection, the reader frees every node it has moved past. A matching element is
+    // expanded, copied into a document of its own and handed out; the reader then continues
+    // inside it, so nested matches are found too.
+    int xmlOptions = _parseOptionsForNodeOptions(options) & ~XML_PARSE_RECOVER;
+    xmlTextReaderPtr reader = xmlReaderForIO(ioread, ioclose, context, NULL, NULL, xmlOptions);
+    if (reader == NULL) {
+        _setErrorInfo(error, 0, "Could not create a reader for the input stream");
+        return false;
+    }
+
+    _XMLError messages = { 0 };
+    xmlTextReaderSetStructuredErrorHandler(reader, &_XMLStructuredErrorHandler, &messages);
+
+    uint64_t start = _XMLInstrumentationNow();
+    int result = 0;
+    bool stopped = false;
+    while (!stopped && (result = xmlTextReaderRead(reader)) == 1) {
+        if (xmlTextReaderNodeType(reader) != XML_READER_TYPE_ELEMENT
+            || !_matchesStreamSteps(streamQuery, streamQuery->stepCount - 1, xmlTextReaderCurrentNode(reader))) {
+            continue;
+        }
+
+        xmlNodePtr subtree = xmlTextReaderExpand(reader);
+        xmlDocPtr doc = subtree != NULL ? xmlNewDoc((const xmlChar*)"1.0") : NULL;
+        xmlNodePtr copy = doc != NULL ? xmlDocCopyNode(subtree, doc, 1) : NULL;
+        if (copy == NULL) {
+            xmlFreeDoc(doc);
+            result = -1;
+            break;
+        }
+        xmlDocSetRootElement(doc, copy);
+        stopped = !match(matchContext, doc);
+    }
+    _XMLInstrumentationRecord(_kXMLTimingParse, start);
+    _XMLInstrumentationAdd(_kXMLCounterBytesParsed, xmlTextReaderByteConsumed(reader));
+
+    bool succeeded = stopped || result == 0;
+    if (!succeeded) {
+        _setErrorInfo(error, messages.code, messages.message);
+    }
+
+    xmlFreeTextReader(reader);
+
+    return succeeded;
+}
+
+#pragma mark - Entity cache
+
+// Raw bytes of external entities and DTDs, keyed by their resolved system ID and evicted least
+// recently used first. XMLDTD(contentsOf:) also keeps the parsed DTD and hands out copies of it.
+typedef struct _XMLEntityCacheEntry {
+    xmlChar* systemID;
+    uint8_t* bytes;
+    size_t length;
+    xmlDtdPtr _Nullable dtd;
+    struct _XMLEntityCacheEntry* _Nullable previous;
+    struct _XMLEntityCacheEntry* _Nullable next;
+} _XMLEntityCacheEntry;
+
+static pthread_mutex_t _entityCacheLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t _entityLoaderOnce = PTHREAD_ONCE_INIT;
+static xmlExternalEntityLoader _defaultEntityLoader = NULL;
+static xmlHashTablePtr _entityCacheTable = NULL;
+static _XMLEntityCacheEntry* _entityCacheMostRecent = NULL;
+static _XMLEntityCacheEntry* _entityCacheLeastRecent = NULL;
+static size_t _entityCacheSize = 0;
+static size_t _entityCacheCapacity = 0;
+static bool _entityCacheAllowsNetwork = true;
+static int64_t _entityCacheHits = 0;
+static int64_t _entityCacheMisses = 0;
+
+static inline size_t _entityCacheEntrySize(_XMLEntityCacheEntry* entry) {
+    // A parsed DTD is charged as much again as its source.
+    return entry->dtd != NULL ? entry->length * 2 : entry->length;
+}
+
+static void _entityCacheUnlink(_XMLEntityCacheEntry* entry) {
+    if (entry->previous != NULL) {
+        entry->previous->next = entry->next;
+    } else {
+        _entityCacheMostRecent = entry->next;
+    }
+    if (entry->next != NULL) {
+        entry->next->previous = entry->previous;
+    } else {
+        _entityCacheLeastRecent = entry->previous;
+    }
+    entry->previous = NULL;
+    entry->next = NULL;
+}
+
+static void _entityCachePushFront(_XMLEntityCacheEntry* entry) {
+    entry->next = _entityCacheMostRecent;
+    if (_entityCacheMostRecent != NULL) {
+        _entityCacheMostRecent->previous = entry;
+    }
+    _entityCacheMostRecent = entry;
+    if (_entityCacheLeastRecent == NULL) {
+        _entityCacheLeastRecent = entry;
+    }
+}
+
+static void _entityCacheRemove(_XMLEntityCacheEntry* entry) {
+    xmlHashRemoveEntry(_entityCacheTable, entry->systemID, NULL);
+    _entityCacheUnlink(entry);
+    _entityCacheSize -= _entityCacheEntrySize(entry);
+    xmlFree(entry->systemID);
+    free(entry->bytes);
+    if (entry->dtd != NULL) {
+        xmlFreeDtd(entry->dtd);
+    }
+    free(entry);
+}
+
+static void _entityCacheTrim(void) {
+    while (_entityCacheSize > _entityCacheCapacity && _entityCacheLeastRecent != NULL) {
+        _entityCacheRemove(_entityCacheLeastRecent);
+    }
+}
+
+static _XMLEntityCacheEntry* _Nullable _entityCacheLookup(const xmlChar* systemID) {
+    if (_entityCacheTable == NULL) {
+        return NULL;
+    }
+    _XMLEntityCacheEntry* entry = xmlHashLookup(_entityCacheTable, systemID);
+    if (entry != NULL) {
+        _entityCacheUnlink(entry);
+        _entityCachePushFront(entry);
+    }
+    return entry;
+}
+
+static bool _isLocalSystemID(const xmlChar* systemID) {
+    return xmlStrstr(systemID, (const xmlChar*)"://") == NULL || xmlStrncasecmp(systemID, (const xmlChar*)"file://", 7) == 0;
+}
+
+static xmlChar* _Nullable _resolveSystemID(const char* _Nullable URL, const char* _Nullable ID, xmlParserCtxtPtr _Nullable ctxt) {
+    // Catalog entries win, so mapped remote identifiers are read from their local copies.
+    xmlChar* resolved = xmlCatalogResolve((const xmlChar*)ID, (const xmlChar*)URL);
+    if (resolved == NULL && URL != NULL) {
+        resolved = xmlCatalogResolveURI((const xmlChar*)URL);
+    }
+    if (resolved != NULL || URL == NULL) {
+        return resolved;
+    }
+
+    const char* base = ctxt != NULL && ctxt->input != NULL ? ctxt->input->filename : NULL;
+    resolved = base != NULL ? xmlBuildURI((const xmlChar*)URL, (const xmlChar*)base) : NULL;
+    return resolved != NULL ? resolved : xmlStrdup((const xmlChar*)URL);
+}
+
+static uint8_t* _Nullable _readLocalSystemID(const xmlChar* systemID, size_t* length) {
+    char* path = xmlStrncasecmp(systemID, (const xmlChar*)"file://", 7) == 0
+        ? xmlURIUnescapeString((const char*)systemID + 7, 0, NULL)
+        : (char*)xmlStrdup(systemID);
+    FILE* file = path != NULL ? fopen(path, "rb") : NULL;
+    xmlFree(path);
+    if (file == NULL) {
+        return NULL;
+    }
+
+    uint8_t* bytes = NULL;
+    size_t capacity = 0;
+    *length = 0;
+    for (;;) {
+        if (*length == capacity) {
+            capacity = capacity != 0 ? capacity * 2 : 16384;
+            uint8_t* grown = realloc(bytes, capacity);
+            if (grown == NULL) {
+                free(bytes);
+                fclose(file);
+                return NULL;
+            }
+            bytes = grown;
+        }
+        size_t read = fread(bytes + *length, 1, capacity - *length, file);
+        if (read == 0) {
+            break;
+        }
+        *length += read;
+    }
+    bool failed = ferror(file) != 0;
+    fclose(file);
+    if (failed) {
+        free(bytes);
+        return NULL;
+    }
+    return bytes;
+}
+
+static xmlParserInputPtr _Nullable _entityInputFromBytes(xmlParserCtxtPtr ctxt, const uint8_t* bytes, size_t length, const xmlChar* systemID) {
+    // The buffer gets a copy, so the entry may be evicted while the parser still reads.
+    xmlParserInputBufferPtr buffer = xmlParserInputBufferCreateMem((const char*)bytes, (int)length, XML_CHAR_ENCODING_NONE);
+    if (buffer == NULL) {
+        return NULL;
+    }
+    xmlParserInputPtr input = xmlNewIOInputStream(ctxt, buffer, XML_CHAR_ENCODING_NONE);
+    if (input == NULL) {
+        xmlFreeParserInputBuffer(buffer);
+        return NULL;
+    }
+    // The file name is the base that relative references inside the entity are resolved against.
+    input->filename = (const char*)xmlStrdup(systemID);
+    return input;
+}
+
+static xmlParserInputPtr _Nullable _cachingEntityLoader(const char* _Nullable URL, const char* _Nullable ID, xmlParserCtxtPtr ctxt) {
+    xmlChar* systemID = _resolveSystemID(URL, ID, ctxt);
+    if (systemID == NULL) {
+        return _defaultEntityLoader(URL, ID, ctxt);
+    }
+
+    if (!_isLocalSystemID(systemID)) {
+        pthread_mutex_lock(&_entityCacheLock);
+        bool allowsNetwork = _entityCacheAllowsNetwork;
+        pthread_mutex_unlock(&_entityCacheLock);
+
+        xmlParserInputPtr input = NULL;
+        if (allowsNetwork) {
+            input = _defaultEntityLoader((const char*)systemID, ID, ctxt);
+        } else if (ctxt != NULL) {
+            xmlParserWarning(ctxt, "Blocked loading remote entity %s\n", (const char*)systemID);
+        }
+        xmlFree(systemID);
+        return input;
+    }
+
+    xmlParserInputPtr input = NULL;
+    pthread_mutex_lock(&_entityCacheLock);
+    _XMLEntityCacheEntry* entry = _entityCacheCapacity > 0 ? _entityCacheLookup(systemID) : NULL;
+    if (entry != NULL) {
+        _entityCacheHits++;
+        input = _entityInputFromBytes(ctxt, entry->bytes, entry->length, systemID);
+    } else {
+        _entityCacheMisses++;
+    }
+    pthread_mutex_unlock(&_entityCacheLock);
+    if (entry != NULL) {
+        xmlFree(systemID);
+        return input;
+    }
+
+    size_t length = 0;
+    uint8_t* bytes = _readLocalSystemID(systemID, &length);
+    if (bytes == NULL) {
+        // Let the default loader fail, so the parser reports the usual error.
+        input = _defaultEntityLoader((const char*)systemID, ID, ctxt);
+        xmlFree(systemID);
+        return input;
+    }
+    input = _entityInputFromBytes(ctxt, bytes, length, systemID);
+
+    pthread_mutex_lock(&_entityCacheLock);
+    if (_entityCacheCapacity >= length && (_entityCacheTable != NULL || (_entityCacheTable = xmlHashCreate(64)) != NULL)
+        && xmlHashLookup(_entityCacheTable, systemID) == NULL) {
+        entry = calloc(1, sizeof(_XMLEntityCacheEntry));
+        if (entry != NULL) {
+            entry->systemID = systemID;
+            entry->bytes = bytes;
+            entry->length = length;
+            if (xmlHashAddEntry(_entityCacheTable, systemID, entry) == 0) {
+                _entityCachePushFront(entry);
+                _entityCacheSize += length;
+                _entityCacheTrim();
+                systemID = NULL;
+                bytes = NULL;
+            } else {
+                free(entry);
+            }
+        }
+    }
+    pthread_mutex_unlock(&_entityCacheLock);
+
+    xmlFree(systemID);
+    free(bytes);
+    return input;
+}
+
+static void _installEntityLoader(void) {
+    _defaultEntityLoader = xmlGetExternalEntityLoader();
+    xmlSetExternalEntityLoader(&_cachingEntityLoader);
+}
+
+void _XMLEntityCacheSetCapacity(_XMLIndex capacity) {
+    pthread_once(&_entityLoaderOnce, &_installEntityLoader);
+    pthread_mutex_lock(&_entityCacheLock);
+    _entityCacheCapacity = capacity > 0 ? (size_t)capacity : 0;
+    _entityCacheTrim();
+    pthread_mutex_unlock(&_entityCacheLock);
+}
+
+_XMLIndex _XMLEntityCacheGetCapacity(void) {
+    pthread_mutex_lock(&_entityCacheLock);
+    _XMLIndex capacity = (_XMLIndex)_entityCacheCapacity;
+    pthread_mutex_unlock(&_entityCacheLock);
+    return capacity;
+}
+
+void _XMLEntityCacheSetAllowsNetwork(bool allowsNetwork) {
+    pthread_once(&_entityLoaderOnce, &_installEntityLoader);
+    pthread_mutex_lock(&_entityCacheLock);
+    _entityCacheAllowsNetwork = allowsNetwork;
+    pthread_mutex_unlock(&_entityCacheLock);
+}
+
+bool _XMLEntityCacheGetAllowsNetwork(void) {
+    pthread_mutex_lock(&_entityCacheLock);
+    bool allowsNetwork = _entityCacheAllowsNetwork;
+    pthread_mutex_unlock(&_entityCacheLock);
+    return allowsNetwork;
+}
+
+void _XMLEntityCacheGetStatistics(int64_t* hits, int64_t* misses, _XMLIndex* size) {
+    pthread_mutex_lock(&_entityCacheLock);
+    *hits = _entityCacheHits;
+    *misses = _entityCacheMisses;
+    *size = (_XMLIndex)_entityCacheSize;
+    pthread_mutex_unlock(&_entityCacheLock);
+}
+
+void _XMLEntityCacheRemoveAll(void) {
+    pthread_mutex_lock(&_entityCacheLock);
+    while (_entityCacheLeastRecent != NULL) {
+        _entityCacheRemove(_entityCacheLeastRecent);
+    }
+    _entityCacheHits = 0;
+    _entityCacheMisses = 0;
+    pthread_mutex_unlock(&_entityCacheLock);
+}
+
+bool _XMLEntityCacheLoadCatalog(const char* path, _XMLError* _Nullable error) {
+    pthread_once(&_entityLoaderOnce, &_installEntityLoader);
+    if (xmlLoadCatalog(path) != 0) {
+        _setErrorInfo(error, 0, "The catalog could not be loaded");
+        return false;
+    }
+    return true;
+}
+
+bool _XMLEntityCacheAddCatalogEntry(bool publicID, const char* identifier, const char* replacement) {
+    pthread_once(&_entityLoaderOnce, &_installEntityLoader);
+    // Creates the default catalog, from XML_CATALOG_FILES or /etc/xml/catalog, for the entry to go into.
+    xmlInitializeCatalog();
+    return xmlCatalogAdd((const xmlChar*)(publicID ? "public" : "system"), (const xmlChar*)identifier, (const xmlChar*)replacement) == 0;
+}
+
+static xmlDtdPtr _Nullable _entityCacheParseDTD(const xmlChar* URL) {
+    if (_XMLEntityCacheGetCapacity() == 0) {
+        return xmlParseDTD(NULL, URL);
+    }
+
+    xmlChar* systemID = _resolveSystemID((const char*)URL, NULL, NULL);
+    xmlDtdPtr dtd = NULL;
+    if (systemID != NULL) {
+        pthread_mutex_lock(&_entityCacheLock);
+        _XMLEntityCacheEntry* entry = _entityCacheLookup(systemID);
+        dtd = entry != NULL && entry->dtd != NULL ? xmlCopyDtd(entry->dtd) : NULL;
+        if (dtd != NULL) {
+            _entityCacheHits++;
+        }
+        pthread_mutex_unlock(&_entityCacheLock);
+    }
+    if (dtd != NULL) {
+        xmlFree(systemID);
+        return dtd;
+    }
+
+    // Parsing goes through the caching loader, which adds the entry the parsed DTD is kept with.
+    dtd = xmlParseDTD(NULL, URL);
+    if (dtd != NULL && systemID != NULL) {
+        pthread_mutex_lock(&_entityCacheLock);
+        _XMLEntityCacheEntry* entry = _entityCacheLookup(systemID);
+        if (entry != NULL && entry->dtd == NULL) {
+            entry->dtd = xmlCopyDtd(dtd);
+            if (entry->dtd != NULL) {
+                _entityCacheSize += entry->length;
+                _entityCacheTrim();
+            }
+        }
+        pthread_mutex_unlock(&_entityCacheLock);
+    }
+    xmlFree(systemID);
+    return dtd;
+}
+
+#pragma mark - HTML
+
+// Parser contexts are kept per thread and reset between documents, which keeps their input buffers,
+// node stacks and SAX handler. HTML documents copy their names instead of sharing the context's
+// dictionary, so a reused context never ties two documents together; one whose dictionary has grown
+// past _XML_HTML_CONTEXT_MAX_NAMES is dropped instead of being kept.
+#define _XML_HTML_CONTEXT_MAX_NAMES 8192
+
+static pthread_key_t _htmlParserContextKey;
+static pthread_once_t _htmlParserContextKeyOnce = PTHREAD_ONCE_INIT;
+
+static void _htmlParserContextDestructor(void* ctxt) {
+    htmlFreeParserCtxt((htmlParserCtxtPtr)ctxt);
+}
+
+static void _createHTMLParserContextKey(void) {
+    pthread_key_create(&_htmlParserContextKey, &_htmlParserContextDestructor);
+}
+
+// htmlCtxtReset leaves the context without a charset, so the first non-ASCII byte of a document with
+// no BOM or meta charset would be read as ISO-8859-1. Like the context htmlReadMemory creates, ours
+// start each document as UTF-8 and only fall back to ISO-8859-1 on bytes that are not valid UTF-8.
+// The document starts after the reset and the BOM check, so a BOM still wins.
+static void _htmlStartDocument(void* context) {
+    xmlSAX2StartDocument(context);
+    ((htmlParserCtxtPtr)context)->charset = XML_CHAR_ENCODING_UTF8;
+}
+
+// The context is taken out of its slot while in use, so a parse started from inside a read callback gets its own.
+static htmlParserCtxtPtr _Nullable _takeHTMLParserContext(void) {
+    pthread_once(&_htmlParserContextKeyOnce, &_createHTMLParserContextKey);
+
+    htmlParserCtxtPtr ctxt = pthread_getspecific(_htmlParserContextKey);
+    if (ctxt != NULL) {
+        pthread_setspecific(_htmlParserContextKey, NULL);
+        return ctxt;
+    }
+
+    ctxt = htmlNewParserCtxt();
+    if (ctxt != NULL) {
+        ctxt->sax->startDocument = &_htmlStartDocument;
+    }
+    return ctxt;
+}
+
+static void _returnHTMLParserContext(htmlParserCtxtPtr ctxt) {
+    // Resetting now rather than at the next parse closes the input right away.
+    htmlCtxtReset(ctxt);
+    if (pthread_getspecific(_htmlParserContextKey) == NULL && xmlDictSize(ctxt->dict) <= _XML_HTML_CONTEXT_MAX_NAMES) {
+        pthread_setspecific(_htmlParserContextKey, ctxt);
+    } else {
+        htmlFreeParserCtxt(ctxt);
+    }
+}
+
+static inline int _htmlParseOptionsForNodeOptions(unsigned int options) {
+    // Markup found in the wild is rarely valid: recover without reporting every unclosed tag, and do
+    // not add the HTML 4.0 DOCTYPE libxml2 otherwise invents for documents without one.
+    int htmlOptions = HTML_PARSE_RECOVER | HTML_PARSE_NOERROR | HTML_PARSE_NOWARNING | HTML_PARSE_NODEFDTD | HTML_PARSE_COMPACT;
+
+    if ((options & _kXMLNodePreserveWhitespace) == 0) {
+        htmlOptions |= HTML_PARSE_NOBLANKS;
+    }
+
+    return htmlOptions;
+}
+
+// The tree is handed out as a regular document flagged XML_DOC_HTML: the rest of the interface only
+// knows XML_DOCUMENT_NODE, while documentContentKind and serialization look at the flag. Without the
+// HTML type, xmlEncodeEntitiesReentrant writes non-ASCII text as character references unless the
+// document has an encoding, so one without a declared charset is given the UTF-8 it was read as.
+static xmlDocPtr _Nullable _finishHTMLDocument(xmlDocPtr _Nullable doc, _XMLError* _Nullable error) {
+    if (doc == NULL) {
+        _setErrorInfo(error, 0, "Document could not be parsed as HTML");
+        return NULL;
+    }
+
+    doc->type = XML_DOCUMENT_NODE;
+    doc->properties |= XML_DOC_HTML;
+    if (doc->encoding == NULL) {
+        doc->encoding = xmlStrdup((const xmlChar*)"UTF-8");
+    }
+    return doc;
+}
+
+_XMLDocPtr _Nullable _XMLHTMLDocPtrFromBytes(const uint8_t* _Nullable bytes, size_t length, unsigned int options, _XMLError* _Nullable error) {
+    if (length > INT_MAX) {
+        _setErrorInfo(error, 0, "The document is too large");
+        return NULL;
+    }
+
+    htmlParserCtxtPtr ctxt = _takeHTMLParserContext();
+    if (ctxt == NULL) {
+        _setErrorInfo(error, 0, "Could not create an HTML parser");
+        return NULL;
+    }
+
+    uint64_t start = _XMLInstrumentationNow();
+    xmlDocPtr doc = htmlCtxtReadMemory(ctxt, bytes != NULL ? (const char*)bytes : "", (int)length, NULL, NULL, _htmlParseOptionsForNodeOptions(options));
+    _XMLInstrumentationRecord(_kXMLTimingParse, start);
+    _XMLInstrumentationAdd(_kXMLCounterBytesParsed, (int64_t)length);
+    _returnHTMLParserContext(ctxt);
+
+    return _finishHTMLDocument(doc, error);
+}
+
+_XMLDocPtr _Nullable _XMLHTMLDocPtrFromIO(xmlInputReadCallback ioread, xmlInputCloseCallback ioclose, void* context, unsigned int options, _XMLError* _Nullable error) {
+    htmlParserCtxtPtr ctxt = _takeHTMLParserContext();
+    if (ctxt == NULL) {
+        _setErrorInfo(error, 0, "Could not create an HTML parser for the input stream");
+        return NULL;
+    }
+
+    uint64_t start = _XMLInstrumentationNow();
+    xmlDocPtr doc = htmlCtxtReadIO(ctxt, ioread, ioclose, context, NULL, NULL, _htmlParseOptionsForNodeOptions(options));
+    _XMLInstrumentationRecord(_kXMLTimingParse, start);
+    if (ctxt->input != NULL) {
+        _XMLInstrumentationAdd(_kXMLCounterBytesParsed, xmlByteConsumed(ctxt));
+    }
+    _returnHTMLParserContext(ctxt);
+
+    return _finishHTMLDocument(doc, error);
+}
@@ -22,72 +22,84 @@
 #include <libxml/xpath.h>
 #include <libxml/xpathInternals.h>
 #include <libxml/dict.h>
-#include <CoreFoundation/CoreFoundation.h>
-
-extern CFIndex _kXMLInterfaceRecover;
-extern CFIndex _kXMLInterfaceNoEnt;
-extern CFIndex _kXMLInterfaceDTDLoad;
-extern CFIndex _kXMLInterfaceDTDAttr;
-extern CFIndex _kXMLInterfaceDTDValid;
-extern CFIndex _kXMLInterfaceNoError;
-extern CFIndex _kXMLInterfaceNoWarning;
-extern CFIndex _kXMLInterfacePedantic;
-extern CFIndex _kXMLInterfaceNoBlanks;
-extern CFIndex _kXMLInterfaceSAX1;
-extern CFIndex _kXMLInterfaceXInclude;
-extern CFIndex _kXMLInterfaceNoNet;
-extern CFIndex _kXMLInterfaceNoDict;
-extern CFIndex _kXMLInterfaceNSClean;
-extern CFIndex _kXMLInterfaceNoCdata;
-extern CFIndex _kXMLInterfaceNoXIncnode;
-extern CFIndex _kXMLInterfaceCompact;
-extern CFIndex _kXMLInterfaceOld10;
-extern CFIndex _kXMLInterfaceNoBasefix;
-extern CFIndex _kXMLInterfaceHuge;
-extern CFIndex _kXMLInterfaceOldsax;
-extern CFIndex _kXMLInterfaceIgnoreEnc;
-extern CFIndex _kXMLInterfaceBigLines;
-
-extern CFIndex _kXMLTypeInvalid;
-extern CFIndex _kXMLTypeDocument;
-extern CFIndex _kXMLTypeElement;
-extern CFIndex _kXMLTypeAttribute;
-extern CFIndex _kXMLTypeProcessingInstruction;
-extern CFIndex _kXMLTypeComment;
-extern CFIndex _kXMLTypeText;
-extern CFIndex _kXMLTypeCDataSection;
-extern CFIndex _kXMLTypeDTD;
-extern CFIndex _kXMLDocTypeHTML;
-extern CFIndex _kXMLTypeNamespace;
-
-extern CFIndex _kXMLDTDNodeTypeEntity;
-extern CFIndex _kXMLDTDNodeTypeAttribute;
-extern CFIndex _kXMLDTDNodeTypeElement;
-extern CFIndex _kXMLDTDNodeTypeNotation;
-
-extern CFIndex _kXMLDTDNodeElementTypeUndefined;
-extern CFIndex _kXMLDTDNodeElementTypeEmpty;
-extern CFIndex _kXMLDTDNodeElementTypeAny;
-extern CFIndex _kXMLDTDNodeElementTypeMixed;
-extern CFIndex _kXMLDTDNodeElementTypeElement;
-
-extern CFIndex _kXMLDTDNodeEntityTypeInternalGeneral;
-extern CFIndex _kXMLDTDNodeEntityTypeExternalGeneralParsed;
-extern CFIndex _kXMLDTDNodeEntityTypeExternalGeneralUnparsed;
-extern CFIndex _kXMLDTDNodeEntityTypeInternalParameter;
-extern CFIndex _kXMLDTDNodeEntityTypeExternalParameter;
-extern CFIndex _kXMLDTDNodeEntityTypeInternalPredefined;
-
-extern CFIndex _kXMLDTDNodeAttributeTypeCData;
-extern CFIndex _kXMLDTDNodeAttributeTypeID;
-extern CFIndex _kXMLDTDNodeAttributeTypeIDRef;
-extern CFIndex _kXMLDTDNodeAttributeTypeIDRefs;
-extern CFIndex _kXMLDTDNodeAttributeTypeEntity;
-extern CFIndex _kXMLDTDNodeAttributeTypeEntities;
-extern CFIndex _kXMLDTDNodeAttributeTypeNMToken;
-extern CFIndex _kXMLDTDNodeAttributeTypeNMTokens;
-extern CFIndex _kXMLDTDNodeAttributeTypeEnumeration;
-extern CFIndex _kXMLDTDNodeAttributeTypeNotation;
+#include <stddef.h>
+
+// Signed, pointer-sized on every Apple platform, so it imports into Swift as Int.
+typedef long _XMLIndex;
+
+extern _XMLIndex _kXMLInterfaceRecover;
+extern _XMLIndex _kXMLInterfaceNoEnt;
+extern _XMLIndex _kXMLInterfaceDTDLoad;
+extern _XMLIndex _kXMLInterfaceDTDAttr;
+extern _XMLIndex _kXMLInterfaceDTDValid;
+extern _XMLIndex _kXMLInterfaceNoError;
+extern _XMLIndex _kXMLInterfaceNoWarning;
+extern _XMLIndex _kXMLInterfacePedantic;
+extern _XMLIndex _kXMLInterfaceNoBlanks;
+extern _XMLIndex _kXMLInterfaceSAX1;
+extern _XMLIndex _kXMLInterfaceXInclude;
+extern _XMLIndex _kXMLInterfaceNoNet;
+extern _XMLIndex _kXMLInterfaceNoDict;
+extern _XMLIndex _kXMLInterfaceNSClean;
+extern _XMLIndex _kXMLInterfaceNoCdata;
+extern _XMLIndex _kXMLInterfaceNoXIncnode;
+extern _XMLIndex _kXMLInterfaceCompact;
+extern _XMLIndex _kXMLInterfaceOld10;
+extern _XMLIndex _kXMLInterfaceNoBasefix;
+extern _XMLIndex _kXMLInterfaceHuge;
+extern _XMLIndex _kXMLInterfaceOldsax;
+extern _XMLIndex _kXMLInterfaceIgnoreEnc;
+extern _XMLIndex _kXMLInterfaceBigLines;
+
+extern _XMLIndex _kXMLTypeInvalid;
+extern _XMLIndex _kXMLTypeDocument;
+extern _XMLIndex _kXMLTypeElement;
+extern _XMLIndex _kXMLTypeAttribute;
+extern _XMLIndex _kXMLTypeProcessingInstruction;
+extern _XMLIndex _kXMLTypeComment;
+extern _XMLIndex _kXMLTypeText;
+extern _XMLIndex _kXMLTypeCDataSection;
+extern _XMLIndex _kXMLTypeDTD;
+extern _XMLIndex _kXMLTypeEntityReference;
+extern _XMLIndex _kXMLDocTypeHTML;
+extern _XMLIndex _kXMLTypeNamespace;
+
+extern _XMLIndex _kXMLDTDNodeTypeEntity;
+extern _XMLIndex _kXMLDTDNodeTypeAttribute;
+extern _XMLIndex _kXMLDTDNodeTypeElement;
+extern _XMLIndex _kXMLDTDNodeTypeNotation;
+
+extern _XMLIndex _kXMLDTDNodeElementTypeUndefined;
+extern _XMLIndex _kXMLDTDNodeElementTypeEmpty;
+extern _XMLIndex _kXMLDTDNodeElementTypeAny;
+extern _XMLIndex _kXMLDTDNodeElementTypeMixed;
+extern _XMLIndex _kXMLDTDNodeElementTypeElement;
+
+extern _XMLIndex _kXMLDTDNodeEntityTypeInternalGeneral;
+extern _XMLIndex _kXMLDTDNodeEntityTypeExternalGeneralParsed;
+extern _XMLIndex _kXMLDTDNodeEntityTypeExternalGeneralUnparsed;
+extern _XMLIndex _kXMLDTDNodeEntityTypeInternalParameter;
+extern _XMLIndex _kXMLDTDNodeEntityTypeExternalParameter;
+extern _XMLIndex _kXMLDTDNodeEntityTypeInternalPredefined;
+
+extern _XMLIndex _kXMLDTDNodeAttributeTypeCData;
+extern _XMLIndex _kXMLDTDNodeAttributeTypeID;
+extern _XMLIndex _kXMLDTDNodeAttributeTypeIDRef;
+extern _XMLIndex _kXMLDTDNodeAttributeTypeIDRefs;
+extern _XMLIndex _kXMLDTDNodeAttributeTypeEntity;
+extern _XMLIndex _kXMLDTDNodeAttributeTypeEntities;
+extern _XMLIndex _kXMLDTDNodeAttributeTypeNMToken;
+extern _XMLIndex _kXMLDTDNodeAttributeTypeNMTokens;
+extern _XMLIndex _kXMLDTDNodeAttributeTypeEnumeration;
+extern _XMLIndex _kXMLDTDNodeAttributeTypeNotation;
+
+extern _XMLIndex _kXMLSchemaKindXSD;
+extern _XMLIndex _kXMLSchemaKindRelaxNG;
+
+extern _XMLIndex _kXMLXPathResultNodeSet;
+extern _XMLIndex _kXMLXPathResultBoolean;
+extern _XMLIndex _kXMLXPathResultNumber;
+extern _XMLIndex _kXMLXPathResultString;
 
 typedef void* _XMLNodePtr;
 typedef void* _XMLDocPtr;
@@ -95,6 +107,101 @@ typedef void* _XMLNamespacePtr;
 typedef void* _XMLEntityPtr;
 typedef void* _XMLDTDPtr;
 typedef void* _XMLDTDNodePtr;
+typedef void* _XMLSchemaPtr;
+typedef void* _XMLWriterPtr;
+typedef void* _XMLZStreamPtr;
+typedef void* _XMLXPathObjectPtr;
+typedef void* _XMLXPathCompiledPtr;
+typedef void* _XMLXPathContextPtr;
+typedef void* _XMLStreamQueryPtr;
+
+typedef void (*_XMLDetachedNodeCallback)(_XMLNodePtr parent, _XMLNodePtr node);
+typedef void (*_XMLKeyCallback)(void* context, _XMLNodePtr element, const char* value);
+typedef bool (*_XMLStreamMatchCallback)(void* context, _XMLDocPtr doc);
+// UTF-8 bytes handed across the C boundary without a CoreFoundation round trip. The bytes are not
+// NUL-terminated as far as length is concerned. A borrowed span points into the tree and stays valid
+// until the node is mutated or freed; an owned one must be given back with _XMLSpanRelease.
+typedef struct {
+    const uint8_t* _Nullable bytes;
+    size_t length;
+    bool owned;
+} _XMLSpan;
+
+// Filled in by functions that fail with a libxml2 error; code is an xmlParserErrors value or 0.
+typedef struct {
+    int32_t code;
+    char message[256];
+} _XMLError;
+
+typedef void (*_XMLIndexMatchCallback)(void* context, _XMLIndex key, const char* _Nullable value, _XMLIndex valueLength, int64_t start, int64_t end);
+
+typedef enum {
+    _kXMLCounterBytesParsed = 0,
+    _kXMLCounterNodesCreated,
+    _kXMLCounterWrappersMaterialized,
+    _kXMLCounterStringCopies,
+    _kXMLCounterXPathCompilations,
+    _kXMLCounterXPathEvaluations,
+    _kXMLCounterSerializedBytes,
+    _kXMLCounterCount
+} _XMLCounter;
+
+typedef enum {
+    _kXMLTimingParse = 0,
+    _kXMLTimingXPath,
+    _kXMLTimingValidation,
+    _kXMLTimingSerialization,
+    _kXMLTimingCount
+} _XMLTiming;
+
+// Opcodes read by _XMLBuildTree. Every opcode but _kXMLBuildOpEndElement is followed by its string
+// operands (two for an attribute), each a 32-bit length in host byte order, the UTF-8 bytes and a NUL.
+typedef enum {
+    _kXMLBuildOpStartElement = 1,
+    _kXMLBuildOpEndElement,
+    _kXMLBuildOpAttribute,
+    _kXMLBuildOpText,
+    _kXMLBuildOpCData,
+    _kXMLBuildOpComment,
+} _XMLBuildOp;
+
+// Bucket i of a timing histogram counts durations in [2^i, 2^(i+1)) nanoseconds.
+#define _kXMLTimingBucketCount 48
+
+// Instrumentation is compiled in only when XML2SWIFT_INSTRUMENTATION is defined to 1
+// (GCC_PREPROCESSOR_DEFINITIONS, plus -Xcc -DXML2SWIFT_INSTRUMENTATION=1 for Swift).
+// Otherwise every hook below is an empty inline function and disappears from the call sites.
+#if XML2SWIFT_INSTRUMENTATION
+extern int64_t _XMLInstrumentationCounters[_kXMLCounterCount];
+
+static inline bool _XMLInstrumentationEnabled(void) {
+    return true;
+}
+
+static inline void _XMLInstrumentationAdd(_XMLCounter counter, int64_t value) {
+    __atomic_fetch_add(&_XMLInstrumentationCounters[counter], value, __ATOMIC_RELAXED);
+}
+
+uint64_t _XMLInstrumentationNow(void);
+void _XMLInstrumentationRecord(_XMLTiming timing, uint64_t start);
+void _XMLInstrumentationInstall(void);
+int64_t _XMLInstrumentationCounterValue(_XMLCounter counter);
+int64_t _XMLInstrumentationTimingCount(_XMLTiming timing);
+int64_t _XMLInstrumentationTimingTotal(_XMLTiming timing);
+int64_t _XMLInstrumentationTimingBucket(_XMLTiming timing, _XMLIndex bucket);
+void _XMLInstrumentationReset(void);
+#else
+static inline bool _XMLInstrumentationEnabled(void) { return false; }
+static inline void _XMLInstrumentationAdd(_XMLCounter counter, int64_t value) {}
+static inline uint64_t _XMLInstrumentationNow(void) { return 0; }
+static inline void _XMLInstrumentationRecord(_XMLTiming timing, uint64_t start) {}
+static inline void _XMLInstrumentationInstall(void) {}
+static inline int64_t _XMLInstrumentationCounterValue(_XMLCounter counter) { return 0; }
+static inline int64_t _XMLInstrumentationTimingCount(_XMLTiming timing) { return 0; }
+static inline int64_t _XMLInstrumentationTimingTotal(_XMLTiming timing) { return 0; }
+static inline int64_t _XMLInstrumentationTimingBucket(_XMLTiming timing, _XMLIndex bucket) { return 0; }
+static inline void _XMLInstrumentationReset(void) {}
+#endif
 
 _XMLDTDNodePtr _Nullable _XMLDTDNewElementDesc(_XMLDTDPtr dtd, const unsigned char* name);
 
@@ -108,18 +215,19 @@ void _XMLDocSetStandalone(_XMLDocPtr doc, bool standalone);
 
 _XMLNodePtr _XMLDocRootElement(_XMLDocPtr doc);
 void _XMLDocSetRootElement(_XMLDocPtr doc, _XMLNodePtr node);
-CFStringRef _XMLDocCopyCharacterEncoding(_XMLDocPtr doc);
+_XMLSpan _XMLDocGetCharacterEncodingSpan(_XMLDocPtr doc);
 void _XMLDocSetCharacterEncoding(_XMLDocPtr doc,  const unsigned char* _Nullable  encoding);
-CFStringRef _XMLDocCopyVersion(_XMLDocPtr doc);
+_XMLSpan _XMLDocGetVersionSpan(_XMLDocPtr doc);
 void _XMLDocSetVersion(_XMLDocPtr doc, const unsigned char* version);
 int _XMLDocProperties(_XMLDocPtr doc);
 void _XMLDocSetProperties(_XMLDocPtr doc, int newProperties);
 _XMLDTDPtr _Nullable _XMLDocDTD(_XMLDocPtr doc);
 void _XMLDocSetDTD(_XMLDocPtr doc, _XMLDTDPtr _Nullable dtd);
-CFIndex _XMLNodeGetElementChildCount(_XMLNodePtr node);
-void _XMLNodeAddChild(_XMLNodePtr node, _XMLNodePtr child);
-void _XMLNodeAddPrevSibling(_XMLNodePtr node, _XMLNodePtr prevSibling);
-void _XMLNodeAddNextSibling(_XMLNodePtr node, _XMLNodePtr nextSibling);
+_XMLIndex _XMLNodeGetElementChildCount(_XMLNodePtr node);
+// Text next to text is merged into the neighbour; these then return false and leave the new node unlinked.
+bool _XMLNodeAddChild(_XMLNodePtr node, _XMLNodePtr child);
+bool _XMLNodeAddPrevSibling(_XMLNodePtr node, _XMLNodePtr prevSibling);
+bool _XMLNodeAddNextSibling(_XMLNodePtr node, _XMLNodePtr nextSibling);
 void _XMLNodeReplaceNode(_XMLNodePtr node, _XMLNodePtr replacement);
 
 _XMLDocPtr _XMLNewDoc(const unsigned char* version);
@@ -131,13 +239,14 @@ _XMLNodePtr _XMLNewComment(const unsigned char* value);
 _XMLNodePtr _Nonnull _XMLNewProperty(_XMLNodePtr node, const unsigned char* name, const unsigned char* uri, const unsigned char* value);
 const char* _XMLNodeCopyURI(_XMLNodePtr node);
 void _XMLNodeSetURI(_XMLNodePtr node, const unsigned char* URI);
-bool _XMLDocValidate(_XMLDocPtr doc, CFErrorRef _Nullable * error);
+bool _XMLDocValidate(_XMLDocPtr doc, _XMLError* _Nullable error);
 _XMLDTDPtr _XMLNewDTD(_XMLDocPtr doc, const unsigned char* name, const unsigned char* publicID, const unsigned char* systemID);
-_XMLDocPtr _XMLDocPtrFromDataWithOptions(CFDataRef data, unsigned int options);
-CFStringRef _XMLNodeCopyLocalName(_XMLNodePtr node);
-CFStringRef _Nullable _XMLNamespaceCopyPrefix(_XMLNodePtr node);
+_XMLDocPtr _Nullable _XMLDocPtrFromBytesWithOptions(const uint8_t* _Nullable bytes, size_t length, unsigned int options, _XMLError* _Nullable error);
+_XMLDocPtr _Nullable _XMLDocPtrFromBytesWithProjection(const uint8_t* _Nullable bytes, size_t length, unsigned int options, const char* _Nonnull const* _Nullable patterns, _XMLIndex count, _XMLError* _Nullable error);
+_XMLSpan _XMLNodeGetLocalNameSpan(_XMLNodePtr node);
+_XMLSpan _XMLNamespaceGetPrefixSpan(_XMLNodePtr node);
 _XMLNodePtr _XMLNewNamespace(const char* name, const char* stringValue);
-CFStringRef _XMLCopyStringWithOptions(_XMLNodePtr node, uint32_t options);
+_XMLSpan _XMLNodeCopyStringSpan(_XMLNodePtr node, uint32_t options);
 
 
 static inline int _compareNamespacePrefix(const xmlChar* prefix1, const xmlChar* prefix2);
@@ -145,20 +254,22 @@ static inline xmlNsPtr _searchNamespace(xmlNodePtr nodePtr, const xmlChar* prefi
 void _XMLCompletePropURI(_XMLNodePtr propertyNode, _XMLNodePtr node);
 _XMLNodePtr _XMLNodeHasProp(_XMLNodePtr node, const unsigned char* propertyName, const unsigned char* uri);
 void _XMLNodeSetPrivateData(_XMLNodePtr node, void* data);
-CFArrayRef _XMLNodesForXPath(_XMLNodePtr node, const unsigned char* xpath);
-CFStringRef _Nullable _XMLCopyPathForNode(_XMLNodePtr node);
+_XMLNodePtr _Nonnull * _Nullable _XMLNodesForXPath(_XMLNodePtr node, const unsigned char* xpath, _XMLIndex* count);
+_XMLSpan _XMLNodeCopyPathSpan(_XMLNodePtr node);
 void* _Nullable  _XMLNodeGetPrivateData(_XMLNodePtr node);
-CFStringRef _Nullable _XMLNodeCopyName(_XMLNodePtr node);
+bool _XMLNodeCompareAndSwapPrivateData(_XMLNodePtr node, void* _Nullable expected, void* data);
+_XMLSpan _XMLNodeGetNameSpan(_XMLNodePtr node, uint8_t* _Nullable buffer, size_t capacity);
+void _XMLSpanRelease(_XMLSpan span);
 
 void _XMLNodeForceSetName(_XMLNodePtr node, const char* _Nullable name);
 void _XMLNodeSetName(_XMLNodePtr node, const char* name);
-Boolean _XMLNodeNameEqual(_XMLNodePtr node, const char* name);
-CFStringRef _XMLCopyEntityContent(_XMLEntityPtr entity);
-_XMLNodePtr _Nonnull * _Nullable _XMLNamespaces(_XMLNodePtr node, CFIndex* count);
-void _XMLSetNamespaces(_XMLNodePtr node, _XMLNodePtr _Nullable * _Nullable nodes, CFIndex count);
-CFStringRef _Nullable _XMLNamespaceCopyValue(_XMLNodePtr node);
+bool _XMLNodeNameEqual(_XMLNodePtr node, const char* name);
+_XMLSpan _XMLEntityGetContentSpan(_XMLEntityPtr entity);
+_XMLNodePtr _Nonnull * _Nullable _XMLNamespaces(_XMLNodePtr node, _XMLIndex* count);
+void _XMLSetNamespaces(_XMLNodePtr node, _XMLNodePtr _Nullable * _Nullable nodes, _XMLIndex count);
+_XMLSpan _XMLNamespaceGetValueSpan(_XMLNodePtr node);
 void _XMLNamespaceSetPrefix(_XMLNodePtr node, const char* prefix, int64_t length);
-CFStringRef _XMLNodeCopyContent(_XMLNodePtr node);
+_XMLSpan _XMLNodeCopyContentSpan(_XMLNodePtr node);
 void _XMLNamespaceSetValue(_XMLNodePtr node, const char* value, int64_t length);
 void _XMLAddNamespace(_XMLNodePtr node, _XMLNodePtr nsNode);
 void _XMLRemoveNamespace(_XMLNodePtr node, const char* prefix);
@@ -170,20 +281,20 @@ const char *_XMLSplitQualifiedName(const char *_Nonnull qname);
 bool _XMLGetLengthOfPrefixInQualifiedName(const char *_Nonnull qname, size_t *length);
 void _XMLNodeSetContent(_XMLNodePtr node, const unsigned char* _Nullable  content);
 _XMLDocPtr _XMLNodeGetDocument(_XMLNodePtr node);
-CFStringRef _XMLEncodeEntities(_XMLDocPtr doc, const unsigned char* string);
-CFStringRef _XMLNodeCopyPrefix(_XMLNodePtr node);
+_XMLSpan _XMLEncodeEntities(_XMLDocPtr _Nullable doc, const unsigned char* _Nullable string);
+_XMLSpan _XMLNodeGetPrefixSpan(_XMLNodePtr node);
 _XMLDTDNodePtr _XMLParseDTDNode(const unsigned char* xmlString);
 
 _XMLNodePtr _XMLNodeProperties(_XMLNodePtr node);
-CFIndex _XMLNodeGetType(_XMLNodePtr node);
-CFIndex _XMLNodeGetElementChildCount(_XMLNodePtr node);
+_XMLIndex _XMLNodeGetType(_XMLNodePtr node);
+_XMLIndex _XMLNodeGetElementChildCount(_XMLNodePtr node);
 _XMLNodePtr _XMLNodeGetFirstChild(_XMLNodePtr node);
 _XMLDTDPtr _Nullable _XMLParseDTD(const unsigned char* URL);
-_XMLDTDPtr _Nullable _XMLParseDTDFromData(CFDataRef data, CFErrorRef _Nullable * error);
+_XMLDTDPtr _Nullable _XMLParseDTDFromBytes(const uint8_t* _Nullable bytes, size_t length, _XMLError* _Nullable error);
 _XMLDTDNodePtr _XMLParseDTDNode(const unsigned char* xmlString);
-CFStringRef _Nullable _XMLDTDCopyExternalID(_XMLDTDPtr dtd);
+_XMLSpan _XMLDTDGetExternalIDSpan(_XMLDTDPtr dtd);
 void _XMLDTDSetExternalID(_XMLDTDPtr dtd, const unsigned char* externalID);
-CFStringRef _Nullable _XMLDTDCopySystemID(_XMLDTDPtr dtd);
+_XMLSpan _XMLDTDGetSystemIDSpan(_XMLDTDPtr dtd);
 void _XMLDTDSetSystemID(_XMLDTDPtr dtd, const unsigned char* systemID);
 _XMLDTDNodePtr _Nullable _XMLDTDGetElementDesc(_XMLDTDPtr dtd, const unsigned char* name);
 _XMLDTDNodePtr _Nullable _XMLDTDGetAttributeDesc(_XMLDTDPtr dtd, const unsigned char* elementName, const unsigned char* name);
@@ -192,20 +303,117 @@ _XMLDTDNodePtr _Nullable _XMLDTDGetEntityDesc(_XMLDTDPtr dtd, const unsigned cha
 
 
 _XMLDTDNodePtr _Nullable _XMLDTDGetPredefinedEntity(const unsigned char* name);
-CFStringRef _Nullable _XMLDTDCopySystemID(_XMLDTDPtr dtd);
+_XMLSpan _XMLDTDGetSystemIDSpan(_XMLDTDPtr dtd);
 void _XMLDTDSetSystemID(_XMLDTDPtr dtd, const unsigned char* systemID);
 _XMLDTDNodePtr _Nullable _XMLDTDGetElementDesc(_XMLDTDPtr dtd, const unsigned char* name);
 _XMLDTDNodePtr _Nullable _XMLDTDGetAttributeDesc(_XMLDTDPtr dtd, const unsigned char* elementName, const unsigned char* name);
 _XMLDTDNodePtr _Nullable _XMLDTDGetNotationDesc(_XMLDTDPtr dtd, const unsigned char* name);
 _XMLDTDNodePtr _Nullable _XMLDTDGetEntityDesc(_XMLDTDPtr dtd, const unsigned char* name);
 _XMLDTDNodePtr _Nullable _XMLDTDGetPredefinedEntity(const unsigned char* name);
-CFIndex _XMLDTDElementNodeGetType(_XMLDTDNodePtr node);
-CFIndex _XMLDTDEntityNodeGetType(_XMLDTDNodePtr node);
-CFIndex _XMLDTDAttributeNodeGetType(_XMLDTDNodePtr node);
-CFStringRef _Nullable _XMLDTDNodeCopySystemID(_XMLDTDNodePtr node);
+_XMLIndex _XMLDTDElementNodeGetType(_XMLDTDNodePtr node);
+_XMLIndex _XMLDTDEntityNodeGetType(_XMLDTDNodePtr node);
+_XMLIndex _XMLDTDAttributeNodeGetType(_XMLDTDNodePtr node);
+_XMLSpan _XMLDTDNodeGetSystemIDSpan(_XMLDTDNodePtr node);
 void _XMLDTDNodeSetSystemID(_XMLDTDNodePtr node, const unsigned char* systemID);
-CFStringRef _Nullable _XMLDTDNodeCopyPublicID(_XMLDTDNodePtr node);
+_XMLSpan _XMLDTDNodeGetPublicIDSpan(_XMLDTDNodePtr node);
 void _XMLDTDNodeSetPublicID(_XMLDTDNodePtr node, const unsigned char* publicID);
 
+_XMLSchemaPtr _Nullable _XMLSchemaCreateWithBytes(_XMLIndex kind, const uint8_t* _Nullable bytes, size_t length, const unsigned char* _Nullable URL, _XMLError* _Nullable error);
+_XMLSchemaPtr _Nullable _XMLSchemaCreateWithURL(_XMLIndex kind, const unsigned char* URL, _XMLError* _Nullable error);
+void _XMLSchemaFree(_XMLSchemaPtr schema);
+bool _XMLSchemaValidateDocument(_XMLSchemaPtr schema, _XMLDocPtr doc, _XMLError* _Nullable error);
+bool _XMLSchemaValidateIO(_XMLSchemaPtr schema, xmlInputReadCallback ioread, xmlInputCloseCallback ioclose, void* context, _XMLError* _Nullable error);
+
+_XMLNodePtr _Nullable _XMLNodeFindElement(_XMLNodePtr _Nullable start, const char* _Nullable name);
+const char* _Nullable _XMLNodeGetContentNoCopy(_XMLNodePtr node);
+bool _XMLTextGetInt64(const char* text, int64_t* value);
+bool _XMLTextGetUInt64(const char* text, uint64_t* value);
+bool _XMLTextGetDouble(const char* text, double* value);
+bool _XMLTextGetBool(const char* text, bool* value);
+bool _XMLTextGetISO8601Date(const char* text, double* secondsSince1970);
+_XMLSpan _XMLTextCopyBase64Span(const char* text);
+_XMLSpan _XMLTextCopyHexSpan(const char* text);
+_XMLIndex _XMLFormatISO8601Date(double secondsSince1970, char* buffer, _XMLIndex capacity);
+
+_XMLWriterPtr _Nullable _XMLWriterCreateIO(xmlOutputWriteCallback iowrite, xmlOutputCloseCallback ioclose, void* context, bool indent);
+int _XMLWriterStartDocument(_XMLWriterPtr writer);
+int _XMLWriterEndDocument(_XMLWriterPtr writer);
+int _XMLWriterStartElement(_XMLWriterPtr writer, const char* name);
+int _XMLWriterEndElement(_XMLWriterPtr writer);
+int _XMLWriterWriteAttribute(_XMLWriterPtr writer, const char* name, const char* value);
+int _XMLWriterWriteString(_XMLWriterPtr writer, const char* text);
+int _XMLWriterWriteBase64(_XMLWriterPtr writer, const uint8_t* bytes, _XMLIndex length);
+int _XMLWriterWriteBinHex(_XMLWriterPtr writer, const uint8_t* bytes, _XMLIndex length);
+void _XMLWriterFree(_XMLWriterPtr writer);
+
+void _XMLMemoryInstall(void);
+_XMLDocPtr _Nullable _XMLDocPtrFromBytesWithLimits(const uint8_t* _Nullable bytes, size_t length, unsigned int options, _XMLIndex maxBytes, _XMLIndex maxNodes, _XMLIndex maxDepth, _XMLError* _Nullable error);
+_XMLIndex _XMLDocGetMemoryFootprint(_XMLDocPtr doc);
+
+void _XMLDocFreeze(_XMLDocPtr doc);
+bool _XMLNodeIsFrozen(_XMLNodePtr node);
+
+_XMLNodePtr _Nullable _XMLCloneNode(_XMLNodePtr node, _XMLDocPtr target);
+
+_XMLNodePtr _Nullable _XMLBuildTree(_XMLNodePtr _Nullable parent, _XMLDocPtr _Nullable doc, const uint8_t* instructions, _XMLIndex length);
+
+void _XMLNodeNormalizeAdjacentTextNodes(_XMLNodePtr node, bool preserveCDATA, _XMLDetachedNodeCallback detached);
+
+uint64_t _XMLHashCombine(uint64_t seed, uint64_t value);
+uint64_t _XMLNodeGetLocalHash(_XMLNodePtr node, bool includeAttributes);
+uint64_t _XMLNodeGetStructuralHash(_XMLNodePtr node);
+void _XMLNodeInvalidateStructuralHash(_XMLNodePtr node);
+_XMLNodePtr _Nullable _XMLNodeParseFragment(_XMLNodePtr context, const char* xml, _XMLIndex length);
+bool _XMLNodeInsertChildAtIndex(_XMLNodePtr node, _XMLNodePtr child, _XMLIndex index);
+
+_XMLDocPtr _Nullable _XMLDocPtrFromReadIO(xmlInputReadCallback ioread, xmlInputCloseCallback ioclose, void* context, int parserOptions);
+_XMLDocPtr _Nullable _XMLDocPtrFromIOWithOptions(xmlInputReadCallback ioread, xmlInputCloseCallback ioclose, void* context, unsigned int options, _XMLError* _Nullable error);
+
+_XMLZStreamPtr _Nullable _XMLZStreamCreateInflate(void);
+_XMLZStreamPtr _Nullable _XMLZStreamCreateDeflate(int level, bool gzip);
+_XMLIndex _XMLZStreamProcess(_XMLZStreamPtr stream, const uint8_t* _Nullable input, _XMLIndex inputLength, _XMLIndex* consumed, uint8_t* output, _XMLIndex outputLength, bool flush, bool* ended);
+void _XMLZStreamFree(_XMLZStreamPtr stream);
+
+bool _XMLNodeSaveToIO(_XMLNodePtr node, uint32_t options, xmlOutputWriteCallback iowrite, xmlOutputCloseCallback ioclose, void* context);
+
+bool _XMLDocWriteSnapshot(_XMLDocPtr doc, xmlOutputWriteCallback iowrite, void* context, _XMLError* _Nullable error);
+_XMLDocPtr _Nullable _XMLDocCreateFromSnapshot(const uint8_t* _Nullable bytes, _XMLIndex length, _XMLError* _Nullable error);
+
+bool _XMLIndexFile(const char* path, const char* _Nonnull const* _Nullable paths, const char* _Nonnull const* _Nullable keyNames, _XMLIndex keyCount, _XMLIndexMatchCallback match, void* context, _XMLError* _Nullable error);
+
+_XMLNodePtr _Nullable _XMLDocGetElementForID(_XMLDocPtr doc, const char* ID);
+void _XMLNodeCollectKeys(_XMLNodePtr node, bool descendants, const char* elementName, const char* attributeName, _XMLKeyCallback callback, void* context);
+int _XMLNodeCompareDocumentOrder(_XMLNodePtr first, _XMLNodePtr second);
+
+_XMLXPathObjectPtr _Nullable _XMLEvaluateXPath(_XMLNodePtr node, const char* xpath, _XMLError* _Nullable error);
+_XMLIndex _XMLXPathObjectGetType(_XMLXPathObjectPtr object);
+bool _XMLXPathObjectGetBoolean(_XMLXPathObjectPtr object);
+double _XMLXPathObjectGetNumber(_XMLXPathObjectPtr object);
+const char* _XMLXPathObjectGetString(_XMLXPathObjectPtr object);
+_XMLIndex _XMLXPathObjectGetNodeCount(_XMLXPathObjectPtr object);
+_XMLNodePtr _XMLXPathObjectGetNode(_XMLXPathObjectPtr object, _XMLIndex index);
+void _XMLXPathObjectFree(_XMLXPathObjectPtr object);
+
+_XMLXPathCompiledPtr _Nullable _XMLXPathCompile(const char* xpath, _XMLError* _Nullable error);
+void _XMLXPathCompiledFree(_XMLXPathCompiledPtr compiled);
+_XMLXPathContextPtr _XMLXPathContextCreate(const char* _Nonnull const* _Nullable prefixes, const char* _Nonnull const* _Nullable uris, _XMLIndex count);
+void _XMLXPathContextFree(_XMLXPathContextPtr context);
+_XMLXPathObjectPtr _Nullable _XMLXPathContextEvaluate(_XMLXPathContextPtr context, _XMLXPathCompiledPtr compiled, _XMLNodePtr node);
+
+_XMLStreamQueryPtr _Nullable _XMLStreamQueryCreate(const char* xpath, const char* _Nonnull const* _Nullable prefixes, const char* _Nonnull const* _Nullable uris, _XMLIndex count, _XMLError* _Nullable error);
+void _XMLStreamQueryFree(_XMLStreamQueryPtr query);
+bool _XMLStreamQueryRun(_XMLStreamQueryPtr query, xmlInputReadCallback ioread, xmlInputCloseCallback ioclose, void* context, unsigned int options, _XMLStreamMatchCallback match, void* matchContext, _XMLError* _Nullable error);
+
+void _XMLEntityCacheSetCapacity(_XMLIndex capacity);
+_XMLIndex _XMLEntityCacheGetCapacity(void);
+void _XMLEntityCacheSetAllowsNetwork(bool allowsNetwork);
+bool _XMLEntityCacheGetAllowsNetwork(void);
+void _XMLEntityCacheGetStatistics(int64_t* hits, int64_t* misses, _XMLIndex* size);
+void _XMLEntityCacheRemoveAll(void);
+bool _XMLEntityCacheLoadCatalog(const char* path, _XMLError* _Nullable error);
+bool _XMLEntityCacheAddCatalogEntry(bool publicID, const char* identifier, const char* replacement);
+
+_XMLDocPtr _Nullable _XMLHTMLDocPtrFromBytes(const uint8_t* _Nullable bytes, size_t length, unsigned int options, _XMLError* _Nullable error);
+_XMLDocPtr _Nullable _XMLHTMLDocPtrFromIO(xmlInputReadCallback ioread, xmlInputCloseCallback ioclose, void* context, unsigned int options, _XMLError* _Nullable error);
 
 #endif /* xml_interface_h */